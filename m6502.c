@@ -1,150 +1,790 @@
+// (for MAP_ANONYMOUS, used by the recompiler)
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
 #include "m6502.h"
 
-// the number of cycles an instruction takes
-static const uint8_t CYCLES_6502[] = {
-    0, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 0, 4, 6, 0,
-    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
-    6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0,
-    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
-    6, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 3, 4, 6, 0,
-    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
-    6, 6, 0, 0, 0, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0,
-    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
-    0, 6, 0, 0, 3, 3, 3, 0, 2, 0, 2, 0, 4, 4, 4, 0,
-    2, 6, 0, 0, 4, 4, 4, 0, 2, 5, 2, 0, 0, 5, 0, 0,
-    2, 6, 2, 0, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0,
-    2, 5, 0, 0, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0,
-    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
-    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
-    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
-    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0
+// the opcodes: for the 6502 then the 65C02, the mnemonic, addressing mode
+// and base number of cycles, then the number of additional cycles if a page
+// is crossed. Opcodes which are invalid on the 6502 are executed as NOPs,
+// and the cycles of the 65C02 BBR/BBS/RMB/SMB instructions are not counted.
+// 65C02 cycles from http://www.obelisk.demon.co.uk/65C02/reference.html
+#define OPCODES(X) \
+    X(0x00, BRK, IMP, 7, BRK, IMP, 7, 0) \
+    X(0x01, ORA, INX, 6, ORA, INX, 6, 0) \
+    X(0x02, INV, IMP, 2, NOP, IMM, 2, 0) \
+    X(0x03, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x04, INV, IMP, 2, TSB, ZPG, 5, 0) \
+    X(0x05, ORA, ZPG, 3, ORA, ZPG, 3, 0) \
+    X(0x06, ASL, ZPG, 5, ASL, ZPG, 5, 0) \
+    X(0x07, INV, IMP, 2, RMB, ZPG, 0, 0) \
+    X(0x08, PHP, IMP, 3, PHP, IMP, 3, 0) \
+    X(0x09, ORA, IMM, 2, ORA, IMM, 2, 0) \
+    X(0x0A, ASL, ACC, 2, ASL, ACC, 2, 0) \
+    X(0x0B, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x0C, INV, IMP, 2, TSB, ABS, 6, 0) \
+    X(0x0D, ORA, ABS, 4, ORA, ABS, 4, 0) \
+    X(0x0E, ASL, ABS, 6, ASL, ABS, 6, 0) \
+    X(0x0F, INV, IMP, 2, BBR, ZPR, 0, 1) \
+    X(0x10, BPL, REL, 2, BPL, REL, 2, 1) \
+    X(0x11, ORA, INY, 5, ORA, INY, 5, 1) \
+    X(0x12, INV, IMP, 2, ORA, INZ, 5, 0) \
+    X(0x13, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x14, INV, IMP, 2, TRB, ZPG, 5, 0) \
+    X(0x15, ORA, ZPX, 4, ORA, ZPX, 4, 0) \
+    X(0x16, ASL, ZPX, 6, ASL, ZPX, 6, 0) \
+    X(0x17, INV, IMP, 2, RMB, ZPG, 0, 0) \
+    X(0x18, CLC, IMP, 2, CLC, IMP, 2, 0) \
+    X(0x19, ORA, ABY, 4, ORA, ABY, 4, 1) \
+    X(0x1A, INV, IMP, 2, INC, ACC, 2, 0) \
+    X(0x1B, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x1C, INV, IMP, 2, TRB, ABS, 6, 0) \
+    X(0x1D, ORA, ABX, 4, ORA, ABX, 4, 1) \
+    X(0x1E, ASL, ABX, 7, ASL, ABX, 7, 0) \
+    X(0x1F, INV, IMP, 2, BBR, ZPR, 0, 1) \
+    X(0x20, JSR, ABS, 6, JSR, ABS, 6, 0) \
+    X(0x21, AND, INX, 6, AND, INX, 6, 0) \
+    X(0x22, INV, IMP, 2, NOP, IMM, 2, 0) \
+    X(0x23, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x24, BIT, ZPG, 3, BIT, ZPG, 3, 0) \
+    X(0x25, AND, ZPG, 3, AND, ZPG, 3, 0) \
+    X(0x26, ROL, ZPG, 5, ROL, ZPG, 5, 0) \
+    X(0x27, INV, IMP, 2, RMB, ZPG, 0, 0) \
+    X(0x28, PLP, IMP, 4, PLP, IMP, 4, 0) \
+    X(0x29, AND, IMM, 2, AND, IMM, 2, 0) \
+    X(0x2A, ROL, ACC, 2, ROL, ACC, 2, 0) \
+    X(0x2B, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x2C, BIT, ABS, 4, BIT, ABS, 4, 0) \
+    X(0x2D, AND, ABS, 4, AND, ABS, 4, 0) \
+    X(0x2E, ROL, ABS, 6, ROL, ABS, 6, 0) \
+    X(0x2F, INV, IMP, 2, BBR, ZPR, 0, 1) \
+    X(0x30, BMI, REL, 2, BMI, REL, 2, 1) \
+    X(0x31, AND, INY, 5, AND, INY, 5, 1) \
+    X(0x32, INV, IMP, 2, AND, INZ, 5, 0) \
+    X(0x33, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x34, INV, IMP, 2, BIT, ZPX, 3, 0) \
+    X(0x35, AND, ZPX, 4, AND, ZPX, 4, 0) \
+    X(0x36, ROL, ZPX, 6, ROL, ZPX, 6, 0) \
+    X(0x37, INV, IMP, 2, RMB, ZPG, 0, 0) \
+    X(0x38, SEC, IMP, 2, SEC, IMP, 2, 0) \
+    X(0x39, AND, ABY, 4, AND, ABY, 4, 1) \
+    X(0x3A, INV, IMP, 2, DEC, ACC, 2, 0) \
+    X(0x3B, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x3C, INV, IMP, 2, BIT, ABX, 4, 0) \
+    X(0x3D, AND, ABX, 4, AND, ABX, 4, 1) \
+    X(0x3E, ROL, ABX, 7, ROL, ABX, 7, 0) \
+    X(0x3F, INV, IMP, 2, BBR, ZPR, 0, 1) \
+    X(0x40, RTI, IMP, 6, RTI, IMP, 6, 0) \
+    X(0x41, EOR, INX, 6, EOR, INX, 6, 0) \
+    X(0x42, INV, IMP, 2, NOP, IMM, 2, 0) \
+    X(0x43, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x44, INV, IMP, 2, NOP, ZPG, 3, 0) \
+    X(0x45, EOR, ZPG, 3, EOR, ZPG, 3, 0) \
+    X(0x46, LSR, ZPG, 5, LSR, ZPG, 5, 0) \
+    X(0x47, INV, IMP, 2, RMB, ZPG, 0, 0) \
+    X(0x48, PHA, IMP, 3, PHA, IMP, 3, 0) \
+    X(0x49, EOR, IMM, 2, EOR, IMM, 2, 0) \
+    X(0x4A, LSR, ACC, 2, LSR, ACC, 2, 0) \
+    X(0x4B, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x4C, JMP, ABS, 3, JMP, ABS, 3, 0) \
+    X(0x4D, EOR, ABS, 4, EOR, ABS, 4, 0) \
+    X(0x4E, LSR, ABS, 6, LSR, ABS, 6, 0) \
+    X(0x4F, INV, IMP, 2, BBR, ZPR, 0, 1) \
+    X(0x50, BVC, REL, 2, BVC, REL, 2, 1) \
+    X(0x51, EOR, INY, 5, EOR, INY, 5, 1) \
+    X(0x52, INV, IMP, 2, EOR, INZ, 5, 0) \
+    X(0x53, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x54, INV, IMP, 2, NOP, ZPX, 4, 0) \
+    X(0x55, EOR, ZPX, 4, EOR, ZPX, 4, 0) \
+    X(0x56, LSR, ZPX, 6, LSR, ZPX, 6, 0) \
+    X(0x57, INV, IMP, 2, RMB, ZPG, 0, 0) \
+    X(0x58, CLI, IMP, 2, CLI, IMP, 2, 0) \
+    X(0x59, EOR, ABY, 4, EOR, ABY, 4, 1) \
+    X(0x5A, INV, IMP, 2, PHY, IMP, 3, 0) \
+    X(0x5B, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x5C, INV, IMP, 2, NOP, ABS, 8, 0) \
+    X(0x5D, EOR, ABX, 4, EOR, ABX, 4, 1) \
+    X(0x5E, LSR, ABX, 7, LSR, ABX, 7, 0) \
+    X(0x5F, INV, IMP, 2, BBR, ZPR, 0, 1) \
+    X(0x60, RTS, IMP, 6, RTS, IMP, 6, 0) \
+    X(0x61, ADC, INX, 6, ADC, INX, 6, 0) \
+    X(0x62, INV, IMP, 2, NOP, IMM, 2, 0) \
+    X(0x63, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x64, INV, IMP, 2, STZ, ZPG, 3, 0) \
+    X(0x65, ADC, ZPG, 3, ADC, ZPG, 3, 0) \
+    X(0x66, ROR, ZPG, 5, ROR, ZPG, 5, 0) \
+    X(0x67, INV, IMP, 2, RMB, ZPG, 0, 0) \
+    X(0x68, PLA, IMP, 4, PLA, IMP, 4, 0) \
+    X(0x69, ADC, IMM, 2, ADC, IMM, 2, 0) \
+    X(0x6A, ROR, ACC, 2, ROR, ACC, 2, 0) \
+    X(0x6B, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x6C, JMP, IND, 5, JMP, IND, 5, 0) \
+    X(0x6D, ADC, ABS, 4, ADC, ABS, 4, 0) \
+    X(0x6E, ROR, ABS, 6, ROR, ABS, 6, 0) \
+    X(0x6F, INV, IMP, 2, BBR, ZPR, 0, 1) \
+    X(0x70, BVS, REL, 2, BVS, REL, 2, 1) \
+    X(0x71, ADC, INY, 5, ADC, INY, 5, 1) \
+    X(0x72, INV, IMP, 2, ADC, INZ, 5, 0) \
+    X(0x73, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x74, INV, IMP, 2, STZ, ZPX, 4, 0) \
+    X(0x75, ADC, ZPX, 4, ADC, ZPX, 4, 0) \
+    X(0x76, ROR, ZPX, 6, ROR, ZPX, 6, 0) \
+    X(0x77, INV, IMP, 2, RMB, ZPG, 0, 0) \
+    X(0x78, SEI, IMP, 2, SEI, IMP, 2, 0) \
+    X(0x79, ADC, ABY, 4, ADC, ABY, 4, 1) \
+    X(0x7A, INV, IMP, 2, PLY, IMP, 4, 0) \
+    X(0x7B, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x7C, INV, IMP, 2, JMP, IAX, 6, 0) \
+    X(0x7D, ADC, ABX, 4, ADC, ABX, 4, 1) \
+    X(0x7E, ROR, ABX, 7, ROR, ABX, 7, 0) \
+    X(0x7F, INV, IMP, 2, BBR, ZPR, 0, 1) \
+    X(0x80, INV, IMP, 2, BRA, REL, 3, 1) \
+    X(0x81, STA, INX, 6, STA, INX, 6, 0) \
+    X(0x82, INV, IMP, 2, NOP, IMM, 2, 0) \
+    X(0x83, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x84, STY, ZPG, 3, STY, ZPG, 3, 0) \
+    X(0x85, STA, ZPG, 3, STA, ZPG, 3, 0) \
+    X(0x86, STX, ZPG, 3, STX, ZPG, 3, 0) \
+    X(0x87, INV, IMP, 2, SMB, ZPG, 0, 0) \
+    X(0x88, DEY, IMP, 2, DEY, IMP, 2, 0) \
+    X(0x89, INV, IMP, 2, BIT, IMM, 3, 0) \
+    X(0x8A, TXA, IMP, 2, TXA, IMP, 2, 0) \
+    X(0x8B, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x8C, STY, ABS, 4, STY, ABS, 4, 0) \
+    X(0x8D, STA, ABS, 4, STA, ABS, 4, 0) \
+    X(0x8E, STX, ABS, 4, STX, ABS, 4, 0) \
+    X(0x8F, INV, IMP, 2, BBS, ZPR, 0, 1) \
+    X(0x90, BCC, REL, 2, BCC, REL, 2, 1) \
+    X(0x91, STA, INY, 6, STA, INY, 6, 0) \
+    X(0x92, INV, IMP, 2, STA, INZ, 5, 0) \
+    X(0x93, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x94, STY, ZPX, 4, STY, ZPX, 4, 0) \
+    X(0x95, STA, ZPX, 4, STA, ZPX, 4, 0) \
+    X(0x96, STX, ZPY, 4, STX, ZPY, 4, 0) \
+    X(0x97, INV, IMP, 2, SMB, ZPG, 0, 0) \
+    X(0x98, TYA, IMP, 2, TYA, IMP, 2, 0) \
+    X(0x99, STA, ABY, 5, STA, ABY, 5, 0) \
+    X(0x9A, TXS, IMP, 2, TXS, IMP, 2, 0) \
+    X(0x9B, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0x9C, INV, IMP, 2, STZ, ABS, 4, 0) \
+    X(0x9D, STA, ABX, 5, STA, ABX, 5, 0) \
+    X(0x9E, INV, IMP, 2, STZ, ABX, 5, 0) \
+    X(0x9F, INV, IMP, 2, BBS, ZPR, 0, 1) \
+    X(0xA0, LDY, IMM, 2, LDY, IMM, 2, 0) \
+    X(0xA1, LDA, INX, 6, LDA, INX, 6, 0) \
+    X(0xA2, LDX, IMM, 2, LDX, IMM, 2, 0) \
+    X(0xA3, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0xA4, LDY, ZPG, 3, LDY, ZPG, 3, 0) \
+    X(0xA5, LDA, ZPG, 3, LDA, ZPG, 3, 0) \
+    X(0xA6, LDX, ZPG, 3, LDX, ZPG, 3, 0) \
+    X(0xA7, INV, IMP, 2, SMB, ZPG, 0, 0) \
+    X(0xA8, TAY, IMP, 2, TAY, IMP, 2, 0) \
+    X(0xA9, LDA, IMM, 2, LDA, IMM, 2, 0) \
+    X(0xAA, TAX, IMP, 2, TAX, IMP, 2, 0) \
+    X(0xAB, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0xAC, LDY, ABS, 4, LDY, ABS, 4, 0) \
+    X(0xAD, LDA, ABS, 4, LDA, ABS, 4, 0) \
+    X(0xAE, LDX, ABS, 4, LDX, ABS, 4, 0) \
+    X(0xAF, INV, IMP, 2, BBS, ZPR, 0, 1) \
+    X(0xB0, BCS, REL, 2, BCS, REL, 2, 1) \
+    X(0xB1, LDA, INY, 5, LDA, INY, 5, 1) \
+    X(0xB2, INV, IMP, 2, LDA, INZ, 5, 0) \
+    X(0xB3, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0xB4, LDY, ZPX, 4, LDY, ZPX, 4, 0) \
+    X(0xB5, LDA, ZPX, 4, LDA, ZPX, 4, 0) \
+    X(0xB6, LDX, ZPY, 4, LDX, ZPY, 4, 0) \
+    X(0xB7, INV, IMP, 2, SMB, ZPG, 0, 0) \
+    X(0xB8, CLV, IMP, 2, CLV, IMP, 2, 0) \
+    X(0xB9, LDA, ABY, 4, LDA, ABY, 4, 1) \
+    X(0xBA, TSX, IMP, 2, TSX, IMP, 2, 0) \
+    X(0xBB, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0xBC, LDY, ABX, 4, LDY, ABX, 4, 1) \
+    X(0xBD, LDA, ABX, 4, LDA, ABX, 4, 1) \
+    X(0xBE, LDX, ABY, 4, LDX, ABY, 4, 1) \
+    X(0xBF, INV, IMP, 2, BBS, ZPR, 0, 1) \
+    X(0xC0, CPY, IMM, 2, CPY, IMM, 2, 0) \
+    X(0xC1, CMP, INX, 6, CMP, INX, 6, 0) \
+    X(0xC2, INV, IMP, 2, NOP, IMM, 2, 0) \
+    X(0xC3, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0xC4, CPY, ZPG, 3, CPY, ZPG, 3, 0) \
+    X(0xC5, CMP, ZPG, 3, CMP, ZPG, 3, 0) \
+    X(0xC6, DEC, ZPG, 5, DEC, ZPG, 5, 0) \
+    X(0xC7, INV, IMP, 2, SMB, ZPG, 0, 0) \
+    X(0xC8, INY, IMP, 2, INY, IMP, 2, 0) \
+    X(0xC9, CMP, IMM, 2, CMP, IMM, 2, 0) \
+    X(0xCA, DEX, IMP, 2, DEX, IMP, 2, 0) \
+    X(0xCB, INV, IMP, 2, WAI, IMP, 3, 0) \
+    X(0xCC, CPY, ABS, 4, CPY, ABS, 4, 0) \
+    X(0xCD, CMP, ABS, 4, CMP, ABS, 4, 0) \
+    X(0xCE, DEC, ABS, 6, DEC, ABS, 6, 0) \
+    X(0xCF, INV, IMP, 2, BBS, ZPR, 0, 1) \
+    X(0xD0, BNE, REL, 2, BNE, REL, 2, 1) \
+    X(0xD1, CMP, INY, 5, CMP, INY, 5, 1) \
+    X(0xD2, INV, IMP, 2, CMP, INZ, 5, 0) \
+    X(0xD3, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0xD4, INV, IMP, 2, NOP, ZPX, 4, 0) \
+    X(0xD5, CMP, ZPX, 4, CMP, ZPX, 4, 0) \
+    X(0xD6, DEC, ZPX, 6, DEC, ZPX, 6, 0) \
+    X(0xD7, INV, IMP, 2, SMB, ZPG, 0, 0) \
+    X(0xD8, CLD, IMP, 2, CLD, IMP, 2, 0) \
+    X(0xD9, CMP, ABY, 4, CMP, ABY, 4, 1) \
+    X(0xDA, INV, IMP, 2, PHX, IMP, 3, 0) \
+    X(0xDB, INV, IMP, 2, STP, IMP, 3, 0) \
+    X(0xDC, INV, IMP, 2, NOP, ABS, 4, 0) \
+    X(0xDD, CMP, ABX, 4, CMP, ABX, 4, 1) \
+    X(0xDE, DEC, ABX, 7, DEC, ABX, 7, 0) \
+    X(0xDF, INV, IMP, 2, BBS, ZPR, 0, 1) \
+    X(0xE0, CPX, IMM, 2, CPX, IMM, 2, 0) \
+    X(0xE1, SBC, INX, 6, SBC, INX, 6, 0) \
+    X(0xE2, INV, IMP, 2, NOP, IMM, 2, 0) \
+    X(0xE3, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0xE4, CPX, ZPG, 3, CPX, ZPG, 3, 0) \
+    X(0xE5, SBC, ZPG, 3, SBC, ZPG, 3, 0) \
+    X(0xE6, INC, ZPG, 5, INC, ZPG, 5, 0) \
+    X(0xE7, INV, IMP, 2, SMB, ZPG, 0, 0) \
+    X(0xE8, INX, IMP, 2, INX, IMP, 2, 0) \
+    X(0xE9, SBC, IMM, 2, SBC, IMM, 2, 0) \
+    X(0xEA, NOP, IMP, 2, NOP, IMP, 2, 0) \
+    X(0xEB, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0xEC, CPX, ABS, 4, CPX, ABS, 4, 0) \
+    X(0xED, SBC, ABS, 4, SBC, ABS, 4, 0) \
+    X(0xEE, INC, ABS, 6, INC, ABS, 6, 0) \
+    X(0xEF, INV, IMP, 2, BBS, ZPR, 0, 1) \
+    X(0xF0, BEQ, REL, 2, BEQ, REL, 2, 1) \
+    X(0xF1, SBC, INY, 5, SBC, INY, 5, 1) \
+    X(0xF2, INV, IMP, 2, SBC, INZ, 5, 0) \
+    X(0xF3, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0xF4, INV, IMP, 2, NOP, ZPX, 4, 0) \
+    X(0xF5, SBC, ZPX, 4, SBC, ZPX, 4, 0) \
+    X(0xF6, INC, ZPX, 6, INC, ZPX, 6, 0) \
+    X(0xF7, INV, IMP, 2, SMB, ZPG, 0, 0) \
+    X(0xF8, SED, IMP, 2, SED, IMP, 2, 0) \
+    X(0xF9, SBC, ABY, 4, SBC, ABY, 4, 1) \
+    X(0xFA, INV, IMP, 2, PLX, IMP, 4, 0) \
+    X(0xFB, INV, IMP, 2, NOP, IMP, 1, 0) \
+    X(0xFC, INV, IMP, 2, NOP, ABS, 4, 0) \
+    X(0xFD, SBC, ABX, 4, SBC, ABX, 4, 1) \
+    X(0xFE, INC, ABX, 7, INC, ABX, 7, 0) \
+    X(0xFF, INV, IMP, 2, BBS, ZPR, 0, 1)
+
+// the mnemonics, with what they do with their operand
+#define MNEMONICS(X) \
+    X(INV, NONE) X(ADC, READ) X(AND, READ) X(ASL, RMW) X(BBR, BRANCH) \
+    X(BBS, BRANCH) X(BCC, BRANCH) X(BCS, BRANCH) X(BEQ, BRANCH) \
+    X(BIT, READ) X(BMI, BRANCH) X(BNE, BRANCH) X(BPL, BRANCH) \
+    X(BRA, BRANCH) X(BRK, JUMP) X(BVC, BRANCH) X(BVS, BRANCH) X(CLC, NONE) \
+    X(CLD, NONE) X(CLI, NONE) X(CLV, NONE) X(CMP, READ) X(CPX, READ) \
+    X(CPY, READ) X(DEC, RMW) X(DEX, NONE) X(DEY, NONE) X(EOR, READ) \
+    X(INC, RMW) X(INX, NONE) X(INY, NONE) X(JMP, JUMP) X(JSR, JUMP) \
+    X(LDA, READ) X(LDX, READ) X(LDY, READ) X(LSR, RMW) X(NOP, NONE) \
+    X(ORA, READ) X(PHA, NONE) X(PHP, NONE) X(PHX, NONE) X(PHY, NONE) \
+    X(PLA, NONE) X(PLP, NONE) X(PLX, NONE) X(PLY, NONE) X(RMB, RMW) \
+    X(ROL, RMW) X(ROR, RMW) X(RTI, JUMP) X(RTS, JUMP) X(SBC, READ) \
+    X(SEC, NONE) X(SED, NONE) X(SEI, NONE) X(SMB, RMW) X(STA, WRITE) \
+    X(STP, HALT) X(STX, WRITE) X(STY, WRITE) X(STZ, WRITE) X(TAX, NONE) \
+    X(TAY, NONE) X(TRB, RMW) X(TSB, RMW) X(TSX, NONE) X(TXA, NONE) \
+    X(TXS, NONE) X(TYA, NONE) X(WAI, HALT)
+
+#define MNEMONIC_NAME(mnemonic, kind) [M6502_##mnemonic] = #mnemonic,
+static const char* const MNEMONIC_NAMES[M6502_NB_MNEMONICS] = {
+    MNEMONICS(MNEMONIC_NAME)
 };
-
-// from http://www.obelisk.demon.co.uk/65C02/reference.html
-static const uint8_t CYCLES_65C02[] = {
-    0, 6, 0, 0, 5, 3, 5, 0, 3, 2, 2, 0, 6, 4, 6, 0,
-    2, 5, 5, 0, 5, 4, 6, 0, 2, 4, 2, 0, 6, 4, 7, 0,
-    6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0,
-    2, 5, 5, 0, 3, 4, 6, 0, 2, 4, 2, 0, 4, 4, 7, 0,
-    6, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 3, 4, 6, 0,
-    2, 5, 5, 0, 0, 4, 6, 0, 2, 4, 3, 0, 0, 4, 7, 0,
-    6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0,
-    2, 5, 5, 0, 4, 4, 6, 0, 2, 4, 4, 0, 6, 4, 7, 0,
-    3, 6, 0, 0, 3, 3, 3, 0, 2, 3, 2, 0, 4, 4, 4, 0,
-    2, 6, 5, 0, 4, 4, 4, 0, 2, 5, 2, 0, 4, 5, 5, 0,
-    2, 6, 2, 0, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0,
-    2, 5, 5, 0, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0,
-    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 3, 4, 4, 6, 0,
-    2, 5, 5, 0, 0, 4, 6, 0, 2, 4, 3, 3, 0, 4, 7, 0,
-    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
-    2, 5, 5, 0, 0, 4, 6, 0, 2, 4, 4, 0, 0, 4, 7, 0
+#undef MNEMONIC_NAME
+
+#define MNEMONIC_KIND(mnemonic, kind) KIND_##mnemonic = M6502_KIND_##kind,
+enum { MNEMONICS(MNEMONIC_KIND) };
+#undef MNEMONIC_KIND
+
+// the number of bytes of an instruction (opcode and operand) in each
+// addressing mode
+enum {
+    LENGTH_IMP = 1, LENGTH_ACC = 1, LENGTH_IMM = 2, LENGTH_ZPG = 2,
+    LENGTH_ZPX = 2, LENGTH_ZPY = 2, LENGTH_ABS = 3, LENGTH_ABX = 3,
+    LENGTH_ABY = 3, LENGTH_IND = 3, LENGTH_INX = 2, LENGTH_INY = 2,
+    LENGTH_INZ = 2, LENGTH_IAX = 3, LENGTH_REL = 2, LENGTH_ZPR = 3,
 };
 
-// the number of additional cycles an instruction takes if a page is crossed
-static const uint8_t INSTRUCTIONS_PAGE_CROSSED_CYCLES[] = {
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
-    1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
-    1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
-    1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
-    1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 1,
-    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
-    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
-    1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 1, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
-    1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
-    1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 1
-};
+// the description of an opcode (in the implied, accumulator and immediate
+// modes, instructions don't access memory)
+#define OPCODE(mnemonic, mode, cycles, page_crossed_cycles) { \
+    M6502_##mnemonic, M6502_MODE_##mode, LENGTH_##mode, cycles, \
+    page_crossed_cycles, \
+    M6502_MODE_##mode <= M6502_MODE_IMM && \
+        (int) KIND_##mnemonic <= M6502_KIND_RMW \
+        ? M6502_KIND_NONE : KIND_##mnemonic \
+}
+#define OPCODE_6502(opcode, mnemonic, mode, cycles, mnemonic_65c02, \
+        mode_65c02, cycles_65c02, page_crossed_cycles) \
+    [opcode] = OPCODE(mnemonic, mode, cycles, page_crossed_cycles),
+#define OPCODE_65C02(opcode, mnemonic, mode, cycles, mnemonic_65c02, \
+        mode_65c02, cycles_65c02, page_crossed_cycles) \
+    [opcode] = OPCODE(mnemonic_65c02, mode_65c02, cycles_65c02, \
+        page_crossed_cycles),
+
+static const m6502_opcode OPCODES_6502[256] = { OPCODES(OPCODE_6502) };
+static const m6502_opcode OPCODES_65C02[256] = { OPCODES(OPCODE_65C02) };
+
+#undef OPCODE
+#undef OPCODE_6502
+#undef OPCODE_65C02
 
 static const uint16_t STACK_START_ADDR = 0x100;
 
+// the CPU variants a core is compiled for (see m6502_core.h): the helpers
+// taking a variant are always called with a constant, so that each core
+// only contains the code of its own variant
+#define VARIANT_CMOS 1 // 65C02 instead of NMOS 6502
+#define VARIANT_BCD 2 // decimal mode enabled
+
+// page_flags: the page holds instructions stored in the decode cache
+#define PAGE_CODE 1
+// the page holds breakpoints of each kind
+#define PAGE_BREAK_EXEC 2
+#define PAGE_BREAK_READ 4
+#define PAGE_BREAK_WRITE 8
+// the page is an I/O page (see m6502_set_io)
+#define PAGE_IO 16
+// the page wasn't written since the snapshot being tracked was saved or
+// restored (see m6502_snapshot_save)
+#define PAGE_CLEAN 32
+// the writes to the page are ignored (see M6502_MAP_PROTECT)
+#define PAGE_PROTECT 64
+
+// private exit condition used by m6502_run when the instruction at PC can't
+// be decoded (its page isn't mapped for reads)
+#define EXIT_NOT_DECODED (1 << 14)
+
+// the maximum number of cycles an instruction can take, used to know
+// whether an idle loop can be skipped within the cycle budget
+#define MAX_INSTRUCTION_CYCLES 8
+
+// private exit condition used by m6502_step to return after one instruction
+// (some instructions, like BBR/BBS, are counted as taking zero cycles)
+#define EXIT_STEP (1 << 15)
+
+// private exit condition of the decoded cores when a hot loop is compiled,
+// handing the run over to the recompiler (see m6502_jit.h)
+#define EXIT_JIT (1 << 13)
+
+// the recompiler generates x86-64 code for the System V ABI, unless
+// M6502_NO_JIT is defined
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__)) && \
+    !defined(M6502_NO_JIT)
+#define JIT 1
+#else
+#define JIT 0
+#endif
+
+// c->signals: the M6502_SIGNAL_* bits, private signals set by CLI, SEI and
+// PLP and by the watchpoints, and the IRQ sources in the high bits
+#define SIGNAL_BREAK (1U << 6)
+#define SIGNAL_IDF_DELAYED (1U << 7)
+#define SIGNAL_IRQ_SHIFT 8
+#define SIGNAL_IRQ (((1U << M6502_IRQ_SOURCES) - 1) << SIGNAL_IRQ_SHIFT)
+// signals that end the cores, handled by m6502_run
+#define SIGNAL_RUN (M6502_SIGNAL_RESET | M6502_SIGNAL_STOP | \
+    M6502_SIGNAL_PAUSE | SIGNAL_BREAK)
+
+// the signals are set by any thread with release semantics, and checked
+// before each instruction with a relaxed load (the cheapest one), then
+// read again with acquire semantics once one is seen
+static inline uint32_t peek_signals(const m6502* const c) {
+    return __atomic_load_n(&c->signals, __ATOMIC_RELAXED);
+}
+
+// returns the variant the emulator is configured for
+static inline int get_variant(const m6502* const c) {
+    return (c->m65c02_mode ? VARIANT_CMOS : 0) |
+           (c->enable_bcd ? VARIANT_BCD : 0);
+}
+
 // memory helpers (the only functions to use read_byte and write_byte
-// function pointers)
+// function pointers): pages mapped with m6502_map are accessed directly,
+// the others go through the user callbacks
+
+static uint8_t read_slow(m6502* const c, uint16_t addr);
+static uint8_t fetch_slow(m6502* const c, uint16_t addr);
 
 // reads a byte from memory
 static inline uint8_t m6502_rb(m6502* const c, uint16_t addr) {
-    return c->read_byte(c->userdata, addr);
+    const uint8_t* const page = c->read_pages[addr >> 8];
+    if (page != NULL) {
+        return page[addr & 0xFF];
+    }
+    if (c->page_flags[addr >> 8] == 0) { // (the page isn't mapped)
+        return c->read_byte(c->userdata, addr);
+    }
+    return read_slow(c, addr);
+}
+
+// reads a byte of an instruction (which doesn't hit the read watchpoints)
+static inline uint8_t m6502_fetch(m6502* const c, uint16_t addr) {
+    const uint8_t* const page = c->fetch_pages[addr >> 8];
+    if (page != NULL) {
+        return page[addr & 0xFF];
+    }
+    if (c->page_flags[addr >> 8] == 0) {
+        return c->read_byte(c->userdata, addr);
+    }
+    return fetch_slow(c, addr);
 }
 
 // reads a word from memory
 static inline uint16_t m6502_rw(m6502* const c, uint16_t addr) {
-    return (c->read_byte(c->userdata, addr + 1) << 8) |
-            c->read_byte(c->userdata, addr);
+    return (m6502_rb(c, addr + 1) << 8) | m6502_rb(c, addr);
 }
 
 // emulates a 6502 bug where the low byte wrapped without incrementing
 // the high byte
-static inline uint16_t m6502_rw_bug(m6502* const c, uint16_t addr) {
+static inline uint16_t m6502_rw_bug(m6502* const c, uint16_t addr,
+        const int variant) {
     // the buggy read word has been fixed in the 65C02
-    if (c->m65c02_mode) {
+    if (variant & VARIANT_CMOS) {
         return m6502_rw(c, addr);
     }
 
     uint16_t hi_addr = (addr & 0xFF00) | ((addr + 1) & 0xFF);
-    return (c->read_byte(c->userdata, hi_addr) << 8) |
-            c->read_byte(c->userdata, addr);
+    return (m6502_rb(c, hi_addr) << 8) | m6502_rb(c, addr);
 }
 
+static void write_slow(m6502* const c, uint16_t addr, uint8_t val);
+
 // writes a byte to memory
 static inline void m6502_wb(m6502* const c, uint16_t addr, uint8_t val) {
-    c->write_byte(c->userdata, addr, val);
+    uint8_t* const page = c->write_pages[addr >> 8];
+    if (page != NULL) {
+        page[addr & 0xFF] = val;
+        return;
+    }
+    write_slow(c, addr, val);
+}
+
+// updates the direct access pointers of a page after its mapping or flags
+// changed
+static void update_page(m6502* const c, uint8_t page) {
+    const int flags = c->page_flags[page];
+
+    c->read_pages[page] = (flags & (PAGE_BREAK_READ | PAGE_IO))
+        ? NULL : c->read_map[page];
+    c->write_pages[page] =
+        (flags & (PAGE_CODE | PAGE_BREAK_WRITE | PAGE_IO | PAGE_CLEAN))
+        ? NULL : c->write_map[page];
+    c->fetch_pages[page] = (flags & PAGE_BREAK_EXEC)
+        ? NULL : c->read_map[page];
+}
+
+static inline bool test_bit(const uint64_t* bitmap, uint16_t addr) {
+    return (bitmap[addr >> 6] >> (addr & 63)) & 1;
+}
+
+// calls the breakpoint callback, returns true if the hit ends the run
+static bool break_hit(m6502* const c, uint16_t addr, int kind) {
+    const m6502_breakpoints* const breakpoints = c->breakpoints;
+    return breakpoints->callback == NULL ||
+        breakpoints->callback(c, addr, kind);
+}
+
+// checks a read or write watchpoint on a page holding some: the run ends
+// after the current instruction
+static void watch_access(m6502* const c, const uint64_t* bitmap,
+        uint16_t addr, int kind) {
+    if (test_bit(bitmap, addr) && break_hit(c, addr, kind)) {
+        __atomic_fetch_or(&c->signals, SIGNAL_BREAK, __ATOMIC_RELAXED);
+    }
+}
+
+// checks the execution breakpoint at pc on a page holding some, returns
+// true if it ends the run before its instruction
+static bool break_exec(m6502* const c, uint16_t pc) {
+    if (!test_bit(c->breakpoints->exec, pc) ||
+            (pc == c->break_pc && c->cyc == c->break_cyc)) {
+        return false; // (resuming from this breakpoint)
+    }
+    if (!break_hit(c, pc, M6502_BREAK_EXEC)) {
+        return false;
+    }
+    c->break_pc = pc;
+    c->break_cyc = c->cyc;
+    return true;
+}
+
+// I/O log entries: a varint (7 bits per byte, low bits first) holding the
+// cycles elapsed since the previous entry, shifted left by IO_KIND_BITS,
+// and the kind of the entry, followed by its operands
+#define IO_KIND_BITS 3
+enum {
+    IO_READ_SAME, // value read at the address of the previous read
+    IO_READ, // address (2 bytes, little-endian) and value read
+    IO_IRQ, // IRQ taken
+    IO_NMI, // NMI taken
+    IO_RESET, // RESET taken (the cycle counter restarts from 0)
+    IO_WAKE, // WAI ended by a masked IRQ
+};
+#define IO_ENTRY_MAX (10 + 3)
+
+typedef struct io_entry {
+    int kind;
+    uint64_t time;
+    uint16_t addr;
+    uint8_t val;
+} io_entry;
+
+// appends an entry to the log when recording
+static void io_record(m6502* const c, int kind, uint16_t addr, uint8_t val) {
+    m6502_io_log* const log = c->io_log;
+    if (log == NULL || log->mode != M6502_IO_RECORD) {
+        return;
+    }
+
+    if (kind == IO_READ && addr == log->end.addr) {
+        kind = IO_READ_SAME;
+    }
+    uint8_t entry[IO_ENTRY_MAX];
+    size_t n = 0;
+    uint64_t head = (c->cyc - log->end.cyc) << IO_KIND_BITS | kind;
+    while (head >= 0x80) {
+        entry[n++] = (head & 0x7F) | 0x80;
+        head >>= 7;
+    }
+    entry[n++] = head;
+    if (kind == IO_READ) {
+        entry[n++] = addr & 0xFF;
+        entry[n++] = addr >> 8;
+    }
+    if (kind == IO_READ || kind == IO_READ_SAME) {
+        entry[n++] = val;
+        log->end.addr = addr;
+    }
+
+    if (log->size + n > log->capacity && log->flush != NULL) {
+        log->flush(log);
+    }
+    if (log->size + n > log->capacity) {
+        log->overflow = true;
+        log->mode = 0;
+        return;
+    }
+    memcpy(&log->data[log->size], entry, n);
+    log->size += n;
+    log->end.pos += n;
+    log->end.cyc = c->cyc;
+}
+
+// reads the entry at a cursor of the log, returns false at its end
+static bool io_next(const m6502_io_log* log, m6502_io_cursor* cursor,
+        io_entry* entry) {
+    size_t pos = cursor->pos;
+    uint64_t head = 0;
+    for (unsigned shift = 0;; shift += 7) {
+        if (pos >= log->size || shift >= 64) {
+            return false;
+        }
+        const uint8_t byte = log->data[pos++];
+        head |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+
+    entry->kind = head & ((1 << IO_KIND_BITS) - 1);
+    entry->time = cursor->cyc + (head >> IO_KIND_BITS);
+    entry->addr = cursor->addr;
+    entry->val = 0;
+    if (entry->kind == IO_READ) {
+        if (pos + 2 > log->size) {
+            return false;
+        }
+        entry->addr = log->data[pos] | log->data[pos + 1] << 8;
+        pos += 2;
+    }
+    if (entry->kind == IO_READ || entry->kind == IO_READ_SAME) {
+        if (pos >= log->size) {
+            return false;
+        }
+        entry->val = log->data[pos++];
+    }
+
+    cursor->pos = pos;
+    cursor->cyc = entry->kind == IO_RESET ? 0 : entry->time;
+    cursor->addr = entry->addr;
+    return true;
+}
+
+// serves a read from an I/O page from the log being replayed, returns -1
+// once the log is exhausted
+static int io_replay_read(m6502* const c, uint16_t addr) {
+    m6502_io_log* const log = c->io_log;
+    io_entry entry;
+    while (io_next(log, &log->reads, &entry)) {
+        if (entry.kind != IO_READ && entry.kind != IO_READ_SAME) {
+            continue; // (replayed by the event)
+        }
+        if (entry.addr != addr || entry.time != c->cyc) {
+            log->mismatches += 1;
+        }
+        return entry.val;
+    }
+    return -1;
+}
+
+// reads a byte from a page that can't be accessed directly
+static uint8_t read_slow(m6502* const c, uint16_t addr) {
+    const uint8_t page = addr >> 8;
+
+    if (c->page_flags[page] & PAGE_BREAK_READ) {
+        watch_access(c, c->breakpoints->read, addr, M6502_BREAK_READ);
+    }
+    const bool io = (c->page_flags[page] & PAGE_IO) && c->io_log != NULL;
+    if (io && c->io_log->mode == M6502_IO_REPLAY) {
+        const int val = io_replay_read(c, addr);
+        if (val >= 0) {
+            return val;
+        }
+    }
+
+    const uint8_t val = c->read_map[page] != NULL
+        ? c->read_map[page][addr & 0xFF] : c->read_byte(c->userdata, addr);
+    if (io) {
+        io_record(c, IO_READ, addr, val);
+    }
+    return val;
 }
 
-// addressing modes helpers
-static inline uint16_t IMM(m6502* const c) { // immediate
-    return c->pc++;
+// reads a byte of an instruction from a page that can't be accessed
+// directly
+static uint8_t fetch_slow(m6502* const c, uint16_t addr) {
+    const uint8_t* const page = c->read_map[addr >> 8];
+    if (page != NULL) {
+        return page[addr & 0xFF];
+    }
+    return c->read_byte(c->userdata, addr);
 }
 
-static inline uint8_t ZPG(m6502* const c) { // zero page
-    return m6502_rb(c, c->pc++);
+#if JIT
+static void jit_invalidate_page(m6502_jit* jit, uint8_t page);
+#endif
+
+// discards the decoded instructions overlapping a page, including the ones
+// starting at the end of the previous page, and their compiled blocks
+static void invalidate_page(m6502* const c, uint8_t page) {
+    const uint16_t start = (page << 8) - 2;
+    for (unsigned i = 0; i < 256 + 2; i++) {
+        c->decode_cache[(uint16_t) (start + i)].length = 0;
+    }
+#if JIT
+    if (c->jit != NULL) {
+        jit_invalidate_page(c->jit, page);
+    }
+#endif
+
+    c->page_flags[page] &= ~PAGE_CODE;
+    update_page(c, page);
+    c->decode_invalidations += 1;
 }
 
-static inline uint8_t ZPX(m6502* const c) { // zero page + x
-    return m6502_rb(c, c->pc++) + c->x;
+// marks a page as changed since the snapshot being tracked
+static void mark_dirty(m6502* const c, uint8_t page) {
+    c->page_flags[page] &= ~PAGE_CLEAN;
+    update_page(c, page);
 }
 
-static inline uint8_t ZPY(m6502* const c) { // zero page + y
-    return m6502_rb(c, c->pc++) + c->y;
+// writes a byte to a page that can't be accessed directly
+static void write_slow(m6502* const c, uint16_t addr, uint8_t val) {
+    const uint8_t page = addr >> 8;
+
+    if (c->page_flags[page] & PAGE_CLEAN) {
+        mark_dirty(c, page);
+    }
+    if (c->page_flags[page] & PAGE_CODE) {
+        invalidate_page(c, page);
+    }
+    if (c->page_flags[page] & PAGE_BREAK_WRITE) {
+        watch_access(c, c->breakpoints->write, addr, M6502_BREAK_WRITE);
+    }
+    // the devices don't run while a log is replayed
+    if ((c->page_flags[page] & PAGE_IO) && c->io_log != NULL &&
+            c->io_log->mode == M6502_IO_REPLAY) {
+        return;
+    }
+    if (c->page_flags[page] & PAGE_PROTECT) {
+        return;
+    }
+
+    if (c->write_map[page] != NULL) {
+        c->write_map[page][addr & 0xFF] = val;
+    }
+    else {
+        c->write_byte(c->userdata, addr, val);
+    }
 }
 
-static inline uint16_t ABS(m6502* const c) { // absolute
-    uint16_t addr = m6502_rw(c, c->pc);
+// reads the operand word of an instruction
+static inline uint16_t fetch_word(m6502* const c) {
+    uint16_t val = (m6502_fetch(c, c->pc + 1) << 8) | m6502_fetch(c, c->pc);
     c->pc += 2;
-    return addr;
+    return val;
+}
+
+// returns the first byte of an operand from the decode cache, and shifts
+// the next one in its place
+static inline uint8_t next_operand_byte(uint16_t* const operand) {
+    const uint8_t val = *operand & 0xFF;
+    *operand >>= 8;
+    return val;
+}
+
+// addressing modes helpers: they compute an address from the operand
+// of the instruction (the immediate mode is handled in m6502_core.h)
+static inline uint8_t ZPG(uint8_t op) { // zero page
+    return op;
 }
 
-static inline uint16_t ABX(m6502* const c) { // absolute + x
-    uint16_t addr = ABS(c) + c->x;
+static inline uint8_t ZPX(m6502* const c, uint8_t op) { // zero page + x
+    return op + c->x;
+}
+
+static inline uint8_t ZPY(m6502* const c, uint8_t op) { // zero page + y
+    return op + c->y;
+}
+
+static inline uint16_t ABS(uint16_t op) { // absolute
+    return op;
+}
+
+static inline uint16_t ABX(m6502* const c, uint16_t op) { // absolute + x
+    uint16_t addr = op + c->x;
     c->page_crossed = ((addr - c->x) & 0xFF00) != (addr & 0xFF00);
     return addr;
 }
 
-static inline uint16_t ABY(m6502* const c) { // absolute + y
-    uint16_t addr = ABS(c) + c->y;
+static inline uint16_t ABY(m6502* const c, uint16_t op) { // absolute + y
+    uint16_t addr = op + c->y;
     c->page_crossed = ((addr - c->y) & 0xFF00) != (addr & 0xFF00);
     return addr;
 }
 
-static inline uint16_t INX(m6502* const c) { // indexed indirect x
-    return m6502_rw_bug(c, (m6502_rb(c, c->pc++) + c->x) & 0xFF);
+static inline uint16_t INX(m6502* const c, uint8_t op,
+        const int variant) { // indexed indirect x
+    return m6502_rw_bug(c, (op + c->x) & 0xFF, variant);
 }
 
-static inline uint16_t INY(m6502* const c) { // indirect indexed y
-    uint16_t addr = m6502_rw_bug(c, m6502_rb(c, c->pc++)) + c->y;
+static inline uint16_t INY(m6502* const c, uint8_t op,
+        const int variant) { // indirect indexed y
+    uint16_t addr = m6502_rw_bug(c, op, variant) + c->y;
     c->page_crossed = ((addr - c->y) & 0xFF00) != (addr & 0xFF00);
     return addr;
 }
 
-static inline int8_t REL(m6502* const c) { // relative
-    return (int8_t) m6502_rb(c, c->pc++);
+static inline int8_t REL(uint8_t op) { // relative
+    return (int8_t) op;
 }
 
-static inline uint16_t INZ(m6502* const c) { // indirect zero page (65C02)
-    uint16_t addr = m6502_rw(c, m6502_rb(c, c->pc++));
+static inline uint16_t INZ(m6502* const c,
+        uint8_t op) { // indirect zero page (65C02)
+    uint16_t addr = m6502_rw(c, op);
     return addr;
 }
 
@@ -179,70 +819,133 @@ static inline uint16_t pull_word(m6502* const c) {
 
 // helper to quickly set Z/N flags according to a byte value
 static inline void set_zn(m6502* const c, uint8_t val) {
-    c->zf = val == 0;
-    c->nf = val >> 7;
+    c->n_result = val;
+    c->z_result = val;
+}
+
+// returns the N flag
+static inline bool get_nf(const m6502* const c) {
+    return c->n_result >> 7;
+}
+
+// returns the Z flag
+static inline bool get_zf(const m6502* const c) {
+    return c->z_result == 0;
 }
 
 // returns flags status in one byte
-static inline uint8_t get_flags(m6502* const c) {
+static inline uint8_t get_flags(const m6502* const c) {
     uint8_t flags = 0;
-    flags |= c->nf << 7;
+    flags |= get_nf(c) << 7;
     flags |= c->vf << 6;
     flags |= 1 << 5; // bit 5 is always set
     flags |= c->bf << 4; // clear if interrupt vectoring, set if BRK or PHP
     flags |= c->df << 3;
     flags |= c->idf << 2;
-    flags |= c->zf << 1;
+    flags |= get_zf(c) << 1;
     flags |= c->cf << 0;
     return flags;
 }
 
 static inline void set_flags(m6502* const c, uint8_t val) {
-    c->nf = (val >> 7) & 1;
+    c->n_result = val & 0x80;
     c->vf = (val >> 6) & 1;
     c->df = (val >> 3) & 1;
     c->bf = (val >> 4) & 1;
     c->idf = (val >> 2) & 1;
-    c->zf = (val >> 1) & 1;
+    c->z_result = ~val & 0x02;
     c->cf = (val >> 0) & 1;
 }
 
 // interrupts
 
-static inline void interrupt(m6502* const c, uint16_t vector) {
+// pushes the state and jumps to an interrupt vector (the cycles are counted
+// by the caller: the opcode table for BRK, gen_interrupt otherwise)
+static inline void interrupt(m6502* const c, uint16_t vector,
+        const int variant) {
     push_word(c, c->pc);
     push_byte(c, get_flags(c));
     c->pc = m6502_rw(c, vector);
 
     c->idf = 1;
     c->wait = 0;
-    c->cyc += 7;
-    if (c->m65c02_mode) {
+    if (variant & VARIANT_CMOS) {
         c->df = 0;
     }
 }
 
+// CLI, SEI and PLP change the I flag after the interrupts are polled for
+// the next instruction boundary, which sees the previous value: called
+// before they change it (an interrupt signalled later can't be taken on
+// this boundary anyway)
+static inline void delay_idf(m6502* const c) {
+    if (peek_signals(c) != 0) {
+        c->idf_before = c->idf;
+        __atomic_fetch_or(&c->signals, SIGNAL_IDF_DELAYED, __ATOMIC_RELAXED);
+    }
+}
+
+// takes the interrupt signalled at an instruction boundary, if any (only
+// called when a signal is set), and returns true if the run must end to let
+// m6502_run handle the other signals
+static bool poll_signals(m6502* const c, const int variant) {
+    const uint32_t signals = __atomic_load_n(&c->signals, __ATOMIC_ACQUIRE);
+    if (signals & SIGNAL_RUN) {
+        return true;
+    }
+
+    bool idf = c->idf;
+    if (signals & SIGNAL_IDF_DELAYED) {
+        idf = c->idf_before;
+        __atomic_fetch_and(&c->signals, ~SIGNAL_IDF_DELAYED,
+            __ATOMIC_RELAXED);
+    }
+    if (signals & M6502_SIGNAL_NMI) {
+        __atomic_fetch_and(&c->signals, ~M6502_SIGNAL_NMI, __ATOMIC_RELAXED);
+        io_record(c, IO_NMI, 0, 0);
+        c->bf = 0;
+        interrupt(c, 0xFFFA, variant);
+        c->cyc += 7;
+    }
+    else if (signals & SIGNAL_IRQ) {
+        if (!idf) {
+            io_record(c, IO_IRQ, 0, 0);
+            c->bf = 0;
+            interrupt(c, 0xFFFE, variant);
+            c->cyc += 7;
+        }
+        else if (c->wait) {
+            // an IRQ ends WAI even when it is masked
+            io_record(c, IO_WAKE, 0, 0);
+            c->wait = 0;
+        }
+    }
+    return false;
+}
+
 // opcodes - storage
 
 // loads a register with a byte
-static inline void m6502_ldr(m6502* const c, uint8_t* const reg, uint16_t addr) {
-    *reg = m6502_rb(c, addr);
+static inline void m6502_ldr(m6502* const c, uint8_t* const reg, uint8_t val) {
+    *reg = val;
     set_zn(c, *reg);
 }
 
+// loads a register with a byte in memory
+static inline void m6502_ldr_addr(m6502* const c, uint8_t* const reg,
+        uint16_t addr) {
+    m6502_ldr(c, reg, m6502_rb(c, addr));
+}
+
 // opcodes - math
 
 // adds a byte (+ carry flag) to the accumulator
-static inline void m6502_adc(m6502* const c, uint16_t addr) {
-    const uint8_t val = m6502_rb(c, addr);
-
-    if (c->enable_bcd && c->df) {
+static inline void m6502_adc(m6502* const c, uint8_t val, const int variant) {
+    if ((variant & VARIANT_BCD) && c->df) {
         // decimal ADC
         const uint8_t cy = c->cf;
 
-        c->nf = 0;
         c->vf = 0;
-        c->zf = 0;
         c->cf = 0;
 
         uint8_t al = (c->a & 0xF) + (val & 0xF) + cy;
@@ -263,17 +966,14 @@ static inline void m6502_adc(m6502* const c, uint16_t addr) {
 
         c->a = (ah << 4) | (al & 0xF);
 
-        if (c->a == 0) {
-            c->zf = 1;
-        }
-
-        if (ah & 0x8) {
-            c->nf = 1;
-        }
+        // Z is set according to the result, N according to its high digit
+        // before the decimal adjustment
+        c->z_result = c->a;
+        c->n_result = ah << 4;
 
         // in the 65c02, if the decimal mode is set in ADC/SBC,
         // those operations last one more cycle
-        if (c->m65c02_mode) {
+        if (variant & VARIANT_CMOS) {
             c->cyc += 1;
         }
     }
@@ -289,17 +989,19 @@ static inline void m6502_adc(m6502* const c, uint16_t addr) {
     }
 }
 
-// substracts a byte (+ *not* carry flag) to the accumulator
-static inline void m6502_sbc(m6502* const c, uint16_t addr) {
-    const uint8_t val = m6502_rb(c, addr);
+// adds a byte in memory (+ carry flag) to the accumulator
+static inline void m6502_adc_addr(m6502* const c, uint16_t addr,
+        const int variant) {
+    m6502_adc(c, m6502_rb(c, addr), variant);
+}
 
-    if (c->enable_bcd && c->df) {
+// substracts a byte (+ *not* carry flag) to the accumulator
+static inline void m6502_sbc(m6502* const c, uint8_t val, const int variant) {
+    if ((variant & VARIANT_BCD) && c->df) {
         // decimal ADC
         const uint8_t cy = !c->cf;
 
-        c->nf = 0;
         c->vf = 0;
-        c->zf = 0;
         c->cf = 0;
 
         const uint16_t result = c->a - val - cy;
@@ -321,17 +1023,14 @@ static inline void m6502_sbc(m6502* const c, uint16_t addr) {
 
         c->a = (ah << 4) | (al & 0xF);
 
-        if (c->a == 0) {
-            c->zf = 1;
-        }
-
-        if (ah & 0x8) {
-            c->nf = 1;
-        }
+        // Z is set according to the result, N according to its high digit
+        // before the decimal adjustment
+        c->z_result = c->a;
+        c->n_result = ah << 4;
 
         // in the 65c02, if the decimal mode is set in ADC/SBC,
         // those operations last one more cycle
-        if (c->m65c02_mode) {
+        if (variant & VARIANT_CMOS) {
             c->cyc += 1;
         }
     }
@@ -347,6 +1046,12 @@ static inline void m6502_sbc(m6502* const c, uint16_t addr) {
     }
 }
 
+// substracts a byte in memory (+ *not* carry flag) to the accumulator
+static inline void m6502_sbc_addr(m6502* const c, uint16_t addr,
+        const int variant) {
+    m6502_sbc(c, m6502_rb(c, addr), variant);
+}
+
 // increments a byte and returns the incremented value
 static inline uint8_t m6502_inc(m6502* const c, uint8_t val) {
     uint8_t result = val + 1;
@@ -385,13 +1090,17 @@ static inline void m6502_der(m6502* const c, uint8_t* const reg) {
 
 // opcodes - bitwise
 
-// executes a logical AND between the accumulator and a byte in memory
-static inline void m6502_and(m6502* const c, uint16_t addr) {
-    uint8_t val = m6502_rb(c, addr);
+// executes a logical AND between the accumulator and a byte
+static inline void m6502_and(m6502* const c, uint8_t val) {
     c->a &= val;
     set_zn(c, c->a);
 }
 
+// executes a logical AND between the accumulator and a byte in memory
+static inline void m6502_and_addr(m6502* const c, uint16_t addr) {
+    m6502_and(c, m6502_rb(c, addr));
+}
+
 // shifts left the contents of a byte and returns it
 static inline uint8_t m6502_asl(m6502* const c, uint8_t val) {
     uint8_t result = val << 1;
@@ -410,16 +1119,21 @@ static inline void m6502_asl_addr(m6502* const c, uint16_t addr) {
 static inline void m6502_bit(m6502* const c, uint16_t addr) {
     uint8_t val = m6502_rb(c, addr);
     c->vf = (val >> 6) & 1;
-    c->zf = (val & c->a) == 0;
-    c->nf = val >> 7;
+    c->z_result = val & c->a;
+    c->n_result = val;
 }
 
-// executes an exclusive OR on register A and a byte in memory
-static inline void m6502_eor(m6502* const c, uint16_t addr) {
-    c->a ^= m6502_rb(c, addr);
+// executes an exclusive OR on register A and a byte
+static inline void m6502_eor(m6502* const c, uint8_t val) {
+    c->a ^= val;
     set_zn(c, c->a);
 }
 
+// executes an exclusive OR on register A and a byte in memory
+static inline void m6502_eor_addr(m6502* const c, uint16_t addr) {
+    m6502_eor(c, m6502_rb(c, addr));
+}
+
 // shifts right the contents of a byte and returns it
 static inline uint8_t m6502_lsr(m6502* const c, uint8_t val) {
     uint8_t result = val >> 1;
@@ -434,12 +1148,17 @@ static inline void m6502_lsr_addr(m6502* const c, uint16_t addr) {
     m6502_wb(c, addr, m6502_lsr(c, val));
 }
 
-// executes an inclusive OR on register A and a byte in memory
-static inline void m6502_ora(m6502* const c, uint16_t addr) {
-    c->a |= m6502_rb(c, addr);
+// executes an inclusive OR on register A and a byte
+static inline void m6502_ora(m6502* const c, uint8_t val) {
+    c->a |= val;
     set_zn(c, c->a);
 }
 
+// executes an inclusive OR on register A and a byte in memory
+static inline void m6502_ora_addr(m6502* const c, uint16_t addr) {
+    m6502_ora(c, m6502_rb(c, addr));
+}
+
 // rotates left a byte and returns the rotated value
 static inline uint8_t m6502_rol(m6502* const c, uint8_t val) {
     uint8_t result = val << 1;
@@ -473,14 +1192,14 @@ static inline void m6502_ror_addr(m6502* const c, uint16_t addr) {
 // test and resets bits
 static inline void m6502_trb(m6502* const c, uint16_t addr) {
     uint8_t val = m6502_rb(c, addr);
-    c->zf = (val & c->a) == 0;
+    c->z_result = val & c->a;
     m6502_wb(c, addr, val & ~c->a);
 }
 
 // test and set bits
 static inline void m6502_tsb(m6502* const c, uint16_t addr) {
     uint8_t val = m6502_rb(c, addr);
-    c->zf = (val & c->a) == 0;
+    c->z_result = val & c->a;
     m6502_wb(c, addr, val | c->a);
 }
 
@@ -523,140 +1242,404 @@ static inline void m6502_rts(m6502* const c) {
 
 // opcodes - registers
 
-// compares the value of a register with another byte in memory
-static inline void m6502_cmp(m6502* const c, uint16_t addr, uint8_t reg_value) {
-    uint8_t val = m6502_rb(c, addr);
+// compares the value of a register with another byte
+static inline void m6502_cmp(m6502* const c, uint8_t val, uint8_t reg_value) {
     uint8_t result = reg_value - val;
     c->cf = reg_value >= val;
     set_zn(c, result);
 }
 
-static inline void execute_m65c02_opcode(m6502* const c, uint8_t opcode) {
-    switch (opcode) {
-    case 0x80: m6502_branch(c, REL(c), 1); break; // BRA REL
-
-    case 0xDA: push_byte(c, c->x); break; // PHX
-    case 0xFA: c->x = pull_byte(c); set_zn(c, c->x); break; // PLX
-    case 0x5A: push_byte(c, c->y); break; // PHY
-    case 0x7A: c->y = pull_byte(c); set_zn(c, c->y); break; // PLY
-
-    case 0x9C: m6502_wb(c, ABS(c), 0); break; // STZ ABS
-    case 0x9E: m6502_wb(c, ABX(c), 0); break; // STZ ABX
-    case 0x64: m6502_wb(c, ZPG(c), 0); break; // STZ ZPG
-    case 0x74: m6502_wb(c, ZPX(c), 0); break; // STZ ZPX
-
-    case 0x1C: m6502_trb(c, ABS(c)); break; // TRB ABS
-    case 0x14: m6502_trb(c, ZPG(c)); break; // TRB ZPG
-
-    case 0x0C: m6502_tsb(c, ABS(c)); break; // TSB ABS
-    case 0x04: m6502_tsb(c, ZPG(c)); break; // TSB ZPG
-
-    // BBR
-    case 0x0F: case 0x1F: case 0x2F: case 0x3F:
-    case 0x4F: case 0x5F: case 0x6F: case 0x7F: {
-        const uint8_t bit_no = opcode >> 4;
-        const uint8_t val = m6502_rb(c, ZPG(c));
-        const int8_t addr = REL(c);
-
-        m6502_branch(c, addr, ((val >> bit_no) & 1) == 0);
-    } break;
-
-    // BBS
-    case 0x8F: case 0x9F: case 0xAF: case 0xBF:
-    case 0xCF: case 0xDF: case 0xEF: case 0xFF: {
-        const uint8_t bit_no = (opcode >> 4) - 8;
-        const uint8_t val = m6502_rb(c, ZPG(c));
-        const int8_t addr = REL(c);
-
-        m6502_branch(c, addr, ((val >> bit_no) & 1) == 1);
-    } break;
-
-    // RMB
-    case 0x07: case 0x17: case 0x27: case 0x37:
-    case 0x47: case 0x57: case 0x67: case 0x77: {
-        const uint8_t bit_no = opcode >> 4;
-        const uint8_t addr = ZPG(c);
-        uint8_t val = m6502_rb(c, addr);
-        val &= ~(1UL << bit_no);
-        m6502_wb(c, addr, val);
-    } break;
-
-    // SMB
-    case 0x87: case 0x97: case 0xA7: case 0xB7:
-    case 0xC7: case 0xD7: case 0xE7: case 0xF7: {
-        const uint8_t bit_no = (opcode >> 4) - 8;
-        const uint8_t addr = ZPG(c);
-        uint8_t val = m6502_rb(c, addr);
-        val |= (1 << bit_no);
-        m6502_wb(c, addr, val);
-    } break;
-
-    case 0xDB: c->stop = 1; break; // STP
-    case 0xCB: c->wait = 1; break; // WAI
-
-    case 0x72: m6502_adc(c, INZ(c)); break; // ADC INZ
-    case 0x32: m6502_and(c, INZ(c)); break; // AND INZ
-    case 0x3C: m6502_bit(c, ABX(c)); break; // BIT ABX
-    case 0x34: m6502_bit(c, ZPX(c)); break; // BIT ZPX
-    // when the BIT instruction is used with the immediate
-    // addressing mode, the n and v flags are unaffected.
-    case 0x89: c->zf = (m6502_rb(c, IMM(c)) & c->a) == 0; break; // BIT IMM
-    case 0xD2: m6502_cmp(c, INZ(c), c->a); break; // CMP INZ
-    case 0x3A: m6502_der(c, &c->a); break; // DEA
-    case 0x1A: m6502_inr(c, &c->a); break; // INA
-    case 0x52: m6502_eor(c, INZ(c)); break; // EOR INZ
-    // JMP absolute indexed indirect
-    case 0x7C: m6502_jmp(c, m6502_rw(c, ABS(c) + c->x)); break;
-    case 0xB2: m6502_ldr(c, &c->a, INZ(c)); break; // LDA INZ
-    case 0x12: m6502_ora(c, INZ(c)); break; // ORA INZ
-    case 0xF2: m6502_sbc(c, INZ(c)); break; // SBC INZ
-    case 0x92: m6502_wb(c, INZ(c), c->a); break; // STA INZ
-
-    // one-byte NOP
-    case 0x03: case 0x13: case 0x23: case 0x33: case 0x43: case 0x53:
-    case 0x63: case 0x73: case 0x83: case 0x93: case 0xA3: case 0xB3:
-    case 0xC3: case 0xD3: case 0xE3: case 0xF3:
-    case 0x0B: case 0x1B: case 0x2B: case 0x3B: case 0x4B: case 0x5B:
-    case 0x6B: case 0x7B: case 0x8B: case 0x9B: case 0xAB: case 0xBB:
-    case 0xEB: case 0xFB:
-        c->cyc += 1;
-    break;
-
-    // two-bytes NOP
-    case 0x02: case 0x22: case 0x42: case 0x62: case 0x82: case 0xC2:
-    case 0xE2:
-        c->pc += 1;
-        c->cyc += 2;
-    break;
-
-    case 0x44:
-        c->pc += 1;
-        c->cyc += 3;
-    break;
-
-    case 0x54: case 0xD4: case 0xF4:
-        c->pc += 1;
-        c->cyc += 4;
-    break;
-
-    // three-bytes NOP
-    case 0x5C:
-        c->pc += 2;
-        c->cyc += 8;
-    break;
-
-    case 0xDC: case 0xFC:
-        c->pc += 2;
-        c->cyc += 4;
-    break;
+// compares the value of a register with another byte in memory
+static inline void m6502_cmp_addr(m6502* const c, uint16_t addr,
+        uint8_t reg_value) {
+    m6502_cmp(c, m6502_rb(c, addr), reg_value);
+}
+
+// decode cache
+
+// decodes the straight-line block of instructions starting at addr into the
+// decode cache, and returns false if the instruction at addr can't be
+// decoded because it isn't in memory mapped for reads
+static bool decode_block(m6502* const c, uint16_t addr, const int variant) {
+    const m6502_opcode* const opcodes =
+        (variant & VARIANT_CMOS) ? OPCODES_65C02 : OPCODES_6502;
+    const uint16_t start = addr;
+    const uint8_t first_page = addr >> 8;
+
+    while (c->decode_cache[addr].length == 0) {
+        // (the instructions at breakpoints are fetched without the cache)
+        const uint8_t page = addr >> 8;
+        if (c->read_map[page] == NULL ||
+                (c->page_flags[page] & PAGE_BREAK_EXEC)) {
+            break;
+        }
+
+        const uint8_t opcode = c->read_map[page][addr & 0xFF];
+        const uint8_t length = opcodes[opcode].length;
+        const uint16_t last = addr + length - 1;
+        const uint8_t last_page = last >> 8;
+        if (c->read_map[last_page] == NULL) {
+            break;
+        }
+
+        m6502_decoded* const entry = &c->decode_cache[addr];
+        entry->opcode = opcode;
+        entry->length = length;
+        entry->cycles = opcodes[opcode].cycles;
+        entry->operand = 0;
+        for (unsigned i = 1; i < length; i++) {
+            const uint16_t a = addr + i;
+            entry->operand |= c->read_map[a >> 8][a & 0xFF] << (8 * (i - 1));
+        }
+
+        // writes to the pages holding the instruction must invalidate it
+        c->page_flags[page] |= PAGE_CODE;
+        c->page_flags[last_page] |= PAGE_CODE;
+        update_page(c, page);
+        update_page(c, last_page);
+
+        addr += length;
+        // branches, jumps and STP/WAI may not continue with the next one
+        if (opcodes[opcode].kind >= M6502_KIND_BRANCH ||
+                (addr >> 8) != first_page) {
+            break;
+        }
+    }
+
+    return c->decode_cache[start].length != 0;
+}
+
+// idle loops: a loop whose body only reads mapped memory (no writes, I/O
+// callbacks or stack accesses) and which starts each iteration with the
+// same registers repeats identically until an interrupt or an event
+// changes its memory or its flow. The cores detect it when a backward jump,
+// taken repeatedly from the same address, leaves the same registers on two
+// iterations in a row (sampled every IDLE_SAMPLE iterations), and skip its
+// iterations up to the end of the run, cycle for cycle.
+#define IDLE_SAMPLE 64
+
+// the last backward jump taken by a core
+typedef struct idle_loop {
+    uint16_t from, to; // address of the jump and its target
+    unsigned count; // number of times it was taken in a row
+    // state after the sampled iteration
+    uint64_t regs; // registers and flags (see idle_regs)
+    uint64_t cyc;
+    unsigned long instructions; // instructions executed by the core
+    int pure; // the body only reads mapped memory: 1 or 0, -1 if unknown
+} idle_loop;
+
+// idle loops are only skipped up to a run end closer than this: a longer
+// budget stands for "until an exit condition", which an idle loop can only
+// meet with a signal sent by another thread
+#define IDLE_SKIP_MAX (UINT64_C(1) << 32)
+
+static inline uint64_t idle_regs(const m6502* const c) {
+    return c->a | (uint64_t) c->x << 8 | (uint64_t) c->y << 16 |
+        (uint64_t) c->sp << 24 | (uint64_t) c->n_result << 32 |
+        (uint64_t) c->z_result << 40 |
+        (uint64_t) (c->cf | c->idf << 1 | c->df << 2 | c->vf << 3) << 48;
+}
+
+// reads mapped memory (without side effects), or returns -1
+static int peek_byte(const m6502* const c, uint16_t addr) {
+    const uint8_t* const page = c->read_map[addr >> 8];
+    return page != NULL ? page[addr & 0xFF] : -1;
+}
 
+// returns true if the operand of a read is in memory read directly (mapped,
+// and neither I/O nor watched) whatever the index registers
+static bool idle_read_mapped(const m6502* const c, uint8_t mode,
+        uint16_t operand) {
+    switch (mode) {
+    case M6502_MODE_ZPG: case M6502_MODE_ZPX: case M6502_MODE_ZPY:
+        return c->read_pages[0] != NULL;
+    case M6502_MODE_ABS:
+        return c->read_pages[operand >> 8] != NULL;
+    case M6502_MODE_ABX: case M6502_MODE_ABY:
+        return c->read_pages[operand >> 8] != NULL &&
+            c->read_pages[(uint8_t) ((operand >> 8) + 1)] != NULL;
+    case M6502_MODE_INY: case M6502_MODE_INZ: {
+        // the pointer isn't written by the loop, and is read directly too
+        if (c->read_pages[0] == NULL) {
+            return false;
+        }
+        const int lo = peek_byte(c, operand & 0xFF);
+        const int hi = peek_byte(c, (operand + 1) & 0xFF);
+        return lo >= 0 && hi >= 0 && c->read_pages[hi] != NULL &&
+            c->read_pages[(uint8_t) (hi + 1)] != NULL;
+    }
     default:
-        // treat invalid opcodes as NOPs
-        c->cyc += 2;
-        // fprintf(stderr, "error: invalid 65C02 opcode 0x%02X\n", opcode);
-    break;
+        return false;
+    }
+}
+
+// returns true if the instructions of the loop from to (its first
+// instruction) to from (the backward jump) only read mapped memory and
+// branch within the loop
+static bool idle_loop_pure(const m6502* const c, uint16_t to, uint16_t from,
+        const m6502_opcode* const opcodes) {
+    uint16_t addr = to;
+    for (;;) {
+        const int opcode = peek_byte(c, addr);
+        if (opcode < 0) {
+            return false;
+        }
+        const m6502_opcode* const op = &opcodes[opcode];
+        uint16_t operand = 0;
+        for (unsigned i = 1; i < op->length; i++) {
+            const int byte = peek_byte(c, addr + i);
+            if (byte < 0) {
+                return false;
+            }
+            operand |= byte << (8 * (i - 1));
+        }
+
+        switch (op->kind) {
+        case M6502_KIND_NONE:
+            switch (op->mnemonic) {
+            case M6502_PHA: case M6502_PHP: case M6502_PHX: case M6502_PHY:
+            case M6502_PLA: case M6502_PLP: case M6502_PLX: case M6502_PLY:
+            case M6502_CLI: case M6502_SEI:
+                return false;
+            }
+            break;
+        case M6502_KIND_READ:
+            if (!idle_read_mapped(c, op->mode, operand)) {
+                return false;
+            }
+            break;
+        case M6502_KIND_BRANCH: {
+            int8_t offset = operand;
+            if (op->mode == M6502_MODE_ZPR) { // BBR/BBS
+                if (c->read_pages[0] == NULL) {
+                    return false;
+                }
+                offset = operand >> 8;
+            }
+            if (addr == from) {
+                return true;
+            }
+            const uint16_t target = addr + op->length + offset;
+            if ((uint16_t) (target - to) > (uint16_t) (from - to)) {
+                return false;
+            }
+            break;
+        }
+        default: // only the backward JMP
+            return addr == from && op->mnemonic == M6502_JMP &&
+                op->mode == M6502_MODE_ABS;
+        }
+
+        addr += op->length;
+        if ((uint16_t) (addr - to) > (uint16_t) (from - to)) {
+            return false;
+        }
+    }
+}
+
+// skips the iterations of the idle loop from to to (whose purity is cached
+// in pure) which end before the end of the run, and returns their number.
+// The last one is executed, and stops where the budget is consumed.
+static uint64_t skip_idle_iterations(m6502* const c, uint16_t from,
+        uint16_t to, uint64_t period, int* const pure, uint64_t end_cyc,
+        const m6502_opcode* const opcodes) {
+    if (!c->skip_idle || c->breakpoints != NULL || peek_signals(c) != 0 ||
+            period == 0 ||
+            c->cyc + MAX_INSTRUCTION_CYCLES >= end_cyc ||
+            end_cyc - c->cyc > IDLE_SKIP_MAX) {
+        return 0;
+    }
+    if (*pure < 0) {
+        *pure = idle_loop_pure(c, to, from, opcodes);
+    }
+    if (!*pure) {
+        return 0;
+    }
+
+    // the page crossing cycles of the jump are counted after it
+    const uint64_t n = (end_cyc - c->cyc - MAX_INSTRUCTION_CYCLES) / period;
+    c->cyc += n * period;
+    c->idle_skips += n != 0;
+    c->idle_cycles += n * period;
+    return n;
+}
+
+// called after a backward jump from pc to c->pc (inlined in the cores, so
+// that their state stays in registers), returns the cycles skipped
+static inline uint64_t skip_idle_loop(m6502* const c, idle_loop* const loop,
+        uint16_t pc, unsigned long* const instructions, uint64_t end_cyc,
+        const m6502_opcode* const opcodes) {
+    if (pc != loop->from || c->pc != loop->to) {
+        loop->from = pc;
+        loop->to = c->pc;
+        loop->count = 0;
+        loop->pure = -1;
+        return 0;
+    }
+
+    loop->count += 1;
+    if (loop->count % IDLE_SAMPLE == IDLE_SAMPLE - 1) {
+        loop->regs = idle_regs(c);
+        loop->cyc = c->cyc;
+        loop->instructions = *instructions;
+    }
+    else if (loop->count % IDLE_SAMPLE == 0 && idle_regs(c) == loop->regs) {
+        const uint64_t period = c->cyc - loop->cyc;
+        int pure = loop->pure;
+        const uint64_t n = skip_idle_iterations(c, loop->from, loop->to,
+            period, &pure, end_cyc, opcodes);
+        loop->pure = pure;
+        *instructions += n * (*instructions - loop->instructions);
+        return n * period;
+    }
+    return 0;
+}
+
+// cores, one per variant. They use threaded code (computed gotos) on
+// compilers supporting it, unless M6502_NO_THREADED_CORE is defined, and a
+// switch otherwise.
+
+// the cores only count the instructions in c->profile when M6502_PROFILE is
+// defined
+#if defined(M6502_PROFILE)
+#define PROFILE 1
+#else
+#define PROFILE 0
+#endif
+
+#if PROFILE
+// counts an instruction that took cycles in the profile
+static void profile_instruction(m6502* const c,
+        const m6502_opcode* const opcodes, uint8_t opcode, uint16_t pc,
+        uint64_t cycles) {
+    m6502_profile* const profile = c->profile;
+    profile->opcode_count[opcode] += 1;
+    profile->opcode_cycles[opcode] += cycles;
+    profile->pc_count[pc] += 1;
+    profile->pc_cycles[pc] += cycles;
+
+    const m6502_opcode* const op = &opcodes[opcode];
+    const unsigned page_crossed = c->page_crossed ? op->page_crossed_cycles : 0;
+    profile->page_crossed_cycles[opcode] += page_crossed;
+    if (op->kind == M6502_KIND_BRANCH) {
+        profile->branch_taken_cycles[opcode] +=
+            cycles - op->cycles - page_crossed;
     }
 }
+#endif
+
+// the cores only record the instructions in c->trace when M6502_TRACE is
+// defined
+#if defined(M6502_TRACE)
+#define TRACE 1
+#else
+#define TRACE 0
+#endif
+
+#if TRACE
+// records an instruction about to execute (its opcode fetched) in the trace
+static void trace_instruction(m6502* const c, uint16_t pc, uint8_t opcode) {
+    m6502_trace* const trace = c->trace;
+    m6502_trace_record* const r = &trace->records[trace->next];
+    const uint64_t cycles = c->cyc - trace->cyc;
+
+    r->cycles = cycles < UINT32_MAX ? cycles : UINT32_MAX;
+    r->pc = pc;
+    // the two bytes following the opcode are peeked from the mapped memory
+    // (as m6502_debug_output prints them), so that tracing never calls
+    // read_byte, which may change the state of a device
+    const int byte1 = peek_byte(c, pc + 1);
+    const int byte2 = peek_byte(c, pc + 2);
+    r->operand = (byte1 >= 0 ? byte1 : 0) | (byte2 >= 0 ? byte2 : 0) << 8;
+    r->opcode = opcode;
+    r->a = c->a;
+    r->x = c->x;
+    r->y = c->y;
+    r->sp = c->sp;
+    r->p = get_flags(c);
+    trace->cyc = c->cyc;
+    trace->next = trace->next + 1 < trace->capacity ? trace->next + 1 : 0;
+    trace->count += 1;
+}
+#endif
+
+#if JIT
+#include "m6502_jit.h"
+#endif
+
+#if defined(__GNUC__) && !defined(M6502_NO_THREADED_CORE)
+#define THREADED_CORE 1
+// labels as values are a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#if !defined(__clang__)
+// keeps GCC from merging the dispatch code duplicated at the end of each
+// handler back into a single indirect jump
+#pragma GCC push_options
+#pragma GCC optimize ("no-crossjumping")
+#endif
+#else
+#define THREADED_CORE 0
+#endif
+
+#define CORE_NAME run_nmos_nobcd
+#define CORE_VARIANT 0
+#define CORE_DECODED 0
+#include "m6502_core.h"
+
+#define CORE_NAME run_nmos_nobcd_decoded
+#define CORE_VARIANT 0
+#define CORE_DECODED 1
+#include "m6502_core.h"
+
+#define CORE_NAME run_cmos_nobcd
+#define CORE_VARIANT VARIANT_CMOS
+#define CORE_DECODED 0
+#include "m6502_core.h"
+
+#define CORE_NAME run_cmos_nobcd_decoded
+#define CORE_VARIANT VARIANT_CMOS
+#define CORE_DECODED 1
+#include "m6502_core.h"
+
+#define CORE_NAME run_nmos
+#define CORE_VARIANT VARIANT_BCD
+#define CORE_DECODED 0
+#include "m6502_core.h"
+
+#define CORE_NAME run_nmos_decoded
+#define CORE_VARIANT VARIANT_BCD
+#define CORE_DECODED 1
+#include "m6502_core.h"
+
+#define CORE_NAME run_cmos
+#define CORE_VARIANT (VARIANT_CMOS | VARIANT_BCD)
+#define CORE_DECODED 0
+#include "m6502_core.h"
+
+#define CORE_NAME run_cmos_decoded
+#define CORE_VARIANT (VARIANT_CMOS | VARIANT_BCD)
+#define CORE_DECODED 1
+#include "m6502_core.h"
+
+#if THREADED_CORE
+#if !defined(__clang__)
+#pragma GCC pop_options
+#endif
+#pragma GCC diagnostic pop
+#endif
+
+// indexed by variant
+static m6502_run_result (*const CORES[])(m6502* const, uint64_t, int) = {
+    run_nmos_nobcd, run_cmos_nobcd, run_nmos, run_cmos
+};
+
+static m6502_run_result (*const DECODED_CORES[])(m6502* const, uint64_t,
+        int) = {
+    run_nmos_nobcd_decoded, run_cmos_nobcd_decoded,
+    run_nmos_decoded, run_cmos_decoded
+};
 
 // interface
 
@@ -668,288 +1651,1349 @@ void m6502_init(m6502* const c) {
     c->y = 0;
     c->sp = 0xFD;
     c->cyc = 0;
-    c->cf = 0;
-    c->zf = 0;
-    c->idf = 0;
-    c->df = 0;
-    c->bf = 0;
-    c->vf = 0;
-    c->nf = 0;
+    m6502_set_flags(c, 0);
     c->page_crossed = 0;
     c->enable_bcd = 1;
     c->m65c02_mode = 0;
     c->stop = 0;
     c->wait = 0;
+    c->skip_idle = 1;
+    c->idf_before = 0;
+    c->signals = 0;
+    c->nmi_line = 0;
+    c->exit_pc = 0;
     c->userdata = NULL;
     c->read_byte = NULL;
     c->write_byte = NULL;
+    memset(c->read_map, 0, sizeof(c->read_map));
+    memset(c->write_map, 0, sizeof(c->write_map));
+    memset(c->page_flags, 0, sizeof(c->page_flags));
+    memset(c->read_pages, 0, sizeof(c->read_pages));
+    memset(c->write_pages, 0, sizeof(c->write_pages));
+    memset(c->fetch_pages, 0, sizeof(c->fetch_pages));
+    c->breakpoints = NULL;
+    c->break_pc = 0;
+    c->break_cyc = UINT64_MAX;
+    c->decode_cache = NULL;
+    c->decode_invalidations = 0;
+    c->jit = NULL;
+    c->jit_blocks = 0;
+    c->jit_instructions = 0;
+    c->nb_events = 0;
+    c->idle_skips = 0;
+    c->idle_cycles = 0;
+    c->profile = NULL;
+    c->trace = NULL;
+    c->io_log = NULL;
+    c->snapshot = NULL;
 }
 
 // executes one instruction stored at the address pointed by
-// the program counter
+// the program counter (after taking the signals, if any)
 void m6502_step(m6502* const c) {
-    if (c->stop || c->wait) {
-        return;
-    }
+    m6502_run(c, 1, EXIT_STEP);
+}
 
-    const uint8_t opcode = m6502_rb(c, c->pc++);
-    if (c->m65c02_mode) {
-            c->cyc += CYCLES_65C02[opcode];
-    }
-    else {
-        c->cyc += CYCLES_6502[opcode];
-    }
-    c->page_crossed = 0;
+// event queue: a binary min-heap of the scheduled events, whose queue_pos
+// is their index in c->events plus one
 
-    switch (opcode) {
-    // storage
-    case 0xA9: m6502_ldr(c, &c->a, IMM(c)); break; // LDA IMM
-    case 0xA5: m6502_ldr(c, &c->a, ZPG(c)); break; // LDA ZPG
-    case 0xB5: m6502_ldr(c, &c->a, ZPX(c)); break; // LDA ZPX
-    case 0xAD: m6502_ldr(c, &c->a, ABS(c)); break; // LDA ABS
-    case 0xBD: m6502_ldr(c, &c->a, ABX(c)); break; // LDA ABX
-    case 0xB9: m6502_ldr(c, &c->a, ABY(c)); break; // LDA ABY
-    case 0xA1: m6502_ldr(c, &c->a, INX(c)); break; // LDA INX
-    case 0xB1: m6502_ldr(c, &c->a, INY(c)); break; // LDA INY
-
-    case 0xA2: m6502_ldr(c, &c->x, IMM(c)); break; // LDX IMM
-    case 0xA6: m6502_ldr(c, &c->x, ZPG(c)); break; // LDX ZPG
-    case 0xB6: m6502_ldr(c, &c->x, ZPY(c)); break; // LDX ZPY
-    case 0xAE: m6502_ldr(c, &c->x, ABS(c)); break; // LDX ABS
-    case 0xBE: m6502_ldr(c, &c->x, ABY(c)); break; // LDX ABY
-
-    case 0xA0: m6502_ldr(c, &c->y, IMM(c)); break; // LDY IMM
-    case 0xA4: m6502_ldr(c, &c->y, ZPG(c)); break; // LDY ZPG
-    case 0xB4: m6502_ldr(c, &c->y, ZPX(c)); break; // LDY ZPX
-    case 0xAC: m6502_ldr(c, &c->y, ABS(c)); break; // LDY ABS
-    case 0xBC: m6502_ldr(c, &c->y, ABX(c)); break; // LDY ABX
-
-    case 0x85: m6502_wb(c, ZPG(c), c->a); break; // STA ZPG
-    case 0x95: m6502_wb(c, ZPX(c), c->a); break; // STA ZPX
-    case 0x8D: m6502_wb(c, ABS(c), c->a); break; // STA ABS
-    case 0x9D: m6502_wb(c, ABX(c), c->a); break; // STA ABX
-    case 0x99: m6502_wb(c, ABY(c), c->a); break; // STA ABY
-    case 0x81: m6502_wb(c, INX(c), c->a); break; // STA INX
-    case 0x91: m6502_wb(c, INY(c), c->a); break; // STA INY
-
-    case 0x86: m6502_wb(c, ZPG(c), c->x); break; // STX ZPG
-    case 0x96: m6502_wb(c, ZPY(c), c->x); break; // STX ZPY
-    case 0x8E: m6502_wb(c, ABS(c), c->x); break; // STX ABS
-
-    case 0x84: m6502_wb(c, ZPG(c), c->y); break; // STY ZPG
-    case 0x94: m6502_wb(c, ZPX(c), c->y); break; // STY ZPX
-    case 0x8C: m6502_wb(c, ABS(c), c->y); break; // STY ABS
-
-    case 0xAA: c->x = c->a; set_zn(c, c->x); break; // TAX
-    case 0xA8: c->y = c->a; set_zn(c, c->y); break; // TAY
-    case 0xBA: c->x = c->sp; set_zn(c, c->x); break; // TSX
-    case 0x8A: c->a = c->x; set_zn(c, c->a); break; // TXA
-    case 0x9A: c->sp = c->x; break; // TXS
-    case 0x98: c->a = c->y; set_zn(c, c->a); break; // TYA
-
-    // math
-    case 0x69: m6502_adc(c, IMM(c)); break; // ADC IMM
-    case 0x65: m6502_adc(c, ZPG(c)); break; // ADC ZPG
-    case 0x75: m6502_adc(c, ZPX(c)); break; // ADC ZPX
-    case 0x6D: m6502_adc(c, ABS(c)); break; // ADC ABS
-    case 0x7D: m6502_adc(c, ABX(c)); break; // ADC ABX
-    case 0x79: m6502_adc(c, ABY(c)); break; // ADC ABY
-    case 0x61: m6502_adc(c, INX(c)); break; // ADC INX
-    case 0x71: m6502_adc(c, INY(c)); break; // ADC INY
-
-    case 0xC6: m6502_dec_addr(c, ZPG(c)); break; // DEC ZPG
-    case 0xD6: m6502_dec_addr(c, ZPX(c)); break; // DEC ZPX
-    case 0xCE: m6502_dec_addr(c, ABS(c)); break; // DEC ABS
-    case 0xDE: m6502_dec_addr(c, ABX(c)); break; // DEC ABX
-    case 0xCA: m6502_der(c, &c->x); break; // DEX
-    case 0x88: m6502_der(c, &c->y); break; // DEY
-
-    case 0xE6: m6502_inc_addr(c, ZPG(c)); break; // INC ZPG
-    case 0xF6: m6502_inc_addr(c, ZPX(c)); break; // INC ZPX
-    case 0xEE: m6502_inc_addr(c, ABS(c)); break; // INC ABS
-    case 0xFE: m6502_inc_addr(c, ABX(c)); break; // INC ABX
-    case 0xE8: m6502_inr(c, &c->x); break; // INX
-    case 0xC8: m6502_inr(c, &c->y); break; // INY
-
-    case 0xE9: m6502_sbc(c, IMM(c)); break; // SBC IMM
-    case 0xE5: m6502_sbc(c, ZPG(c)); break; // SBC ZPG
-    case 0xF5: m6502_sbc(c, ZPX(c)); break; // SBC ZPX
-    case 0xED: m6502_sbc(c, ABS(c)); break; // SBC ABS
-    case 0xFD: m6502_sbc(c, ABX(c)); break; // SBC ABX
-    case 0xF9: m6502_sbc(c, ABY(c)); break; // SBC ABY
-    case 0xE1: m6502_sbc(c, INX(c)); break; // SBC INX
-    case 0xF1: m6502_sbc(c, INY(c)); break; // SBC INY
-
-    // bitwise
-    case 0x29: m6502_and(c, IMM(c)); break; // AND IMM
-    case 0x25: m6502_and(c, ZPG(c)); break; // AND ZPG
-    case 0x35: m6502_and(c, ZPX(c)); break; // AND ZPX
-    case 0x2D: m6502_and(c, ABS(c)); break; // AND ABS
-    case 0x3D: m6502_and(c, ABX(c)); break; // AND ABX
-    case 0x39: m6502_and(c, ABY(c)); break; // AND ABY
-    case 0x21: m6502_and(c, INX(c)); break; // AND INX
-    case 0x31: m6502_and(c, INY(c)); break; // AND INY
-
-    case 0x0A: c->a = m6502_asl(c, c->a); break; // ASL ACC
-    case 0x06: m6502_asl_addr(c, ZPG(c)); break; // ASL ZPG
-    case 0x16: m6502_asl_addr(c, ZPX(c)); break; // ASL ZPX
-    case 0x0E: m6502_asl_addr(c, ABS(c)); break; // ASL ABS
-    case 0x1E: m6502_asl_addr(c, ABX(c)); break; // ASL ABX
-
-    case 0x24: m6502_bit(c, ZPG(c)); break; // BIT ZPG
-    case 0x2C: m6502_bit(c, ABS(c)); break; // BIT ABS
-
-    case 0x49: m6502_eor(c, IMM(c)); break; // EOR IMM
-    case 0x45: m6502_eor(c, ZPG(c)); break; // EOR ZPG
-    case 0x55: m6502_eor(c, ZPX(c)); break; // EOR ZPX
-    case 0x4D: m6502_eor(c, ABS(c)); break; // EOR ABS
-    case 0x5D: m6502_eor(c, ABX(c)); break; // EOR ABX
-    case 0x59: m6502_eor(c, ABY(c)); break; // EOR ABY
-    case 0x41: m6502_eor(c, INX(c)); break; // EOR INX
-    case 0x51: m6502_eor(c, INY(c)); break; // EOR INY
-
-    case 0x4A: c->a = m6502_lsr(c, c->a); break; // LSR ACC
-    case 0x46: m6502_lsr_addr(c, ZPG(c)); break; // LSR ZPG
-    case 0x56: m6502_lsr_addr(c, ZPX(c)); break; // LSR ZPX
-    case 0x4E: m6502_lsr_addr(c, ABS(c)); break; // LSR ABS
-    case 0x5E: m6502_lsr_addr(c, ABX(c)); break; // LSR ABX
-
-    case 0x09: m6502_ora(c, IMM(c)); break; // ORA IMM
-    case 0x05: m6502_ora(c, ZPG(c)); break; // ORA ZPG
-    case 0x15: m6502_ora(c, ZPX(c)); break; // ORA ZPX
-    case 0x0D: m6502_ora(c, ABS(c)); break; // ORA ABS
-    case 0x1D: m6502_ora(c, ABX(c)); break; // ORA ABX
-    case 0x19: m6502_ora(c, ABY(c)); break; // ORA ABY
-    case 0x01: m6502_ora(c, INX(c)); break; // ORA IMM
-    case 0x11: m6502_ora(c, INY(c)); break; // ORA IMM
-
-    case 0x2A: c->a = m6502_rol(c, c->a); break; // ROL ACC
-    case 0x26: m6502_rol_addr(c, ZPG(c)); break; // ROL ZPG
-    case 0x36: m6502_rol_addr(c, ZPX(c)); break; // ROL ZPX
-    case 0x2E: m6502_rol_addr(c, ABS(c)); break; // ROL ABS
-    case 0x3E: m6502_rol_addr(c, ABX(c)); break; // ROL ABX
-
-    case 0x6A: c->a = m6502_ror(c, c->a); break; // ROR ACC
-    case 0x66: m6502_ror_addr(c, ZPG(c)); break; // ROR ZPG
-    case 0x76: m6502_ror_addr(c, ZPX(c)); break; // ROR ZPX
-    case 0x6E: m6502_ror_addr(c, ABS(c)); break; // ROR ABS
-    case 0x7E: m6502_ror_addr(c, ABX(c)); break; // ROR ABX
-
-    // branch
-    case 0x90: m6502_branch(c, REL(c), c->cf == 0); break; // BCC REL
-    case 0xB0: m6502_branch(c, REL(c), c->cf == 1); break; // BCS REL
-    case 0xD0: m6502_branch(c, REL(c), c->zf == 0); break; // BNE REL
-    case 0xF0: m6502_branch(c, REL(c), c->zf == 1); break; // BEQ REL
-    case 0x10: m6502_branch(c, REL(c), c->nf == 0); break; // BPL REL
-    case 0x30: m6502_branch(c, REL(c), c->nf == 1); break; // BMI REL
-    case 0x50: m6502_branch(c, REL(c), c->vf == 0); break; // BVC REL
-    case 0x70: m6502_branch(c, REL(c), c->vf == 1); break; // BVS REL
-
-    // jump
-    case 0x4C: m6502_jmp(c, ABS(c)); break; // JMP
-    case 0x6C: m6502_jmp(c, m6502_rw_bug(c, ABS(c))); break; // JMP
-    case 0x20: m6502_jsr(c, ABS(c)); break; // JSR
-    case 0x40: m6502_rti(c); break; // RTI
-    case 0x60: m6502_rts(c); break; // RTS
-
-    // registers
-    case 0x38: c->cf = 1; break; // SEC
-    case 0x18: c->cf = 0; break; // CLC
-    case 0xF8: c->df = 1; break; // SED
-    case 0xD8: c->df = 0; break; // CLD
-    case 0x78: c->idf = 1; break; // SEI
-    case 0x58: c->idf = 0; break; // CLI
-    case 0xB8: c->vf = 0; break; // CLV
-
-    case 0xC9: m6502_cmp(c, IMM(c), c->a); break; // CMP IMM
-    case 0xC5: m6502_cmp(c, ZPG(c), c->a); break; // CMP ZPG
-    case 0xD5: m6502_cmp(c, ZPX(c), c->a); break; // CMP ZPX
-    case 0xCD: m6502_cmp(c, ABS(c), c->a); break; // CMP ABS
-    case 0xDD: m6502_cmp(c, ABX(c), c->a); break; // CMP ABX
-    case 0xD9: m6502_cmp(c, ABY(c), c->a); break; // CMP ABY
-    case 0xC1: m6502_cmp(c, INX(c), c->a); break; // CMP INX
-    case 0xD1: m6502_cmp(c, INY(c), c->a); break; // CMP INY
-    case 0xE0: m6502_cmp(c, IMM(c), c->x); break; // CPX IMM
-    case 0xE4: m6502_cmp(c, ZPG(c), c->x); break; // CPX ZPG
-    case 0xEC: m6502_cmp(c, ABS(c), c->x); break; // CPX ABS
-    case 0xC0: m6502_cmp(c, IMM(c), c->y); break; // CPY IMM
-    case 0xC4: m6502_cmp(c, ZPG(c), c->y); break; // CPY ZPG
-    case 0xCC: m6502_cmp(c, ABS(c), c->y); break; // CPY ABS
-
-    // stack
-    case 0x48: push_byte(c, c->a); break; // PHA
-    case 0x68: c->a = pull_byte(c); set_zn(c, c->a); break; // PLA
-    case 0x08: c->bf = 1; push_byte(c, get_flags(c)); break; // PHP
-    case 0x28: set_flags(c, pull_byte(c)); break; // PLP
-
-    // system
-    case 0x00: c->bf = 1; c->pc += 1; interrupt(c, 0xFFFE); break; // BRK
-    case 0xEA: break; // NOP
+static void place_event(m6502* const c, m6502_event* event, unsigned i) {
+    c->events[i] = event;
+    event->queue_pos = i + 1;
+}
 
-    default:
-        if (c->m65c02_mode) {
-            execute_m65c02_opcode(c, opcode);
+// moves the event at i up or down the heap to its place
+static void sift_event(m6502* const c, unsigned i) {
+    m6502_event* const event = c->events[i];
+    while (i > 0 && event->time < c->events[(i - 1) / 2]->time) {
+        place_event(c, c->events[(i - 1) / 2], i);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        unsigned child = 2 * i + 1;
+        if (child >= c->nb_events) {
+            break;
         }
-        else {
-            // for now, treat all invalid opcodes as NOPs in 6502 mode:
-            c->cyc += 2;
-            // fprintf(stderr, "error: invalid opcode 0x%02X\n", opcode);
+        if (child + 1 < c->nb_events &&
+                c->events[child + 1]->time < c->events[child]->time) {
+            child += 1;
+        }
+        if (c->events[child]->time >= event->time) {
+            break;
         }
-    break;
+        place_event(c, c->events[child], i);
+        i = child;
     }
+    place_event(c, event, i);
+}
 
-    // on certain instructions, if a page is crossed; the instruction
-    // takes additional cycles to execute:
-    if (c->page_crossed) {
-        c->cyc += INSTRUCTIONS_PAGE_CROSSED_CYCLES[opcode];
+// fires the events whose time has come
+static void fire_events(m6502* const c) {
+    while (c->nb_events != 0 && c->events[0]->time <= c->cyc) {
+        m6502_event* const event = c->events[0];
+        m6502_unschedule(c, event);
+        event->callback(c, event);
     }
 }
 
-// prints to the standard output the current state of the emulation,
-// including registers and flags
-void m6502_debug_output(m6502* const c) {
-    char flags[] = "........";
+// runs the core matching the CPU (see m6502_run)
+static m6502_run_result run_cores(m6502* const c, uint64_t cycle_budget,
+        int exit_flags) {
+    const int variant = get_variant(c);
+    if (c->decode_cache == NULL) {
+        return CORES[variant](c, cycle_budget, exit_flags);
+    }
 
-    if (c->nf) flags[0] = 'n';
-    if (c->vf) flags[1] = 'v';
-    flags[2] = '1'; // always set
-    if (c->bf) flags[3] = 'b';
-    if (c->df) flags[4] = 'd';
-    if (c->idf) flags[5] = 'i';
-    if (c->zf) flags[6] = 'z';
-    if (c->cf) flags[7] = 'c';
+    m6502_run_result result = {0, 0, 0};
+    for (;;) {
+        m6502_run_result r = DECODED_CORES[variant](c,
+            cycle_budget - result.cyc, exit_flags);
+        result.cyc += r.cyc;
+        result.instructions += r.instructions;
+        result.exit = r.exit;
+#if JIT
+        if (r.exit == EXIT_JIT) {
+            // a hot loop was compiled: run the blocks, then go on with the
+            // core where they stop
+            result.exit = 0;
+            if (result.cyc >= cycle_budget) {
+                break;
+            }
+            r = run_jit(c, cycle_budget - result.cyc, exit_flags, variant);
+            result.cyc += r.cyc;
+            result.instructions += r.instructions;
+            result.exit = r.exit;
+            if (r.exit != 0 || result.cyc >= cycle_budget) {
+                break;
+            }
+            continue;
+        }
+#endif
+        if (r.exit != EXIT_NOT_DECODED) {
+            break;
+        }
 
-    printf("PC:%04X (%02X %02X %02X) ",
-        c->pc,
-        m6502_rb(c, c->pc),
-        m6502_rb(c, c->pc + 1),
-        m6502_rb(c, c->pc + 2));
+        // the instruction at PC isn't in memory mapped for reads: execute it
+        // through the callbacks
+        r = CORES[variant](c, cycle_budget - result.cyc,
+            exit_flags | EXIT_STEP);
+        result.cyc += r.cyc;
+        result.instructions += r.instructions;
+        result.exit = r.exit;
+        if (r.exit != 0 || (exit_flags & EXIT_STEP) ||
+                result.cyc >= cycle_budget) {
+            break;
+        }
+    }
 
-    // the following line helps to compare with Nintendulator logs
-    const uint16_t cyc = (c->cyc * 3) % 341;
+    return result;
+}
 
-    printf("SP:%02X A:%02X X:%02X Y:%02X P:%02X (%s) CYC:%d\n",
-        c->sp, c->a, c->x, c->y, get_flags(c), flags, cyc);
+// handles the signals that ended a core, and returns the exit condition
+// ending the run (0 if it goes on)
+static int take_run_signals(m6502* const c) {
+    const uint32_t signals = __atomic_load_n(&c->signals, __ATOMIC_ACQUIRE);
+    if (signals & M6502_SIGNAL_RESET) {
+        __atomic_fetch_and(&c->signals,
+            ~(M6502_SIGNAL_RESET | SIGNAL_IDF_DELAYED), __ATOMIC_RELAXED);
+        m6502_gen_res(c);
+    }
+    if (signals & M6502_SIGNAL_STOP) {
+        __atomic_fetch_and(&c->signals, ~M6502_SIGNAL_STOP, __ATOMIC_RELAXED);
+    }
+    if (signals & (M6502_SIGNAL_STOP | M6502_SIGNAL_PAUSE)) {
+        return M6502_EXIT_SIGNAL;
+    }
+    if (signals & SIGNAL_BREAK) {
+        __atomic_fetch_and(&c->signals, ~SIGNAL_BREAK, __ATOMIC_RELAXED);
+        return M6502_EXIT_BREAK;
+    }
+    return 0;
 }
 
-// generates an NMI interrupt
-void m6502_gen_nmi(m6502* const c) {
-    c->bf = 0;
-    interrupt(c, 0xFFFA);
+// executes instructions until at least cycle_budget cycles have been
+// consumed, the CPU is stopped by STP/WAI, or one of the conditions in
+// exit_flags (M6502_EXIT_*) is met. The last instruction always completes,
+// so the run may overshoot the budget by a few cycles.
+// A CPU waiting (WAI) for an interrupt goes straight to the next event
+// within the budget, and with skip_idle, idle loops are skipped up to the
+// next event or the end of the budget (a signal sent by another thread
+// meanwhile is taken afterwards).
+m6502_run_result m6502_run(m6502* const c, uint64_t cycle_budget,
+        int exit_flags) {
+    // the budget of each slice ends at the next event, which is fired before
+    // the next slice
+    m6502_run_result result = {0, 0, 0};
+    for (;;) {
+        fire_events(c);
+        uint64_t budget = cycle_budget - result.cyc;
+        if (c->nb_events != 0 && c->events[0]->time - c->cyc < budget) {
+            budget = c->events[0]->time - c->cyc;
+        }
+
+        const m6502_run_result r = run_cores(c, budget, exit_flags);
+        result.cyc += r.cyc;
+        result.instructions += r.instructions;
+        result.exit = r.exit;
+        if (r.exit == M6502_EXIT_SIGNAL) {
+            result.exit = take_run_signals(c);
+            if (result.exit != 0) {
+                return result;
+            }
+            continue;
+        }
+        if (r.exit == M6502_EXIT_STOP && c->wait && c->nb_events != 0 &&
+                !(exit_flags & EXIT_STEP) &&
+                c->events[0]->time - c->cyc < cycle_budget - result.cyc) {
+            const uint64_t skipped = c->events[0]->time - c->cyc;
+            c->cyc += skipped;
+            c->idle_skips += 1;
+            c->idle_cycles += skipped;
+            result.cyc += skipped;
+            result.exit = 0;
+            continue;
+        }
+        if (r.exit != 0 || (exit_flags & EXIT_STEP) ||
+                result.cyc >= cycle_budget) {
+            // a watchpoint hit by the last instruction ends this run (with
+            // the condition met by the instruction, if any)
+            if (peek_signals(c) & SIGNAL_BREAK) {
+                __atomic_fetch_and(&c->signals, ~SIGNAL_BREAK,
+                    __ATOMIC_RELAXED);
+                if (r.exit == 0) {
+                    result.exit = M6502_EXIT_BREAK;
+                }
+            }
+            return result;
+        }
+    }
 }
 
-// generates a RESET interrupt
-void m6502_gen_res(m6502* const c) {
-    c->bf = 0;
-    interrupt(c, 0xFFFC);
-    c->stop = 0;
-    c->cyc = 0;
+// maps size bytes of host memory at addr, so that reads (M6502_MAP_READ)
+// and/or writes (M6502_MAP_WRITE) to those pages access mem directly
+// without calling read_byte/write_byte, or writes are ignored
+// (M6502_MAP_PROTECT). Pages not covered by access are left untouched.
+void m6502_map(m6502* const c, uint16_t addr, size_t size, uint8_t* mem,
+        int access) {
+    const unsigned first_page = addr >> 8;
+    const unsigned nb_pages = size >> 8;
+
+    for (unsigned i = 0; i < nb_pages && first_page + i < 256; i++) {
+        const uint8_t page = first_page + i;
+        if (access & M6502_MAP_READ) {
+            if (c->page_flags[page] & PAGE_CODE) {
+                invalidate_page(c, page);
+            }
+            c->read_map[page] = mem + (i << 8);
+        }
+        if (access & (M6502_MAP_WRITE | M6502_MAP_PROTECT)) {
+            c->write_map[page] = (access & M6502_MAP_WRITE)
+                ? mem + (i << 8) : NULL;
+            c->page_flags[page] &= ~(PAGE_CLEAN | PAGE_PROTECT);
+            if (!(access & M6502_MAP_WRITE)) {
+                c->page_flags[page] |= PAGE_PROTECT;
+            }
+        }
+        update_page(c, page);
+    }
 }
 
-// generates an IRQ interrupt
+// returns the M6502_MAP_* access a page is mapped with
+int m6502_page_access(const m6502* const c, uint8_t page) {
+    return (c->read_map[page] != NULL ? M6502_MAP_READ : 0) |
+        (c->write_map[page] != NULL ? M6502_MAP_WRITE : 0) |
+        (c->page_flags[page] & PAGE_PROTECT ? M6502_MAP_PROTECT : 0);
+}
+
+// unmaps size bytes at addr: accesses to those pages go through the
+// read_byte/write_byte callbacks again
+void m6502_unmap(m6502* const c, uint16_t addr, size_t size) {
+    const unsigned first_page = addr >> 8;
+    const unsigned nb_pages = size >> 8;
+
+    for (unsigned i = 0; i < nb_pages && first_page + i < 256; i++) {
+        const uint8_t page = first_page + i;
+        if (c->page_flags[page] & PAGE_CODE) {
+            invalidate_page(c, page);
+        }
+        c->read_map[page] = NULL;
+        c->write_map[page] = NULL;
+        c->page_flags[page] &= ~(PAGE_CLEAN | PAGE_PROTECT);
+        update_page(c, page);
+    }
+}
+
+// sets the decode cache (an array of M6502_DECODE_CACHE_SIZE entries, or
+// NULL to disable it). Instructions in pages mapped for reads are decoded
+// once and then executed from the cache, until a write through the
+// emulator to one of their pages invalidates them; changes made to the
+// mapped memory by the host must be reported with m6502_invalidate.
+void m6502_set_decode_cache(m6502* const c, m6502_decoded* cache) {
+    for (unsigned page = 0; page < 256; page++) {
+        c->page_flags[page] &= ~PAGE_CODE;
+        update_page(c, page);
+    }
+
+    c->decode_cache = cache;
+    if (cache != NULL) {
+        memset(cache, 0, M6502_DECODE_CACHE_SIZE * sizeof(m6502_decoded));
+    }
+#if JIT
+    if (c->jit != NULL) {
+        jit_flush(c->jit);
+    }
+#endif
+}
+
+// discards the decoded instructions in size bytes of memory at addr,
+// after the host modified them (which are also tracked as changed since
+// the snapshot)
+void m6502_invalidate(m6502* const c, uint16_t addr, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    const unsigned first_page = addr >> 8;
+    const unsigned last_page = (addr + size - 1) >> 8;
+
+    for (unsigned page = first_page; page <= last_page && page < 256; page++) {
+        if (c->page_flags[page] & PAGE_CLEAN) {
+            mark_dirty(c, page);
+        }
+        if (c->page_flags[page] & PAGE_CODE) {
+            invalidate_page(c, page);
+        }
+    }
+}
+
+// recompiler
+
+// creates a recompiler whose host code takes at most code_size bytes (0 for
+// the default size), or returns NULL if the emulator is built without it or
+// the memory can't be mapped
+m6502_jit* m6502_jit_create(size_t code_size) {
+#if JIT
+    const size_t host_page_size = sysconf(_SC_PAGESIZE);
+    if (code_size < JIT_BLOCK_SIZE) {
+        code_size = code_size == 0 ? JIT_CODE_SIZE : JIT_BLOCK_SIZE;
+    }
+    code_size = (code_size + host_page_size - 1) / host_page_size *
+        host_page_size;
+
+    m6502_jit* const jit = malloc(sizeof(m6502_jit));
+    if (jit == NULL) {
+        return NULL;
+    }
+    void* const code = mmap(NULL, code_size, PROT_READ | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    jit->code = code;
+    jit->code_size = code_size;
+    jit->variant = -1;
+    jit_flush(jit);
+    return jit;
+#else
+    (void) code_size;
+    return NULL;
+#endif
+}
+
+void m6502_jit_destroy(m6502_jit* jit) {
+#if JIT
+    if (jit != NULL) {
+        munmap(jit->code, jit->code_size);
+        free(jit);
+    }
+#else
+    (void) jit;
+#endif
+}
+
+// sets the recompiler of the hot loops (NULL to stop), discarding the
+// blocks it compiled, and returns false if the emulator is built without it
+bool m6502_set_jit(m6502* const c, m6502_jit* jit) {
+    c->jit = JIT ? jit : NULL;
+#if JIT
+    if (jit != NULL) {
+        jit_flush(jit);
+    }
+#endif
+    return JIT;
+}
+
+// breakpoints
+
+// sets the breakpoint flags of a page from the bitmaps, so that its
+// accesses only go through the slow memory path when it holds some
+static void update_page_breakpoints(m6502* const c, uint8_t page) {
+    const m6502_breakpoints* const breakpoints = c->breakpoints;
+    int flags = c->page_flags[page] &
+        ~(PAGE_BREAK_EXEC | PAGE_BREAK_READ | PAGE_BREAK_WRITE);
+
+    if (breakpoints != NULL) {
+        for (unsigned i = page * 4U; i < page * 4U + 4; i++) {
+            if (breakpoints->exec[i] != 0) flags |= PAGE_BREAK_EXEC;
+            if (breakpoints->read[i] != 0) flags |= PAGE_BREAK_READ;
+            if (breakpoints->write[i] != 0) flags |= PAGE_BREAK_WRITE;
+        }
+    }
+
+    c->page_flags[page] = flags;
+    if ((flags & PAGE_BREAK_EXEC) && (flags & PAGE_CODE)) {
+        invalidate_page(c, page);
+    }
+    else {
+        update_page(c, page);
+    }
+}
+
+// sets the breakpoints checked by m6502_run (NULL to remove them), which
+// the host may also change with m6502_break or by setting this again
+void m6502_set_breakpoints(m6502* const c, m6502_breakpoints* breakpoints) {
+    c->breakpoints = breakpoints;
+    c->break_cyc = UINT64_MAX;
+    for (unsigned page = 0; page < 256; page++) {
+        update_page_breakpoints(c, page);
+    }
+}
+
+static void change_breakpoints(m6502* const c, uint16_t addr, size_t size,
+        int kinds, bool set) {
+    m6502_breakpoints* const breakpoints = c->breakpoints;
+    if (breakpoints == NULL || size == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < size && addr + i < 0x10000; i++) {
+        const uint16_t a = addr + i;
+        const uint64_t bit = (uint64_t) 1 << (a & 63);
+        if (kinds & M6502_BREAK_EXEC) {
+            breakpoints->exec[a >> 6] = set
+                ? breakpoints->exec[a >> 6] | bit
+                : breakpoints->exec[a >> 6] & ~bit;
+        }
+        if (kinds & M6502_BREAK_READ) {
+            breakpoints->read[a >> 6] = set
+                ? breakpoints->read[a >> 6] | bit
+                : breakpoints->read[a >> 6] & ~bit;
+        }
+        if (kinds & M6502_BREAK_WRITE) {
+            breakpoints->write[a >> 6] = set
+                ? breakpoints->write[a >> 6] | bit
+                : breakpoints->write[a >> 6] & ~bit;
+        }
+    }
+
+    const unsigned first_page = addr >> 8;
+    const unsigned last_page = (addr + size - 1) >> 8;
+    for (unsigned page = first_page; page <= last_page && page < 256; page++) {
+        update_page_breakpoints(c, page);
+    }
+}
+
+void m6502_break(m6502* const c, uint16_t addr, size_t size, int kinds) {
+    change_breakpoints(c, addr, size, kinds, true);
+}
+
+void m6502_unbreak(m6502* const c, uint16_t addr, size_t size, int kinds) {
+    change_breakpoints(c, addr, size, kinds, false);
+}
+
+// prints to the standard output the current state of the emulation,
+// including registers and flags
+void m6502_debug_output(m6502* const c) {
+    char flags[] = "........";
+
+    if (get_nf(c)) flags[0] = 'n';
+    if (c->vf) flags[1] = 'v';
+    flags[2] = '1'; // always set
+    if (c->bf) flags[3] = 'b';
+    if (c->df) flags[4] = 'd';
+    if (c->idf) flags[5] = 'i';
+    if (get_zf(c)) flags[6] = 'z';
+    if (c->cf) flags[7] = 'c';
+
+    printf("PC:%04X (%02X %02X %02X) ",
+        c->pc,
+        m6502_fetch(c, c->pc),
+        m6502_fetch(c, c->pc + 1),
+        m6502_fetch(c, c->pc + 2));
+
+    // the following line helps to compare with Nintendulator logs
+    const uint16_t cyc = (c->cyc * 3) % 341;
+
+    printf("SP:%02X A:%02X X:%02X Y:%02X P:%02X (%s) CYC:%d\n",
+        c->sp, c->a, c->x, c->y, get_flags(c), flags, cyc);
+}
+
+// returns the opcode descriptions of the 6502 or the 65C02
+const m6502_opcode* m6502_opcodes(bool m65c02_mode) {
+    return m65c02_mode ? OPCODES_65C02 : OPCODES_6502;
+}
+
+// returns the name of a mnemonic, "???" for an invalid opcode
+const char* m6502_mnemonic_name(uint8_t mnemonic) {
+    if (mnemonic == M6502_INV || mnemonic >= M6502_NB_MNEMONICS) {
+        return "???";
+    }
+    return MNEMONIC_NAMES[mnemonic];
+}
+
+// returns the name of an addressing mode
+const char* m6502_mode_name(uint8_t mode) {
+    static const char* const MODE_NAMES[M6502_NB_MODES] = {
+        "IMP", "ACC", "IMM", "ZPG", "ZPX", "ZPY", "ABS", "ABX", "ABY", "IND",
+        "INX", "INY", "INZ", "IAX", "REL", "ZPR"
+    };
+    return mode < M6502_NB_MODES ? MODE_NAMES[mode] : "???";
+}
+
+// disassembler: the instructions are written by hand rather than with
+// printf, to disassemble large traces and memory ranges quickly
+
+static char* put_digits(char* p, unsigned val, unsigned digits) {
+    static const char HEX[] = "0123456789ABCDEF";
+    while (digits-- > 0) {
+        *p++ = HEX[(val >> (4 * digits)) & 0xF];
+    }
+    return p;
+}
+
+static char* put_hex(char* p, unsigned val, unsigned digits) {
+    *p++ = '$';
+    return put_digits(p, val, digits);
+}
+
+static char* put_string(char* p, const char* s) {
+    while (*s != '\0') {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+// writes the instruction in bytes at pc into p (at most
+// M6502_DISASM_SIZE - 1 characters), returns the end of the text
+static char* disasm(char* p, const m6502_opcode* const op,
+        const uint8_t* bytes, uint16_t pc) {
+    p = put_string(p, m6502_mnemonic_name(op->mnemonic));
+    // the bit of RMB, SMB, BBR and BBS is in the opcode
+    if (op->mnemonic == M6502_RMB || op->mnemonic == M6502_SMB ||
+            op->mnemonic == M6502_BBR || op->mnemonic == M6502_BBS) {
+        *p++ = '0' + ((bytes[0] >> 4) & 7);
+    }
+    if (op->mode == M6502_MODE_IMP) {
+        return p;
+    }
+
+    *p++ = ' ';
+    const uint8_t byte = op->length > 1 ? bytes[1] : 0;
+    const uint16_t word = op->length > 2 ? byte | bytes[2] << 8 : byte;
+    switch (op->mode) {
+    case M6502_MODE_ACC: *p++ = 'A'; break;
+    case M6502_MODE_IMM: *p++ = '#'; p = put_hex(p, byte, 2); break;
+    case M6502_MODE_ZPG: p = put_hex(p, byte, 2); break;
+    case M6502_MODE_ZPX: p = put_string(put_hex(p, byte, 2), ",X"); break;
+    case M6502_MODE_ZPY: p = put_string(put_hex(p, byte, 2), ",Y"); break;
+    case M6502_MODE_ABS: p = put_hex(p, word, 4); break;
+    case M6502_MODE_ABX: p = put_string(put_hex(p, word, 4), ",X"); break;
+    case M6502_MODE_ABY: p = put_string(put_hex(p, word, 4), ",Y"); break;
+    case M6502_MODE_IND:
+        *p++ = '(';
+        p = put_string(put_hex(p, word, 4), ")");
+        break;
+    case M6502_MODE_INX:
+        *p++ = '(';
+        p = put_string(put_hex(p, byte, 2), ",X)");
+        break;
+    case M6502_MODE_INY:
+        *p++ = '(';
+        p = put_string(put_hex(p, byte, 2), "),Y");
+        break;
+    case M6502_MODE_INZ:
+        *p++ = '(';
+        p = put_string(put_hex(p, byte, 2), ")");
+        break;
+    case M6502_MODE_IAX:
+        *p++ = '(';
+        p = put_string(put_hex(p, word, 4), ",X)");
+        break;
+    case M6502_MODE_REL:
+        p = put_hex(p, (uint16_t) (pc + 2 + (int8_t) byte), 4);
+        break;
+    case M6502_MODE_ZPR:
+        p = put_string(put_hex(p, byte, 2), ",");
+        p = put_hex(p, (uint16_t) (pc + 3 + (int8_t) (word >> 8)), 4);
+        break;
+    }
+    return p;
+}
+
+// writes the text of the instruction in bytes (its opcode and operand, at
+// least its length) located at pc into buf, and returns its length in
+// bytes. The text is truncated to fit size, M6502_DISASM_SIZE fits any
+// instruction.
+unsigned m6502_disasm(char* buf, size_t size, const uint8_t* bytes,
+        uint16_t pc, bool m65c02_mode) {
+    const m6502_opcode* const op = &m6502_opcodes(m65c02_mode)[bytes[0]];
+    char text[M6502_DISASM_SIZE];
+    const size_t n = disasm(text, op, bytes, pc) - text;
+
+    if (size != 0) {
+        const size_t copied = n < size ? n : size - 1;
+        memcpy(buf, text, copied);
+        buf[copied] = '\0';
+    }
+    return op->length;
+}
+
+// disassembles the size bytes of mem, located at addr, to f: one line per
+// instruction with its address and bytes
+void m6502_disasm_range(FILE* f, const uint8_t* mem, size_t size,
+        uint16_t addr, bool m65c02_mode) {
+    const m6502_opcode* const opcodes = m6502_opcodes(m65c02_mode);
+    char out[4096]; // lines written at once
+    size_t n = 0;
+
+    for (size_t i = 0; i < size;) {
+        const m6502_opcode* op = &opcodes[mem[i]];
+        // an instruction cut by the end of the range is left undecoded
+        const size_t length = i + op->length <= size ? op->length : size - i;
+        const uint16_t pc = addr + i;
+
+        char* p = put_string(put_digits(&out[n], pc, 4), "  ");
+        for (size_t j = 0; j < 3; j++) {
+            if (j < length) {
+                p = put_digits(p, mem[i + j], 2);
+                *p++ = ' ';
+            }
+            else {
+                p = put_string(p, "   ");
+            }
+        }
+        *p++ = ' ';
+        p = length == op->length ? disasm(p, op, &mem[i], pc)
+            : put_string(p, "???");
+        *p++ = '\n';
+
+        n = p - out;
+        if (n > sizeof(out) - 64) {
+            fwrite(out, 1, n, f);
+            n = 0;
+        }
+        i += length;
+    }
+    fwrite(out, 1, n, f);
+}
+
+// returns the status register
+uint8_t m6502_get_flags(const m6502* const c) {
+    return get_flags(c);
+}
+
+// sets the status register
+void m6502_set_flags(m6502* const c, uint8_t flags) {
+    set_flags(c, flags);
+}
+
+// schedules an event at the given cycle count (or reschedules it)
+bool m6502_schedule(m6502* const c, m6502_event* event, uint64_t time) {
+    if (event->queue_pos == 0) {
+        if (c->nb_events == M6502_MAX_EVENTS) {
+            return false;
+        }
+        place_event(c, event, c->nb_events++);
+    }
+    event->time = time;
+    sift_event(c, event->queue_pos - 1);
+    return true;
+}
+
+// removes an event from the queue, if it is scheduled
+void m6502_unschedule(m6502* const c, m6502_event* event) {
+    if (event->queue_pos == 0) {
+        return;
+    }
+    const unsigned i = event->queue_pos - 1;
+    event->queue_pos = 0;
+    c->nb_events -= 1;
+    if (i != c->nb_events) {
+        c->events[i] = c->events[c->nb_events];
+        sift_event(c, i);
+    }
+}
+
+// returns the time of the next event
+uint64_t m6502_next_event(const m6502* const c) {
+    return c->nb_events != 0 ? c->events[0]->time : UINT64_MAX;
+}
+
+// generates a hardware interrupt
+static void gen_interrupt(m6502* const c, uint16_t vector) {
+    c->bf = 0;
+    interrupt(c, vector, get_variant(c));
+    c->cyc += 7;
+}
+
+// generates an NMI interrupt
+void m6502_gen_nmi(m6502* const c) {
+    io_record(c, IO_NMI, 0, 0);
+    gen_interrupt(c, 0xFFFA);
+}
+
+// generates a RESET interrupt
+void m6502_gen_res(m6502* const c) {
+    io_record(c, IO_RESET, 0, 0);
+    gen_interrupt(c, 0xFFFC);
+    c->stop = 0;
+    // the cycle count restarts from 0: the events keep their distance to it
+    // (the order of the queue is unchanged)
+    for (unsigned i = 0; i < c->nb_events; i++) {
+        m6502_event* const event = c->events[i];
+        event->time = event->time > c->cyc ? event->time - c->cyc : 0;
+    }
+    c->cyc = 0;
+    if (c->io_log != NULL) {
+        c->io_log->end.cyc = 0;
+    }
+}
+
+// generates an IRQ interrupt
 void m6502_gen_irq(m6502* const c) {
     if (c->idf == 0) {
-        c->bf = 0;
-        interrupt(c, 0xFFFE);
+        io_record(c, IO_IRQ, 0, 0);
+        gen_interrupt(c, 0xFFFE);
+    }
+}
+
+// deterministic replay
+
+void m6502_set_io(m6502* const c, uint16_t addr, size_t size, bool io) {
+    const unsigned first_page = addr >> 8;
+    const unsigned nb_pages = size >> 8;
+
+    for (unsigned i = 0; i < nb_pages && first_page + i < 256; i++) {
+        const uint8_t page = first_page + i;
+        if (io) {
+            c->page_flags[page] |= PAGE_IO;
+        }
+        else {
+            c->page_flags[page] &= ~PAGE_IO;
+        }
+        update_page(c, page);
+    }
+}
+
+void m6502_io_record(m6502* const c, m6502_io_log* log) {
+    m6502_io_stop(c);
+    log->overflow = false;
+    log->mode = M6502_IO_RECORD;
+    log->end = (m6502_io_cursor) {log->size, c->cyc, 0};
+    log->reads = (m6502_io_cursor) {0, 0, 0};
+    log->interrupts = log->reads;
+    log->event = (m6502_event) {NULL, NULL, 0, 0};
+    c->io_log = log;
+}
+
+// schedules the replay event at the next interrupt of the log, leaving the
+// cursor on it, returns false if the event queue is full
+static bool schedule_replayed_interrupt(m6502* const c, m6502_io_log* log) {
+    m6502_io_cursor cursor = log->interrupts;
+    io_entry entry;
+    while (io_next(log, &cursor, &entry)) {
+        if (entry.kind != IO_READ && entry.kind != IO_READ_SAME) {
+            return m6502_schedule(c, &log->event, entry.time);
+        }
+        log->interrupts = cursor;
+    }
+    return true;
+}
+
+// takes the next interrupt of the log at the instruction boundary it was
+// recorded on
+static void replay_interrupt(m6502* c, m6502_event* event) {
+    m6502_io_log* const log = event->userdata;
+    io_entry entry;
+    if (!io_next(log, &log->interrupts, &entry)) {
+        return;
+    }
+
+    switch (entry.kind) {
+    case IO_IRQ:
+        gen_interrupt(c, 0xFFFE);
+        break;
+    case IO_NMI:
+        gen_interrupt(c, 0xFFFA);
+        break;
+    case IO_RESET:
+        m6502_gen_res(c);
+        break;
+    case IO_WAKE:
+        c->wait = 0;
+        break;
+    }
+    schedule_replayed_interrupt(c, log);
+}
+
+bool m6502_io_replay(m6502* const c, m6502_io_log* log) {
+    m6502_io_stop(c);
+    log->mismatches = 0;
+    log->mode = M6502_IO_REPLAY;
+    log->end = (m6502_io_cursor) {0, 0, 0};
+    log->reads = (m6502_io_cursor) {0, c->cyc, 0};
+    log->interrupts = log->reads;
+    log->event = (m6502_event) {replay_interrupt, log, 0, 0};
+    c->io_log = log;
+    return schedule_replayed_interrupt(c, log);
+}
+
+void m6502_io_stop(m6502* const c) {
+    m6502_io_log* const log = c->io_log;
+    if (log != NULL) {
+        if (log->mode == M6502_IO_REPLAY) {
+            m6502_unschedule(c, &log->event);
+        }
+        log->mode = 0;
+        c->io_log = NULL;
+    }
+}
+
+// snapshots
+
+static void save_state(const m6502* const c, m6502_state* state) {
+    state->cyc = c->cyc;
+    state->pc = c->pc;
+    state->a = c->a;
+    state->x = c->x;
+    state->y = c->y;
+    state->sp = c->sp;
+    state->cf = c->cf;
+    state->idf = c->idf;
+    state->df = c->df;
+    state->bf = c->bf;
+    state->vf = c->vf;
+    state->n_result = c->n_result;
+    state->z_result = c->z_result;
+    state->stop = c->stop;
+    state->wait = c->wait;
+    state->idf_before = c->idf_before;
+    state->nmi_line = __atomic_load_n(&c->nmi_line, __ATOMIC_RELAXED);
+    state->signals = __atomic_load_n(&c->signals, __ATOMIC_ACQUIRE);
+}
+
+static void restore_state(m6502* const c, const m6502_state* state) {
+    c->cyc = state->cyc;
+    c->pc = state->pc;
+    c->a = state->a;
+    c->x = state->x;
+    c->y = state->y;
+    c->sp = state->sp;
+    c->cf = state->cf;
+    c->idf = state->idf;
+    c->df = state->df;
+    c->bf = state->bf;
+    c->vf = state->vf;
+    c->n_result = state->n_result;
+    c->z_result = state->z_result;
+    c->stop = state->stop;
+    c->wait = state->wait;
+    c->idf_before = state->idf_before;
+    __atomic_store_n(&c->nmi_line, state->nmi_line, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->signals, state->signals, __ATOMIC_RELEASE);
+    // (a breakpoint at the restored PC stops the next run again)
+    c->break_cyc = UINT64_MAX;
+}
+
+// returns true if a page saved in the snapshot being tracked may have
+// changed since it was saved or restored
+static inline bool page_changed(const m6502* const c,
+        const m6502_snapshot* snapshot, uint8_t page) {
+    return c->snapshot != snapshot || !(c->page_flags[page] & PAGE_CLEAN);
+}
+
+// tracks the changes made to the pages saved in a snapshot from now on
+static void track_page(m6502* const c, const m6502_snapshot* snapshot,
+        uint8_t page) {
+    if (snapshot->pages[page] != NULL) {
+        c->page_flags[page] |= PAGE_CLEAN;
+    }
+    else {
+        c->page_flags[page] &= ~PAGE_CLEAN;
+    }
+    update_page(c, page);
+}
+
+// saves a snapshot (only copying the pages changed since it was saved or
+// restored if it is the one tracked)
+void m6502_snapshot_save(m6502* const c, m6502_snapshot* snapshot) {
+    save_state(c, &snapshot->state);
+    for (unsigned page = 0; page < 256; page++) {
+        if (!page_changed(c, snapshot, page)) {
+            continue;
+        }
+        snapshot->pages[page] = c->write_map[page];
+        if (snapshot->pages[page] != NULL) {
+            memcpy(&snapshot->memory[page << 8], snapshot->pages[page], 256);
+        }
+        track_page(c, snapshot, page);
+    }
+    c->snapshot = snapshot;
+}
+
+// restores a snapshot, copying back the pages changed since it was saved or
+// restored (or all of them if another snapshot was tracked since), and
+// returns the number of pages copied
+unsigned m6502_snapshot_restore(m6502* const c, m6502_snapshot* snapshot) {
+    unsigned nb_pages = 0;
+    for (unsigned page = 0; page < 256; page++) {
+        if (!page_changed(c, snapshot, page)) {
+            continue;
+        }
+        if (snapshot->pages[page] != NULL) {
+            memcpy(snapshot->pages[page], &snapshot->memory[page << 8], 256);
+            nb_pages += 1;
+            if (c->page_flags[page] & PAGE_CODE) {
+                invalidate_page(c, page);
+            }
+        }
+        track_page(c, snapshot, page);
+    }
+    c->snapshot = snapshot;
+
+    restore_state(c, &snapshot->state);
+    return nb_pages;
+}
+
+// rewinding: each checkpoint but the last one (the reference snapshot) is
+// stored in the history as an entry holding its state and the XOR of its
+// memory with the next checkpoint's, as runs of changed bytes (their
+// address, their length minus one and their XOR) which don't cross pages.
+// The entries form a ring from the oldest to the newest one, each aligned
+// on REWIND_ALIGN bytes, and XORing them from the newest to the reference
+// gives back the memory of the previous checkpoints.
+typedef struct rewind_entry {
+    size_t prev, next; // offsets of the previous and next entries
+    size_t size; // size of the entry, header included
+    m6502_state state;
+} rewind_entry;
+
+#define REWIND_ALIGN 8
+#define REWIND_RUN_HEADER 3
+#define REWIND_RUN_GAP REWIND_RUN_HEADER // unchanged bytes a run goes over
+
+static rewind_entry read_entry(const m6502_rewind* rewind, size_t pos) {
+    rewind_entry entry;
+    memcpy(&entry, &rewind->data[pos], sizeof(entry));
+    return entry;
+}
+
+static void write_entry(m6502_rewind* rewind, size_t pos,
+        const rewind_entry* entry) {
+    memcpy(&rewind->data[pos], entry, sizeof(*entry));
+}
+
+// encodes the changes of a page since it was saved as runs into out, or
+// only counts their size if out is NULL
+static size_t encode_page(uint8_t* out, const uint8_t* mem,
+        const uint8_t* saved, uint8_t page) {
+    size_t n = 0;
+    unsigned i = 0;
+    while (i < 256) {
+        if (mem[i] == saved[i]) {
+            i += 1;
+            continue;
+        }
+
+        unsigned last = i;
+        for (unsigned j = i + 1; j < 256 && j - last <= REWIND_RUN_GAP; j++) {
+            if (mem[j] != saved[j]) {
+                last = j;
+            }
+        }
+        const unsigned len = last + 1 - i;
+        if (out != NULL) {
+            out[n] = i;
+            out[n + 1] = page;
+            out[n + 2] = len - 1;
+            for (unsigned k = 0; k < len; k++) {
+                out[n + REWIND_RUN_HEADER + k] = mem[i + k] ^ saved[i + k];
+            }
+        }
+        n += REWIND_RUN_HEADER + len;
+        i = last + 1;
+    }
+    return n;
+}
+
+// encodes the changes of memory since the reference was saved
+static size_t encode_delta(const m6502* const c,
+        const m6502_snapshot* reference, uint8_t* out) {
+    size_t n = 0;
+    for (unsigned page = 0; page < 256; page++) {
+        const uint8_t* const mem = reference->pages[page];
+        const uint8_t* const saved = &reference->memory[page << 8];
+        if (mem != NULL && page_changed(c, reference, page) &&
+                memcmp(mem, saved, 256) != 0) {
+            n += encode_page(out != NULL ? out + n : NULL, mem, saved, page);
+        }
+    }
+    return n;
+}
+
+// XORs runs of changes into the reference, whose pages changed aren't
+// clean anymore
+static void apply_delta(m6502* const c, m6502_snapshot* reference,
+        const uint8_t* delta, size_t size) {
+    size_t pos = 0;
+    while (pos + REWIND_RUN_HEADER <= size) {
+        const uint16_t addr = delta[pos] | delta[pos + 1] << 8;
+        const unsigned len = delta[pos + 2] + 1;
+        pos += REWIND_RUN_HEADER;
+        for (unsigned i = 0; i < len; i++) {
+            reference->memory[addr + i] ^= delta[pos + i];
+        }
+        pos += len;
+
+        if (c->snapshot == reference &&
+                (c->page_flags[addr >> 8] & PAGE_CLEAN)) {
+            mark_dirty(c, addr >> 8);
+        }
+    }
+}
+
+static void drop_oldest_checkpoint(m6502_rewind* rewind) {
+    rewind->first = read_entry(rewind, rewind->first).next;
+    rewind->checkpoints -= 1;
+    rewind->oldest = rewind->checkpoints > 0
+        ? read_entry(rewind, rewind->first).state.cyc
+        : rewind->reference.state.cyc;
+}
+
+// returns the offset of size free bytes after the newest entry (or at the
+// start of data), dropping the oldest entries in the way
+static size_t alloc_checkpoint(m6502_rewind* rewind, size_t size) {
+    for (;;) {
+        if (rewind->checkpoints == 0) {
+            return 0;
+        }
+        if (rewind->first < rewind->end) { // (the entries don't wrap)
+            if (rewind->end + size <= rewind->capacity) {
+                return rewind->end;
+            }
+            if (size <= rewind->first) {
+                return 0;
+            }
+        }
+        else if (rewind->end + size <= rewind->first) {
+            return rewind->end;
+        }
+        drop_oldest_checkpoint(rewind);
+    }
+}
+
+// stores the reference in the history and saves the current state in it
+static void take_checkpoint(m6502* const c, m6502_rewind* rewind) {
+    m6502_snapshot* const reference = &rewind->reference;
+
+    // (after a RESET, the cycle counts of the history don't go on)
+    const size_t size = c->cyc >= reference->state.cyc
+        ? sizeof(rewind_entry) + encode_delta(c, reference, NULL)
+        : SIZE_MAX;
+    if (size > rewind->capacity) {
+        rewind->checkpoints = 0;
+    }
+    else {
+        const size_t pos = alloc_checkpoint(rewind,
+            (size + REWIND_ALIGN - 1) & ~(size_t) (REWIND_ALIGN - 1));
+        const rewind_entry entry = {rewind->last, 0, size, reference->state};
+        write_entry(rewind, pos, &entry);
+        encode_delta(c, reference, &rewind->data[pos + sizeof(entry)]);
+
+        if (rewind->checkpoints > 0) {
+            rewind_entry last = read_entry(rewind, rewind->last);
+            last.next = pos;
+            write_entry(rewind, rewind->last, &last);
+        }
+        else {
+            rewind->first = pos;
+        }
+        rewind->last = pos;
+        rewind->end = pos + ((size + REWIND_ALIGN - 1) &
+            ~(size_t) (REWIND_ALIGN - 1));
+        rewind->checkpoints += 1;
+    }
+
+    m6502_snapshot_save(c, reference);
+    rewind->oldest = rewind->checkpoints > 0
+        ? read_entry(rewind, rewind->first).state.cyc
+        : reference->state.cyc;
+}
+
+static void checkpoint_event(m6502* c, m6502_event* event) {
+    m6502_rewind* const rewind = event->userdata;
+    take_checkpoint(c, rewind);
+    m6502_schedule(c, event, c->cyc + rewind->interval);
+}
+
+bool m6502_rewind_start(m6502* const c, m6502_rewind* rewind) {
+    if (c->snapshot == &rewind->reference) {
+        c->snapshot = NULL; // (its pages may be stale)
+    }
+    m6502_snapshot_save(c, &rewind->reference);
+    rewind->checkpoints = 0;
+    rewind->oldest = c->cyc;
+    rewind->first = rewind->last = rewind->end = 0;
+    rewind->event = (m6502_event) {checkpoint_event, rewind, 0, 0};
+    return rewind->interval > 0 &&
+        m6502_schedule(c, &rewind->event, c->cyc + rewind->interval);
+}
+
+void m6502_rewind_stop(m6502* const c, m6502_rewind* rewind) {
+    m6502_unschedule(c, &rewind->event);
+}
+
+bool m6502_rewind_seek(m6502* const c, m6502_rewind* rewind, uint64_t cyc) {
+    m6502_snapshot* const reference = &rewind->reference;
+    if (cyc < rewind->oldest || cyc > c->cyc ||
+            c->cyc < reference->state.cyc) {
+        return false;
+    }
+
+    // goes back to the last checkpoint at or before cyc
+    while (reference->state.cyc > cyc) {
+        const rewind_entry entry = read_entry(rewind, rewind->last);
+        apply_delta(c, reference, &rewind->data[rewind->last + sizeof(entry)],
+            entry.size - sizeof(entry));
+        reference->state = entry.state;
+        rewind->end = rewind->last;
+        rewind->last = entry.prev;
+        rewind->checkpoints -= 1;
+    }
+    if (rewind->checkpoints == 0) {
+        rewind->oldest = reference->state.cyc;
+    }
+    m6502_snapshot_restore(c, reference);
+    if (rewind->event.queue_pos != 0) {
+        m6502_schedule(c, &rewind->event, c->cyc + rewind->interval);
+    }
+
+    while (c->cyc < cyc) {
+        const m6502_run_result r = m6502_run(c, cyc - c->cyc, 0);
+        if (r.cyc == 0 && r.instructions == 0) {
+            break; // (the CPU is stopped or paused)
+        }
+    }
+    return true;
+}
+
+// asserts or releases the IRQ line for the given sources
+void m6502_set_irq(m6502* const c, uint32_t sources, bool asserted) {
+    const uint32_t bits = (sources << SIGNAL_IRQ_SHIFT) & SIGNAL_IRQ;
+    if (asserted) {
+        __atomic_fetch_or(&c->signals, bits, __ATOMIC_RELEASE);
+    }
+    else {
+        __atomic_fetch_and(&c->signals, ~bits, __ATOMIC_RELEASE);
+    }
+}
+
+// asserts or releases the NMI line, which triggers an NMI when asserted
+void m6502_set_nmi(m6502* const c, bool asserted) {
+    if (!__atomic_exchange_n(&c->nmi_line, asserted, __ATOMIC_RELAXED) &&
+            asserted) {
+        m6502_signal(c, M6502_SIGNAL_NMI);
+    }
+}
+
+// the other bits of c->signals are private
+#define SIGNAL_PUBLIC (M6502_SIGNAL_NMI | M6502_SIGNAL_RESET | \
+    M6502_SIGNAL_STOP | M6502_SIGNAL_PAUSE)
+
+void m6502_signal(m6502* const c, uint32_t signals) {
+    __atomic_fetch_or(&c->signals, signals & SIGNAL_PUBLIC,
+        __ATOMIC_RELEASE);
+}
+
+void m6502_clear_signals(m6502* const c, uint32_t signals) {
+    __atomic_fetch_and(&c->signals, ~(signals & SIGNAL_PUBLIC),
+        __ATOMIC_RELEASE);
+}
+
+// profiling
+
+// sets the profile counting the executed instructions, returns false if
+// the emulator isn't built with M6502_PROFILE
+bool m6502_set_profile(m6502* const c, m6502_profile* profile) {
+    c->profile = PROFILE ? profile : NULL;
+    return PROFILE;
+}
+
+void m6502_profile_reset(m6502_profile* profile) {
+    memset(profile, 0, sizeof(*profile));
+}
+
+// stores in top the indexes of the (at most nb_top) highest non-zero
+// values, in decreasing order, and returns their number
+static unsigned top_values(const uint64_t* values, size_t nb_values,
+        size_t* top, unsigned nb_top) {
+    unsigned n = 0;
+    for (size_t i = 0; i < nb_values && nb_top != 0; i++) {
+        if (values[i] == 0 ||
+                (n == nb_top && values[i] <= values[top[n - 1]])) {
+            continue;
+        }
+        unsigned j = n < nb_top ? n++ : n - 1;
+        for (; j > 0 && values[top[j - 1]] < values[i]; j--) {
+            top[j] = top[j - 1];
+        }
+        top[j] = i;
+    }
+    return n;
+}
+
+static double percent(uint64_t value, uint64_t total) {
+    return total != 0 ? 100.0 * value / total : 0;
+}
+
+void m6502_profile_print(FILE* f, const m6502_profile* profile,
+        bool m65c02_mode, unsigned top) {
+    const m6502_opcode* const opcodes = m6502_opcodes(m65c02_mode);
+    uint64_t total_count = 0, total_cycles = 0;
+    uint64_t mode_count[M6502_NB_MODES] = {0};
+    uint64_t mode_cycles[M6502_NB_MODES] = {0};
+    for (unsigned i = 0; i < 256; i++) {
+        total_count += profile->opcode_count[i];
+        total_cycles += profile->opcode_cycles[i];
+        mode_count[opcodes[i].mode] += profile->opcode_count[i];
+        mode_cycles[opcodes[i].mode] += profile->opcode_cycles[i];
+    }
+    fprintf(f, "%" PRIu64 " instructions, %" PRIu64 " cycles\n",
+        total_count, total_cycles);
+
+    size_t* const indexes = malloc((top != 0 ? top : 1) * sizeof(size_t));
+    if (indexes == NULL) {
+        return;
+    }
+
+    fprintf(f, "\nopcodes by cycles:\n"
+        "  opcode           count        cycles      %%  page crossed"
+        "  branch taken\n");
+    unsigned n = top_values(profile->opcode_cycles, 256, indexes, top);
+    for (unsigned i = 0; i < n; i++) {
+        const size_t op = indexes[i];
+        fprintf(f, "  %02zX %s %s  %12" PRIu64 "  %12" PRIu64 "  %5.1f"
+            "  %12" PRIu64 "  %12" PRIu64 "\n", op,
+            m6502_mnemonic_name(opcodes[op].mnemonic),
+            m6502_mode_name(opcodes[op].mode), profile->opcode_count[op],
+            profile->opcode_cycles[op],
+            percent(profile->opcode_cycles[op], total_cycles),
+            profile->page_crossed_cycles[op],
+            profile->branch_taken_cycles[op]);
+    }
+
+    fprintf(f, "\naddressing modes by cycles:\n"
+        "  mode         count        cycles      %%\n");
+    size_t modes[M6502_NB_MODES];
+    n = top_values(mode_cycles, M6502_NB_MODES, modes, M6502_NB_MODES);
+    for (unsigned i = 0; i < n; i++) {
+        const size_t mode = modes[i];
+        fprintf(f, "  %s   %12" PRIu64 "  %12" PRIu64 "  %5.1f\n",
+            m6502_mode_name(mode), mode_count[mode], mode_cycles[mode],
+            percent(mode_cycles[mode], total_cycles));
+    }
+
+    fprintf(f, "\naddresses by cycles:\n"
+        "  address        count        cycles      %%\n");
+    n = top_values(profile->pc_cycles, 0x10000, indexes, top);
+    for (unsigned i = 0; i < n; i++) {
+        const size_t pc = indexes[i];
+        fprintf(f, "  $%04zX   %12" PRIu64 "  %12" PRIu64 "  %5.1f\n", pc,
+            profile->pc_count[pc], profile->pc_cycles[pc],
+            percent(profile->pc_cycles[pc], total_cycles));
+    }
+
+    free(indexes);
+}
+
+// tracing
+
+size_t m6502_trace_size(uint32_t capacity) {
+    return sizeof(m6502_trace) + capacity * sizeof(m6502_trace_record);
+}
+
+void m6502_trace_init(m6502_trace* trace, uint32_t capacity) {
+    memset(trace, 0, sizeof(*trace));
+    memcpy(trace->magic, M6502_TRACE_MAGIC, sizeof(trace->magic));
+    trace->capacity = capacity;
+}
+
+// sets the trace recording the executed instructions, returns false if the
+// emulator isn't built with M6502_TRACE
+bool m6502_set_trace(m6502* const c, m6502_trace* trace) {
+    c->trace = TRACE && trace != NULL && trace->capacity != 0 ? trace : NULL;
+    if (c->trace != NULL) {
+        if (trace->count == 0) {
+            trace->cyc = c->cyc;
+        }
+        trace->m65c02_mode = c->m65c02_mode;
+    }
+    return TRACE;
+}
+
+void m6502_trace_print(FILE* f, const m6502_trace* trace, int format,
+        uint64_t last) {
+    const uint32_t capacity = trace->capacity;
+    uint64_t n = trace->count < capacity ? trace->count : capacity;
+    if (last != 0 && last < n) {
+        n = last;
+    }
+    if (n == 0) {
+        return;
+    }
+    const uint32_t first = (trace->next + capacity - n) % capacity;
+
+    // the cycle counter is only kept for the last record: the ones of the
+    // previous records are found by subtracting the cycles between them
+    uint64_t cyc = trace->cyc;
+    for (uint64_t i = 1; i < n; i++) {
+        cyc -= trace->records[(first + i) % capacity].cycles;
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        const m6502_trace_record* const r =
+            &trace->records[(first + i) % capacity];
+        if (i != 0) {
+            cyc += r->cycles;
+        }
+
+        char flags[] = "........";
+        const char* const names = "nv1bdizc";
+        for (unsigned bit = 0; bit < 8; bit++) {
+            if (r->p & (0x80 >> bit)) {
+                flags[bit] = names[bit];
+            }
+        }
+
+        if (format == M6502_TRACE_NINTENDULATOR) {
+            fprintf(f, "PC:%04X (%02X %02X %02X) "
+                "SP:%02X A:%02X X:%02X Y:%02X P:%02X (%s) CYC:%d\n",
+                r->pc, r->opcode, r->operand & 0xFF, r->operand >> 8,
+                r->sp, r->a, r->x, r->y, r->p, flags,
+                (int) ((cyc * 3) % 341));
+        }
+        else {
+            const uint8_t bytes[3] = {
+                r->opcode, r->operand & 0xFF, r->operand >> 8
+            };
+            char text[M6502_DISASM_SIZE];
+            m6502_disasm(text, sizeof(text), bytes, r->pc,
+                trace->m65c02_mode);
+            fprintf(f, "%12" PRIu64 "  %04X  %02X %02X %02X  %-14s  "
+                "A:%02X X:%02X Y:%02X SP:%02X P:%02X (%s)  +%" PRIu32 "\n",
+                cyc, r->pc, r->opcode, r->operand & 0xFF, r->operand >> 8,
+                text, r->a, r->x, r->y, r->sp, r->p, flags, r->cycles);
+        }
     }
 }
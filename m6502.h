@@ -5,34 +5,544 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// an instruction in the decode cache
+typedef struct m6502_decoded {
+    uint16_t operand; // operand bytes (little-endian)
+    uint8_t opcode;
+    uint8_t length; // instruction length in bytes, 0 if not decoded yet
+    uint8_t cycles; // base number of cycles
+    uint8_t reserved[3]; // (an entry is loaded as a single 8-byte word)
+} m6502_decoded;
+
+// description of an opcode (see m6502_opcodes)
+typedef struct m6502_opcode {
+    uint8_t mnemonic; // M6502_ADC, M6502_AND...
+    uint8_t mode; // M6502_MODE_*
+    uint8_t length; // instruction length in bytes
+    uint8_t cycles; // base number of cycles
+    uint8_t page_crossed_cycles; // additional cycles if a page is crossed
+    uint8_t kind; // M6502_KIND_*
+} m6502_opcode;
+
+// mnemonics (M6502_INV is an invalid opcode, executed as a NOP)
+enum {
+    M6502_INV,
+    M6502_ADC, M6502_AND, M6502_ASL, M6502_BBR, M6502_BBS, M6502_BCC,
+    M6502_BCS, M6502_BEQ, M6502_BIT, M6502_BMI, M6502_BNE, M6502_BPL,
+    M6502_BRA, M6502_BRK, M6502_BVC, M6502_BVS, M6502_CLC, M6502_CLD,
+    M6502_CLI, M6502_CLV, M6502_CMP, M6502_CPX, M6502_CPY, M6502_DEC,
+    M6502_DEX, M6502_DEY, M6502_EOR, M6502_INC, M6502_INX, M6502_INY,
+    M6502_JMP, M6502_JSR, M6502_LDA, M6502_LDX, M6502_LDY, M6502_LSR,
+    M6502_NOP, M6502_ORA, M6502_PHA, M6502_PHP, M6502_PHX, M6502_PHY,
+    M6502_PLA, M6502_PLP, M6502_PLX, M6502_PLY, M6502_RMB, M6502_ROL,
+    M6502_ROR, M6502_RTI, M6502_RTS, M6502_SBC, M6502_SEC, M6502_SED,
+    M6502_SEI, M6502_SMB, M6502_STA, M6502_STP, M6502_STX, M6502_STY,
+    M6502_STZ, M6502_TAX, M6502_TAY, M6502_TRB, M6502_TSB, M6502_TSX,
+    M6502_TXA, M6502_TXS, M6502_TYA, M6502_WAI,
+    M6502_NB_MNEMONICS
+};
+
+// addressing modes
+enum {
+    M6502_MODE_IMP, // implied
+    M6502_MODE_ACC, // accumulator
+    M6502_MODE_IMM, // immediate
+    M6502_MODE_ZPG, // zero page
+    M6502_MODE_ZPX, // zero page indexed with X
+    M6502_MODE_ZPY, // zero page indexed with Y
+    M6502_MODE_ABS, // absolute
+    M6502_MODE_ABX, // absolute indexed with X
+    M6502_MODE_ABY, // absolute indexed with Y
+    M6502_MODE_IND, // absolute indirect (JMP)
+    M6502_MODE_INX, // zero page indexed indirect with X
+    M6502_MODE_INY, // zero page indirect indexed with Y
+    M6502_MODE_INZ, // zero page indirect (65C02)
+    M6502_MODE_IAX, // absolute indexed indirect with X (65C02 JMP)
+    M6502_MODE_REL, // relative
+    M6502_MODE_ZPR, // zero page and relative (65C02 BBR/BBS)
+    M6502_NB_MODES
+};
+
+// what an instruction does with its operand
+enum {
+    M6502_KIND_NONE, // no memory operand (implied, accumulator, immediate)
+    M6502_KIND_READ, // reads memory
+    M6502_KIND_WRITE, // writes memory
+    M6502_KIND_RMW, // reads, modifies and writes back memory
+    M6502_KIND_BRANCH, // conditional branch (and BRA)
+    M6502_KIND_JUMP, // JMP, JSR, RTS, RTI, BRK
+    M6502_KIND_HALT, // STP, WAI
+};
+
+// number of entries in a decode cache
+#define M6502_DECODE_CACHE_SIZE 0x10000
+
+// maximum number of events scheduled at once on a CPU
+#define M6502_MAX_EVENTS 32
+
+struct m6502;
+
+// execution profile (see m6502_set_profile): flat counters indexed by
+// opcode and by address. The cycles of an instruction include its
+// penalties, which are also counted apart.
+typedef struct m6502_profile {
+    uint64_t opcode_count[256]; // executions of each opcode
+    uint64_t opcode_cycles[256];
+    uint64_t page_crossed_cycles[256]; // page crossing penalties
+    uint64_t branch_taken_cycles[256]; // taken branch penalties
+    uint64_t pc_count[0x10000]; // executions of the instruction at each PC
+    uint64_t pc_cycles[0x10000];
+} m6502_profile;
+
+// an instruction recorded in an execution trace (see m6502_set_trace)
+typedef struct m6502_trace_record {
+    // cycles since the previous record (saturated at UINT32_MAX)
+    uint32_t cycles;
+    uint16_t pc;
+    // the two bytes following the opcode (little-endian), as
+    // m6502_debug_output prints them, or 0 when they aren't in mapped memory
+    uint16_t operand;
+    uint8_t opcode;
+    uint8_t a, x, y, sp, p; // registers before the instruction
+    uint8_t reserved[2];
+} m6502_trace_record;
+
+#define M6502_TRACE_MAGIC "M6502TR1"
+
+// execution trace: a header followed by a ring buffer of records, which
+// can be allocated or mapped from a file (see m6502_trace_size). Integers
+// are stored in the byte order of the host.
+typedef struct m6502_trace {
+    char magic[8]; // M6502_TRACE_MAGIC
+    uint32_t capacity; // number of records in the buffer
+    uint32_t next; // index of the next record written
+    uint64_t count; // records written (the last capacity ones are kept)
+    uint64_t cyc; // cycle counter at the start of the last record
+    uint8_t m65c02_mode;
+    uint8_t reserved[7];
+    m6502_trace_record records[];
+} m6502_trace;
+
+// trace formats (see m6502_trace_print)
+enum {
+    // the format of m6502_debug_output (for Nintendulator logs)
+    M6502_TRACE_NINTENDULATOR,
+    // cycle counter, disassembly, registers and cycles
+    M6502_TRACE_FULL,
+};
+
+// kinds of breakpoints (see m6502_set_breakpoints)
+enum {
+    M6502_BREAK_EXEC = 1 << 0, // the instruction at the address is executed
+    // the address is read (the opcodes and operands of the instructions
+    // excepted) or written
+    M6502_BREAK_READ = 1 << 1,
+    M6502_BREAK_WRITE = 1 << 2,
+};
+
+// breakpoints and watchpoints: bitmaps of the addresses (bit addr % 64 of
+// word addr / 64) hitting each kind of breakpoint, changed with m6502_break
+// and m6502_unbreak
+typedef struct m6502_breakpoints {
+    uint64_t exec[0x10000 / 64];
+    uint64_t read[0x10000 / 64];
+    uint64_t write[0x10000 / 64];
+    // called on each hit with its M6502_BREAK_* kind, returns true to end
+    // m6502_run with M6502_EXIT_BREAK (when NULL, every hit ends it)
+    bool (*callback)(struct m6502* c, uint16_t addr, int kind);
+    void* userdata; // user custom pointer
+} m6502_breakpoints;
+
+// an event fired once the cycle counter of a CPU reaches its time (see
+// m6502_schedule). It is owned by the caller, and must stay valid while it
+// is scheduled: a zero-initialised event with its callback set is ready to
+// be scheduled.
+typedef struct m6502_event {
+    // called with the event, which isn't scheduled anymore: the callback
+    // can reschedule it (e.g. at event->time + period for a periodic timer)
+    void (*callback)(struct m6502* c, struct m6502_event* event);
+    void* userdata; // user custom pointer
+    uint64_t time; // cycle count at which the event fires
+    unsigned queue_pos; // position in the event queue, 0 if not scheduled
+} m6502_event;
+
+// modes of an I/O log
+enum {
+    M6502_IO_RECORD = 1, // the I/O reads and interrupts are logged
+    M6502_IO_REPLAY, // they are replayed from the log
+};
+
+// position in an I/O log (internal)
+typedef struct m6502_io_cursor {
+    size_t pos; // offset of the next entry in data
+    uint64_t cyc; // time of the previous entry
+    uint16_t addr; // address of the previous read
+} m6502_io_cursor;
+
+// log of the reads from I/O pages (see m6502_set_io) and of the interrupts
+// taken, to replay a run deterministically (see m6502_io_record). It is a
+// stream of entries, each one starting with the cycles elapsed since the
+// previous one, encoded on as few bytes as possible.
+typedef struct m6502_io_log {
+    uint8_t* data;
+    size_t size; // bytes used in data (recorded, or to replay)
+    size_t capacity; // bytes available in data for the recording
+    // called when data is full while recording, to write its size bytes
+    // elsewhere (e.g. to a file) and clear size. If it doesn't (or is NULL),
+    // the recording stops and overflow is set.
+    void (*flush)(struct m6502_io_log* log);
+    void* userdata; // user custom pointer
+    bool overflow;
+    // reads replayed from an address or at a time different from the log's
+    // (the run diverged from the recorded one)
+    unsigned long mismatches;
+
+    // internal state
+    int mode; // M6502_IO_*
+    m6502_io_cursor end; // end of the recording
+    m6502_io_cursor reads, interrupts; // replay positions
+    m6502_event event; // takes the next replayed interrupt
+} m6502_io_log;
+
+// registers, flags, cycle count and interrupt state of a CPU, saved in
+// snapshots and rewind checkpoints
+typedef struct m6502_state {
+    uint64_t cyc;
+    uint16_t pc;
+    uint8_t a, x, y, sp;
+    bool cf, idf, df, bf, vf;
+    uint8_t n_result, z_result;
+    bool stop, wait, idf_before, nmi_line;
+    uint32_t signals;
+} m6502_state;
+
+// snapshot of a CPU (see m6502_snapshot_save): its state and the content of
+// its pages mapped for writes
+typedef struct m6502_snapshot {
+    m6502_state state;
+    // host memory of each page saved (the write map), NULL if not saved
+    uint8_t* pages[256];
+    uint8_t memory[0x10000]; // content of the saved pages
+} m6502_snapshot;
+
+// history of the states of a CPU, checkpointed every interval cycles, to go
+// back to a past cycle (see m6502_rewind_start)
+typedef struct m6502_rewind {
+    // memory budget of the history: the checkpoints are stored as the
+    // changes to the memory since the previous one, and the oldest are
+    // dropped to make room for the new ones
+    uint8_t* data;
+    size_t capacity;
+    uint64_t interval; // cycles between checkpoints
+    unsigned long checkpoints; // checkpoints in data
+    uint64_t oldest; // cycle count of the oldest checkpoint kept
+
+    // internal state
+    size_t first, last, end; // oldest and newest checkpoints, free space
+    m6502_event event; // takes the next checkpoint
+    m6502_snapshot reference; // the last checkpoint
+} m6502_rewind;
+
+// x86-64 recompiler (see m6502_set_jit)
+typedef struct m6502_jit m6502_jit;
+
 typedef struct m6502 {
     uint8_t (*read_byte)(void*, uint16_t); // user function to read from memory
     void (*write_byte)(void*, uint16_t, uint8_t); // same for writing to memory
     void* userdata; // user custom pointer
 
-    unsigned long cyc; // cycle count
+    uint64_t cyc; // cycle count
 
     uint16_t pc; // program counter
     uint8_t a, x, y, sp; // register A, X, Y and stack pointer
 
-    // flags: carry, zero, interrupt disable, decimal mode,
-    // break command, overflow, negative
-    bool cf : 1, zf : 1, idf : 1, df : 1, bf : 1, vf : 1, nf : 1;
+    // flags (use m6502_get_flags/m6502_set_flags to access them): carry,
+    // interrupt disable, decimal mode, break command, overflow
+    bool cf, idf, df, bf, vf;
+    // N and Z are computed from the last result when they are read: N is
+    // bit 7 of n_result, and Z is set when z_result is 0
+    uint8_t n_result, z_result;
 
     bool page_crossed : 1; // helper flag to keep track of page crossing
     bool enable_bcd : 1; // helper flag to enable/disable BCD
     bool m65c02_mode : 1; // helper flag to enable 65C02 emulation
 
     bool stop : 1, wait : 1; // flags used with STP/WAI 65C02 instructions
+    bool skip_idle : 1; // skip idle loops up to the next event (see m6502_run)
+
+    // I flag seen by the next poll after CLI, SEI or PLP (which change it
+    // after the interrupts are polled)
+    bool idf_before : 1;
+
+    // pending signals and IRQ sources asserting the IRQ line, which other
+    // threads can change while the CPU runs: only access them atomically,
+    // through m6502_signal, m6502_set_irq...
+    uint32_t signals;
+    bool nmi_line; // the NMI line is asserted (see m6502_set_nmi)
+
+    uint16_t exit_pc; // address checked by m6502_run with M6502_EXIT_PC
+
+    // breakpoints checked by m6502_run, and the breakpoint that ended the
+    // last run (at break_pc, skipped if nothing was executed since break_cyc)
+    m6502_breakpoints* breakpoints;
+    uint16_t break_pc;
+    uint64_t break_cyc;
+
+    // memory map (see m6502_map): host memory read and written by each
+    // 256-byte page, NULL when the page goes through read_byte/write_byte
+    uint8_t* read_map[256];
+    uint8_t* write_map[256];
+    uint8_t page_flags[256]; // internal state of each page
+    // pointers used to access each page directly: the same as the map,
+    // except NULL when accesses need extra work (e.g. a write to a page
+    // holding decoded instructions, or a page with breakpoints)
+    uint8_t* read_pages[256];
+    uint8_t* write_pages[256];
+    uint8_t* fetch_pages[256]; // for instruction fetches
+
+    m6502_io_log* io_log; // see m6502_io_record and m6502_io_replay
+    // snapshot whose changed pages are tracked (see m6502_snapshot_save)
+    m6502_snapshot* snapshot;
+
+    // optional cache of decoded instructions, indexed by address (see
+    // m6502_set_decode_cache)
+    m6502_decoded* decode_cache;
+    unsigned long decode_invalidations; // pages invalidated by writes
+
+    // optional recompiler of the hot loops (see m6502_set_jit), the blocks
+    // it compiled and the instructions they executed
+    m6502_jit* jit;
+    unsigned long jit_blocks;
+    uint64_t jit_instructions;
+
+    // scheduled events (see m6502_schedule), a binary min-heap ordered by
+    // time
+    m6502_event* events[M6502_MAX_EVENTS];
+    unsigned nb_events;
+
+    // idle loops and WAI skipped by m6502_run, and the cycles they took
+    unsigned long idle_skips;
+    uint64_t idle_cycles;
+
+    m6502_profile* profile; // see m6502_set_profile
+    m6502_trace* trace; // see m6502_set_trace
 } m6502;
 
+// access rights of host memory mapped with m6502_map
+enum {
+    M6502_MAP_READ = 1 << 0, // reads are served from host memory
+    M6502_MAP_WRITE = 1 << 1, // writes are stored in host memory
+    M6502_MAP_READWRITE = M6502_MAP_READ | M6502_MAP_WRITE,
+    // writes are ignored instead of calling write_byte, unless
+    // M6502_MAP_WRITE is set (e.g. for a ROM mapped with M6502_MAP_READ)
+    M6502_MAP_PROTECT = 1 << 2,
+};
+
+// conditions that end m6502_run before its cycle budget is consumed
+enum {
+    M6502_EXIT_PC = 1 << 0, // the program counter reached exit_pc
+    M6502_EXIT_TRAP = 1 << 1, // an instruction jumped or branched to itself
+    M6502_EXIT_STOP = 1 << 2, // the CPU is stopped (STP) or waiting (WAI)
+    // the CPU received M6502_SIGNAL_STOP or M6502_SIGNAL_PAUSE (always
+    // checked)
+    M6502_EXIT_SIGNAL = 1 << 3,
+    // a breakpoint or watchpoint was hit (always checked)
+    M6502_EXIT_BREAK = 1 << 4,
+};
+
+// signals sent to a CPU with m6502_signal, taken at the next instruction
+// boundary
+enum {
+    M6502_SIGNAL_NMI = 1 << 0, // takes an NMI
+    M6502_SIGNAL_RESET = 1 << 1, // takes a RESET (see m6502_gen_res)
+    M6502_SIGNAL_STOP = 1 << 2, // ends the run, then is cleared
+    // ends the runs (which execute nothing) until it is cleared
+    M6502_SIGNAL_PAUSE = 1 << 3,
+};
+
+// number of IRQ sources (see m6502_set_irq)
+#define M6502_IRQ_SOURCES 24
+
+// status register bits
+enum {
+    M6502_FLAG_C = 1 << 0, // carry
+    M6502_FLAG_Z = 1 << 1, // zero
+    M6502_FLAG_I = 1 << 2, // interrupt disable
+    M6502_FLAG_D = 1 << 3, // decimal mode
+    M6502_FLAG_B = 1 << 4, // break command
+    M6502_FLAG_U = 1 << 5, // unused, always set
+    M6502_FLAG_V = 1 << 6, // overflow
+    M6502_FLAG_N = 1 << 7, // negative
+};
+
+typedef struct m6502_run_result {
+    uint64_t cyc; // number of cycles executed
+    unsigned long instructions; // number of instructions executed
+    int exit; // M6502_EXIT_* condition that ended the run, 0 if none
+} m6502_run_result;
+
 void m6502_init(m6502* const c);
 void m6502_step(m6502* const c);
+m6502_run_result m6502_run(m6502* const c, uint64_t cycle_budget,
+    int exit_flags);
 void m6502_debug_output(m6502* const c);
 
-// interrupts
+// status register (combination of M6502_FLAG_*)
+uint8_t m6502_get_flags(const m6502* const c);
+void m6502_set_flags(m6502* const c, uint8_t flags);
+
+// opcode descriptions of the 6502 or the 65C02 (256 entries), and the name
+// of a mnemonic
+const m6502_opcode* m6502_opcodes(bool m65c02_mode);
+const char* m6502_mnemonic_name(uint8_t mnemonic);
+const char* m6502_mode_name(uint8_t mode); // e.g. "ABX"
+
+// disassembler: m6502_disasm writes the text of the instruction in bytes
+// (e.g. "LDA ($12),Y") and returns its length, m6502_disasm_range prints
+// the instructions of a memory range
+#define M6502_DISASM_SIZE 16 // buffer size fitting any instruction
+unsigned m6502_disasm(char* buf, size_t size, const uint8_t* bytes,
+    uint16_t pc, bool m65c02_mode);
+void m6502_disasm_range(FILE* f, const uint8_t* mem, size_t size,
+    uint16_t addr, bool m65c02_mode);
+
+// memory mapping (addr and size must be multiples of 256)
+void m6502_map(m6502* const c, uint16_t addr, size_t size, uint8_t* mem,
+    int access);
+void m6502_unmap(m6502* const c, uint16_t addr, size_t size);
+int m6502_page_access(const m6502* const c, uint8_t page);
+
+// decode cache
+void m6502_set_decode_cache(m6502* const c, m6502_decoded* cache);
+void m6502_invalidate(m6502* const c, uint16_t addr, size_t size);
+
+// recompiler: with the decode cache, the loops taken often are translated
+// into x86-64 code, which runs until an access to a page that isn't mapped
+// directly (I/O, callbacks, watchpoints, decoded instructions), an
+// interrupt, or an instruction left to the cores, with the same cycles.
+// m6502_jit_create returns NULL if the emulator isn't built for x86-64 or
+// is built with M6502_NO_JIT, and m6502_set_jit returns false. The profile
+// and the trace, which record each instruction, stop the recompiler while
+// they are set. A recompiler serves a single CPU at a time.
+m6502_jit* m6502_jit_create(size_t code_size); // 0 for the default size
+void m6502_jit_destroy(m6502_jit* jit);
+bool m6502_set_jit(m6502* const c, m6502_jit* jit);
+
+// events: m6502_run and m6502_step fire the events whose time has come
+// before executing the next instruction, so a run executes up to the next
+// event, fires it and continues. m6502_schedule reschedules an event that is
+// already scheduled, and returns false if the queue is full.
+bool m6502_schedule(m6502* const c, m6502_event* event, uint64_t time);
+void m6502_unschedule(m6502* const c, m6502_event* event);
+uint64_t m6502_next_event(const m6502* const c); // UINT64_MAX if none
+
+// profiling: with the emulator built with M6502_PROFILE, m6502_run and
+// m6502_step count the instructions they execute in profile (NULL to stop),
+// otherwise m6502_set_profile returns false. The iterations of skipped idle
+// loops and the interrupts taken between instructions aren't counted.
+bool m6502_set_profile(m6502* const c, m6502_profile* profile);
+void m6502_profile_reset(m6502_profile* profile);
+// prints the top opcodes, the addressing modes and the top addresses by
+// cycles
+void m6502_profile_print(FILE* f, const m6502_profile* profile,
+    bool m65c02_mode, unsigned top);
+
+// tracing: with the emulator built with M6502_TRACE, m6502_run and
+// m6502_step record the instructions they execute in trace (NULL to stop),
+// otherwise m6502_set_trace returns false. Records are written in a ring
+// buffer of capacity entries, without allocating or formatting anything,
+// so that the trace holds the last instructions executed. The interrupts
+// taken between instructions aren't recorded, and the iterations of
+// skipped idle loops are counted in the cycles of the next record.
+size_t m6502_trace_size(uint32_t capacity); // size of a trace in bytes
+void m6502_trace_init(m6502_trace* trace, uint32_t capacity);
+bool m6502_set_trace(m6502* const c, m6502_trace* trace);
+// prints the last records of a trace (all those kept if last is 0) in a
+// M6502_TRACE_* format
+void m6502_trace_print(FILE* f, const m6502_trace* trace, int format,
+    uint64_t last);
+
+// breakpoints: m6502_run ends with M6502_EXIT_BREAK before executing an
+// instruction at an M6502_BREAK_EXEC address, or after the instruction that
+// read or wrote an address being watched, unless the callback returns
+// false. Pages holding no breakpoints are accessed as fast as without them,
+// the others go through the slow memory path. Running again after an
+// M6502_EXIT_BREAK on an execution breakpoint executes its instruction.
+// While breakpoints are set, idle loops aren't skipped.
+void m6502_set_breakpoints(m6502* const c, m6502_breakpoints* breakpoints);
+// sets or clears the breakpoints of a combination of M6502_BREAK_* kinds on
+// size bytes at addr (m6502_set_breakpoints must be called first)
+void m6502_break(m6502* const c, uint16_t addr, size_t size, int kinds);
+void m6502_unbreak(m6502* const c, uint16_t addr, size_t size, int kinds);
+
+// deterministic replay: m6502_set_io marks (or unmarks) the pages of size
+// bytes at addr as I/O pages, whose reads depend on the host. While
+// m6502_io_record runs, the values read from them and the interrupts taken
+// (whatever their source: lines, signals or m6502_gen_*) are appended to the
+// log, initialised by the caller with its data, capacity and flush callback
+// (both functions reset its internal state). m6502_io_replay replays a log
+// (its data and size set by the caller) on a CPU in the state the recording
+// started from: the reads from I/O pages are served from the log without
+// calling read_byte, the writes to them are dropped, and the interrupts are
+// taken at the same instruction boundaries through an event (so the host
+// must not schedule its device events nor drive the interrupt lines). Once
+// the log is exhausted, the I/O pages are read from the host again.
+// m6502_io_replay returns false if the event queue is full. m6502_io_stop
+// ends either mode.
+void m6502_set_io(m6502* const c, uint16_t addr, size_t size, bool io);
+void m6502_io_record(m6502* const c, m6502_io_log* log);
+bool m6502_io_replay(m6502* const c, m6502_io_log* log);
+void m6502_io_stop(m6502* const c);
+
+// snapshots: m6502_snapshot_save saves the state of a CPU and the pages
+// mapped for writes, and m6502_snapshot_restore puts them back. Until
+// another snapshot is saved or restored, the pages written since the last
+// save or restore are tracked (the first write to each one goes through the
+// slow memory path), so that restoring the same snapshot only copies them
+// back, and returns their number. The host must report its own changes to
+// mapped memory with m6502_invalidate, and keep the memory map unchanged.
+// Memory behind read_byte/write_byte, the scheduled events, the decode cache
+// and the I/O log aren't part of the snapshot.
+void m6502_snapshot_save(m6502* const c, m6502_snapshot* snapshot);
+unsigned m6502_snapshot_restore(m6502* const c, m6502_snapshot* snapshot);
+
+// rewinding: m6502_rewind_start takes a checkpoint of the CPU now and then
+// every interval cycles through an event (it returns false if the event
+// queue is full). Each checkpoint is stored in the data of the history (set
+// by the caller with its capacity and interval) as the XOR of the pages
+// changed since the previous one, run-length encoded, and the oldest ones
+// are dropped when it is full. m6502_rewind_seek goes back to the first
+// instruction boundary at or after a past cycle count: it restores the
+// closest checkpoint before it and executes the instructions up to it
+// again, calling the callbacks and firing the events again (with an I/O
+// log replayed, the run is the same). The checkpoints after it are
+// dropped. It returns false if the cycle is older than the oldest
+// checkpoint or later than the current one. The history uses the snapshot
+// tracking of the CPU (see m6502_snapshot_save), and is cleared by a
+// RESET. m6502_rewind_start also returns false if interval is 0.
+bool m6502_rewind_start(m6502* const c, m6502_rewind* rewind);
+void m6502_rewind_stop(m6502* const c, m6502_rewind* rewind);
+bool m6502_rewind_seek(m6502* const c, m6502_rewind* rewind, uint64_t cyc);
+
+// interrupts, taken immediately (only from the thread running the CPU)
 void m6502_gen_nmi(m6502* const c);
 void m6502_gen_res(m6502* const c);
 void m6502_gen_irq(m6502* const c);
 
+// interrupt lines, polled by m6502_run and m6502_step before each
+// instruction. IRQ is level-triggered: it is asserted as long as one of
+// its sources (the bits of the M6502_IRQ_SOURCES low bits of sources,
+// chosen by the host, e.g. one per device) is, and wakes the CPU from WAI
+// even when masked. NMI is edge-triggered: an NMI is taken each time its
+// line goes from released to asserted.
+// These functions and the signal ones can be called from any thread, even
+// while the CPU runs: the writes made to memory before the call are seen
+// by the CPU when it takes the signal.
+void m6502_set_irq(m6502* const c, uint32_t sources, bool asserted);
+void m6502_set_nmi(m6502* const c, bool asserted);
+
+// sends or clears signals (combination of M6502_SIGNAL_*)
+void m6502_signal(m6502* const c, uint32_t signals);
+void m6502_clear_signals(m6502* const c, uint32_t signals);
+
 #endif // M6502_M6502_H_
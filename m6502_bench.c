@@ -0,0 +1,578 @@
+// throughput benchmark: runs the test programs and a few synthetic kernels
+// with each memory configuration, and prints the results as JSON on the
+// standard output (progress is printed on the standard error)
+//
+// usage: m6502_bench [-r repetitions] [-w warmup] [-f filter] [-j threads]
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "m6502.h"
+#include "m6502_pool.h"
+#include "m6502_lockstep.h"
+
+#define MEMORY_SIZE 0x10000
+#define IO_PAGE 0xD0 // page of the I/O registers used by the MMIO kernel
+#define MIN_SAMPLE_NS 20000000.0 // minimum duration of a timed sample
+#define MAX_REPETITIONS 1000
+#define POOL_NAME "pool_kernel_bcd"
+#define POOL_SIZE 64 // CPUs running the BCD kernel in the pool benchmark
+#define POOL_SLICE 100000UL // cycles
+#define LOCKSTEP_NAME "lockstep_kernel_multiply"
+#define LOCKSTEP_LANES 64 // lanes running the multiply kernel in lockstep
+
+static m6502 cpu;
+static uint8_t memory[MEMORY_SIZE];
+static m6502_decoded* decode_cache;
+static m6502_jit* jit; // NULL if the recompiler is not built
+
+// memory callbacks, with I/O registers for the MMIO kernel
+static bool io_enabled;
+static uint8_t io_status;
+static unsigned long io_writes;
+
+static uint8_t rb(void* userdata, uint16_t addr) {
+    (void) userdata;
+    if (io_enabled && (addr >> 8) == IO_PAGE) {
+        return io_status++;
+    }
+    return memory[addr];
+}
+
+static void wb(void* userdata, uint16_t addr, uint8_t val) {
+    (void) userdata;
+    if (io_enabled && (addr >> 8) == IO_PAGE) {
+        io_writes += 1;
+        return;
+    }
+    memory[addr] = val;
+}
+
+// memory configurations
+enum {
+    MEMORY_CALLBACKS, // all accesses go through read_byte/write_byte
+    MEMORY_MAPPED, // RAM is mapped with m6502_map
+    MEMORY_DECODED, // RAM is mapped and a decode cache is set
+    MEMORY_JIT, // as decoded, with the recompiler of hot blocks
+    NB_MEMORY_MODES
+};
+
+static const char* const MEMORY_MODE_NAMES[] = {
+    "callbacks", "mapped", "decoded", "jit"
+};
+
+// synthetic kernels, loaded at 0x200 and ending with a JMP to itself
+
+// copies 4 KiB from 0x4000 to 0x8000 with (zp),Y accesses, 64 times
+static const uint8_t KERNEL_MEMCPY[] = {
+    0xA9, 0x40, 0x85, 0x10, 0xA9, 0x00, 0x85, 0x00, 0x85, 0x02, 0xA9, 0x40,
+    0x85, 0x01, 0xA9, 0x80, 0x85, 0x03, 0xA2, 0x10, 0xA0, 0x00, 0xB1, 0x00,
+    0x91, 0x02, 0xC8, 0xD0, 0xF9, 0xE6, 0x01, 0xE6, 0x03, 0xCA, 0xD0, 0xF2,
+    0xC6, 0x10, 0xD0, 0xDC, 0x4C, 0x28, 0x02
+};
+
+// multiplies every pair of bytes with a shift-and-add routine, and sums the
+// products in 0x30-0x31
+static const uint8_t KERNEL_MULTIPLY[] = {
+    0xA9, 0x00, 0x85, 0x30, 0x85, 0x31, 0x85, 0x20, 0xA9, 0x00, 0x85, 0x21,
+    0xA5, 0x20, 0x85, 0x22, 0xA5, 0x21, 0x85, 0x23, 0xA9, 0x00, 0xA2, 0x08,
+    0x46, 0x22, 0x90, 0x03, 0x18, 0x65, 0x23, 0x6A, 0x66, 0x22, 0xCA, 0xD0,
+    0xF5, 0x18, 0x48, 0xA5, 0x22, 0x65, 0x30, 0x85, 0x30, 0x68, 0x65, 0x31,
+    0x85, 0x31, 0xE6, 0x21, 0xD0, 0xD6, 0xE6, 0x20, 0xD0, 0xCE, 0x4C, 0x3A,
+    0x02
+};
+
+// adds 7 to a 4-byte BCD counter in 0x40-0x43 and subtracts 3 from a BCD
+// byte in 0x44, 65536 times in decimal mode
+static const uint8_t KERNEL_BCD[] = {
+    0xF8, 0xA9, 0x00, 0x85, 0x40, 0x85, 0x41, 0x85, 0x42, 0x85, 0x43, 0xA0,
+    0x00, 0xA2, 0x00, 0x18, 0xA5, 0x40, 0x69, 0x07, 0x85, 0x40, 0xA5, 0x41,
+    0x69, 0x00, 0x85, 0x41, 0xA5, 0x42, 0x69, 0x00, 0x85, 0x42, 0xA5, 0x43,
+    0x69, 0x00, 0x85, 0x43, 0x38, 0xA5, 0x44, 0xE9, 0x03, 0x85, 0x44, 0xCA,
+    0xD0, 0xDD, 0x88, 0xD0, 0xD8, 0xD8, 0x4C, 0x36, 0x02
+};
+
+// reads an I/O register, writes it to another one and to RAM, 65536 times
+static const uint8_t KERNEL_MMIO[] = {
+    0xA0, 0x00, 0xA2, 0x00, 0xAD, 0x00, 0xD0, 0x8D, 0x01, 0xD0, 0x9D, 0x00,
+    0x30, 0xCA, 0xD0, 0xF4, 0x88, 0xD0, 0xEF, 0x4C, 0x13, 0x02
+};
+
+// checks that a workload produced the expected result
+static bool check_allsuitea(void) {
+    return memory[0x0210] == 0xFF;
+}
+
+static bool check_6502_functional_test(void) {
+    return cpu.pc == 0x3469;
+}
+
+static bool check_6502_decimal_test(void) {
+    return cpu.a == 0;
+}
+
+static bool check_timingtest(void) {
+    return cpu.cyc == 1141;
+}
+
+static bool check_65C02_extended_opcodes_test(void) {
+    return cpu.pc == 0x24F1;
+}
+
+static bool check_memcpy(void) {
+    return memcmp(&memory[0x4000], &memory[0x8000], 0x1000) == 0;
+}
+
+static bool check_multiply(void) {
+    // sum of a * b for every a and b, modulo 65536
+    return memory[0x30] == 0x00 && memory[0x31] == 0x40;
+}
+
+static bool check_bcd(void) {
+    // 65536 * 7 = 458752, and 0 - 65536 * 3 = 92 (mod 100)
+    return memory[0x40] == 0x52 && memory[0x41] == 0x87 &&
+           memory[0x42] == 0x45 && memory[0x43] == 0x00 &&
+           memory[0x44] == 0x92;
+}
+
+static bool check_mmio(void) {
+    return io_writes == 65536;
+}
+
+typedef struct workload {
+    const char* name;
+    const char* filename; // test program, NULL for a kernel
+    const uint8_t* kernel;
+    size_t kernel_size;
+    uint16_t load_addr;
+    uint16_t start_pc; // 0 to start with a RESET
+    bool m65c02_mode;
+    bool io; // the I/O page is handled by the callbacks
+    int exit_flags;
+    uint16_t exit_pc;
+    bool (*check)(void);
+} workload;
+
+static const workload WORKLOADS[] = {
+    {"AllSuiteA", "programs/AllSuiteA.bin", NULL, 0,
+        0x4000, 0, false, false, M6502_EXIT_PC, 0x45C0, check_allsuitea},
+    {"6502_functional_test",
+        "programs/6502_65C02_functional_tests/bin_files/6502_functional_test.bin",
+        NULL, 0, 0, 0x400, false, false, M6502_EXIT_TRAP, 0,
+        check_6502_functional_test},
+    {"6502_decimal_test", "programs/6502_decimal_test.bin", NULL, 0,
+        0x200, 0x200, false, false, M6502_EXIT_PC, 0x024B,
+        check_6502_decimal_test},
+    {"timingtest", "programs/timingtest/timingtest-1.bin", NULL, 0,
+        0x1000, 0x1000, false, false, M6502_EXIT_PC, 0x1269,
+        check_timingtest},
+    {"65C02_extended_opcodes_test",
+        "programs/6502_65C02_functional_tests/bin_files/65C02_extended_opcodes_test.bin",
+        NULL, 0, 0, 0x400, true, false, M6502_EXIT_TRAP, 0,
+        check_65C02_extended_opcodes_test},
+    {"kernel_memcpy", NULL, KERNEL_MEMCPY, sizeof(KERNEL_MEMCPY),
+        0x200, 0x200, false, false, M6502_EXIT_TRAP, 0, check_memcpy},
+    {"kernel_multiply", NULL, KERNEL_MULTIPLY, sizeof(KERNEL_MULTIPLY),
+        0x200, 0x200, false, false, M6502_EXIT_TRAP, 0, check_multiply},
+    {"kernel_bcd", NULL, KERNEL_BCD, sizeof(KERNEL_BCD),
+        0x200, 0x200, false, false, M6502_EXIT_TRAP, 0, check_bcd},
+    {"kernel_mmio", NULL, KERNEL_MMIO, sizeof(KERNEL_MMIO),
+        0x200, 0x200, false, true, M6502_EXIT_TRAP, 0, check_mmio},
+};
+
+#define NB_WORKLOADS (sizeof(WORKLOADS) / sizeof(WORKLOADS[0]))
+
+// program images of the workloads, loaded once
+static uint8_t* images[NB_WORKLOADS];
+static size_t image_sizes[NB_WORKLOADS];
+
+// loads a file in a newly allocated buffer, returns NULL on error
+static uint8_t* load_file(const char* filename, size_t* size) {
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    const long file_size = ftell(f);
+    rewind(f);
+
+    uint8_t* buffer = file_size > 0 ? malloc(file_size) : NULL;
+    if (buffer == NULL ||
+            fread(buffer, 1, file_size, f) != (size_t) file_size) {
+        free(buffer);
+        fclose(f);
+        return NULL;
+    }
+
+    fclose(f);
+    *size = file_size;
+    return buffer;
+}
+
+static double now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// result of one execution of a workload
+typedef struct execution {
+    double ns; // host time spent in m6502_run
+    uint64_t cyc;
+    unsigned long instructions;
+    bool ok;
+} execution;
+
+// resets the memory and the CPU, then runs a workload to completion
+static execution execute(size_t w, int memory_mode) {
+    const workload* const wl = &WORKLOADS[w];
+    execution e;
+
+    memset(memory, 0, MEMORY_SIZE);
+    memcpy(&memory[wl->load_addr], images[w], image_sizes[w]);
+    io_enabled = wl->io;
+    io_status = 0;
+    io_writes = 0;
+
+    m6502_init(&cpu);
+    cpu.read_byte = &rb;
+    cpu.write_byte = &wb;
+    cpu.m65c02_mode = wl->m65c02_mode;
+    if (memory_mode != MEMORY_CALLBACKS) {
+        m6502_map(&cpu, 0, MEMORY_SIZE, memory, M6502_MAP_READWRITE);
+        if (wl->io) {
+            m6502_unmap(&cpu, IO_PAGE << 8, 0x100);
+        }
+    }
+    if (memory_mode >= MEMORY_DECODED) {
+        m6502_set_decode_cache(&cpu, decode_cache);
+    }
+    if (memory_mode == MEMORY_JIT) {
+        m6502_set_jit(&cpu, jit);
+    }
+    if (wl->start_pc == 0) {
+        m6502_gen_res(&cpu);
+    }
+    else {
+        cpu.pc = wl->start_pc;
+    }
+    cpu.exit_pc = wl->exit_pc;
+
+    const double start = now_ns();
+    const m6502_run_result r = m6502_run(&cpu, UINT64_MAX, wl->exit_flags);
+    e.ns = now_ns() - start;
+
+    e.cyc = cpu.cyc;
+    e.instructions = r.instructions;
+    e.ok = r.exit != 0 && wl->check();
+    return e;
+}
+
+// runs a workload for the warm-up and the timed repetitions, and prints
+// its JSON result. Short workloads are executed several times per sample.
+// Returns false if the workload produced a wrong result.
+static bool bench(size_t w, int memory_mode, int repetitions, int warmup,
+        bool first) {
+    const workload* const wl = &WORKLOADS[w];
+    const char* const mode_name = MEMORY_MODE_NAMES[memory_mode];
+
+    printf("%s    {\"workload\": \"%s\", \"memory\": \"%s\", ",
+        first ? "" : ",\n", wl->name, mode_name);
+
+    if (images[w] == NULL) {
+        fprintf(stderr, "%s (%s): skipped, can't open '%s'\n",
+            wl->name, mode_name, wl->filename);
+        printf("\"status\": \"skipped\"}");
+        return true;
+    }
+    if (memory_mode == MEMORY_JIT && jit == NULL) {
+        fprintf(stderr, "%s (%s): skipped, no recompiler in this build\n",
+            wl->name, mode_name);
+        printf("\"status\": \"skipped\"}");
+        return true;
+    }
+
+    // warm-up, also used to choose the number of executions per sample
+    execution e = execute(w, memory_mode);
+    for (int i = 1; i < warmup; i++) {
+        e = execute(w, memory_mode);
+    }
+    unsigned long iterations = 1;
+    if (e.ns > 0 && e.ns < MIN_SAMPLE_NS) {
+        iterations = (unsigned long) ceil(MIN_SAMPLE_NS / e.ns);
+    }
+
+    double samples[MAX_REPETITIONS];
+    bool ok = e.ok;
+    for (int rep = 0; rep < repetitions; rep++) {
+        samples[rep] = 0;
+        for (unsigned long i = 0; i < iterations; i++) {
+            const execution s = execute(w, memory_mode);
+            samples[rep] += s.ns;
+            ok = ok && s.ok && s.cyc == e.cyc;
+        }
+        samples[rep] /= iterations;
+    }
+
+    double mean = 0, min = HUGE_VAL, max = 0;
+    for (int rep = 0; rep < repetitions; rep++) {
+        mean += samples[rep];
+        min = samples[rep] < min ? samples[rep] : min;
+        max = samples[rep] > max ? samples[rep] : max;
+    }
+    mean /= repetitions;
+    double variance = 0;
+    for (int rep = 0; rep < repetitions; rep++) {
+        variance += (samples[rep] - mean) * (samples[rep] - mean);
+    }
+    variance /= repetitions;
+    const double stddev = sqrt(variance);
+
+    const double mhz = e.cyc / mean * 1e3;
+    fprintf(stderr, "%s (%s): %s, %.1f MHz, %.2f ns/instruction (+/- %.1f%%)\n",
+        wl->name, mode_name, ok ? "ok" : "FAILED", mhz,
+        mean / e.instructions, 100 * stddev / mean);
+
+    printf("\"status\": \"%s\", \"iterations\": %lu, "
+        "\"cycles\": %" PRIu64 ", \"instructions\": %lu, "
+        "\"mhz\": %.3f, \"ns_per_instruction\": %.4f, "
+        "\"instructions_per_second\": %.0f, "
+        "\"time_ns\": {\"mean\": %.0f, \"min\": %.0f, \"max\": %.0f, "
+        "\"stddev\": %.0f, \"variance\": %.0f}}",
+        ok ? "ok" : "failed", iterations, e.cyc, e.instructions,
+        mhz, mean / e.instructions, e.instructions / mean * 1e9,
+        mean, min, max, stddev, variance);
+    return ok;
+}
+
+// runs the BCD kernel on a pool of CPUs with 1, 2, 4... threads up to
+// max_threads, and prints the JSON result of each thread count
+static bool bench_pool(int repetitions, unsigned max_threads) {
+    size_t w = 0;
+    while (strcmp(WORKLOADS[w].name, "kernel_bcd") != 0) {
+        w += 1;
+    }
+    m6502_pool* pool = m6502_pool_create(POOL_SIZE, MEMORY_SIZE);
+    if (pool == NULL) {
+        fprintf(stderr, "%s: FAILED, can't allocate the pool\n", POOL_NAME);
+        return false;
+    }
+    double single_thread_mean = 0;
+    bool ok = true;
+
+    for (unsigned threads = 1;;
+            threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        double mean = 0;
+        uint64_t cyc = 0;
+
+        for (int rep = 0; rep < repetitions; rep++) {
+            for (size_t i = 0; i < POOL_SIZE; i++) {
+                uint8_t* const mem = m6502_pool_memory(pool, i);
+                m6502* const c = m6502_pool_cpu(pool, i);
+                memset(mem, 0, MEMORY_SIZE);
+                memcpy(&mem[WORKLOADS[w].load_addr], images[w],
+                    image_sizes[w]);
+                c->pc = WORKLOADS[w].start_pc;
+                c->cyc = 0;
+            }
+
+            const double start = now_ns();
+            ok = m6502_pool_run(pool, threads, POOL_SLICE) && ok;
+            mean += now_ns() - start;
+
+            cyc = 0;
+            for (size_t i = 0; i < POOL_SIZE; i++) {
+                const m6502_run_result r = m6502_pool_result(pool, i);
+                memcpy(memory, m6502_pool_memory(pool, i), MEMORY_SIZE);
+                ok = ok && r.exit == M6502_EXIT_TRAP && check_bcd();
+                cyc += r.cyc;
+            }
+        }
+        mean /= repetitions;
+        if (threads == 1) {
+            single_thread_mean = mean;
+        }
+
+        const double mhz = cyc / mean * 1e3;
+        fprintf(stderr, "%s (%u threads): %s, %.1f MHz, speedup %.2f\n",
+            POOL_NAME, threads, ok ? "ok" : "FAILED", mhz,
+            single_thread_mean / mean);
+        printf("%s    {\"threads\": %u, \"cpus\": %d, \"status\": \"%s\", "
+            "\"cycles\": %" PRIu64 ", \"mhz\": %.3f, \"speedup\": %.3f, "
+            "\"time_ns\": {\"mean\": %.0f}}",
+            threads == 1 ? "" : ",\n", threads, POOL_SIZE,
+            ok ? "ok" : "failed", cyc, mhz, single_thread_mean / mean, mean);
+
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    m6502_pool_destroy(pool);
+    return ok;
+}
+
+// runs the multiply kernel on lanes executing in lockstep, and prints the
+// JSON result
+static bool bench_lockstep(int repetitions) {
+    size_t w = 0;
+    while (strcmp(WORKLOADS[w].name, "kernel_multiply") != 0) {
+        w += 1;
+    }
+    m6502_lockstep* ls = m6502_lockstep_create(LOCKSTEP_LANES, false, true);
+    if (ls == NULL) {
+        fprintf(stderr, "%s: FAILED, can't allocate the lanes\n",
+            LOCKSTEP_NAME);
+        return false;
+    }
+    m6502 c;
+    m6502_init(&c);
+    c.pc = WORKLOADS[w].start_pc;
+    double mean = 0;
+    uint64_t cyc = 0;
+    bool ok = true;
+
+    for (int rep = 0; rep < repetitions; rep++) {
+        for (size_t lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            m6502_lockstep_set_cpu(ls, lane, &c);
+        }
+        m6502_lockstep_load(ls, WORKLOADS[w].load_addr, images[w],
+            image_sizes[w]);
+
+        const double start = now_ns();
+        m6502_lockstep_run(ls, UINT64_MAX, WORKLOADS[w].exit_flags);
+        mean += now_ns() - start;
+
+        cyc = 0;
+        for (size_t lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            const m6502_run_result r = m6502_lockstep_result(ls, lane);
+            memory[0x30] = m6502_lockstep_read(ls, lane, 0x30);
+            memory[0x31] = m6502_lockstep_read(ls, lane, 0x31);
+            ok = ok && r.exit == M6502_EXIT_TRAP && check_multiply();
+            cyc += r.cyc;
+        }
+    }
+    mean /= repetitions;
+    m6502_lockstep_destroy(ls);
+
+    const double mhz = cyc / mean * 1e3;
+    fprintf(stderr, "%s (%d lanes): %s, %.1f MHz\n", LOCKSTEP_NAME,
+        LOCKSTEP_LANES, ok ? "ok" : "FAILED", mhz);
+    printf("    {\"lanes\": %d, \"status\": \"%s\", \"cycles\": %" PRIu64 ", "
+        "\"mhz\": %.3f, \"time_ns\": {\"mean\": %.0f}}", LOCKSTEP_LANES,
+        ok ? "ok" : "failed", cyc, mhz, mean);
+    return ok;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-r repetitions] [-w warmup] [-f filter] "
+        "[-j threads]\n"
+        "  -r  timed samples per workload (default: 5)\n"
+        "  -w  untimed executions before the samples (default: 1)\n"
+        "  -f  only run the workloads whose name contains filter\n"
+        "  -j  maximum number of threads of the pool benchmark (default: "
+        "one per CPU)\n", name);
+}
+
+int main(int argc, char** argv) {
+    int repetitions = 5;
+    int warmup = 1;
+    const char* filter = NULL;
+    long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-r") == 0) {
+            repetitions = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-w") == 0) {
+            warmup = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-f") == 0) {
+            filter = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-j") == 0) {
+            max_threads = atol(argv[++i]);
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (max_threads < 1) {
+        max_threads = 1;
+    }
+    if (repetitions < 1 || repetitions > MAX_REPETITIONS || warmup < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    decode_cache = malloc(M6502_DECODE_CACHE_SIZE * sizeof(m6502_decoded));
+    bool allocated = decode_cache != NULL;
+    jit = m6502_jit_create(0);
+    for (size_t w = 0; w < NB_WORKLOADS; w++) {
+        if (WORKLOADS[w].filename != NULL) {
+            images[w] = load_file(WORKLOADS[w].filename, &image_sizes[w]);
+            if (images[w] != NULL &&
+                    WORKLOADS[w].load_addr + image_sizes[w] > MEMORY_SIZE) {
+                free(images[w]);
+                images[w] = NULL;
+            }
+        }
+        else {
+            images[w] = malloc(WORKLOADS[w].kernel_size);
+            if (images[w] == NULL) {
+                allocated = false;
+                continue;
+            }
+            memcpy(images[w], WORKLOADS[w].kernel, WORKLOADS[w].kernel_size);
+            image_sizes[w] = WORKLOADS[w].kernel_size;
+        }
+    }
+    if (!allocated) {
+        fprintf(stderr, "error: out of memory\n");
+        for (size_t w = 0; w < NB_WORKLOADS; w++) {
+            free(images[w]);
+        }
+        free(decode_cache);
+        m6502_jit_destroy(jit);
+        return 1;
+    }
+
+    bool ok = true;
+    bool first = true;
+    printf("{\"repetitions\": %d, \"warmup\": %d, \"results\": [\n",
+        repetitions, warmup);
+    for (size_t w = 0; w < NB_WORKLOADS; w++) {
+        if (filter != NULL && strstr(WORKLOADS[w].name, filter) == NULL) {
+            continue;
+        }
+        for (int mode = 0; mode < NB_MEMORY_MODES; mode++) {
+            ok = bench(w, mode, repetitions, warmup, first) && ok;
+            first = false;
+        }
+    }
+    printf("\n], \"pool\": [\n");
+    if (filter == NULL || strstr(POOL_NAME, filter) != NULL) {
+        ok = bench_pool(repetitions, max_threads) && ok;
+    }
+    printf("\n], \"lockstep\": [\n");
+    if (filter == NULL || strstr(LOCKSTEP_NAME, filter) != NULL) {
+        ok = bench_lockstep(repetitions) && ok;
+    }
+    printf("\n]}\n");
+
+    for (size_t w = 0; w < NB_WORKLOADS; w++) {
+        free(images[w]);
+    }
+    free(decode_cache);
+    m6502_jit_destroy(jit);
+
+    return ok ? 0 : 1;
+}
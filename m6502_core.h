@@ -0,0 +1,656 @@
+// the instruction set, included by m6502.c once per CPU variant.
+// Before including this file, define:
+// - CORE_NAME: the name of the run function to generate
+// - CORE_VARIANT: a constant combination of the VARIANT_* flags
+// - CORE_DECODED: 1 to take the instructions from the decode cache rather
+//   than reading them from memory
+// so that each generated core only contains the opcodes of its variant and
+// no mode checks on the hot path.
+//
+// With THREADED_CORE, every handler ends with its own dispatch to the next
+// instruction through a table of label addresses (computed goto), instead
+// of going back to a single switch: OP() and NEXT expand to either form.
+
+#if THREADED_CORE
+#define OP(opcode) op_##opcode
+#define NEXT \
+    END_INSTRUCTION(); \
+    BEGIN_INSTRUCTION(); \
+    goto *dispatch[opcode]
+#else
+#define OP(opcode) case opcode
+#define NEXT break
+#endif
+
+// OPERAND8 and OPERAND16 return the operand of the instruction (an
+// immediate operand is fetched like the others, so it doesn't trigger the
+// read watchpoints), and SKIP_OPERAND skips the unused operand of a NOP.
+// The decoded cores advance pc by the constant length of each handler's
+// operand, as the others do: adding the length of the cached instruction
+// would make the lookup of each instruction wait for the previous one.
+#if CORE_DECODED
+#define OPERAND8 (c->pc += 1, next_operand_byte(&operand))
+#define OPERAND16 (c->pc += 2, operand)
+#define SKIP_OPERAND(length) c->pc += (length)
+#else
+#define OPERAND8 m6502_fetch(c, c->pc++)
+#define OPERAND16 fetch_word(c)
+#define SKIP_OPERAND(length) c->pc += (length)
+#endif
+
+// with PROFILE, the cycles of each instruction are counted from its start
+// (without the idle loop iterations skipped) and recorded once it ends
+#if PROFILE
+#define PROFILE_BEGIN() instruction_cyc = c->cyc
+#define PROFILE_SKIP(cycles) instruction_cyc += (cycles)
+#define PROFILE_END() \
+    if (c->profile != NULL) { \
+        profile_instruction(c, opcodes, opcode, pc, \
+            c->cyc - instruction_cyc); \
+    }
+#else
+#define PROFILE_BEGIN()
+#define PROFILE_SKIP(cycles) (void) (cycles)
+#define PROFILE_END()
+#endif
+
+// with TRACE, each instruction is recorded once its opcode is fetched
+#if TRACE
+#define TRACE_INSTRUCTION() \
+    if (c->trace != NULL) { \
+        trace_instruction(c, pc, opcode); \
+    }
+#else
+#define TRACE_INSTRUCTION()
+#endif
+
+// leaves the run if the budget is consumed, takes the signals (leaving the
+// run for those handled by m6502_run), then leaves the run if the CPU is
+// stopped
+#define CHECK_RUN() \
+    if (c->cyc - start_cyc >= cycle_budget) { \
+        goto done; \
+    } \
+    if (peek_signals(c) != 0 && poll_signals(c, CORE_VARIANT)) { \
+        result.exit = M6502_EXIT_SIGNAL; \
+        goto done; \
+    } \
+    if (c->stop || c->wait) { \
+        result.exit = M6502_EXIT_STOP; \
+        goto done; \
+    } \
+    pc = c->pc
+
+// fetches the next instruction (the pages holding execution breakpoints
+// are never decoded, the plain core checks them before the fetch)
+#if CORE_DECODED
+#define BEGIN_INSTRUCTION() \
+    CHECK_RUN(); \
+    decoded = decode_cache[pc]; \
+    if (decoded.length == 0) { \
+        if (!decode_block(c, pc, CORE_VARIANT)) { \
+            result.exit = EXIT_NOT_DECODED; \
+            goto done; \
+        } \
+        decoded = decode_cache[pc]; \
+    } \
+    opcode = decoded.opcode; \
+    operand = decoded.operand; \
+    c->pc += 1; \
+    TRACE_INSTRUCTION(); \
+    PROFILE_BEGIN(); \
+    c->cyc += decoded.cycles; \
+    c->page_crossed = 0
+#else
+#define BEGIN_INSTRUCTION() \
+    CHECK_RUN(); \
+    if (c->fetch_pages[pc >> 8] == NULL && \
+            (c->page_flags[pc >> 8] & PAGE_BREAK_EXEC) && \
+            break_exec(c, pc)) { \
+        result.exit = M6502_EXIT_BREAK; \
+        goto done; \
+    } \
+    opcode = m6502_fetch(c, c->pc++); \
+    TRACE_INSTRUCTION(); \
+    PROFILE_BEGIN(); \
+    c->cyc += opcodes[opcode].cycles; \
+    c->page_crossed = 0
+#endif
+
+// after a jump or branch: if it went backwards, skips the iterations of the
+// loop it closes when the loop is idle (a self-loop is left to
+// M6502_EXIT_TRAP), or hands the run over to the recompiler once the loop
+// is compiled
+#define IDLE_LOOP() \
+    if (c->pc <= pc && \
+            !(c->pc == pc && (exit_flags & M6502_EXIT_TRAP))) { \
+        PROFILE_SKIP(skip_idle_loop(c, &idle, pc, &result.instructions, \
+            end_cyc, opcodes)); \
+        JIT_LOOP(); \
+    }
+
+#if CORE_DECODED && JIT
+#define JIT_LOOP() \
+    if (c->jit != NULL && !(exit_flags & EXIT_STEP) && \
+            jit_hot(c, pc, exit_flags, CORE_VARIANT)) { \
+        exit_flags |= EXIT_JIT; \
+    }
+#else
+#define JIT_LOOP()
+#endif
+
+// accounts for the instruction that just executed and checks the exit
+// conditions
+#define END_INSTRUCTION() \
+    /* on certain instructions, if a page is crossed; the instruction */ \
+    /* takes additional cycles to execute: */ \
+    if (c->page_crossed) { \
+        c->cyc += opcodes[opcode].page_crossed_cycles; \
+    } \
+    PROFILE_END(); \
+    result.instructions += 1; \
+    if ((exit_flags & M6502_EXIT_PC) && c->pc == c->exit_pc) { \
+        result.exit = M6502_EXIT_PC; \
+        goto done; \
+    } \
+    if ((exit_flags & M6502_EXIT_TRAP) && c->pc == pc) { \
+        result.exit = M6502_EXIT_TRAP; \
+        goto done; \
+    } \
+    if (exit_flags & (EXIT_STEP | EXIT_JIT)) { \
+        result.exit = exit_flags & EXIT_JIT; \
+        goto done; \
+    }
+
+static m6502_run_result CORE_NAME(m6502* const c, uint64_t cycle_budget,
+        int exit_flags) {
+#if CORE_VARIANT & VARIANT_CMOS
+    const m6502_opcode* const opcodes = OPCODES_65C02;
+#else
+    const m6502_opcode* const opcodes = OPCODES_6502;
+#endif
+#if CORE_DECODED
+    const m6502_decoded* const decode_cache = c->decode_cache;
+    m6502_decoded decoded;
+    uint16_t operand;
+#endif
+    m6502_run_result result = {0, 0, 0};
+    const uint64_t start_cyc = c->cyc;
+    const uint64_t end_cyc = cycle_budget < UINT64_MAX - start_cyc
+        ? start_cyc + cycle_budget : UINT64_MAX;
+    idle_loop idle = {0, 1, 0, 0, 0, 0, -1}; // (no backward jump yet)
+#if PROFILE
+    uint64_t instruction_cyc = 0;
+#endif
+    uint16_t pc; // address of the current instruction
+    uint8_t opcode;
+
+#if THREADED_CORE
+    // L: opcode of both variants, C: 65C02 only
+#define L(opcode) &&op_##opcode
+#if CORE_VARIANT & VARIANT_CMOS
+#define C(opcode) &&op_##opcode
+#else
+#define C(opcode) &&op_invalid
+#endif
+    static const void* const dispatch[256] = {
+        L(0x00), L(0x01), C(0x02), C(0x03), C(0x04), L(0x05), L(0x06), C(0x07),
+        L(0x08), L(0x09), L(0x0A), C(0x0B), C(0x0C), L(0x0D), L(0x0E), C(0x0F),
+        L(0x10), L(0x11), C(0x12), C(0x13), C(0x14), L(0x15), L(0x16), C(0x17),
+        L(0x18), L(0x19), C(0x1A), C(0x1B), C(0x1C), L(0x1D), L(0x1E), C(0x1F),
+        L(0x20), L(0x21), C(0x22), C(0x23), L(0x24), L(0x25), L(0x26), C(0x27),
+        L(0x28), L(0x29), L(0x2A), C(0x2B), L(0x2C), L(0x2D), L(0x2E), C(0x2F),
+        L(0x30), L(0x31), C(0x32), C(0x33), C(0x34), L(0x35), L(0x36), C(0x37),
+        L(0x38), L(0x39), C(0x3A), C(0x3B), C(0x3C), L(0x3D), L(0x3E), C(0x3F),
+        L(0x40), L(0x41), C(0x42), C(0x43), C(0x44), L(0x45), L(0x46), C(0x47),
+        L(0x48), L(0x49), L(0x4A), C(0x4B), L(0x4C), L(0x4D), L(0x4E), C(0x4F),
+        L(0x50), L(0x51), C(0x52), C(0x53), C(0x54), L(0x55), L(0x56), C(0x57),
+        L(0x58), L(0x59), C(0x5A), C(0x5B), C(0x5C), L(0x5D), L(0x5E), C(0x5F),
+        L(0x60), L(0x61), C(0x62), C(0x63), C(0x64), L(0x65), L(0x66), C(0x67),
+        L(0x68), L(0x69), L(0x6A), C(0x6B), L(0x6C), L(0x6D), L(0x6E), C(0x6F),
+        L(0x70), L(0x71), C(0x72), C(0x73), C(0x74), L(0x75), L(0x76), C(0x77),
+        L(0x78), L(0x79), C(0x7A), C(0x7B), C(0x7C), L(0x7D), L(0x7E), C(0x7F),
+        C(0x80), L(0x81), C(0x82), C(0x83), L(0x84), L(0x85), L(0x86), C(0x87),
+        L(0x88), C(0x89), L(0x8A), C(0x8B), L(0x8C), L(0x8D), L(0x8E), C(0x8F),
+        L(0x90), L(0x91), C(0x92), C(0x93), L(0x94), L(0x95), L(0x96), C(0x97),
+        L(0x98), L(0x99), L(0x9A), C(0x9B), C(0x9C), L(0x9D), C(0x9E), C(0x9F),
+        L(0xA0), L(0xA1), L(0xA2), C(0xA3), L(0xA4), L(0xA5), L(0xA6), C(0xA7),
+        L(0xA8), L(0xA9), L(0xAA), C(0xAB), L(0xAC), L(0xAD), L(0xAE), C(0xAF),
+        L(0xB0), L(0xB1), C(0xB2), C(0xB3), L(0xB4), L(0xB5), L(0xB6), C(0xB7),
+        L(0xB8), L(0xB9), L(0xBA), C(0xBB), L(0xBC), L(0xBD), L(0xBE), C(0xBF),
+        L(0xC0), L(0xC1), C(0xC2), C(0xC3), L(0xC4), L(0xC5), L(0xC6), C(0xC7),
+        L(0xC8), L(0xC9), L(0xCA), C(0xCB), L(0xCC), L(0xCD), L(0xCE), C(0xCF),
+        L(0xD0), L(0xD1), C(0xD2), C(0xD3), C(0xD4), L(0xD5), L(0xD6), C(0xD7),
+        L(0xD8), L(0xD9), C(0xDA), C(0xDB), C(0xDC), L(0xDD), L(0xDE), C(0xDF),
+        L(0xE0), L(0xE1), C(0xE2), C(0xE3), L(0xE4), L(0xE5), L(0xE6), C(0xE7),
+        L(0xE8), L(0xE9), L(0xEA), C(0xEB), L(0xEC), L(0xED), L(0xEE), C(0xEF),
+        L(0xF0), L(0xF1), C(0xF2), C(0xF3), C(0xF4), L(0xF5), L(0xF6), C(0xF7),
+        L(0xF8), L(0xF9), C(0xFA), C(0xFB), C(0xFC), L(0xFD), L(0xFE), C(0xFF)
+    };
+#undef L
+#undef C
+
+    BEGIN_INSTRUCTION();
+    goto *dispatch[opcode];
+    {
+#else
+    for (;;) {
+        BEGIN_INSTRUCTION();
+
+        switch (opcode) {
+#endif
+        // storage
+        OP(0xA9): m6502_ldr(c, &c->a, OPERAND8); NEXT; // LDA IMM
+        OP(0xA5): m6502_ldr_addr(c, &c->a, ZPG(OPERAND8)); NEXT; // LDA ZPG
+        OP(0xB5): m6502_ldr_addr(c, &c->a, ZPX(c, OPERAND8)); NEXT; // LDA ZPX
+        OP(0xAD): m6502_ldr_addr(c, &c->a, ABS(OPERAND16)); NEXT; // LDA ABS
+        OP(0xBD): m6502_ldr_addr(c, &c->a, ABX(c, OPERAND16)); NEXT; // LDA ABX
+        OP(0xB9): m6502_ldr_addr(c, &c->a, ABY(c, OPERAND16)); NEXT; // LDA ABY
+        OP(0xA1): // LDA INX
+            m6502_ldr_addr(c, &c->a, INX(c, OPERAND8, CORE_VARIANT));
+        NEXT;
+        OP(0xB1): // LDA INY
+            m6502_ldr_addr(c, &c->a, INY(c, OPERAND8, CORE_VARIANT));
+        NEXT;
+
+        OP(0xA2): m6502_ldr(c, &c->x, OPERAND8); NEXT; // LDX IMM
+        OP(0xA6): m6502_ldr_addr(c, &c->x, ZPG(OPERAND8)); NEXT; // LDX ZPG
+        OP(0xB6): m6502_ldr_addr(c, &c->x, ZPY(c, OPERAND8)); NEXT; // LDX ZPY
+        OP(0xAE): m6502_ldr_addr(c, &c->x, ABS(OPERAND16)); NEXT; // LDX ABS
+        OP(0xBE): m6502_ldr_addr(c, &c->x, ABY(c, OPERAND16)); NEXT; // LDX ABY
+
+        OP(0xA0): m6502_ldr(c, &c->y, OPERAND8); NEXT; // LDY IMM
+        OP(0xA4): m6502_ldr_addr(c, &c->y, ZPG(OPERAND8)); NEXT; // LDY ZPG
+        OP(0xB4): m6502_ldr_addr(c, &c->y, ZPX(c, OPERAND8)); NEXT; // LDY ZPX
+        OP(0xAC): m6502_ldr_addr(c, &c->y, ABS(OPERAND16)); NEXT; // LDY ABS
+        OP(0xBC): m6502_ldr_addr(c, &c->y, ABX(c, OPERAND16)); NEXT; // LDY ABX
+
+        OP(0x85): m6502_wb(c, ZPG(OPERAND8), c->a); NEXT; // STA ZPG
+        OP(0x95): m6502_wb(c, ZPX(c, OPERAND8), c->a); NEXT; // STA ZPX
+        OP(0x8D): m6502_wb(c, ABS(OPERAND16), c->a); NEXT; // STA ABS
+        OP(0x9D): m6502_wb(c, ABX(c, OPERAND16), c->a); NEXT; // STA ABX
+        OP(0x99): m6502_wb(c, ABY(c, OPERAND16), c->a); NEXT; // STA ABY
+        OP(0x81): // STA INX
+            m6502_wb(c, INX(c, OPERAND8, CORE_VARIANT), c->a);
+        NEXT;
+        OP(0x91): // STA INY
+            m6502_wb(c, INY(c, OPERAND8, CORE_VARIANT), c->a);
+        NEXT;
+
+        OP(0x86): m6502_wb(c, ZPG(OPERAND8), c->x); NEXT; // STX ZPG
+        OP(0x96): m6502_wb(c, ZPY(c, OPERAND8), c->x); NEXT; // STX ZPY
+        OP(0x8E): m6502_wb(c, ABS(OPERAND16), c->x); NEXT; // STX ABS
+
+        OP(0x84): m6502_wb(c, ZPG(OPERAND8), c->y); NEXT; // STY ZPG
+        OP(0x94): m6502_wb(c, ZPX(c, OPERAND8), c->y); NEXT; // STY ZPX
+        OP(0x8C): m6502_wb(c, ABS(OPERAND16), c->y); NEXT; // STY ABS
+
+        OP(0xAA): c->x = c->a; set_zn(c, c->x); NEXT; // TAX
+        OP(0xA8): c->y = c->a; set_zn(c, c->y); NEXT; // TAY
+        OP(0xBA): c->x = c->sp; set_zn(c, c->x); NEXT; // TSX
+        OP(0x8A): c->a = c->x; set_zn(c, c->a); NEXT; // TXA
+        OP(0x9A): c->sp = c->x; NEXT; // TXS
+        OP(0x98): c->a = c->y; set_zn(c, c->a); NEXT; // TYA
+
+        // math
+        OP(0x69): m6502_adc(c, OPERAND8, CORE_VARIANT); NEXT; // ADC IMM
+        OP(0x65): // ADC ZPG
+            m6502_adc_addr(c, ZPG(OPERAND8), CORE_VARIANT);
+        NEXT;
+        OP(0x75): // ADC ZPX
+            m6502_adc_addr(c, ZPX(c, OPERAND8), CORE_VARIANT);
+        NEXT;
+        OP(0x6D): // ADC ABS
+            m6502_adc_addr(c, ABS(OPERAND16), CORE_VARIANT);
+        NEXT;
+        OP(0x7D): // ADC ABX
+            m6502_adc_addr(c, ABX(c, OPERAND16), CORE_VARIANT);
+        NEXT;
+        OP(0x79): // ADC ABY
+            m6502_adc_addr(c, ABY(c, OPERAND16), CORE_VARIANT);
+        NEXT;
+        OP(0x61): // ADC INX
+            m6502_adc_addr(c, INX(c, OPERAND8, CORE_VARIANT), CORE_VARIANT);
+        NEXT;
+        OP(0x71): // ADC INY
+            m6502_adc_addr(c, INY(c, OPERAND8, CORE_VARIANT), CORE_VARIANT);
+        NEXT;
+
+        OP(0xC6): m6502_dec_addr(c, ZPG(OPERAND8)); NEXT; // DEC ZPG
+        OP(0xD6): m6502_dec_addr(c, ZPX(c, OPERAND8)); NEXT; // DEC ZPX
+        OP(0xCE): m6502_dec_addr(c, ABS(OPERAND16)); NEXT; // DEC ABS
+        OP(0xDE): m6502_dec_addr(c, ABX(c, OPERAND16)); NEXT; // DEC ABX
+        OP(0xCA): m6502_der(c, &c->x); NEXT; // DEX
+        OP(0x88): m6502_der(c, &c->y); NEXT; // DEY
+
+        OP(0xE6): m6502_inc_addr(c, ZPG(OPERAND8)); NEXT; // INC ZPG
+        OP(0xF6): m6502_inc_addr(c, ZPX(c, OPERAND8)); NEXT; // INC ZPX
+        OP(0xEE): m6502_inc_addr(c, ABS(OPERAND16)); NEXT; // INC ABS
+        OP(0xFE): m6502_inc_addr(c, ABX(c, OPERAND16)); NEXT; // INC ABX
+        OP(0xE8): m6502_inr(c, &c->x); NEXT; // INX
+        OP(0xC8): m6502_inr(c, &c->y); NEXT; // INY
+
+        OP(0xE9): m6502_sbc(c, OPERAND8, CORE_VARIANT); NEXT; // SBC IMM
+        OP(0xE5): // SBC ZPG
+            m6502_sbc_addr(c, ZPG(OPERAND8), CORE_VARIANT);
+        NEXT;
+        OP(0xF5): // SBC ZPX
+            m6502_sbc_addr(c, ZPX(c, OPERAND8), CORE_VARIANT);
+        NEXT;
+        OP(0xED): // SBC ABS
+            m6502_sbc_addr(c, ABS(OPERAND16), CORE_VARIANT);
+        NEXT;
+        OP(0xFD): // SBC ABX
+            m6502_sbc_addr(c, ABX(c, OPERAND16), CORE_VARIANT);
+        NEXT;
+        OP(0xF9): // SBC ABY
+            m6502_sbc_addr(c, ABY(c, OPERAND16), CORE_VARIANT);
+        NEXT;
+        OP(0xE1): // SBC INX
+            m6502_sbc_addr(c, INX(c, OPERAND8, CORE_VARIANT), CORE_VARIANT);
+        NEXT;
+        OP(0xF1): // SBC INY
+            m6502_sbc_addr(c, INY(c, OPERAND8, CORE_VARIANT), CORE_VARIANT);
+        NEXT;
+
+        // bitwise
+        OP(0x29): m6502_and(c, OPERAND8); NEXT; // AND IMM
+        OP(0x25): m6502_and_addr(c, ZPG(OPERAND8)); NEXT; // AND ZPG
+        OP(0x35): m6502_and_addr(c, ZPX(c, OPERAND8)); NEXT; // AND ZPX
+        OP(0x2D): m6502_and_addr(c, ABS(OPERAND16)); NEXT; // AND ABS
+        OP(0x3D): m6502_and_addr(c, ABX(c, OPERAND16)); NEXT; // AND ABX
+        OP(0x39): m6502_and_addr(c, ABY(c, OPERAND16)); NEXT; // AND ABY
+        OP(0x21): // AND INX
+            m6502_and_addr(c, INX(c, OPERAND8, CORE_VARIANT));
+        NEXT;
+        OP(0x31): // AND INY
+            m6502_and_addr(c, INY(c, OPERAND8, CORE_VARIANT));
+        NEXT;
+
+        OP(0x0A): c->a = m6502_asl(c, c->a); NEXT; // ASL ACC
+        OP(0x06): m6502_asl_addr(c, ZPG(OPERAND8)); NEXT; // ASL ZPG
+        OP(0x16): m6502_asl_addr(c, ZPX(c, OPERAND8)); NEXT; // ASL ZPX
+        OP(0x0E): m6502_asl_addr(c, ABS(OPERAND16)); NEXT; // ASL ABS
+        OP(0x1E): m6502_asl_addr(c, ABX(c, OPERAND16)); NEXT; // ASL ABX
+
+        OP(0x24): m6502_bit(c, ZPG(OPERAND8)); NEXT; // BIT ZPG
+        OP(0x2C): m6502_bit(c, ABS(OPERAND16)); NEXT; // BIT ABS
+
+        OP(0x49): m6502_eor(c, OPERAND8); NEXT; // EOR IMM
+        OP(0x45): m6502_eor_addr(c, ZPG(OPERAND8)); NEXT; // EOR ZPG
+        OP(0x55): m6502_eor_addr(c, ZPX(c, OPERAND8)); NEXT; // EOR ZPX
+        OP(0x4D): m6502_eor_addr(c, ABS(OPERAND16)); NEXT; // EOR ABS
+        OP(0x5D): m6502_eor_addr(c, ABX(c, OPERAND16)); NEXT; // EOR ABX
+        OP(0x59): m6502_eor_addr(c, ABY(c, OPERAND16)); NEXT; // EOR ABY
+        OP(0x41): // EOR INX
+            m6502_eor_addr(c, INX(c, OPERAND8, CORE_VARIANT));
+        NEXT;
+        OP(0x51): // EOR INY
+            m6502_eor_addr(c, INY(c, OPERAND8, CORE_VARIANT));
+        NEXT;
+
+        OP(0x4A): c->a = m6502_lsr(c, c->a); NEXT; // LSR ACC
+        OP(0x46): m6502_lsr_addr(c, ZPG(OPERAND8)); NEXT; // LSR ZPG
+        OP(0x56): m6502_lsr_addr(c, ZPX(c, OPERAND8)); NEXT; // LSR ZPX
+        OP(0x4E): m6502_lsr_addr(c, ABS(OPERAND16)); NEXT; // LSR ABS
+        OP(0x5E): m6502_lsr_addr(c, ABX(c, OPERAND16)); NEXT; // LSR ABX
+
+        OP(0x09): m6502_ora(c, OPERAND8); NEXT; // ORA IMM
+        OP(0x05): m6502_ora_addr(c, ZPG(OPERAND8)); NEXT; // ORA ZPG
+        OP(0x15): m6502_ora_addr(c, ZPX(c, OPERAND8)); NEXT; // ORA ZPX
+        OP(0x0D): m6502_ora_addr(c, ABS(OPERAND16)); NEXT; // ORA ABS
+        OP(0x1D): m6502_ora_addr(c, ABX(c, OPERAND16)); NEXT; // ORA ABX
+        OP(0x19): m6502_ora_addr(c, ABY(c, OPERAND16)); NEXT; // ORA ABY
+        OP(0x01): // ORA IMM
+            m6502_ora_addr(c, INX(c, OPERAND8, CORE_VARIANT));
+        NEXT;
+        OP(0x11): // ORA IMM
+            m6502_ora_addr(c, INY(c, OPERAND8, CORE_VARIANT));
+        NEXT;
+
+        OP(0x2A): c->a = m6502_rol(c, c->a); NEXT; // ROL ACC
+        OP(0x26): m6502_rol_addr(c, ZPG(OPERAND8)); NEXT; // ROL ZPG
+        OP(0x36): m6502_rol_addr(c, ZPX(c, OPERAND8)); NEXT; // ROL ZPX
+        OP(0x2E): m6502_rol_addr(c, ABS(OPERAND16)); NEXT; // ROL ABS
+        OP(0x3E): m6502_rol_addr(c, ABX(c, OPERAND16)); NEXT; // ROL ABX
+
+        OP(0x6A): c->a = m6502_ror(c, c->a); NEXT; // ROR ACC
+        OP(0x66): m6502_ror_addr(c, ZPG(OPERAND8)); NEXT; // ROR ZPG
+        OP(0x76): m6502_ror_addr(c, ZPX(c, OPERAND8)); NEXT; // ROR ZPX
+        OP(0x6E): m6502_ror_addr(c, ABS(OPERAND16)); NEXT; // ROR ABS
+        OP(0x7E): m6502_ror_addr(c, ABX(c, OPERAND16)); NEXT; // ROR ABX
+
+        // branch
+        OP(0x90): // BCC REL
+            m6502_branch(c, REL(OPERAND8), c->cf == 0);
+            IDLE_LOOP();
+        NEXT;
+        OP(0xB0): // BCS REL
+            m6502_branch(c, REL(OPERAND8), c->cf == 1);
+            IDLE_LOOP();
+        NEXT;
+        OP(0xD0): // BNE REL
+            m6502_branch(c, REL(OPERAND8), !get_zf(c));
+            IDLE_LOOP();
+        NEXT;
+        OP(0xF0): // BEQ REL
+            m6502_branch(c, REL(OPERAND8), get_zf(c));
+            IDLE_LOOP();
+        NEXT;
+        OP(0x10): // BPL REL
+            m6502_branch(c, REL(OPERAND8), !get_nf(c));
+            IDLE_LOOP();
+        NEXT;
+        OP(0x30): // BMI REL
+            m6502_branch(c, REL(OPERAND8), get_nf(c));
+            IDLE_LOOP();
+        NEXT;
+        OP(0x50): // BVC REL
+            m6502_branch(c, REL(OPERAND8), c->vf == 0);
+            IDLE_LOOP();
+        NEXT;
+        OP(0x70): // BVS REL
+            m6502_branch(c, REL(OPERAND8), c->vf == 1);
+            IDLE_LOOP();
+        NEXT;
+
+        // jump
+        OP(0x4C): m6502_jmp(c, ABS(OPERAND16)); IDLE_LOOP(); NEXT; // JMP
+        OP(0x6C): // JMP
+            m6502_jmp(c, m6502_rw_bug(c, ABS(OPERAND16), CORE_VARIANT));
+        NEXT;
+        OP(0x20): m6502_jsr(c, ABS(OPERAND16)); NEXT; // JSR
+        OP(0x40): m6502_rti(c); NEXT; // RTI
+        OP(0x60): m6502_rts(c); NEXT; // RTS
+
+        // registers
+        OP(0x38): c->cf = 1; NEXT; // SEC
+        OP(0x18): c->cf = 0; NEXT; // CLC
+        OP(0xF8): c->df = 1; NEXT; // SED
+        OP(0xD8): c->df = 0; NEXT; // CLD
+        OP(0x78): delay_idf(c); c->idf = 1; NEXT; // SEI
+        OP(0x58): delay_idf(c); c->idf = 0; NEXT; // CLI
+        OP(0xB8): c->vf = 0; NEXT; // CLV
+
+        OP(0xC9): m6502_cmp(c, OPERAND8, c->a); NEXT; // CMP IMM
+        OP(0xC5): m6502_cmp_addr(c, ZPG(OPERAND8), c->a); NEXT; // CMP ZPG
+        OP(0xD5): m6502_cmp_addr(c, ZPX(c, OPERAND8), c->a); NEXT; // CMP ZPX
+        OP(0xCD): m6502_cmp_addr(c, ABS(OPERAND16), c->a); NEXT; // CMP ABS
+        OP(0xDD): m6502_cmp_addr(c, ABX(c, OPERAND16), c->a); NEXT; // CMP ABX
+        OP(0xD9): m6502_cmp_addr(c, ABY(c, OPERAND16), c->a); NEXT; // CMP ABY
+        OP(0xC1): // CMP INX
+            m6502_cmp_addr(c, INX(c, OPERAND8, CORE_VARIANT), c->a);
+        NEXT;
+        OP(0xD1): // CMP INY
+            m6502_cmp_addr(c, INY(c, OPERAND8, CORE_VARIANT), c->a);
+        NEXT;
+        OP(0xE0): m6502_cmp(c, OPERAND8, c->x); NEXT; // CPX IMM
+        OP(0xE4): m6502_cmp_addr(c, ZPG(OPERAND8), c->x); NEXT; // CPX ZPG
+        OP(0xEC): m6502_cmp_addr(c, ABS(OPERAND16), c->x); NEXT; // CPX ABS
+        OP(0xC0): m6502_cmp(c, OPERAND8, c->y); NEXT; // CPY IMM
+        OP(0xC4): m6502_cmp_addr(c, ZPG(OPERAND8), c->y); NEXT; // CPY ZPG
+        OP(0xCC): m6502_cmp_addr(c, ABS(OPERAND16), c->y); NEXT; // CPY ABS
+
+        // stack
+        OP(0x48): push_byte(c, c->a); NEXT; // PHA
+        OP(0x68): c->a = pull_byte(c); set_zn(c, c->a); NEXT; // PLA
+        OP(0x08): c->bf = 1; push_byte(c, get_flags(c)); NEXT; // PHP
+        OP(0x28): delay_idf(c); set_flags(c, pull_byte(c)); NEXT; // PLP
+
+        // system
+        OP(0x00): // BRK
+            c->bf = 1;
+            c->pc += 1;
+            interrupt(c, 0xFFFE, CORE_VARIANT);
+        NEXT;
+        OP(0xEA): NEXT; // NOP
+
+#if CORE_VARIANT & VARIANT_CMOS
+        // 65C02 only
+        OP(0x80): // BRA REL
+            m6502_branch(c, REL(OPERAND8), 1);
+            IDLE_LOOP();
+        NEXT;
+
+        OP(0xDA): push_byte(c, c->x); NEXT; // PHX
+        OP(0xFA): c->x = pull_byte(c); set_zn(c, c->x); NEXT; // PLX
+        OP(0x5A): push_byte(c, c->y); NEXT; // PHY
+        OP(0x7A): c->y = pull_byte(c); set_zn(c, c->y); NEXT; // PLY
+
+        OP(0x9C): m6502_wb(c, ABS(OPERAND16), 0); NEXT; // STZ ABS
+        OP(0x9E): m6502_wb(c, ABX(c, OPERAND16), 0); NEXT; // STZ ABX
+        OP(0x64): m6502_wb(c, ZPG(OPERAND8), 0); NEXT; // STZ ZPG
+        OP(0x74): m6502_wb(c, ZPX(c, OPERAND8), 0); NEXT; // STZ ZPX
+
+        OP(0x1C): m6502_trb(c, ABS(OPERAND16)); NEXT; // TRB ABS
+        OP(0x14): m6502_trb(c, ZPG(OPERAND8)); NEXT; // TRB ZPG
+
+        OP(0x0C): m6502_tsb(c, ABS(OPERAND16)); NEXT; // TSB ABS
+        OP(0x04): m6502_tsb(c, ZPG(OPERAND8)); NEXT; // TSB ZPG
+
+        // BBR
+        OP(0x0F): OP(0x1F): OP(0x2F): OP(0x3F):
+        OP(0x4F): OP(0x5F): OP(0x6F): OP(0x7F): {
+            const uint8_t bit_no = opcode >> 4;
+            const uint8_t val = m6502_rb(c, ZPG(OPERAND8));
+            const int8_t addr = REL(OPERAND8);
+
+            m6502_branch(c, addr, ((val >> bit_no) & 1) == 0);
+            IDLE_LOOP();
+        } NEXT;
+
+        // BBS
+        OP(0x8F): OP(0x9F): OP(0xAF): OP(0xBF):
+        OP(0xCF): OP(0xDF): OP(0xEF): OP(0xFF): {
+            const uint8_t bit_no = (opcode >> 4) - 8;
+            const uint8_t val = m6502_rb(c, ZPG(OPERAND8));
+            const int8_t addr = REL(OPERAND8);
+
+            m6502_branch(c, addr, ((val >> bit_no) & 1) == 1);
+            IDLE_LOOP();
+        } NEXT;
+
+        // RMB
+        OP(0x07): OP(0x17): OP(0x27): OP(0x37):
+        OP(0x47): OP(0x57): OP(0x67): OP(0x77): {
+            const uint8_t bit_no = opcode >> 4;
+            const uint8_t addr = ZPG(OPERAND8);
+            uint8_t val = m6502_rb(c, addr);
+            val &= ~(1UL << bit_no);
+            m6502_wb(c, addr, val);
+        } NEXT;
+
+        // SMB
+        OP(0x87): OP(0x97): OP(0xA7): OP(0xB7):
+        OP(0xC7): OP(0xD7): OP(0xE7): OP(0xF7): {
+            const uint8_t bit_no = (opcode >> 4) - 8;
+            const uint8_t addr = ZPG(OPERAND8);
+            uint8_t val = m6502_rb(c, addr);
+            val |= (1 << bit_no);
+            m6502_wb(c, addr, val);
+        } NEXT;
+
+        OP(0xDB): c->stop = 1; NEXT; // STP
+        OP(0xCB): c->wait = 1; NEXT; // WAI
+
+        OP(0x72): // ADC INZ
+            m6502_adc_addr(c, INZ(c, OPERAND8), CORE_VARIANT);
+        NEXT;
+        OP(0x32): m6502_and_addr(c, INZ(c, OPERAND8)); NEXT; // AND INZ
+        OP(0x3C): m6502_bit(c, ABX(c, OPERAND16)); NEXT; // BIT ABX
+        OP(0x34): m6502_bit(c, ZPX(c, OPERAND8)); NEXT; // BIT ZPX
+        // when the BIT instruction is used with the immediate
+        // addressing mode, the n and v flags are unaffected.
+        OP(0x89): c->z_result = OPERAND8 & c->a; NEXT; // BIT IMM
+        OP(0xD2): m6502_cmp_addr(c, INZ(c, OPERAND8), c->a); NEXT; // CMP INZ
+        OP(0x3A): m6502_der(c, &c->a); NEXT; // DEA
+        OP(0x1A): m6502_inr(c, &c->a); NEXT; // INA
+        OP(0x52): m6502_eor_addr(c, INZ(c, OPERAND8)); NEXT; // EOR INZ
+        // JMP absolute indexed indirect
+        OP(0x7C): m6502_jmp(c, m6502_rw(c, ABS(OPERAND16) + c->x)); NEXT;
+        OP(0xB2): m6502_ldr_addr(c, &c->a, INZ(c, OPERAND8)); NEXT; // LDA INZ
+        OP(0x12): m6502_ora_addr(c, INZ(c, OPERAND8)); NEXT; // ORA INZ
+        OP(0xF2): // SBC INZ
+            m6502_sbc_addr(c, INZ(c, OPERAND8), CORE_VARIANT);
+        NEXT;
+        OP(0x92): m6502_wb(c, INZ(c, OPERAND8), c->a); NEXT; // STA INZ
+
+        // one-byte NOP
+        OP(0x03): OP(0x13): OP(0x23): OP(0x33): OP(0x43): OP(0x53):
+        OP(0x63): OP(0x73): OP(0x83): OP(0x93): OP(0xA3): OP(0xB3):
+        OP(0xC3): OP(0xD3): OP(0xE3): OP(0xF3):
+        OP(0x0B): OP(0x1B): OP(0x2B): OP(0x3B): OP(0x4B): OP(0x5B):
+        OP(0x6B): OP(0x7B): OP(0x8B): OP(0x9B): OP(0xAB): OP(0xBB):
+        OP(0xEB): OP(0xFB):
+        NEXT;
+
+        // two-bytes NOP
+        OP(0x02): OP(0x22): OP(0x42): OP(0x62): OP(0x82): OP(0xC2):
+        OP(0xE2): OP(0x44): OP(0x54): OP(0xD4): OP(0xF4):
+            SKIP_OPERAND(1);
+        NEXT;
+
+        // three-bytes NOP
+        OP(0x5C): OP(0xDC): OP(0xFC):
+            SKIP_OPERAND(2);
+        NEXT;
+
+#endif
+
+#if THREADED_CORE
+        // (every opcode has a handler in the 65C02 cores)
+        op_invalid: __attribute__((unused));
+#else
+        default:
+#endif
+            // treat invalid opcodes as NOPs
+        NEXT;
+#if !THREADED_CORE
+        }
+
+        END_INSTRUCTION();
+#endif
+    }
+
+done:
+    result.cyc = c->cyc - start_cyc;
+    return result;
+}
+
+#undef OP
+#undef NEXT
+#undef OPERAND8
+#undef OPERAND16
+#undef SKIP_OPERAND
+#undef CHECK_RUN
+#undef BEGIN_INSTRUCTION
+#undef IDLE_LOOP
+#undef JIT_LOOP
+#undef PROFILE_BEGIN
+#undef PROFILE_SKIP
+#undef PROFILE_END
+#undef TRACE_INSTRUCTION
+#undef END_INSTRUCTION
+#undef CORE_NAME
+#undef CORE_VARIANT
+#undef CORE_DECODED
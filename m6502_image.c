@@ -0,0 +1,153 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "m6502_image.h"
+
+#define MEMORY_SIZE 0x10000
+#define IMAGE_SIZE (M6502_IMAGE_MEMORY_OFFSET + MEMORY_SIZE)
+
+// image_header.flags
+#define IMAGE_65C02 1
+#define IMAGE_BCD 2
+#define IMAGE_STOP 4
+#define IMAGE_WAIT 8
+#define IMAGE_IDF_BEFORE 16
+#define IMAGE_NMI_LINE 32
+
+// header at the start of an image file (its fields are naturally aligned,
+// so that its layout doesn't depend on the compiler)
+typedef struct image_header {
+    char magic[8]; // M6502_IMAGE_MAGIC
+    uint32_t version; // M6502_IMAGE_VERSION
+    uint32_t memory_offset; // M6502_IMAGE_MEMORY_OFFSET
+    uint64_t cyc;
+    uint32_t signals;
+    uint16_t pc;
+    uint8_t a, x, y, sp;
+    uint8_t p; // status register
+    uint8_t flags; // IMAGE_*
+    uint8_t access[256]; // M6502_MAP_* access of each page
+} image_header;
+
+struct m6502_image {
+    uint8_t* data; // the whole file, mapped
+};
+
+bool m6502_image_save(const m6502* const c, const char* filename) {
+    image_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, M6502_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = M6502_IMAGE_VERSION;
+    header.memory_offset = M6502_IMAGE_MEMORY_OFFSET;
+    header.cyc = c->cyc;
+    header.signals = __atomic_load_n(&c->signals, __ATOMIC_ACQUIRE);
+    header.pc = c->pc;
+    header.a = c->a;
+    header.x = c->x;
+    header.y = c->y;
+    header.sp = c->sp;
+    header.p = m6502_get_flags(c);
+    header.flags = (c->m65c02_mode ? IMAGE_65C02 : 0) |
+        (c->enable_bcd ? IMAGE_BCD : 0) |
+        (c->stop ? IMAGE_STOP : 0) |
+        (c->wait ? IMAGE_WAIT : 0) |
+        (c->idf_before ? IMAGE_IDF_BEFORE : 0) |
+        (__atomic_load_n(&c->nmi_line, __ATOMIC_RELAXED)
+            ? IMAGE_NMI_LINE : 0);
+    for (unsigned page = 0; page < 256; page++) {
+        // (an image holds a single copy of each page)
+        if (c->read_map[page] != NULL && c->write_map[page] != NULL &&
+                c->read_map[page] != c->write_map[page]) {
+            return false;
+        }
+        header.access[page] = m6502_page_access(c, page);
+    }
+
+    FILE* f = fopen(filename, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fseek(f, M6502_IMAGE_MEMORY_OFFSET, SEEK_SET) == 0;
+    static const uint8_t zeros[256];
+    for (unsigned page = 0; ok && page < 256; page++) {
+        const uint8_t* const mem = c->read_map[page] != NULL
+            ? c->read_map[page] : c->write_map[page];
+        ok = fwrite(mem != NULL ? mem : zeros, 256, 1, f) == 1;
+    }
+    return fclose(f) == 0 && ok;
+}
+
+m6502_image* m6502_image_load(m6502* const c, const char* filename) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    void* const data = fstat(fd, &st) == 0 && st.st_size >= IMAGE_SIZE
+        ? mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    image_header header;
+    memcpy(&header, data, sizeof(header));
+    m6502_image* const image = malloc(sizeof(m6502_image));
+    if (image == NULL ||
+            memcmp(header.magic, M6502_IMAGE_MAGIC,
+            sizeof(header.magic)) != 0 ||
+            header.version != M6502_IMAGE_VERSION ||
+            header.memory_offset != M6502_IMAGE_MEMORY_OFFSET) {
+        free(image);
+        munmap(data, IMAGE_SIZE);
+        return NULL;
+    }
+    image->data = data;
+
+    c->cyc = header.cyc;
+    c->pc = header.pc;
+    c->a = header.a;
+    c->x = header.x;
+    c->y = header.y;
+    c->sp = header.sp;
+    m6502_set_flags(c, header.p);
+    c->m65c02_mode = header.flags & IMAGE_65C02;
+    c->enable_bcd = header.flags & IMAGE_BCD;
+    c->stop = header.flags & IMAGE_STOP;
+    c->wait = header.flags & IMAGE_WAIT;
+    c->idf_before = header.flags & IMAGE_IDF_BEFORE;
+    __atomic_store_n(&c->nmi_line, (header.flags & IMAGE_NMI_LINE) != 0,
+        __ATOMIC_RELAXED);
+    __atomic_store_n(&c->signals, header.signals, __ATOMIC_RELEASE);
+
+    // (the pages which weren't mapped go to the callbacks)
+    m6502_unmap(c, 0, MEMORY_SIZE);
+    uint8_t* const memory = m6502_image_memory(image);
+    for (unsigned page = 0; page < 256; page++) {
+        if (header.access[page] != 0) {
+            m6502_map(c, page << 8, 256, &memory[page << 8],
+                header.access[page]);
+        }
+    }
+    return image;
+}
+
+void m6502_image_close(m6502_image* image) {
+    if (image != NULL) {
+        munmap(image->data, IMAGE_SIZE);
+        free(image);
+    }
+}
+
+uint8_t* m6502_image_memory(m6502_image* image) {
+    return image->data + M6502_IMAGE_MEMORY_OFFSET;
+}
@@ -0,0 +1,39 @@
+#ifndef M6502_M6502_IMAGE_H_
+#define M6502_M6502_IMAGE_H_
+
+#include "m6502.h"
+
+// warm-start images: files holding the state of a CPU and its 64K of
+// memory, to start programs from a state reached after a long boot instead
+// of running it again. An image starts with a header (M6502_IMAGE_MAGIC,
+// version, registers, flags, cycle count, interrupt state and the access
+// of each page, in the byte order of the host), followed by the memory at
+// offset M6502_IMAGE_MEMORY_OFFSET, so that it can be mapped as it is.
+#define M6502_IMAGE_MAGIC "M6502IMG"
+#define M6502_IMAGE_VERSION 2
+#define M6502_IMAGE_MEMORY_OFFSET 0x10000 // (a multiple of the host pages)
+
+typedef struct m6502_image m6502_image;
+
+// writes the state of a CPU and its mapped pages to an image file, or
+// returns false if it can't be written or if a page is mapped to different
+// memory for reads and writes (e.g. a ROM with a RAM shadow). Pages
+// accessed through read_byte/write_byte are saved as zeros and aren't
+// mapped on loading.
+bool m6502_image_save(const m6502* const c, const char* filename);
+
+// maps an image file copy-on-write, so that its memory pages are only read
+// from the file when they are first accessed and changes to them stay
+// private, then sets the state of the CPU from it and maps its pages with
+// the access they were saved with (the other pages are unmapped). Returns
+// NULL if the file can't be mapped or isn't an image of this version. The
+// other fields of the CPU (e.g. the callbacks, exit_pc or the decode cache)
+// are left untouched.
+m6502_image* m6502_image_load(m6502* const c, const char* filename);
+// unmaps an image (the pages of the CPUs mapped to it must be unmapped)
+void m6502_image_close(m6502_image* image);
+
+// the 64K of memory of a loaded image
+uint8_t* m6502_image_memory(m6502_image* image);
+
+#endif // M6502_M6502_IMAGE_H_
@@ -0,0 +1,1157 @@
+// the x86-64 recompiler, included by m6502.c when JIT is set (see
+// m6502_set_jit).
+//
+// The decoded cores count the backward jumps to each address: once a loop
+// has been entered JIT_HOT times, the block at its start is translated into
+// host code, and the core hands the run over to run_jit, which executes the
+// compiled blocks (compiling those entered JIT_HOT times too) until it
+// reaches one it can't run, then returns to the core. A block is the
+// straight-line run of decoded instructions starting at an address, up to
+// its first branch or jump, the end of its page, or an instruction left to
+// the cores (BRK, RTI, JMP indirect, the I flag changes, the 65C02 bit
+// instructions, STP and WAI).
+//
+// Within a block, A, X, Y, SP, the flags and the cycle counter stay in host
+// registers, and the cycles are counted as the cores do. A branch back to
+// the start of its block loops in host code while the budget allows another
+// iteration and no signal is pending. Memory is accessed through read_pages
+// and write_pages: when the page of an access is NULL (I/O and callback
+// pages, watchpoints, pages holding decoded instructions or tracked by a
+// snapshot), as well as on ADC and SBC in decimal mode, the block leaves
+// before the instruction, which the core executes (a block leaving this way
+// JIT_SIDE_EXITS times in a row is left to the cores). So the host code never
+// calls back the host nor writes over instructions, and a write to a block
+// through the cores or m6502_invalidate discards it along with its decoded
+// instructions (see invalidate_page).
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// default size of the code arena
+#define JIT_CODE_SIZE (4 << 20)
+// largest host code of a block: the arena is flushed when less is left
+#define JIT_BLOCK_SIZE 16384
+// instructions translated at most in a block
+#define JIT_BLOCK_INSTRUCTIONS 64
+// side exits of an instruction at most
+#define JIT_INSTRUCTION_EXITS 4
+// entries into a block (backward jumps, then exits of other blocks) before
+// it is compiled
+#define JIT_HOT 16
+// hits of a block which can't be compiled
+#define JIT_NEVER UINT16_MAX
+// side exits taken in a row before a compiled block is left to the cores
+// (e.g. a loop polling an I/O register)
+#define JIT_SIDE_EXITS 16
+
+// a compiled block: runs until its end, a side exit, or the cycle counter
+// reaches limit when it loops, and returns twice the number of instructions
+// executed, plus one after a side exit. The signals in signal_mask end its
+// loop.
+typedef uint64_t (*jit_block)(m6502* c, uint64_t limit, uint32_t signal_mask);
+
+typedef struct jit_entry {
+    jit_block code; // NULL if not compiled
+    uint16_t last; // address of the last instruction
+    uint16_t end; // address of the last byte
+    uint16_t max_cycles; // cycles of the block at most
+    uint16_t hits; // entries counted before its compilation, then side exits
+} jit_entry;
+
+struct m6502_jit {
+    uint8_t* code; // executable arena
+    size_t code_size, code_used;
+    int variant; // variant of the compiled blocks
+    jit_entry entries[0x10000]; // indexed by address
+};
+
+// host registers, by x86-64 number
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// the state held in host registers by the blocks (RAX, RCX, RDX, RSI and
+// RDI are scratch)
+#define REG_CPU RBX
+#define REG_CYC RBP // c->cyc at the start of the block or of the iteration
+#define REG_A R12
+#define REG_X R13
+#define REG_Y R14
+#define REG_SP R15
+#define REG_N R8 // n_result
+#define REG_Z R9 // z_result
+#define REG_CF R10
+#define REG_VF R11
+
+// condition codes
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_NS 0x9
+
+// arithmetic operations (the reg field of the 0x81 and 0x83 opcodes)
+#define ALU_ADD 0
+#define ALU_OR 1
+#define ALU_AND 4
+#define ALU_SUB 5
+#define ALU_XOR 6
+#define ALU_CMP 7
+
+// shifts (the reg field of the 0xC1 opcode)
+#define SHIFT_SHL 4
+#define SHIFT_SHR 5
+
+// operand sizes of an instruction (32 bits by default)
+#define X64_W 1 // 64 bits
+#define X64_BYTE 2 // byte registers
+#define X64_WORD 4 // 16 bits
+
+// offset of a field of the CPU, addressed from REG_CPU
+#define FIELD(field) ((int32_t) offsetof(m6502, field))
+
+// the stack frame of a block: instructions executed (twice their number)
+// by the previous iterations, limit and signal_mask
+#define FRAME_INSTRUCTIONS 0
+#define FRAME_LIMIT 8
+#define FRAME_SIGNALS 16
+#define FRAME_SIZE 24
+
+// a side exit of an instruction, leaving the block before it
+typedef struct jit_stub {
+    uint8_t* jumps[JIT_INSTRUCTION_EXITS]; // displacements to patch
+    unsigned nb_jumps;
+    uint16_t pc; // address of the instruction
+    unsigned cycles, count; // cycles and instructions of the block before it
+} jit_stub;
+
+typedef struct jit_compiler {
+    int variant;
+    uint8_t* p; // next byte of host code
+    uint8_t* end;
+    bool overflow; // the code didn't fit in the arena
+    uint8_t* epilogue; // stores the state and returns (see jit_exit)
+    uint8_t* body; // first instruction, where the block loops
+    uint16_t start; // address of the block
+    jit_stub stubs[JIT_BLOCK_INSTRUCTIONS];
+    unsigned nb_stubs;
+} jit_compiler;
+
+// x86-64 encoding
+
+static void emit8(jit_compiler* jc, unsigned byte) {
+    if (jc->p < jc->end) {
+        *jc->p++ = byte;
+    }
+    else {
+        jc->overflow = true;
+    }
+}
+
+static void emit32(jit_compiler* jc, uint32_t val) {
+    for (unsigned i = 0; i < 4; i++) {
+        emit8(jc, (val >> (8 * i)) & 0xFF);
+    }
+}
+
+// emits the prefixes and the opcode (a byte, or 0x0F and a byte) of an
+// instruction whose ModRM byte holds reg, index and base
+static void emit_opcode(jit_compiler* jc, int size, unsigned opcode, int reg,
+        int index, int base) {
+    if (size & X64_WORD) {
+        emit8(jc, 0x66);
+    }
+    const unsigned rex = (size & X64_W ? 8 : 0) | (reg & 8) >> 1 |
+        (index & 8) >> 2 | (base & 8) >> 3;
+    // (without REX, the byte registers 4 to 7 are AH to BH, not SPL to DIL)
+    const bool byte_regs = (size & X64_BYTE) &&
+        ((reg >= 4 && reg < 8) || (base >= 4 && base < 8));
+    if (rex != 0 || byte_regs) {
+        emit8(jc, 0x40 | rex);
+    }
+    if (opcode > 0xFF) {
+        emit8(jc, opcode >> 8);
+    }
+    emit8(jc, opcode & 0xFF);
+}
+
+// instruction with register operands
+static void x64_rr(jit_compiler* jc, int size, unsigned opcode, int reg,
+        int rm) {
+    emit_opcode(jc, size, opcode, reg, 0, rm);
+    emit8(jc, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// instruction with a register and the memory operand
+// [base + index + disp] (no index if negative)
+static void x64_rm(jit_compiler* jc, int size, unsigned opcode, int reg,
+        int base, int index, int32_t disp) {
+    emit_opcode(jc, size, opcode, reg, index >= 0 ? index : 0, base);
+    // (RBP and R13 as a base always take a displacement)
+    const unsigned mod = disp == 0 && (base & 7) != RBP ? 0
+        : disp >= -128 && disp <= 127 ? 1 : 2;
+    if (index >= 0 || (base & 7) == RSP) {
+        emit8(jc, mod << 6 | (reg & 7) << 3 | RSP);
+        emit8(jc, (index >= 0 ? index & 7 : RSP) << 3 | (base & 7));
+    }
+    else {
+        emit8(jc, mod << 6 | (reg & 7) << 3 | (base & 7));
+    }
+    if (mod == 1) {
+        emit8(jc, disp & 0xFF);
+    }
+    else if (mod == 2) {
+        emit32(jc, disp);
+    }
+}
+
+// the 64-bit pointer at [base + index * 8 + disp]
+static void x64_load_pointer(jit_compiler* jc, int dst, int base, int index,
+        int32_t disp) {
+    emit_opcode(jc, X64_W, 0x8B, dst, index, base);
+    emit8(jc, 2 << 6 | (dst & 7) << 3 | RSP);
+    emit8(jc, 3 << 6 | (index & 7) << 3 | (base & 7));
+    emit32(jc, disp);
+}
+
+static void x64_mov(jit_compiler* jc, int dst, int src) {
+    x64_rr(jc, 0, 0x89, src, dst);
+}
+
+static void x64_mov_imm(jit_compiler* jc, int dst, uint32_t imm) {
+    emit_opcode(jc, 0, 0xB8 | (dst & 7), 0, 0, dst);
+    emit32(jc, imm);
+}
+
+// dst = src & 0xFF
+static void x64_movzx8(jit_compiler* jc, int dst, int src) {
+    x64_rr(jc, X64_BYTE, 0x0FB6, dst, src);
+}
+
+// dst = src & 0xFFFF
+static void x64_movzx16(jit_compiler* jc, int dst, int src) {
+    x64_rr(jc, 0, 0x0FB7, dst, src);
+}
+
+static void x64_alu(jit_compiler* jc, int op, int dst, int src) {
+    x64_rr(jc, 0, op << 3 | 1, src, dst);
+}
+
+static void x64_alu_imm(jit_compiler* jc, int size, int op, int dst,
+        int32_t imm) {
+    if (imm >= -128 && imm <= 127) {
+        x64_rr(jc, size, 0x83, op, dst);
+        emit8(jc, imm & 0xFF);
+    }
+    else {
+        x64_rr(jc, size, 0x81, op, dst);
+        emit32(jc, imm);
+    }
+}
+
+static void x64_shift(jit_compiler* jc, int op, int reg, unsigned count) {
+    x64_rr(jc, 0, 0xC1, op, reg);
+    emit8(jc, count);
+}
+
+static void x64_test(jit_compiler* jc, int a, int b) {
+    x64_rr(jc, 0, 0x85, b, a);
+}
+
+// reg = 1 if the condition holds, 0 otherwise (only sets its low byte)
+static void x64_setcc(jit_compiler* jc, int cc, int reg) {
+    x64_rr(jc, X64_BYTE, 0x0F90 | cc, 0, reg);
+}
+
+// dst = byte [base + index + disp]
+static void x64_load8(jit_compiler* jc, int dst, int base, int index,
+        int32_t disp) {
+    x64_rm(jc, 0, 0x0FB6, dst, base, index, disp);
+}
+
+// byte [base + index + disp] = the low byte of src
+static void x64_store8(jit_compiler* jc, int src, int base, int index,
+        int32_t disp) {
+    x64_rm(jc, X64_BYTE, 0x88, src, base, index, disp);
+}
+
+static void x64_patch(jit_compiler* jc, uint8_t* rel, const uint8_t* target) {
+    if (!jc->overflow) {
+        const int32_t disp = (int32_t) (target - (rel + 4));
+        memcpy(rel, &disp, sizeof(disp));
+    }
+}
+
+// emits a jump (unconditional if cc is negative) to target, or to a target
+// patched later if NULL: returns its displacement
+static uint8_t* x64_jump(jit_compiler* jc, int cc, const uint8_t* target) {
+    if (cc < 0) {
+        emit8(jc, 0xE9);
+    }
+    else {
+        emit8(jc, 0x0F);
+        emit8(jc, 0x80 | cc);
+    }
+    uint8_t* const rel = jc->p;
+    emit32(jc, 0);
+    if (target != NULL) {
+        x64_patch(jc, rel, target);
+    }
+    return rel;
+}
+
+// blocks
+
+// the function of a block, whose code starts at entry
+static jit_block jit_function(uint8_t* entry) {
+    // (ISO C has no conversion between object and function pointers)
+    jit_block code;
+    void* const address = entry;
+    memcpy(&code, &address, sizeof(code));
+    return code;
+}
+
+// stores the state and returns from the block, given the pc in RSI, the
+// cycles executed since REG_CYC in RDI and the result in RDX
+static void jit_emit_epilogue(jit_compiler* jc) {
+    x64_rm(jc, X64_WORD, 0x89, RSI, REG_CPU, -1, FIELD(pc));
+    x64_rr(jc, X64_W, 0x01, REG_CYC, RDI);
+    x64_rm(jc, X64_W, 0x89, RDI, REG_CPU, -1, FIELD(cyc));
+    x64_store8(jc, REG_A, REG_CPU, -1, FIELD(a));
+    x64_store8(jc, REG_X, REG_CPU, -1, FIELD(x));
+    x64_store8(jc, REG_Y, REG_CPU, -1, FIELD(y));
+    x64_store8(jc, REG_SP, REG_CPU, -1, FIELD(sp));
+    x64_store8(jc, REG_N, REG_CPU, -1, FIELD(n_result));
+    x64_store8(jc, REG_Z, REG_CPU, -1, FIELD(z_result));
+    x64_store8(jc, REG_CF, REG_CPU, -1, FIELD(cf));
+    x64_store8(jc, REG_VF, REG_CPU, -1, FIELD(vf));
+
+    x64_mov(jc, RAX, RDX);
+    x64_rm(jc, X64_W, 0x03, RAX, RSP, -1, FRAME_INSTRUCTIONS);
+    x64_alu_imm(jc, X64_W, ALU_ADD, RSP, FRAME_SIZE);
+    static const int SAVED[] = {R15, R14, R13, R12, RBP, RBX};
+    for (unsigned i = 0; i < sizeof(SAVED) / sizeof(SAVED[0]); i++) {
+        emit_opcode(jc, 0, 0x58 | (SAVED[i] & 7), 0, 0, SAVED[i]); // pop
+    }
+    emit8(jc, 0xC3); // ret
+}
+
+// saves the registers of the caller and loads the state
+static void jit_emit_prologue(jit_compiler* jc) {
+    static const int SAVED[] = {RBX, RBP, R12, R13, R14, R15};
+    for (unsigned i = 0; i < sizeof(SAVED) / sizeof(SAVED[0]); i++) {
+        emit_opcode(jc, 0, 0x50 | (SAVED[i] & 7), 0, 0, SAVED[i]); // push
+    }
+    x64_alu_imm(jc, X64_W, ALU_SUB, RSP, FRAME_SIZE);
+    x64_rr(jc, X64_W, 0x89, RDI, REG_CPU);
+    x64_rm(jc, X64_W, 0x89, RSI, RSP, -1, FRAME_LIMIT);
+    x64_rm(jc, 0, 0x89, RDX, RSP, -1, FRAME_SIGNALS);
+    x64_alu(jc, ALU_XOR, RAX, RAX);
+    x64_rm(jc, X64_W, 0x89, RAX, RSP, -1, FRAME_INSTRUCTIONS);
+
+    x64_load8(jc, REG_A, REG_CPU, -1, FIELD(a));
+    x64_load8(jc, REG_X, REG_CPU, -1, FIELD(x));
+    x64_load8(jc, REG_Y, REG_CPU, -1, FIELD(y));
+    x64_load8(jc, REG_SP, REG_CPU, -1, FIELD(sp));
+    x64_load8(jc, REG_N, REG_CPU, -1, FIELD(n_result));
+    x64_load8(jc, REG_Z, REG_CPU, -1, FIELD(z_result));
+    x64_load8(jc, REG_CF, REG_CPU, -1, FIELD(cf));
+    x64_load8(jc, REG_VF, REG_CPU, -1, FIELD(vf));
+    x64_rm(jc, X64_W, 0x8B, REG_CYC, REG_CPU, -1, FIELD(cyc));
+}
+
+// leaves the block at pc (or at the pc in RSI if negative), cycles after
+// REG_CYC, with result (see jit_block)
+static void jit_exit(jit_compiler* jc, int32_t pc, unsigned cycles,
+        unsigned result) {
+    if (pc >= 0) {
+        x64_mov_imm(jc, RSI, pc);
+    }
+    x64_mov_imm(jc, RDI, cycles);
+    x64_mov_imm(jc, RDX, result);
+    x64_jump(jc, -1, jc->epilogue);
+}
+
+// leaves the block before the current instruction if the condition holds
+static void jit_side_exit(jit_compiler* jc, int cc) {
+    jit_stub* const stub = &jc->stubs[jc->nb_stubs];
+    if (stub->nb_jumps == JIT_INSTRUCTION_EXITS) {
+        jc->overflow = true;
+        return;
+    }
+    stub->jumps[stub->nb_jumps++] = x64_jump(jc, cc, NULL);
+}
+
+// dst = the page of addr (in addr_reg, or the constant addr if addr_reg is
+// negative) in read_pages or write_pages, leaving the block if it's NULL
+static void jit_page(jit_compiler* jc, int dst, int32_t pages, int addr_reg,
+        uint16_t addr) {
+    if (addr_reg < 0) {
+        x64_rm(jc, X64_W, 0x8B, dst, REG_CPU, -1, pages + (addr >> 8) * 8);
+    }
+    else {
+        x64_mov(jc, dst, addr_reg);
+        x64_shift(jc, SHIFT_SHR, dst, 8);
+        x64_load_pointer(jc, dst, REG_CPU, dst, pages);
+    }
+    x64_rr(jc, X64_W, 0x85, dst, dst);
+    jit_side_exit(jc, CC_E);
+}
+
+// RAX = the byte at addr (in addr_reg, kept if it's RCX, or the constant
+// addr if addr_reg is negative)
+static void jit_read(jit_compiler* jc, int addr_reg, uint16_t addr) {
+    jit_page(jc, RAX, FIELD(read_pages), addr_reg, addr);
+    if (addr_reg < 0) {
+        x64_load8(jc, RAX, RAX, -1, addr & 0xFF);
+    }
+    else {
+        x64_movzx8(jc, RDX, addr_reg);
+        x64_load8(jc, RAX, RAX, RDX, 0);
+    }
+}
+
+// RCX = the zero page pointer at ptr, read as m6502_rw_bug does
+static void jit_pointer(jit_compiler* jc, uint8_t ptr) {
+    const uint16_t hi = (jc->variant & VARIANT_CMOS) ? ptr + 1
+        : (uint8_t) (ptr + 1);
+    jit_read(jc, -1, ptr);
+    x64_mov(jc, RCX, RAX);
+    jit_read(jc, -1, hi);
+    x64_shift(jc, SHIFT_SHL, RAX, 8);
+    x64_alu(jc, ALU_OR, RCX, RAX);
+}
+
+// RDI = 1 if the page of RCX isn't the page of base, when the instruction
+// takes more cycles on a page crossing
+static void jit_page_crossed(jit_compiler* jc, const m6502_opcode* op,
+        int base) {
+    if (op->page_crossed_cycles != 0) {
+        x64_mov(jc, RDI, RCX);
+        x64_alu(jc, ALU_XOR, RDI, base);
+        x64_shift(jc, SHIFT_SHR, RDI, 8);
+        x64_alu_imm(jc, 0, ALU_AND, RDI, 1);
+    }
+}
+
+// computes the address of the memory operand: returns true with the
+// constant *addr, or false with the address in RCX (and with RDI set by
+// jit_page_crossed in the indexed modes)
+static bool jit_address(jit_compiler* jc, const m6502_opcode* op,
+        uint16_t operand, uint16_t* addr) {
+    switch (op->mode) {
+    case M6502_MODE_ZPG:
+        *addr = operand & 0xFF;
+        return true;
+    case M6502_MODE_ABS:
+        *addr = operand;
+        return true;
+    case M6502_MODE_ZPX: case M6502_MODE_ZPY:
+        x64_rm(jc, 0, 0x8D, RCX, op->mode == M6502_MODE_ZPX ? REG_X : REG_Y,
+            -1, operand & 0xFF);
+        x64_movzx8(jc, RCX, RCX);
+        return false;
+    case M6502_MODE_ABX: case M6502_MODE_ABY:
+        x64_rm(jc, 0, 0x8D, RCX, op->mode == M6502_MODE_ABX ? REG_X : REG_Y,
+            -1, operand);
+        if (op->page_crossed_cycles != 0) {
+            x64_mov_imm(jc, RSI, operand);
+            jit_page_crossed(jc, op, RSI);
+        }
+        x64_movzx16(jc, RCX, RCX);
+        return false;
+    case M6502_MODE_INX:
+        // the pointer at (operand + X) & 0xFF, read from RSI
+        x64_rm(jc, 0, 0x8D, RDX, REG_X, -1, operand & 0xFF);
+        x64_movzx8(jc, RDX, RDX);
+        jit_page(jc, RSI, FIELD(read_pages), -1, 0);
+        x64_load8(jc, RCX, RSI, RDX, 0);
+        x64_alu_imm(jc, 0, ALU_ADD, RDX, 1);
+        if (jc->variant & VARIANT_CMOS) {
+            jit_read(jc, RDX, 0); // (may be in page 1)
+        }
+        else {
+            x64_movzx8(jc, RDX, RDX);
+            x64_load8(jc, RAX, RSI, RDX, 0);
+        }
+        x64_shift(jc, SHIFT_SHL, RAX, 8);
+        x64_alu(jc, ALU_OR, RCX, RAX);
+        return false;
+    case M6502_MODE_INY:
+        jit_pointer(jc, operand);
+        x64_mov(jc, RSI, RCX);
+        x64_alu(jc, ALU_ADD, RCX, REG_Y);
+        jit_page_crossed(jc, op, RSI);
+        x64_movzx16(jc, RCX, RCX);
+        return false;
+    case M6502_MODE_INZ:
+        jit_pointer(jc, operand);
+        return false;
+    default: // (not compiled)
+        jc->overflow = true;
+        *addr = 0;
+        return true;
+    }
+}
+
+// RAX = the operand of a read
+static void jit_operand(jit_compiler* jc, const m6502_opcode* op,
+        uint16_t operand) {
+    if (op->mode == M6502_MODE_IMM) {
+        x64_mov_imm(jc, RAX, operand & 0xFF);
+        return;
+    }
+    uint16_t addr;
+    const bool constant = jit_address(jc, op, operand, &addr);
+    jit_read(jc, constant ? -1 : RCX, addr);
+}
+
+// sets N and Z according to reg
+static void jit_set_zn(jit_compiler* jc, int reg) {
+    x64_mov(jc, REG_N, reg);
+    x64_mov(jc, REG_Z, reg);
+}
+
+// the operation of a read-modify-write instruction on reg
+static void jit_modify(jit_compiler* jc, int mnemonic, int reg) {
+    switch (mnemonic) {
+    case M6502_INC:
+        x64_alu_imm(jc, 0, ALU_ADD, reg, 1);
+        break;
+    case M6502_DEC:
+        x64_alu_imm(jc, 0, ALU_SUB, reg, 1);
+        break;
+    case M6502_ASL:
+        x64_mov(jc, REG_CF, reg);
+        x64_shift(jc, SHIFT_SHR, REG_CF, 7);
+        x64_shift(jc, SHIFT_SHL, reg, 1);
+        break;
+    case M6502_LSR:
+        x64_mov(jc, REG_CF, reg);
+        x64_alu_imm(jc, 0, ALU_AND, REG_CF, 1);
+        x64_shift(jc, SHIFT_SHR, reg, 1);
+        break;
+    case M6502_ROL:
+        x64_mov(jc, RDI, reg);
+        x64_shift(jc, SHIFT_SHL, reg, 1);
+        x64_alu(jc, ALU_OR, reg, REG_CF);
+        x64_shift(jc, SHIFT_SHR, RDI, 7);
+        x64_mov(jc, REG_CF, RDI);
+        break;
+    case M6502_ROR:
+        x64_mov(jc, RDI, REG_CF);
+        x64_shift(jc, SHIFT_SHL, RDI, 7);
+        x64_mov(jc, REG_CF, reg);
+        x64_alu_imm(jc, 0, ALU_AND, REG_CF, 1);
+        x64_shift(jc, SHIFT_SHR, reg, 1);
+        x64_alu(jc, ALU_OR, reg, RDI);
+        break;
+    }
+    x64_movzx8(jc, reg, reg);
+    jit_set_zn(jc, reg);
+}
+
+// the register of the registers instructions
+static int jit_register(int mnemonic) {
+    switch (mnemonic) {
+    case M6502_LDX: case M6502_STX: case M6502_CPX: case M6502_INX:
+    case M6502_DEX: case M6502_PHX: case M6502_PLX:
+        return REG_X;
+    case M6502_LDY: case M6502_STY: case M6502_CPY: case M6502_INY:
+    case M6502_DEY: case M6502_PHY: case M6502_PLY:
+        return REG_Y;
+    default:
+        return REG_A;
+    }
+}
+
+// returns true if the instruction can be compiled
+static bool jit_supported(const m6502_opcode* op) {
+    switch (op->mode) {
+    case M6502_MODE_IND: case M6502_MODE_IAX: case M6502_MODE_ZPR:
+        return false;
+    }
+    switch (op->mnemonic) {
+    case M6502_BBR: case M6502_BBS: case M6502_BRK: case M6502_CLI:
+    case M6502_PLP: case M6502_RMB: case M6502_RTI: case M6502_SEI:
+    case M6502_SMB: case M6502_STP: case M6502_TRB: case M6502_TSB:
+    case M6502_WAI:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// the state of the instructions compiled before the current one
+typedef struct jit_position {
+    uint16_t pc; // address of the instruction
+    unsigned cycles; // base cycles of the previous instructions
+    unsigned count; // number of previous instructions
+} jit_position;
+
+// a branch or jump to target taken with the cycles of the block: loops
+// back to the start of the block, or leaves it
+static void jit_jump(jit_compiler* jc, const jit_position* at,
+        uint16_t target, unsigned cycles) {
+    if (target != jc->start) {
+        jit_exit(jc, target, cycles, 2 * (at->count + 1));
+        return;
+    }
+
+    // counts the iteration, then loops if the signals and the budget allow
+    // it
+    x64_alu_imm(jc, X64_W, ALU_ADD, REG_CYC, cycles);
+    x64_rm(jc, X64_W, 0x81, ALU_ADD, RSP, -1, FRAME_INSTRUCTIONS);
+    emit32(jc, 2 * (at->count + 1));
+    x64_rm(jc, 0, 0x8B, RAX, REG_CPU, -1, FIELD(signals));
+    x64_rm(jc, 0, 0x85, RAX, RSP, -1, FRAME_SIGNALS);
+    uint8_t* const signaled = x64_jump(jc, CC_NE, NULL);
+    x64_rm(jc, X64_W, 0x3B, REG_CYC, RSP, -1, FRAME_LIMIT);
+    x64_jump(jc, CC_B, jc->body);
+    x64_patch(jc, signaled, jc->p);
+    jit_exit(jc, jc->start, 0, 0);
+}
+
+// a conditional branch (or BRA) ending the block
+static void jit_branch(jit_compiler* jc, const jit_position* at,
+        const m6502_opcode* op, uint16_t operand) {
+    const uint16_t next = at->pc + op->length;
+    const uint16_t target = next + (int8_t) operand;
+    const unsigned cycles = at->cycles + op->cycles;
+    const unsigned taken_cycles = cycles + 1 +
+        ((next & 0xFF00) != (target & 0xFF00) ? op->page_crossed_cycles : 0);
+
+    int reg = -1; // the branch is taken if reg is zero (cc E) or not (NE)
+    int cc = CC_NE;
+    switch (op->mnemonic) {
+    case M6502_BCC: reg = REG_CF; cc = CC_E; break;
+    case M6502_BCS: reg = REG_CF; break;
+    case M6502_BNE: reg = REG_Z; break;
+    case M6502_BEQ: reg = REG_Z; cc = CC_E; break;
+    case M6502_BVC: reg = REG_VF; cc = CC_E; break;
+    case M6502_BVS: reg = REG_VF; break;
+    case M6502_BPL: case M6502_BMI:
+        // test n_result, 0x80
+        x64_rr(jc, X64_BYTE, 0xF6, 0, REG_N);
+        emit8(jc, 0x80);
+        cc = op->mnemonic == M6502_BPL ? CC_E : CC_NE;
+        break;
+    default: // BRA
+        jit_jump(jc, at, target, taken_cycles);
+        return;
+    }
+    if (reg >= 0) {
+        x64_test(jc, reg, reg);
+    }
+    uint8_t* const taken = x64_jump(jc, cc, NULL);
+    jit_exit(jc, next, cycles, 2 * (at->count + 1));
+    x64_patch(jc, taken, jc->p);
+    jit_jump(jc, at, target, taken_cycles);
+}
+
+// compiles an instruction, and returns true if it ends the block
+static bool jit_instruction(jit_compiler* jc, const jit_position* at,
+        const m6502_opcode* op, uint16_t operand) {
+    const int mnemonic = op->mnemonic;
+    const int reg = jit_register(mnemonic);
+    uint16_t addr = 0;
+    bool constant;
+
+    if (mnemonic == M6502_NOP || mnemonic == M6502_INV) {
+        return false;
+    }
+    switch (op->kind) {
+    case M6502_KIND_BRANCH:
+        jit_branch(jc, at, op, operand);
+        return true;
+    case M6502_KIND_JUMP:
+        break;
+    case M6502_KIND_WRITE:
+        constant = jit_address(jc, op, operand, &addr);
+        jit_page(jc, RSI, FIELD(write_pages), constant ? -1 : RCX, addr);
+        if (!constant) {
+            x64_movzx8(jc, RDX, RCX);
+        }
+        if (mnemonic == M6502_STZ) {
+            x64_alu(jc, ALU_XOR, RAX, RAX);
+        }
+        x64_store8(jc, mnemonic == M6502_STZ ? RAX : reg, RSI,
+            constant ? -1 : RDX, constant ? addr & 0xFF : 0);
+        return false;
+    case M6502_KIND_RMW:
+        constant = jit_address(jc, op, operand, &addr);
+        jit_page(jc, RSI, FIELD(write_pages), constant ? -1 : RCX, addr);
+        jit_read(jc, constant ? -1 : RCX, addr);
+        jit_modify(jc, mnemonic, RAX);
+        x64_store8(jc, RAX, RSI, constant ? -1 : RDX,
+            constant ? addr & 0xFF : 0);
+        return false;
+    default:
+        if (op->mode == M6502_MODE_ACC) { // INC, DEC and the shifts of A
+            jit_modify(jc, mnemonic, REG_A);
+            return false;
+        }
+        if (op->kind == M6502_KIND_READ || op->mode == M6502_MODE_IMM) {
+            break;
+        }
+        // implied
+        switch (mnemonic) {
+        case M6502_TAX: case M6502_TAY:
+            x64_mov(jc, mnemonic == M6502_TAX ? REG_X : REG_Y, REG_A);
+            jit_set_zn(jc, REG_A);
+            break;
+        case M6502_TXA: case M6502_TYA:
+            x64_mov(jc, REG_A, mnemonic == M6502_TXA ? REG_X : REG_Y);
+            jit_set_zn(jc, REG_A);
+            break;
+        case M6502_TSX:
+            x64_mov(jc, REG_X, REG_SP);
+            jit_set_zn(jc, REG_X);
+            break;
+        case M6502_TXS:
+            x64_mov(jc, REG_SP, REG_X);
+            break;
+        case M6502_INX: case M6502_INY:
+            jit_modify(jc, M6502_INC, reg);
+            break;
+        case M6502_DEX: case M6502_DEY:
+            jit_modify(jc, M6502_DEC, reg);
+            break;
+        case M6502_CLC:
+            x64_alu(jc, ALU_XOR, REG_CF, REG_CF);
+            break;
+        case M6502_SEC:
+            x64_mov_imm(jc, REG_CF, 1);
+            break;
+        case M6502_CLV:
+            x64_alu(jc, ALU_XOR, REG_VF, REG_VF);
+            break;
+        case M6502_CLD: case M6502_SED:
+            // mov byte [c->df], imm
+            x64_rm(jc, 0, 0xC6, 0, REG_CPU, -1, FIELD(df));
+            emit8(jc, mnemonic == M6502_SED);
+            break;
+        case M6502_PHA: case M6502_PHX: case M6502_PHY: case M6502_PHP:
+            jit_page(jc, RSI, FIELD(write_pages), -1, STACK_START_ADDR);
+            if (mnemonic == M6502_PHP) {
+                // c->bf = 1, then RAX = get_flags(c)
+                x64_rm(jc, 0, 0xC6, 0, REG_CPU, -1, FIELD(bf));
+                emit8(jc, 1);
+                x64_mov(jc, RAX, REG_N);
+                x64_alu_imm(jc, 0, ALU_AND, RAX, 0x80);
+                x64_alu_imm(jc, 0, ALU_OR, RAX, 0x30);
+                x64_alu(jc, ALU_OR, RAX, REG_CF);
+                x64_mov(jc, RDX, REG_VF);
+                x64_shift(jc, SHIFT_SHL, RDX, 6);
+                x64_alu(jc, ALU_OR, RAX, RDX);
+                x64_load8(jc, RDX, REG_CPU, -1, FIELD(df));
+                x64_shift(jc, SHIFT_SHL, RDX, 3);
+                x64_alu(jc, ALU_OR, RAX, RDX);
+                x64_load8(jc, RDX, REG_CPU, -1, FIELD(idf));
+                x64_shift(jc, SHIFT_SHL, RDX, 2);
+                x64_alu(jc, ALU_OR, RAX, RDX);
+                x64_alu(jc, ALU_XOR, RDX, RDX);
+                x64_test(jc, REG_Z, REG_Z);
+                x64_setcc(jc, CC_E, RDX);
+                x64_alu(jc, ALU_ADD, RDX, RDX);
+                x64_alu(jc, ALU_OR, RAX, RDX);
+            }
+            x64_store8(jc, mnemonic == M6502_PHP ? RAX : reg, RSI, REG_SP, 0);
+            x64_alu_imm(jc, 0, ALU_SUB, REG_SP, 1);
+            x64_movzx8(jc, REG_SP, REG_SP);
+            break;
+        case M6502_PLA: case M6502_PLX: case M6502_PLY:
+            jit_page(jc, RSI, FIELD(read_pages), -1, STACK_START_ADDR);
+            x64_alu_imm(jc, 0, ALU_ADD, REG_SP, 1);
+            x64_movzx8(jc, REG_SP, REG_SP);
+            x64_load8(jc, reg, RSI, REG_SP, 0);
+            jit_set_zn(jc, reg);
+            break;
+        }
+        return false;
+    }
+
+    if (op->kind == M6502_KIND_JUMP) {
+        const unsigned cycles = at->cycles + op->cycles;
+        switch (mnemonic) {
+        case M6502_JMP:
+            jit_jump(jc, at, operand, cycles);
+            break;
+        case M6502_JSR: {
+            // pushes the address of the operand's last byte (the low byte
+            // goes to page 0 if SP is 0, left to the cores)
+            const uint16_t ret = at->pc + 2;
+            x64_test(jc, REG_SP, REG_SP);
+            jit_side_exit(jc, CC_E);
+            jit_page(jc, RSI, FIELD(write_pages), -1, STACK_START_ADDR);
+            x64_rm(jc, 0, 0xC6, 0, RSI, REG_SP, 0);
+            emit8(jc, ret >> 8);
+            x64_rm(jc, 0, 0xC6, 0, RSI, REG_SP, -1);
+            emit8(jc, ret & 0xFF);
+            x64_alu_imm(jc, 0, ALU_SUB, REG_SP, 2);
+            x64_movzx8(jc, REG_SP, REG_SP);
+            jit_exit(jc, operand, cycles, 2 * (at->count + 1));
+            break;
+        }
+        case M6502_RTS:
+            jit_page(jc, RSI, FIELD(read_pages), -1, STACK_START_ADDR);
+            x64_rm(jc, 0, 0x8D, RAX, REG_SP, -1, 1);
+            x64_movzx8(jc, RAX, RAX);
+            x64_load8(jc, RCX, RSI, RAX, 0);
+            x64_rm(jc, 0, 0x8D, RAX, REG_SP, -1, 2);
+            x64_movzx8(jc, REG_SP, RAX);
+            x64_load8(jc, RAX, RSI, REG_SP, 0);
+            x64_shift(jc, SHIFT_SHL, RAX, 8);
+            x64_rm(jc, 0, 0x8D, RSI, RCX, RAX, 1);
+            x64_movzx16(jc, RSI, RSI);
+            jit_exit(jc, -1, cycles, 2 * (at->count + 1));
+            break;
+        }
+        return true;
+    }
+
+    // reads
+    if (!(mnemonic == M6502_BIT && op->mode == M6502_MODE_IMM)) {
+        jit_operand(jc, op, operand);
+    }
+    switch (mnemonic) {
+    case M6502_LDA: case M6502_LDX: case M6502_LDY:
+        x64_mov(jc, reg, RAX);
+        jit_set_zn(jc, reg);
+        break;
+    case M6502_AND:
+        x64_alu(jc, ALU_AND, REG_A, RAX);
+        jit_set_zn(jc, REG_A);
+        break;
+    case M6502_ORA:
+        x64_alu(jc, ALU_OR, REG_A, RAX);
+        jit_set_zn(jc, REG_A);
+        break;
+    case M6502_EOR:
+        x64_alu(jc, ALU_XOR, REG_A, RAX);
+        jit_set_zn(jc, REG_A);
+        break;
+    case M6502_CMP: case M6502_CPX: case M6502_CPY:
+        x64_alu(jc, ALU_XOR, REG_CF, REG_CF);
+        x64_alu(jc, ALU_CMP, reg, RAX);
+        x64_setcc(jc, CC_AE, REG_CF);
+        x64_mov(jc, REG_N, reg);
+        x64_alu(jc, ALU_SUB, REG_N, RAX);
+        x64_movzx8(jc, REG_N, REG_N);
+        x64_mov(jc, REG_Z, REG_N);
+        break;
+    case M6502_BIT:
+        if (op->mode == M6502_MODE_IMM) { // (65C02: only sets Z)
+            x64_mov_imm(jc, REG_Z, operand & 0xFF);
+            x64_alu(jc, ALU_AND, REG_Z, REG_A);
+            break;
+        }
+        x64_mov(jc, REG_VF, RAX);
+        x64_shift(jc, SHIFT_SHR, REG_VF, 6);
+        x64_alu_imm(jc, 0, ALU_AND, REG_VF, 1);
+        x64_mov(jc, REG_N, RAX);
+        x64_mov(jc, REG_Z, RAX);
+        x64_alu(jc, ALU_AND, REG_Z, REG_A);
+        break;
+    case M6502_ADC:
+        // RDX = A + val + C, V if the sign of the result is neither the
+        // sign of A nor the sign of val
+        x64_rm(jc, 0, 0x8D, RDX, REG_A, RAX, 0);
+        x64_alu(jc, ALU_ADD, RDX, REG_CF);
+        x64_mov(jc, RCX, REG_A);
+        x64_alu(jc, ALU_XOR, RCX, RDX);
+        x64_alu(jc, ALU_XOR, RAX, RDX);
+        x64_alu(jc, ALU_AND, RAX, RCX);
+        x64_shift(jc, SHIFT_SHR, RAX, 7);
+        x64_alu_imm(jc, 0, ALU_AND, RAX, 1);
+        x64_mov(jc, REG_VF, RAX);
+        x64_mov(jc, REG_CF, RDX);
+        x64_shift(jc, SHIFT_SHR, REG_CF, 8);
+        x64_movzx8(jc, REG_A, RDX);
+        jit_set_zn(jc, REG_A);
+        break;
+    case M6502_SBC:
+        // RDX = A - val - !C (negative if it borrows)
+        x64_mov(jc, RDX, REG_A);
+        x64_alu(jc, ALU_SUB, RDX, RAX);
+        x64_alu(jc, ALU_ADD, RDX, REG_CF);
+        x64_alu_imm(jc, 0, ALU_SUB, RDX, 1);
+        x64_mov(jc, RCX, REG_A);
+        x64_alu(jc, ALU_XOR, RCX, RAX);
+        x64_mov(jc, RAX, REG_A);
+        x64_alu(jc, ALU_XOR, RAX, RDX);
+        x64_alu(jc, ALU_AND, RAX, RCX);
+        x64_shift(jc, SHIFT_SHR, RAX, 7);
+        x64_alu_imm(jc, 0, ALU_AND, RAX, 1);
+        x64_mov(jc, REG_VF, RAX);
+        x64_alu(jc, ALU_XOR, REG_CF, REG_CF);
+        x64_test(jc, RDX, RDX);
+        x64_setcc(jc, CC_NS, REG_CF);
+        x64_movzx8(jc, REG_A, RDX);
+        jit_set_zn(jc, REG_A);
+        break;
+    }
+
+    // the page crossing penalty, once nothing can leave the block
+    if (op->page_crossed_cycles != 0 && (op->mode == M6502_MODE_ABX ||
+            op->mode == M6502_MODE_ABY || op->mode == M6502_MODE_INY)) {
+        for (unsigned i = 0; i < op->page_crossed_cycles; i++) {
+            x64_rr(jc, X64_W, 0x01, RDI, REG_CYC);
+        }
+    }
+    return false;
+}
+
+// discards the compiled blocks
+static void jit_flush(m6502_jit* jit) {
+    memset(jit->entries, 0, sizeof(jit->entries));
+    jit->code_used = 0;
+}
+
+// compiles the block at start, returns false if it can't be
+static bool jit_compile(m6502* const c, m6502_jit* jit, uint16_t start,
+        const int variant) {
+    const m6502_opcode* const opcodes =
+        (variant & VARIANT_CMOS) ? OPCODES_65C02 : OPCODES_6502;
+
+    // the instructions of the block
+    uint16_t addrs[JIT_BLOCK_INSTRUCTIONS];
+    unsigned nb_instructions = 0;
+    unsigned max_cycles = 0;
+    uint16_t addr = start;
+    while (nb_instructions < JIT_BLOCK_INSTRUCTIONS &&
+            (addr >> 8) == (start >> 8)) {
+        if (c->decode_cache[addr].length == 0 &&
+                !decode_block(c, addr, variant)) {
+            break;
+        }
+        const m6502_opcode* const op = &opcodes[c->decode_cache[addr].opcode];
+        if (!jit_supported(op)) {
+            break;
+        }
+        addrs[nb_instructions++] = addr;
+        max_cycles += op->cycles + op->page_crossed_cycles +
+            (op->kind == M6502_KIND_BRANCH);
+        addr += op->length;
+        if (op->kind >= M6502_KIND_BRANCH) {
+            break;
+        }
+    }
+    if (nb_instructions == 0) {
+        return false;
+    }
+
+    if (jit->code_size - jit->code_used < JIT_BLOCK_SIZE) {
+        jit_flush(jit);
+    }
+    if (mprotect(jit->code, jit->code_size, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+
+    jit_compiler jc;
+    jc.variant = variant;
+    jc.p = jit->code + jit->code_used;
+    jc.end = jc.p + JIT_BLOCK_SIZE;
+    jc.overflow = false;
+    jc.start = start;
+    jc.nb_stubs = 0;
+
+    jc.epilogue = jc.p;
+    jit_emit_epilogue(&jc);
+    uint8_t* const entry = jc.p;
+    jit_emit_prologue(&jc);
+    jc.body = jc.p;
+
+    jit_position at = {start, 0, 0};
+    bool ends = false;
+    for (unsigned i = 0; i < nb_instructions; i++) {
+        const m6502_decoded d = c->decode_cache[addrs[i]];
+        const m6502_opcode* const op = &opcodes[d.opcode];
+        at.pc = addrs[i];
+
+        jit_stub* const stub = &jc.stubs[jc.nb_stubs];
+        stub->nb_jumps = 0;
+        stub->pc = at.pc;
+        stub->cycles = at.cycles;
+        stub->count = at.count;
+        if ((variant & VARIANT_BCD) &&
+                (op->mnemonic == M6502_ADC || op->mnemonic == M6502_SBC)) {
+            // cmp byte [c->df], 0
+            x64_rm(&jc, 0, 0x80, ALU_CMP, REG_CPU, -1, FIELD(df));
+            emit8(&jc, 0);
+            jit_side_exit(&jc, CC_NE);
+        }
+        ends = jit_instruction(&jc, &at, op, d.operand);
+        if (stub->nb_jumps != 0) {
+            jc.nb_stubs += 1;
+        }
+        if (ends) {
+            break;
+        }
+        at.cycles += op->cycles;
+        at.count += 1;
+    }
+    if (!ends) {
+        // the block goes on with the next one
+        jit_exit(&jc, addr, at.cycles, 2 * at.count);
+    }
+
+    // side exits
+    for (unsigned i = 0; i < jc.nb_stubs; i++) {
+        const jit_stub* const stub = &jc.stubs[i];
+        for (unsigned j = 0; j < stub->nb_jumps; j++) {
+            x64_patch(&jc, stub->jumps[j], jc.p);
+        }
+        jit_exit(&jc, stub->pc, stub->cycles, 2 * stub->count + 1);
+    }
+
+    if (!jc.overflow) {
+        jit_entry* const e = &jit->entries[start];
+        const m6502_decoded last = c->decode_cache[at.pc];
+        e->code = jit_function(entry);
+        e->last = at.pc;
+        e->end = at.pc + last.length - 1;
+        e->max_cycles = max_cycles;
+        const size_t size = jc.p - (jit->code + jit->code_used);
+        jit->code_used += (size + 15) & ~(size_t) 15;
+        c->jit_blocks += 1;
+    }
+    if (mprotect(jit->code, jit->code_size, PROT_READ | PROT_EXEC) != 0) {
+        // (the arena can't be executed)
+        jit_flush(jit);
+        return false;
+    }
+    return !jc.overflow;
+}
+
+// counts an entry into the block at addr, reached from the instruction at
+// from, and compiles it once hot: returns true if it is compiled
+static bool jit_enter(m6502* const c, uint16_t addr, uint16_t from,
+        const int variant) {
+    m6502_jit* const jit = c->jit;
+    // (the blocks don't record the instructions)
+    if (c->trace != NULL || c->profile != NULL) {
+        return false;
+    }
+    if (jit->variant != variant) {
+        jit_flush(jit);
+        jit->variant = variant;
+    }
+
+    jit_entry* const entry = &jit->entries[addr];
+    if (entry->code != NULL) {
+        return true;
+    }
+    if (entry->hits == JIT_NEVER || ++entry->hits < JIT_HOT) {
+        return false;
+    }
+    // the idle loops are left to the cores, which skip them
+    const m6502_opcode* const opcodes =
+        (variant & VARIANT_CMOS) ? OPCODES_65C02 : OPCODES_6502;
+    if ((from >= addr && c->skip_idle && c->breakpoints == NULL &&
+            idle_loop_pure(c, addr, from, opcodes)) ||
+            !jit_compile(c, jit, addr, variant)) {
+        jit->entries[addr].hits = JIT_NEVER;
+        return false;
+    }
+    return true;
+}
+
+// returns true if the block can run without missing an exit condition: a
+// block loops if the limit returned is above the cycle counter
+static bool jit_runnable(const m6502* const c, const jit_entry* entry,
+        int exit_flags, uint64_t* limit) {
+    const uint16_t start = c->pc;
+    if ((exit_flags & M6502_EXIT_PC) &&
+            (uint16_t) (c->exit_pc - start - 1) <
+            (uint16_t) (entry->last - start)) {
+        return false;
+    }
+    *limit = ((exit_flags & M6502_EXIT_PC) && c->exit_pc == start) ||
+        ((exit_flags & M6502_EXIT_TRAP) && entry->last == start)
+        ? 0 : *limit;
+    return true;
+}
+
+// called by the decoded cores after a backward jump from from to c->pc:
+// returns true if the compiled blocks can take over the run
+static bool jit_hot(m6502* const c, uint16_t from, int exit_flags,
+        const int variant) {
+    uint64_t limit = 0;
+    return jit_enter(c, c->pc, from, variant) &&
+        jit_runnable(c, &c->jit->entries[c->pc], exit_flags, &limit);
+}
+
+// the signals ending the blocks: those the cores would take before the
+// next instruction (a masked IRQ only matters to WAI)
+static inline uint32_t jit_signal_mask(const m6502* const c) {
+    return c->idf ? ~SIGNAL_IRQ : ~UINT32_C(0);
+}
+
+// runs the compiled blocks from c->pc (see run_cores), until a block can't
+// be compiled, a side exit or an exit condition
+static m6502_run_result run_jit(m6502* const c, uint64_t cycle_budget,
+        int exit_flags, const int variant) {
+    m6502_jit* const jit = c->jit;
+    m6502_run_result result = {0, 0, 0};
+    const uint64_t start_cyc = c->cyc;
+    const uint64_t end_cyc = cycle_budget < UINT64_MAX - start_cyc
+        ? start_cyc + cycle_budget : UINT64_MAX;
+    uint16_t from = c->pc - 1; // (the first block is compiled)
+
+    for (;;) {
+        const uint16_t start = c->pc;
+        if (!jit_enter(c, start, from, variant)) {
+            break;
+        }
+        jit_entry* const entry = &jit->entries[start];
+        // a block only runs if the cores would execute all its instructions
+        if (c->cyc >= end_cyc || end_cyc - c->cyc < entry->max_cycles ||
+                (peek_signals(c) & jit_signal_mask(c)) != 0 ||
+                c->stop || c->wait) {
+            break;
+        }
+        uint64_t limit = end_cyc - entry->max_cycles + 1;
+        if (!jit_runnable(c, entry, exit_flags, &limit)) {
+            break;
+        }
+
+        const uint64_t r = entry->code(c, limit, jit_signal_mask(c));
+        result.instructions += r >> 1;
+        c->jit_instructions += r >> 1;
+        if (r & 1) {
+            if (++entry->hits >= JIT_HOT + JIT_SIDE_EXITS) {
+                entry->code = NULL;
+                entry->hits = JIT_NEVER;
+            }
+            break;
+        }
+        entry->hits = JIT_HOT;
+
+        if ((exit_flags & M6502_EXIT_PC) && c->pc == c->exit_pc) {
+            result.exit = M6502_EXIT_PC;
+            break;
+        }
+        if ((exit_flags & M6502_EXIT_TRAP) && c->pc == entry->last) {
+            result.exit = M6502_EXIT_TRAP;
+            break;
+        }
+        from = entry->last;
+    }
+
+    result.cyc = c->cyc - start_cyc;
+    return result;
+}
+
+// discards the blocks overlapping a page (see invalidate_page)
+static void jit_invalidate_page(m6502_jit* jit, uint8_t page) {
+    memset(&jit->entries[page << 8], 0, 256 * sizeof(jit_entry));
+    jit_entry* const previous = &jit->entries[(uint8_t) (page - 1) << 8];
+    for (unsigned i = 0; i < 256; i++) {
+        if (previous[i].code != NULL && (previous[i].end >> 8) == page) {
+            memset(&previous[i], 0, sizeof(jit_entry));
+        }
+    }
+}
@@ -0,0 +1,810 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "m6502_lockstep.h"
+
+struct m6502_lockstep {
+    size_t nb_lanes;
+    const m6502_opcode* opcodes;
+    bool m65c02_mode, enable_bcd;
+
+    // memory of the lanes, interleaved: the byte at addr of a lane is at
+    // memory[addr * nb_lanes + lane]
+    uint8_t* memory;
+
+    // registers of each lane (the flags are stored as the status register)
+    uint16_t* pc;
+    uint8_t *a, *x, *y, *sp, *p;
+    uint64_t* cyc;
+    uint16_t* exit_pc;
+    uint8_t *stop, *wait; // the lane masks are bytes, which vectorize
+
+    // state of the last run
+    uint64_t* start_cyc;
+    uint64_t* deadline; // cycle count at which the budget is exhausted
+    unsigned long* instructions;
+    uint8_t* exits; // M6502_EXIT_* condition that ended the run
+    uint8_t* done;
+    uint8_t* over_budget;
+    m6502_run_result* results;
+
+    // lanes executing the current instruction, the ones executing it
+    // together (the others use the scratch CPU), and their operands
+    uint8_t *at_pc, *together;
+    uint16_t* addr;
+    uint8_t* val;
+    uint8_t* crossed;
+
+    // opcodes the lanes can execute together
+    bool together_opcodes[256];
+
+    // I/O pages
+    bool has_io;
+    bool io_pages[256];
+    m6502_lockstep_io_read io_read;
+    m6502_lockstep_io_write io_write;
+    void* io_userdata;
+
+    // CPU executing the instructions the lanes can't execute together, one
+    // lane at a time
+    m6502 scratch;
+    size_t scratch_lane;
+};
+
+// byte at addr of a lane, in the memory of n lanes (the functions load the
+// fields of the engine in local variables, as the compiler can't assume
+// that a byte store doesn't change them)
+#define MEM(addr, lane) memory[(size_t) (uint16_t) (addr) * n + (lane)]
+
+#define STACK_START_ADDR 0x100
+
+#define FLAG_NZ (M6502_FLAG_N | M6502_FLAG_Z)
+
+// returns the status register p with N and Z set according to val
+static inline uint8_t set_zn(uint8_t p, uint8_t val) {
+    return (p & ~FLAG_NZ) | (val & M6502_FLAG_N) | (val ? 0 : M6502_FLAG_Z);
+}
+
+// sets or clears the flags in mask
+static inline uint8_t set_flag(uint8_t p, uint8_t mask, bool set) {
+    return set ? p | mask : p & ~mask;
+}
+
+// scratch CPU callbacks: accesses go to the memory of the current lane
+
+static uint8_t scratch_read(void* userdata, uint16_t addr) {
+    m6502_lockstep* const ls = userdata;
+    const uint8_t* const memory = ls->memory;
+    const size_t n = ls->nb_lanes;
+    if (ls->io_pages[addr >> 8]) {
+        return ls->io_read(ls->io_userdata, ls->scratch_lane, addr);
+    }
+    return MEM(addr, ls->scratch_lane);
+}
+
+static void scratch_write(void* userdata, uint16_t addr, uint8_t val) {
+    m6502_lockstep* const ls = userdata;
+    uint8_t* const memory = ls->memory;
+    const size_t n = ls->nb_lanes;
+    if (ls->io_pages[addr >> 8]) {
+        ls->io_write(ls->io_userdata, ls->scratch_lane, addr, val);
+        return;
+    }
+    MEM(addr, ls->scratch_lane) = val;
+}
+
+// returns true if the lanes can execute an opcode together (the other
+// opcodes are executed by the scratch CPU)
+static bool can_execute_together(const m6502_opcode* op) {
+    switch (op->mode) {
+    case M6502_MODE_IMP: case M6502_MODE_ACC: case M6502_MODE_IMM:
+    case M6502_MODE_ZPG: case M6502_MODE_ZPX: case M6502_MODE_ZPY:
+    case M6502_MODE_ABS: case M6502_MODE_ABX: case M6502_MODE_ABY:
+    case M6502_MODE_INX: case M6502_MODE_INY: case M6502_MODE_REL:
+        break;
+    default:
+        return false;
+    }
+
+    switch (op->mnemonic) {
+    case M6502_BRK: case M6502_RTI: case M6502_PHP: case M6502_PLP:
+    case M6502_TRB: case M6502_TSB: case M6502_RMB: case M6502_SMB:
+    case M6502_BBR: case M6502_BBS: case M6502_STP: case M6502_WAI:
+        return false;
+    default:
+        return true;
+    }
+}
+
+m6502_lockstep* m6502_lockstep_create(size_t nb_lanes, bool m65c02_mode,
+        bool enable_bcd) {
+    if (nb_lanes == 0) {
+        return NULL;
+    }
+
+    m6502_lockstep* const ls = calloc(1, sizeof(m6502_lockstep));
+    if (ls == NULL) {
+        return NULL;
+    }
+    ls->nb_lanes = nb_lanes;
+    ls->opcodes = m6502_opcodes(m65c02_mode);
+    ls->m65c02_mode = m65c02_mode;
+    ls->enable_bcd = enable_bcd;
+
+    ls->memory = calloc(nb_lanes, 0x10000);
+    ls->pc = calloc(nb_lanes, sizeof(*ls->pc));
+    ls->a = calloc(nb_lanes, sizeof(*ls->a));
+    ls->x = calloc(nb_lanes, sizeof(*ls->x));
+    ls->y = calloc(nb_lanes, sizeof(*ls->y));
+    ls->sp = calloc(nb_lanes, sizeof(*ls->sp));
+    ls->p = calloc(nb_lanes, sizeof(*ls->p));
+    ls->cyc = calloc(nb_lanes, sizeof(*ls->cyc));
+    ls->exit_pc = calloc(nb_lanes, sizeof(*ls->exit_pc));
+    ls->stop = calloc(nb_lanes, sizeof(*ls->stop));
+    ls->wait = calloc(nb_lanes, sizeof(*ls->wait));
+    ls->start_cyc = calloc(nb_lanes, sizeof(*ls->start_cyc));
+    ls->deadline = calloc(nb_lanes, sizeof(*ls->deadline));
+    ls->instructions = calloc(nb_lanes, sizeof(*ls->instructions));
+    ls->exits = calloc(nb_lanes, sizeof(*ls->exits));
+    ls->done = calloc(nb_lanes, sizeof(*ls->done));
+    ls->over_budget = calloc(nb_lanes, sizeof(*ls->over_budget));
+    ls->results = calloc(nb_lanes, sizeof(*ls->results));
+    ls->at_pc = calloc(nb_lanes, sizeof(*ls->at_pc));
+    ls->together = calloc(nb_lanes, sizeof(*ls->together));
+    ls->addr = calloc(nb_lanes, sizeof(*ls->addr));
+    ls->val = calloc(nb_lanes, sizeof(*ls->val));
+    ls->crossed = calloc(nb_lanes, sizeof(*ls->crossed));
+    if (ls->memory == NULL || ls->pc == NULL || ls->a == NULL ||
+            ls->x == NULL || ls->y == NULL || ls->sp == NULL ||
+            ls->p == NULL || ls->cyc == NULL || ls->exit_pc == NULL ||
+            ls->stop == NULL || ls->wait == NULL || ls->start_cyc == NULL ||
+            ls->deadline == NULL || ls->instructions == NULL ||
+            ls->exits == NULL || ls->done == NULL ||
+            ls->over_budget == NULL || ls->results == NULL ||
+            ls->at_pc == NULL || ls->together == NULL || ls->addr == NULL ||
+            ls->val == NULL || ls->crossed == NULL) {
+        m6502_lockstep_destroy(ls);
+        return NULL;
+    }
+
+    for (unsigned opcode = 0; opcode < 256; opcode++) {
+        ls->together_opcodes[opcode] =
+            can_execute_together(&ls->opcodes[opcode]);
+    }
+
+    m6502* const c = &ls->scratch;
+    m6502_init(c);
+    c->read_byte = &scratch_read;
+    c->write_byte = &scratch_write;
+    c->userdata = ls;
+    c->m65c02_mode = m65c02_mode;
+    c->enable_bcd = enable_bcd;
+
+    for (size_t lane = 0; lane < nb_lanes; lane++) {
+        m6502_lockstep_set_cpu(ls, lane, c);
+    }
+
+    return ls;
+}
+
+void m6502_lockstep_destroy(m6502_lockstep* ls) {
+    if (ls == NULL) {
+        return;
+    }
+    free(ls->memory);
+    free(ls->pc);
+    free(ls->a);
+    free(ls->x);
+    free(ls->y);
+    free(ls->sp);
+    free(ls->p);
+    free(ls->cyc);
+    free(ls->exit_pc);
+    free(ls->stop);
+    free(ls->wait);
+    free(ls->start_cyc);
+    free(ls->deadline);
+    free(ls->instructions);
+    free(ls->exits);
+    free(ls->done);
+    free(ls->over_budget);
+    free(ls->results);
+    free(ls->at_pc);
+    free(ls->together);
+    free(ls->addr);
+    free(ls->val);
+    free(ls->crossed);
+    free(ls);
+}
+
+void m6502_lockstep_set_io(m6502_lockstep* ls, uint16_t addr, size_t size,
+        m6502_lockstep_io_read io_read, m6502_lockstep_io_write io_write,
+        void* userdata) {
+    for (size_t page = addr >> 8; page < ((addr + size) >> 8); page++) {
+        // the zero page and the stack are accessed without checking
+        if (page >= 2) {
+            ls->io_pages[page] = true;
+            ls->has_io = true;
+        }
+    }
+    ls->io_read = io_read;
+    ls->io_write = io_write;
+    ls->io_userdata = userdata;
+}
+
+void m6502_lockstep_load(m6502_lockstep* ls, uint16_t addr,
+        const uint8_t* data, size_t size) {
+    uint8_t* const memory = ls->memory;
+    const size_t n = ls->nb_lanes;
+    for (size_t i = 0; i < size && addr + i < 0x10000; i++) {
+        memset(&MEM(addr + i, 0), data[i], n);
+    }
+}
+
+uint8_t m6502_lockstep_read(const m6502_lockstep* ls, size_t lane,
+        uint16_t addr) {
+    const uint8_t* const memory = ls->memory;
+    const size_t n = ls->nb_lanes;
+    return MEM(addr, lane);
+}
+
+void m6502_lockstep_write(m6502_lockstep* ls, size_t lane, uint16_t addr,
+        uint8_t val) {
+    uint8_t* const memory = ls->memory;
+    const size_t n = ls->nb_lanes;
+    MEM(addr, lane) = val;
+}
+
+void m6502_lockstep_get_cpu(const m6502_lockstep* ls, size_t lane,
+        m6502* c) {
+    c->pc = ls->pc[lane];
+    c->a = ls->a[lane];
+    c->x = ls->x[lane];
+    c->y = ls->y[lane];
+    c->sp = ls->sp[lane];
+    m6502_set_flags(c, ls->p[lane]);
+    c->cyc = ls->cyc[lane];
+    c->exit_pc = ls->exit_pc[lane];
+    c->stop = ls->stop[lane];
+    c->wait = ls->wait[lane];
+}
+
+void m6502_lockstep_set_cpu(m6502_lockstep* ls, size_t lane,
+        const m6502* c) {
+    ls->pc[lane] = c->pc;
+    ls->a[lane] = c->a;
+    ls->x[lane] = c->x;
+    ls->y[lane] = c->y;
+    ls->sp[lane] = c->sp;
+    ls->p[lane] = m6502_get_flags(c);
+    ls->cyc[lane] = c->cyc;
+    ls->exit_pc[lane] = c->exit_pc;
+    ls->stop[lane] = c->stop;
+    ls->wait[lane] = c->wait;
+}
+
+m6502_run_result m6502_lockstep_result(const m6502_lockstep* ls,
+        size_t lane) {
+    return ls->results[lane];
+}
+
+// executes the instruction at PC of a lane with the scratch CPU
+static void step_slow(m6502_lockstep* ls, size_t lane) {
+    m6502* const c = &ls->scratch;
+    ls->scratch_lane = lane;
+    m6502_lockstep_get_cpu(ls, lane, c);
+    m6502_step(c);
+    m6502_lockstep_set_cpu(ls, lane, c);
+}
+
+// computes the address of the memory operand of each lane (lanes that don't
+// execute the instruction get an unused address)
+static void compute_addresses(m6502_lockstep* ls, const m6502_opcode* op,
+        uint16_t operand) {
+    const uint8_t* const memory = ls->memory;
+    const size_t n = ls->nb_lanes;
+    const uint8_t* const x = ls->x;
+    const uint8_t* const y = ls->y;
+    uint16_t* const addr = ls->addr;
+    uint8_t* const crossed = ls->crossed;
+    const uint8_t op8 = operand & 0xFF;
+    // the 6502 reads the high byte of a pointer at 0xFF from 0x00
+    const uint16_t last_ptr = ls->m65c02_mode ? 0x100 : 0x00;
+
+    memset(crossed, 0, n);
+    switch (op->mode) {
+    case M6502_MODE_ZPG:
+    case M6502_MODE_ABS:
+        for (size_t l = 0; l < n; l++) {
+            addr[l] = operand;
+        }
+        break;
+    case M6502_MODE_ZPX:
+    case M6502_MODE_ZPY: {
+        const uint8_t* const index = op->mode == M6502_MODE_ZPX ? x : y;
+        for (size_t l = 0; l < n; l++) {
+            addr[l] = (uint8_t) (op8 + index[l]);
+        }
+        break;
+    }
+    case M6502_MODE_ABX:
+    case M6502_MODE_ABY: {
+        const uint8_t* const index = op->mode == M6502_MODE_ABX ? x : y;
+        for (size_t l = 0; l < n; l++) {
+            addr[l] = operand + index[l];
+            crossed[l] = (operand & 0xFF00) != (addr[l] & 0xFF00);
+        }
+        break;
+    }
+    case M6502_MODE_INX:
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t ptr = op8 + x[l];
+            const uint16_t hi = ptr == 0xFF ? last_ptr : ptr + 1;
+            addr[l] = (MEM(hi, l) << 8) | MEM(ptr, l);
+        }
+        break;
+    case M6502_MODE_INY: {
+        const uint16_t hi = op8 == 0xFF ? last_ptr : op8 + 1;
+        for (size_t l = 0; l < n; l++) {
+            const uint16_t base = (MEM(hi, l) << 8) | MEM(op8, l);
+            addr[l] = base + y[l];
+            crossed[l] = (base & 0xFF00) != (addr[l] & 0xFF00);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// executes an instruction for the lanes marked in together (all of them
+// with their memory operand, if any, outside of the I/O pages). The loops
+// compute the result of every lane, then select the new value of the lanes
+// executing the instruction: without conditional loads, the compiler can
+// vectorize them.
+static void execute_together(m6502_lockstep* ls, const m6502_opcode* op,
+        uint16_t pc, uint16_t operand) {
+    uint8_t* const memory = ls->memory;
+    const size_t n = ls->nb_lanes;
+    uint16_t* const pcs = ls->pc;
+    uint8_t* const a = ls->a;
+    uint8_t* const x = ls->x;
+    uint8_t* const y = ls->y;
+    uint8_t* const sp = ls->sp;
+    uint8_t* const p = ls->p;
+    uint64_t* const cyc = ls->cyc;
+    const uint8_t* const together = ls->together;
+    const uint16_t* const addr = ls->addr;
+    uint8_t* const val = ls->val;
+    uint8_t* const crossed = ls->crossed;
+    const uint8_t mnemonic = op->mnemonic;
+    const bool acc = op->mode == M6502_MODE_ACC;
+    const uint16_t next_pc = pc + op->length;
+    // with a zero page or absolute operand, the lanes access the same
+    // address, whose bytes are contiguous in memory
+    uint8_t* const row = op->mode == M6502_MODE_ZPG ||
+        op->mode == M6502_MODE_ABS ? &MEM(operand, 0) : NULL;
+    bool store = false; // the result in val is stored to the operand
+
+    // operand of each lane
+    if (op->mode == M6502_MODE_IMM) {
+        memset(val, operand & 0xFF, n);
+    }
+    else if (acc) {
+        memcpy(val, a, n);
+    }
+    else if (op->kind == M6502_KIND_READ || op->kind == M6502_KIND_RMW) {
+        if (row != NULL) {
+            memcpy(val, row, n);
+        }
+        else {
+            for (size_t l = 0; l < n; l++) {
+                val[l] = MEM(addr[l], l);
+            }
+        }
+    }
+
+    for (size_t l = 0; l < n; l++) {
+        pcs[l] = together[l] ? next_pc : pcs[l];
+    }
+
+    switch (mnemonic) {
+    case M6502_LDA: case M6502_LDX: case M6502_LDY: {
+        uint8_t* const reg = mnemonic == M6502_LDA ? a :
+            mnemonic == M6502_LDX ? x : y;
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t v = val[l];
+            const uint8_t flags = set_zn(p[l], v);
+            reg[l] = together[l] ? v : reg[l];
+            p[l] = together[l] ? flags : p[l];
+        }
+        break;
+    }
+    case M6502_STA: case M6502_STX: case M6502_STY:
+        memcpy(val, mnemonic == M6502_STA ? a : mnemonic == M6502_STX ? x : y,
+            n);
+        store = true;
+        break;
+    case M6502_STZ:
+        memset(val, 0, n);
+        store = true;
+        break;
+    case M6502_AND: case M6502_ORA: case M6502_EOR:
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t result = mnemonic == M6502_AND ? a[l] & val[l] :
+                mnemonic == M6502_ORA ? a[l] | val[l] : a[l] ^ val[l];
+            const uint8_t flags = set_zn(p[l], result);
+            a[l] = together[l] ? result : a[l];
+            p[l] = together[l] ? flags : p[l];
+        }
+        break;
+    case M6502_ADC: case M6502_SBC: {
+        // binary mode only (see execute_step); SBC adds the complement
+        const uint8_t complement = mnemonic == M6502_SBC ? 0xFF : 0x00;
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t v = val[l] ^ complement;
+            const uint16_t result = a[l] + v + (p[l] & M6502_FLAG_C);
+            uint8_t flags = set_zn(p[l], result & 0xFF);
+            flags = set_flag(flags, M6502_FLAG_V,
+                ~(a[l] ^ v) & (a[l] ^ result) & 0x80);
+            flags = set_flag(flags, M6502_FLAG_C, result & 0xFF00);
+            a[l] = together[l] ? result & 0xFF : a[l];
+            p[l] = together[l] ? flags : p[l];
+        }
+        break;
+    }
+    case M6502_CMP: case M6502_CPX: case M6502_CPY: {
+        const uint8_t* const reg = mnemonic == M6502_CMP ? a :
+            mnemonic == M6502_CPX ? x : y;
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t flags = set_flag(set_zn(p[l], reg[l] - val[l]),
+                M6502_FLAG_C, reg[l] >= val[l]);
+            p[l] = together[l] ? flags : p[l];
+        }
+        break;
+    }
+    case M6502_BIT: {
+        // BIT IMM (65C02) only sets Z
+        const uint8_t nv = op->mode == M6502_MODE_IMM ? 0x00 : 0xC0;
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t v = val[l];
+            const uint8_t flags = set_flag(p[l], M6502_FLAG_Z,
+                (v & a[l]) == 0);
+            p[l] = together[l] ? (flags & ~nv) | (v & nv) : p[l];
+        }
+        break;
+    }
+    case M6502_ASL: case M6502_ROL:
+    case M6502_LSR: case M6502_ROR: {
+        const bool left = mnemonic == M6502_ASL || mnemonic == M6502_ROL;
+        const bool rotate = mnemonic == M6502_ROL || mnemonic == M6502_ROR;
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t v = val[l];
+            const uint8_t carry = rotate ? p[l] & M6502_FLAG_C : 0;
+            const uint8_t result = left ? (v << 1) | carry :
+                (v >> 1) | (carry << 7);
+            const uint8_t flags = set_zn(set_flag(p[l], M6502_FLAG_C,
+                left ? v >> 7 : v & 1), result);
+            val[l] = result;
+            p[l] = together[l] ? flags : p[l];
+        }
+        store = true;
+        break;
+    }
+    case M6502_INC: case M6502_DEC: {
+        const uint8_t delta = mnemonic == M6502_INC ? 1 : 0xFF;
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t result = val[l] + delta;
+            const uint8_t flags = set_zn(p[l], result);
+            val[l] = result;
+            p[l] = together[l] ? flags : p[l];
+        }
+        store = true;
+        break;
+    }
+    case M6502_INX: case M6502_INY: case M6502_DEX: case M6502_DEY: {
+        uint8_t* const reg = mnemonic == M6502_INX ||
+            mnemonic == M6502_DEX ? x : y;
+        const uint8_t delta = mnemonic == M6502_INX ||
+            mnemonic == M6502_INY ? 1 : 0xFF;
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t result = reg[l] + delta;
+            const uint8_t flags = set_zn(p[l], result);
+            reg[l] = together[l] ? result : reg[l];
+            p[l] = together[l] ? flags : p[l];
+        }
+        break;
+    }
+    case M6502_TAX: case M6502_TAY: case M6502_TXA: case M6502_TYA:
+    case M6502_TSX: case M6502_TXS: {
+        const uint8_t* const src =
+            mnemonic == M6502_TAX || mnemonic == M6502_TAY ? a :
+            mnemonic == M6502_TXA || mnemonic == M6502_TXS ? x :
+            mnemonic == M6502_TYA ? y : sp;
+        uint8_t* const dst =
+            mnemonic == M6502_TAX || mnemonic == M6502_TSX ? x :
+            mnemonic == M6502_TAY ? y : mnemonic == M6502_TXS ? sp : a;
+        const bool flags = mnemonic != M6502_TXS;
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t v = src[l];
+            const uint8_t new_flags = flags ? set_zn(p[l], v) : p[l];
+            dst[l] = together[l] ? v : dst[l];
+            p[l] = together[l] ? new_flags : p[l];
+        }
+        break;
+    }
+    case M6502_CLC: case M6502_SEC: case M6502_CLI: case M6502_SEI:
+    case M6502_CLD: case M6502_SED: case M6502_CLV: {
+        const uint8_t mask =
+            mnemonic == M6502_CLC || mnemonic == M6502_SEC ? M6502_FLAG_C :
+            mnemonic == M6502_CLI || mnemonic == M6502_SEI ? M6502_FLAG_I :
+            mnemonic == M6502_CLD || mnemonic == M6502_SED ? M6502_FLAG_D :
+            M6502_FLAG_V;
+        const bool set = mnemonic == M6502_SEC || mnemonic == M6502_SEI ||
+            mnemonic == M6502_SED;
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t flags = set_flag(p[l], mask, set);
+            p[l] = together[l] ? flags : p[l];
+        }
+        break;
+    }
+    case M6502_BPL: case M6502_BMI: case M6502_BVC: case M6502_BVS:
+    case M6502_BCC: case M6502_BCS: case M6502_BNE: case M6502_BEQ:
+    case M6502_BRA: {
+        // the branch is taken when (p & mask) == expected
+        const uint8_t mask =
+            mnemonic == M6502_BPL || mnemonic == M6502_BMI ? M6502_FLAG_N :
+            mnemonic == M6502_BVC || mnemonic == M6502_BVS ? M6502_FLAG_V :
+            mnemonic == M6502_BCC || mnemonic == M6502_BCS ? M6502_FLAG_C :
+            mnemonic == M6502_BNE || mnemonic == M6502_BEQ ? M6502_FLAG_Z :
+            0;
+        const uint8_t expected = mnemonic == M6502_BMI ||
+            mnemonic == M6502_BVS || mnemonic == M6502_BCS ||
+            mnemonic == M6502_BEQ ? mask : 0;
+        const uint16_t target = next_pc + (int8_t) (operand & 0xFF);
+        const bool page_crossed = (next_pc & 0xFF00) != (target & 0xFF00);
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t taken = together[l] & ((p[l] & mask) == expected);
+            pcs[l] = taken ? target : pcs[l];
+            val[l] = taken;
+            crossed[l] = taken & page_crossed;
+        }
+        for (size_t l = 0; l < n; l++) {
+            cyc[l] += val[l]; // taken branches take one more cycle
+        }
+        break;
+    }
+    case M6502_JMP:
+        for (size_t l = 0; l < n; l++) {
+            pcs[l] = together[l] ? operand : pcs[l];
+        }
+        break;
+    case M6502_JSR: {
+        const uint16_t ret = next_pc - 1;
+        for (size_t l = 0; l < n; l++) {
+            if (together[l]) {
+                const uint16_t top = STACK_START_ADDR + sp[l];
+                MEM(top, l) = ret >> 8;
+                MEM(top - 1, l) = ret & 0xFF;
+                sp[l] -= 2;
+                pcs[l] = operand;
+            }
+        }
+        break;
+    }
+    case M6502_RTS:
+        for (size_t l = 0; l < n; l++) {
+            if (together[l]) {
+                const uint8_t lo = MEM(STACK_START_ADDR + ++sp[l], l);
+                const uint8_t hi = MEM(STACK_START_ADDR + ++sp[l], l);
+                pcs[l] = ((hi << 8) | lo) + 1;
+            }
+        }
+        break;
+    case M6502_PHA: case M6502_PHX: case M6502_PHY: {
+        const uint8_t* const reg = mnemonic == M6502_PHA ? a :
+            mnemonic == M6502_PHX ? x : y;
+        for (size_t l = 0; l < n; l++) {
+            if (together[l]) {
+                MEM(STACK_START_ADDR + sp[l]--, l) = reg[l];
+            }
+        }
+        break;
+    }
+    case M6502_PLA: case M6502_PLX: case M6502_PLY: {
+        uint8_t* const reg = mnemonic == M6502_PLA ? a :
+            mnemonic == M6502_PLX ? x : y;
+        for (size_t l = 0; l < n; l++) {
+            if (together[l]) {
+                reg[l] = MEM(STACK_START_ADDR + ++sp[l], l);
+                p[l] = set_zn(p[l], reg[l]);
+            }
+        }
+        break;
+    }
+    default:
+        // NOPs (they don't take additional cycles when crossing a page)
+        memset(crossed, 0, n);
+        break;
+    }
+
+    if (store && acc) {
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t v = val[l];
+            a[l] = together[l] ? v : a[l];
+        }
+    }
+    else if (store && row != NULL) {
+        for (size_t l = 0; l < n; l++) {
+            const uint8_t v = val[l];
+            row[l] = together[l] ? v : row[l];
+        }
+    }
+    else if (store) {
+        for (size_t l = 0; l < n; l++) {
+            if (together[l]) {
+                MEM(addr[l], l) = val[l];
+            }
+        }
+    }
+
+    const uint8_t cycles = op->cycles;
+    const uint8_t page_crossed_cycles = op->page_crossed_cycles;
+    for (size_t l = 0; l < n; l++) {
+        cyc[l] += together[l] *
+            (unsigned) (cycles + crossed[l] * page_crossed_cycles);
+    }
+}
+
+// executes the instruction at pc for the lanes marked in at_pc
+static void execute_step(m6502_lockstep* ls, uint16_t pc, size_t leader) {
+    const uint8_t* const memory = ls->memory;
+    const size_t n = ls->nb_lanes;
+    const uint8_t* const at_pc = ls->at_pc;
+    uint8_t* const together = ls->together;
+
+    // the lanes having the same instruction as the leader execute it
+    // together, unless it is in an I/O page
+    const uint8_t opcode = MEM(pc, leader);
+    const m6502_opcode* const op = &ls->opcodes[opcode];
+    const uint16_t last = pc + op->length - 1;
+    const uint16_t operand = op->length == 3 ?
+        (MEM(pc + 2, leader) << 8) | MEM(pc + 1, leader) :
+        MEM(pc + 1, leader);
+    if (ls->together_opcodes[opcode] && !ls->io_pages[pc >> 8] &&
+            !ls->io_pages[last >> 8]) {
+        memcpy(together, at_pc, n);
+    }
+    else {
+        memset(together, 0, n);
+    }
+    for (unsigned i = 0; i < op->length; i++) {
+        const uint8_t* const bytes = &MEM(pc + i, 0);
+        const uint8_t expected = bytes[leader];
+        for (size_t l = 0; l < n; l++) {
+            together[l] &= bytes[l] == expected;
+        }
+    }
+
+    // decimal ADC/SBC are executed by the scratch CPU
+    if (ls->enable_bcd &&
+            (op->mnemonic == M6502_ADC || op->mnemonic == M6502_SBC)) {
+        const uint8_t* const p = ls->p;
+        for (size_t l = 0; l < n; l++) {
+            together[l] &= !(p[l] & M6502_FLAG_D);
+        }
+    }
+
+    compute_addresses(ls, op, operand);
+
+    // so are accesses to I/O pages
+    if (ls->has_io && op->kind >= M6502_KIND_READ &&
+            op->kind <= M6502_KIND_RMW) {
+        const uint16_t* const addr = ls->addr;
+        for (size_t l = 0; l < n; l++) {
+            together[l] &= !ls->io_pages[addr[l] >> 8];
+        }
+    }
+
+    execute_together(ls, op, pc, operand);
+    if (memcmp(together, at_pc, n) != 0) {
+        for (size_t l = 0; l < n; l++) {
+            if (at_pc[l] && !together[l]) {
+                step_slow(ls, l);
+            }
+        }
+    }
+}
+
+// sets the exit condition of the lanes that executed the instruction at pc,
+// and marks the ones that ended their run as done (the arrays are distinct:
+// restrict lets the compiler vectorize the loop)
+static void update_exits(size_t n, uint16_t pc, int exit_flags,
+        const uint16_t* restrict pcs, const uint16_t* restrict exit_pc,
+        const uint8_t* restrict stop, const uint8_t* restrict wait,
+        const uint8_t* restrict over_budget, const uint8_t* restrict at_pc,
+        uint8_t* restrict exits, uint8_t* restrict done) {
+    const uint8_t check_pc = (exit_flags & M6502_EXIT_PC) != 0;
+    const uint8_t check_trap = (exit_flags & M6502_EXIT_TRAP) != 0;
+    for (size_t l = 0; l < n; l++) {
+        // same priority as m6502_run: PC, TRAP, budget, then STP/WAI
+        const uint8_t pc_reached = check_pc & (pcs[l] == exit_pc[l]);
+        const uint8_t trapped = check_trap & (pcs[l] == pc);
+        const uint8_t over = over_budget[l];
+        const uint8_t halted = (stop[l] | wait[l]) & !over;
+        const uint8_t exit = pc_reached ? M6502_EXIT_PC :
+            trapped ? M6502_EXIT_TRAP : halted * M6502_EXIT_STOP;
+        exits[l] = at_pc[l] ? exit : exits[l];
+        done[l] |= at_pc[l] & ((exit != 0) | over);
+    }
+}
+
+void m6502_lockstep_run(m6502_lockstep* ls, uint64_t cycle_budget,
+        int exit_flags) {
+    const size_t n = ls->nb_lanes;
+    const uint16_t* const pcs = ls->pc;
+    const uint64_t* const cyc = ls->cyc;
+    const uint8_t* const stop = ls->stop;
+    const uint8_t* const wait = ls->wait;
+    uint64_t* const start_cyc = ls->start_cyc;
+    uint64_t* const deadline = ls->deadline;
+    unsigned long* const instructions = ls->instructions;
+    uint8_t* const exits = ls->exits;
+    uint8_t* const done = ls->done;
+    uint8_t* const over_budget = ls->over_budget;
+    uint8_t* const at_pc = ls->at_pc;
+
+    // a lane is over budget when the sign bit of cyc - deadline is clear,
+    // which is exact while a run lasts less than 2^63 cycles
+    const uint64_t budget =
+        cycle_budget < UINT64_MAX / 2 ? cycle_budget : UINT64_MAX / 2 + 1;
+
+    // m6502_run checks the budget and STP/WAI before each instruction:
+    // they only change when a lane executes an instruction, so they are
+    // checked here, then after each instruction with its exit conditions
+    for (size_t l = 0; l < n; l++) {
+        start_cyc[l] = cyc[l];
+        deadline[l] = cyc[l] + budget;
+        instructions[l] = 0;
+        exits[l] = cycle_budget != 0 && (stop[l] || wait[l]) ?
+            M6502_EXIT_STOP : 0;
+        done[l] = cycle_budget == 0 || stop[l] || wait[l];
+    }
+
+    for (;;) {
+        // the lanes at the lowest PC execute their instruction first, which
+        // lets the lanes that diverged on a forward branch catch up
+        unsigned lowest_pc = 0x10000;
+        for (size_t l = 0; l < n; l++) {
+            const unsigned lane_pc = pcs[l] | (unsigned) done[l] << 16;
+            lowest_pc = lane_pc < lowest_pc ? lane_pc : lowest_pc;
+        }
+        if (lowest_pc == 0x10000) {
+            break;
+        }
+
+        for (size_t l = 0; l < n; l++) {
+            at_pc[l] = !done[l] & (pcs[l] == lowest_pc);
+        }
+        size_t leader = 0;
+        while (!at_pc[leader]) {
+            leader += 1;
+        }
+        execute_step(ls, lowest_pc, leader);
+
+        for (size_t l = 0; l < n; l++) {
+            over_budget[l] = ((cyc[l] - deadline[l]) >> 63) ^ 1;
+        }
+        for (size_t l = 0; l < n; l++) {
+            instructions[l] += at_pc[l];
+        }
+        update_exits(n, lowest_pc, exit_flags, pcs, ls->exit_pc, stop, wait,
+            over_budget, at_pc, exits, done);
+    }
+
+    for (size_t l = 0; l < n; l++) {
+        ls->results[l] = (m6502_run_result) {
+            cyc[l] - start_cyc[l], instructions[l], exits[l]
+        };
+    }
+}
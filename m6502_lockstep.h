@@ -0,0 +1,56 @@
+#ifndef M6502_M6502_LOCKSTEP_H_
+#define M6502_M6502_LOCKSTEP_H_
+
+#include "m6502.h"
+
+// a group of CPUs ("lanes") running the same program on different data.
+// The registers of the lanes are stored as arrays, and their memories are
+// interleaved (the byte at an address is contiguous for all the lanes), so
+// that the lanes at the same PC execute each instruction together. Lanes
+// whose instruction can't be executed this way (I/O, decimal mode, rare
+// opcodes) execute it with m6502_step. The results are the same as running
+// each lane with m6502_run, cycle counts included.
+typedef struct m6502_lockstep m6502_lockstep;
+
+// I/O callbacks, called with the lane accessing an I/O page
+typedef uint8_t (*m6502_lockstep_io_read)(void* userdata, size_t lane,
+    uint16_t addr);
+typedef void (*m6502_lockstep_io_write)(void* userdata, size_t lane,
+    uint16_t addr, uint8_t val);
+
+// creates a group of nb_lanes CPUs with 64 KiB of RAM each, all with
+// m6502_init's state, or returns NULL if the allocation fails
+m6502_lockstep* m6502_lockstep_create(size_t nb_lanes, bool m65c02_mode,
+    bool enable_bcd);
+void m6502_lockstep_destroy(m6502_lockstep* ls);
+
+// routes the accesses to [addr, addr + size) to the I/O callbacks (addr and
+// size must be multiples of 256). The zero page and the stack can't be I/O.
+void m6502_lockstep_set_io(m6502_lockstep* ls, uint16_t addr, size_t size,
+    m6502_lockstep_io_read io_read, m6502_lockstep_io_write io_write,
+    void* userdata);
+
+// memory of the lanes
+void m6502_lockstep_load(m6502_lockstep* ls, uint16_t addr,
+    const uint8_t* data, size_t size); // copies data to every lane
+uint8_t m6502_lockstep_read(const m6502_lockstep* ls, size_t lane,
+    uint16_t addr);
+void m6502_lockstep_write(m6502_lockstep* ls, size_t lane, uint16_t addr,
+    uint8_t val);
+
+// copies the registers, flags, cycle count, STP/WAI state and exit_pc of a
+// lane to or from c (the other fields of c are left untouched)
+void m6502_lockstep_get_cpu(const m6502_lockstep* ls, size_t lane,
+    m6502* c);
+void m6502_lockstep_set_cpu(m6502_lockstep* ls, size_t lane,
+    const m6502* c);
+
+// runs every lane as m6502_run(c, cycle_budget, exit_flags) would
+void m6502_lockstep_run(m6502_lockstep* ls, uint64_t cycle_budget,
+    int exit_flags);
+
+// what a lane executed during the last m6502_lockstep_run
+m6502_run_result m6502_lockstep_result(const m6502_lockstep* ls,
+    size_t lane);
+
+#endif // M6502_M6502_LOCKSTEP_H_
@@ -0,0 +1,83 @@
+#include <string.h>
+
+#include "m6502_mapper.h"
+
+void m6502_mapper_init(m6502_mapper* mapper, m6502* cpu) {
+    mapper->cpu = cpu;
+    mapper->nb_banks = 0;
+    for (unsigned page = 0; page < 256; page++) {
+        mapper->page_banks[page] = -1;
+        mapper->page_offsets[page] = 0;
+    }
+}
+
+int m6502_mapper_add(m6502_mapper* mapper, const char* name, uint8_t* mem,
+        size_t size, int access) {
+    if (mapper->nb_banks >= M6502_MAX_BANKS || size % 256 != 0) {
+        return -1;
+    }
+    mapper->banks[mapper->nb_banks] = (m6502_bank) {name, mem, size, access};
+    return mapper->nb_banks++;
+}
+
+int m6502_mapper_find(const m6502_mapper* mapper, const char* name) {
+    for (unsigned i = 0; i < mapper->nb_banks; i++) {
+        if (strcmp(mapper->banks[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool m6502_mapper_switch(m6502_mapper* mapper, uint16_t addr, size_t size,
+        int bank, size_t index) {
+    if (bank < 0 || (unsigned) bank >= mapper->nb_banks || size == 0 ||
+            ((addr | size) & 0xFF) != 0 || addr + size > 0x10000) {
+        return false;
+    }
+    const m6502_bank* const b = &mapper->banks[bank];
+    const size_t offset = index * size;
+    if (index >= b->size / size || offset + size > b->size) {
+        return false;
+    }
+
+    const unsigned first_page = addr >> 8;
+    const unsigned nb_pages = size >> 8;
+    unsigned mapped = 0;
+    while (mapped < nb_pages &&
+            mapper->page_banks[first_page + mapped] == bank &&
+            mapper->page_offsets[first_page + mapped] ==
+            offset + (mapped << 8)) {
+        mapped += 1;
+    }
+    if (mapped == nb_pages) {
+        return true; // (the window is already mapped)
+    }
+
+    // (the accesses the bank doesn't have go to the callbacks, or are
+    // ignored, instead of the previous bank)
+    m6502_unmap(mapper->cpu, addr, size);
+    m6502_map(mapper->cpu, addr, size, &b->mem[offset], b->access);
+
+    for (unsigned i = 0; i < nb_pages; i++) {
+        mapper->page_banks[first_page + i] = bank;
+        mapper->page_offsets[first_page + i] = offset + (i << 8);
+    }
+    return true;
+}
+
+void m6502_mapper_unmap(m6502_mapper* mapper, uint16_t addr, size_t size) {
+    m6502_unmap(mapper->cpu, addr, size);
+    for (size_t i = 0; i < size >> 8 && (addr >> 8) + i < 256; i++) {
+        mapper->page_banks[(addr >> 8) + i] = -1;
+    }
+}
+
+int m6502_mapper_bank_at(const m6502_mapper* mapper, uint16_t addr,
+        size_t* offset) {
+    const int bank = mapper->page_banks[addr >> 8];
+    if (bank >= 0 && offset != NULL) {
+        *offset = mapper->page_offsets[addr >> 8] + (addr & 0xFF);
+    }
+    return bank;
+}
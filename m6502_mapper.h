@@ -0,0 +1,59 @@
+#ifndef M6502_M6502_MAPPER_H_
+#define M6502_M6502_MAPPER_H_
+
+#include "m6502.h"
+
+// memory banks of a banked machine (cartridge banks, language cards, paged
+// RAM...): host buffers with a name and an access, switched into windows of
+// the address space of a CPU. A switch only rewrites the entries of the
+// window in the page table of the CPU (see m6502_map), so it costs a few
+// stores per 256-byte page, and the accesses to the bank stay on the direct
+// memory path instead of going through read_byte/write_byte.
+#define M6502_MAX_BANKS 64
+
+typedef struct m6502_bank {
+    const char* name;
+    uint8_t* mem;
+    size_t size; // multiple of 256
+    // M6502_MAP_* access of the bank once mapped, e.g. M6502_MAP_READWRITE
+    // for RAM, M6502_MAP_READ | M6502_MAP_PROTECT for a ROM ignoring writes,
+    // or M6502_MAP_READ for a ROM whose writes go to write_byte (e.g. to
+    // the registers of a cartridge mapper)
+    int access;
+} m6502_bank;
+
+typedef struct m6502_mapper {
+    m6502* cpu;
+    m6502_bank banks[M6502_MAX_BANKS];
+    unsigned nb_banks;
+    // bank mapped at each page of the CPU (-1 if none), and the offset of
+    // the page in the bank
+    int page_banks[256];
+    size_t page_offsets[256];
+} m6502_mapper;
+
+// initialises a mapper of the pages of a CPU, with no banks
+void m6502_mapper_init(m6502_mapper* mapper, m6502* cpu);
+
+// adds a bank and returns its number, or -1 if there are already
+// M6502_MAX_BANKS banks or its size isn't a multiple of 256
+int m6502_mapper_add(m6502_mapper* mapper, const char* name, uint8_t* mem,
+    size_t size, int access);
+// returns the number of the bank with the given name, or -1
+int m6502_mapper_find(const m6502_mapper* mapper, const char* name);
+
+// maps window number index of a bank (the size bytes at index * size in
+// the bank) at addr, e.g. the 8K or 16K windows of a cartridge, replacing
+// the banks or the pages mapped there. Returns false if the window isn't
+// in the bank, or if addr or size isn't a multiple of 256.
+bool m6502_mapper_switch(m6502_mapper* mapper, uint16_t addr, size_t size,
+    int bank, size_t index);
+// unmaps size bytes at addr (see m6502_unmap)
+void m6502_mapper_unmap(m6502_mapper* mapper, uint16_t addr, size_t size);
+
+// returns the bank mapped at an address (and the offset of the address in
+// the bank if offset isn't NULL), or -1 if none
+int m6502_mapper_bank_at(const m6502_mapper* mapper, uint16_t addr,
+    size_t* offset);
+
+#endif // M6502_M6502_MAPPER_H_
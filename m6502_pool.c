@@ -0,0 +1,300 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "m6502_pool.h"
+
+#define CACHE_LINE_SIZE 64
+#define HOST_PAGE_SIZE 4096
+
+// rounds size up to a multiple of alignment (a power of two)
+#define ALIGN_UP(size, alignment) \
+    (((size) + (alignment) - 1) & ~((size_t) (alignment) - 1))
+
+// a CPU and its completion state, aligned on a cache line so that the
+// threads running different CPUs don't share lines
+typedef struct pool_slot {
+    m6502 cpu;
+    int exit_flags;
+    uint64_t max_cycles;
+    m6502_run_result result; // only written by the thread running the CPU
+} pool_slot;
+
+struct m6502_pool {
+    size_t nb_cpus;
+    size_t memory_size;
+    size_t slot_stride; // distance between two slots in bytes
+    size_t memory_stride; // same for the memory images
+    uint8_t* slots;
+    uint8_t* memory;
+};
+
+static uint8_t open_bus_read(void* userdata, uint16_t addr) {
+    (void) userdata;
+    (void) addr;
+    return 0xFF;
+}
+
+static void open_bus_write(void* userdata, uint16_t addr, uint8_t val) {
+    (void) userdata;
+    (void) addr;
+    (void) val;
+}
+
+static pool_slot* get_slot(const m6502_pool* pool, size_t index) {
+    return (pool_slot*) (pool->slots + index * pool->slot_stride);
+}
+
+m6502_pool* m6502_pool_create(size_t nb_cpus, size_t memory_size) {
+    if (nb_cpus == 0 || memory_size == 0 || memory_size > 0x10000 ||
+            (memory_size & 0xFF) != 0) {
+        return NULL;
+    }
+
+    m6502_pool* pool = malloc(sizeof(m6502_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->nb_cpus = nb_cpus;
+    pool->memory_size = memory_size;
+    pool->slot_stride = ALIGN_UP(sizeof(pool_slot), CACHE_LINE_SIZE);
+    pool->memory_stride = ALIGN_UP(memory_size, HOST_PAGE_SIZE);
+
+    void* slots = NULL;
+    void* memory = NULL;
+    if (posix_memalign(&slots, CACHE_LINE_SIZE,
+            nb_cpus * pool->slot_stride) != 0 ||
+            posix_memalign(&memory, HOST_PAGE_SIZE,
+            nb_cpus * pool->memory_stride) != 0) {
+        free(slots);
+        free(pool);
+        return NULL;
+    }
+    pool->slots = slots;
+    pool->memory = memory;
+    memset(pool->memory, 0, nb_cpus * pool->memory_stride);
+
+    for (size_t i = 0; i < nb_cpus; i++) {
+        pool_slot* const slot = get_slot(pool, i);
+        m6502_init(&slot->cpu);
+        slot->cpu.read_byte = &open_bus_read;
+        slot->cpu.write_byte = &open_bus_write;
+        m6502_map(&slot->cpu, 0, memory_size, m6502_pool_memory(pool, i),
+            M6502_MAP_READWRITE);
+        slot->exit_flags = M6502_EXIT_TRAP;
+        slot->max_cycles = UINT64_MAX;
+        slot->result = (m6502_run_result) {0, 0, 0};
+    }
+
+    return pool;
+}
+
+void m6502_pool_destroy(m6502_pool* pool) {
+    if (pool != NULL) {
+        free(pool->slots);
+        free(pool->memory);
+        free(pool);
+    }
+}
+
+size_t m6502_pool_size(const m6502_pool* pool) {
+    return pool->nb_cpus;
+}
+
+m6502* m6502_pool_cpu(m6502_pool* pool, size_t index) {
+    return &get_slot(pool, index)->cpu;
+}
+
+uint8_t* m6502_pool_memory(m6502_pool* pool, size_t index) {
+    return pool->memory + index * pool->memory_stride;
+}
+
+void m6502_pool_set_exit(m6502_pool* pool, size_t index, int exit_flags,
+        uint64_t max_cycles) {
+    pool_slot* const slot = get_slot(pool, index);
+    slot->exit_flags = exit_flags;
+    slot->max_cycles = max_cycles;
+}
+
+m6502_run_result m6502_pool_result(const m6502_pool* pool, size_t index) {
+    return get_slot(pool, index)->result;
+}
+
+// scheduler: each thread owns a deque of CPUs to run. It takes them from
+// the bottom of its deque and puts them back there after each slice until
+// they are done; threads without work steal CPUs from the top of the
+// others' deques. The deque locks are only taken between slices.
+
+typedef struct worker {
+    pthread_mutex_t lock;
+    size_t* tasks; // ring buffer of CPU indices
+    size_t top, bottom; // the deque is tasks[top..bottom) (modulo capacity)
+    struct scheduler* scheduler;
+    unsigned id;
+} worker;
+
+typedef struct scheduler {
+    m6502_pool* pool;
+    worker* workers;
+    unsigned nb_workers;
+    unsigned long slice_cycles;
+    size_t remaining; // CPUs not done yet (atomic)
+} scheduler;
+
+static void push_bottom(worker* w, size_t task) {
+    const size_t capacity = w->scheduler->pool->nb_cpus;
+    pthread_mutex_lock(&w->lock);
+    w->tasks[w->bottom % capacity] = task;
+    w->bottom += 1;
+    pthread_mutex_unlock(&w->lock);
+}
+
+static bool pop_bottom(worker* w, size_t* task) {
+    const size_t capacity = w->scheduler->pool->nb_cpus;
+    bool found = false;
+    pthread_mutex_lock(&w->lock);
+    if (w->bottom != w->top) {
+        w->bottom -= 1;
+        *task = w->tasks[w->bottom % capacity];
+        found = true;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return found;
+}
+
+static bool steal_top(worker* w, size_t* task) {
+    const size_t capacity = w->scheduler->pool->nb_cpus;
+    bool found = false;
+    pthread_mutex_lock(&w->lock);
+    if (w->bottom != w->top) {
+        *task = w->tasks[w->top % capacity];
+        w->top += 1;
+        found = true;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return found;
+}
+
+// runs a slice of a CPU, and returns true if it is done
+static bool run_slice(scheduler* s, size_t index) {
+    pool_slot* const slot = get_slot(s->pool, index);
+
+    uint64_t budget = slot->max_cycles - slot->result.cyc;
+    if (budget > s->slice_cycles) {
+        budget = s->slice_cycles;
+    }
+
+    const m6502_run_result r = m6502_run(&slot->cpu, budget,
+        slot->exit_flags);
+    slot->result.cyc += r.cyc;
+    slot->result.instructions += r.instructions;
+    slot->result.exit = r.exit;
+
+    return r.exit != 0 || slot->result.cyc >= slot->max_cycles;
+}
+
+static void* work(void* arg) {
+    worker* const self = arg;
+    scheduler* const s = self->scheduler;
+
+    for (;;) {
+        size_t task;
+        bool found = pop_bottom(self, &task);
+        for (unsigned i = 1; !found && i < s->nb_workers; i++) {
+            found = steal_top(&s->workers[(self->id + i) % s->nb_workers],
+                &task);
+        }
+
+        if (!found) {
+            // the remaining CPUs are being run by other threads
+            if (__atomic_load_n(&s->remaining, __ATOMIC_ACQUIRE) == 0) {
+                return NULL;
+            }
+            sched_yield();
+            continue;
+        }
+
+        if (run_slice(s, task)) {
+            __atomic_fetch_sub(&s->remaining, 1, __ATOMIC_RELEASE);
+        }
+        else {
+            push_bottom(self, task);
+        }
+    }
+}
+
+bool m6502_pool_run(m6502_pool* pool, unsigned nb_threads,
+        unsigned long slice_cycles) {
+    if (nb_threads == 0) {
+        const long nb_processors = sysconf(_SC_NPROCESSORS_ONLN);
+        nb_threads = nb_processors > 0 ? nb_processors : 1;
+    }
+    if (nb_threads > pool->nb_cpus) {
+        nb_threads = pool->nb_cpus;
+    }
+    if (slice_cycles == 0) {
+        slice_cycles = 1;
+    }
+
+    scheduler s;
+    s.pool = pool;
+    s.nb_workers = nb_threads;
+    s.slice_cycles = slice_cycles;
+    s.remaining = pool->nb_cpus;
+    s.workers = malloc(nb_threads * sizeof(worker));
+    size_t* const tasks = malloc(nb_threads * pool->nb_cpus * sizeof(size_t));
+    pthread_t* const threads = malloc(nb_threads * sizeof(pthread_t));
+    bool* const started = malloc(nb_threads * sizeof(bool));
+    if (s.workers == NULL || tasks == NULL || threads == NULL ||
+            started == NULL) {
+        free(started);
+        free(threads);
+        free(tasks);
+        free(s.workers);
+        return false;
+    }
+
+    // each thread starts with a contiguous range of CPUs
+    for (unsigned w = 0; w < nb_threads; w++) {
+        worker* const wk = &s.workers[w];
+        pthread_mutex_init(&wk->lock, NULL);
+        wk->tasks = tasks + w * pool->nb_cpus;
+        wk->scheduler = &s;
+        wk->id = w;
+        wk->top = 0;
+        wk->bottom = 0;
+
+        const size_t first = pool->nb_cpus * w / nb_threads;
+        const size_t last = pool->nb_cpus * (w + 1) / nb_threads;
+        for (size_t i = last; i-- > first;) {
+            get_slot(pool, i)->result = (m6502_run_result) {0, 0, 0};
+            wk->tasks[wk->bottom++] = i;
+        }
+    }
+
+    // the calling thread is the first worker. If a thread can't be
+    // created, the CPUs of its worker are stolen by the others.
+    for (unsigned w = 1; w < nb_threads; w++) {
+        started[w] = pthread_create(&threads[w], NULL, work,
+            &s.workers[w]) == 0;
+    }
+    work(&s.workers[0]);
+    for (unsigned w = 1; w < nb_threads; w++) {
+        if (started[w]) {
+            pthread_join(threads[w], NULL);
+        }
+    }
+
+    for (unsigned w = 0; w < nb_threads; w++) {
+        pthread_mutex_destroy(&s.workers[w].lock);
+    }
+    free(started);
+    free(threads);
+    free(tasks);
+    free(s.workers);
+    return true;
+}
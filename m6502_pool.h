@@ -0,0 +1,39 @@
+#ifndef M6502_M6502_POOL_H_
+#define M6502_M6502_POOL_H_
+
+#include "m6502.h"
+
+// a pool of independent CPUs, each with its own memory image mapped at
+// 0x0000, executed concurrently by m6502_pool_run
+typedef struct m6502_pool m6502_pool;
+
+// creates a pool of nb_cpus CPUs with memory_size bytes of memory each (a
+// multiple of 256, at most 0x10000), or returns NULL if the allocation
+// fails. The CPUs are initialised with m6502_init; accesses outside of
+// their memory read 0xFF and ignore writes, unless the callbacks are
+// replaced.
+m6502_pool* m6502_pool_create(size_t nb_cpus, size_t memory_size);
+void m6502_pool_destroy(m6502_pool* pool);
+
+size_t m6502_pool_size(const m6502_pool* pool);
+m6502* m6502_pool_cpu(m6502_pool* pool, size_t index);
+uint8_t* m6502_pool_memory(m6502_pool* pool, size_t index);
+
+// sets when a CPU is done: when m6502_run exits with one of exit_flags
+// (see M6502_EXIT_*; a stopped CPU is always done), or after max_cycles.
+// By default, CPUs are done when they are trapped, with no cycle limit.
+void m6502_pool_set_exit(m6502_pool* pool, size_t index, int exit_flags,
+    uint64_t max_cycles);
+
+// runs every CPU until it is done, on nb_threads threads (0 for one per
+// online processor; fewer if threads can't be created), by slices of
+// slice_cycles cycles. Returns false, without running any CPU, if the
+// scheduler can't be allocated.
+bool m6502_pool_run(m6502_pool* pool, unsigned nb_threads,
+    unsigned long slice_cycles);
+
+// what a CPU executed during the last m6502_pool_run: exit is 0 if the CPU
+// reached its cycle limit
+m6502_run_result m6502_pool_result(const m6502_pool* pool, size_t index);
+
+#endif // M6502_M6502_POOL_H_
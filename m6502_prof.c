@@ -0,0 +1,197 @@
+// profiler: runs a program on the emulator built with M6502_PROFILE, then
+// prints the opcodes, addressing modes and addresses its cycles are spent on.
+// It can also record the last instructions executed in a trace file (built
+// with M6502_TRACE), decoded by m6502_trace.
+//
+// usage: m6502_prof [-n top] [-a load_addr] [-s start_pc] [-e exit_pc]
+//                   [-m max_cycles] [-c] [-t trace_file [-T records]]
+//                   image.bin
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "m6502.h"
+
+#define MEMORY_SIZE 0x10000
+
+static uint8_t memory[MEMORY_SIZE];
+
+// the whole memory is mapped: the callbacks are never called
+static uint8_t rb(void* userdata, uint16_t addr) {
+    (void) userdata;
+    return memory[addr];
+}
+
+static void wb(void* userdata, uint16_t addr, uint8_t val) {
+    (void) userdata;
+    memory[addr] = val;
+}
+
+// maps a trace file of the given capacity, whose records are written to the
+// file as they are recorded (they are kept if the program crashes)
+static m6502_trace* map_trace(const char* filename, uint32_t capacity) {
+    const size_t size = m6502_trace_size(capacity);
+    const int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    void* const mem = ftruncate(fd, size) == 0
+        ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+    if (mem == MAP_FAILED) {
+        return NULL;
+    }
+    m6502_trace_init(mem, capacity);
+    return mem;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-n top] [-a load_addr] [-s start_pc] "
+        "[-e exit_pc] [-m max_cycles] [-c] [-t trace_file [-T records]] "
+        "image.bin\n"
+        "  -n  number of opcodes and addresses printed (default: 20)\n"
+        "  -a  address the image is loaded at (default: 0)\n"
+        "  -s  start address (default: the RESET vector)\n"
+        "  -e  stops when the program counter reaches exit_pc (the program\n"
+        "      also stops on an instruction jumping to itself, STP or WAI)\n"
+        "  -m  maximum number of cycles (default: 1000000000)\n"
+        "  -c  emulates a 65C02\n"
+        "  -t  records the last instructions in trace_file (see m6502_trace)\n"
+        "  -T  number of instructions kept in the trace (default: 1048576)\n",
+        name);
+}
+
+int main(int argc, char** argv) {
+    unsigned top = 20;
+    unsigned long load_addr = 0;
+    long start_pc = -1, exit_pc = -1;
+    uint64_t max_cycles = 1000000000;
+    bool m65c02_mode = false;
+    const char* filename = NULL;
+    const char* trace_filename = NULL;
+    unsigned long trace_capacity = 1 << 20;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+            top = strtoul(argv[++i], NULL, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-a") == 0) {
+            load_addr = strtoul(argv[++i], NULL, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+            start_pc = strtol(argv[++i], NULL, 0) & 0xFFFF;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-e") == 0) {
+            exit_pc = strtol(argv[++i], NULL, 0) & 0xFFFF;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-m") == 0) {
+            max_cycles = strtoull(argv[++i], NULL, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-t") == 0) {
+            trace_filename = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-T") == 0) {
+            trace_capacity = strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-c") == 0) {
+            m65c02_mode = true;
+        }
+        else if (argv[i][0] != '-' && filename == NULL) {
+            filename = argv[i];
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (filename == NULL || load_addr >= MEMORY_SIZE ||
+            trace_capacity == 0 || trace_capacity > UINT32_MAX) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "error: can't open file '%s'.\n", filename);
+        return 1;
+    }
+    const size_t size = fread(&memory[load_addr], 1, MEMORY_SIZE - load_addr,
+        f);
+    fclose(f);
+    if (size == 0) {
+        fprintf(stderr, "error: while reading file '%s'\n", filename);
+        return 1;
+    }
+
+    m6502_profile* const profile = malloc(sizeof(m6502_profile));
+    if (profile == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return 1;
+    }
+    m6502_profile_reset(profile);
+
+    m6502 cpu;
+    m6502_init(&cpu);
+    cpu.read_byte = &rb;
+    cpu.write_byte = &wb;
+    cpu.m65c02_mode = m65c02_mode;
+    m6502_map(&cpu, 0, MEMORY_SIZE, memory, M6502_MAP_READWRITE);
+    if (!m6502_set_profile(&cpu, profile)) {
+        fprintf(stderr, "error: the emulator isn't built with "
+            "M6502_PROFILE\n");
+        free(profile);
+        return 1;
+    }
+    m6502_trace* trace = NULL;
+    if (trace_filename != NULL) {
+        trace = map_trace(trace_filename, trace_capacity);
+        if (trace == NULL) {
+            fprintf(stderr, "error: can't map trace file '%s'.\n",
+                trace_filename);
+            free(profile);
+            return 1;
+        }
+        if (!m6502_set_trace(&cpu, trace)) {
+            fprintf(stderr, "error: the emulator isn't built with "
+                "M6502_TRACE\n");
+            munmap(trace, m6502_trace_size(trace_capacity));
+            free(profile);
+            return 1;
+        }
+    }
+    if (start_pc < 0) {
+        m6502_gen_res(&cpu);
+    }
+    else {
+        cpu.pc = start_pc;
+    }
+    int exit_flags = M6502_EXIT_TRAP;
+    if (exit_pc >= 0) {
+        cpu.exit_pc = exit_pc;
+        exit_flags |= M6502_EXIT_PC;
+    }
+
+    const m6502_run_result r = m6502_run(&cpu, max_cycles, exit_flags);
+    printf("%s at PC:%04X after %lu instructions and %" PRIu64 " cycles "
+        "(%" PRIu64 " cycles in skipped idle loops)\n\n",
+        r.exit == M6502_EXIT_PC ? "exit" :
+        r.exit == M6502_EXIT_TRAP ? "trap" :
+        r.exit == M6502_EXIT_STOP ? "stopped" : "cycle limit reached",
+        cpu.pc, r.instructions, r.cyc, cpu.idle_cycles);
+    m6502_profile_print(stdout, profile, m65c02_mode, top);
+
+    if (trace != NULL) {
+        printf("\n%" PRIu64 " instructions recorded in '%s'\n", trace->count,
+            trace_filename);
+        munmap(trace, m6502_trace_size(trace_capacity));
+    }
+    free(profile);
+    return 0;
+}
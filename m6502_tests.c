@@ -1,26 +1,83 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include "m6502.h"
+#include "m6502_pool.h"
+#include "m6502_lockstep.h"
+#include "m6502_image.h"
+#include "m6502_mapper.h"
 
-static m6502 cpu;
-
-// memory callbacks
 #define MEMORY_SIZE 0x10000
-static uint8_t* memory;
 
+// the tests are executed by slices of RUN_SLICE cycles, until they exit,
+// exceed their cycle or instruction limit or run out of time
+#define RUN_SLICE 1000000UL
+#define DEFAULT_MAX_CYCLES 1000000000UL
+#define DEFAULT_TIMEOUT 60.0 // seconds
+
+// the state of a test: each test has its own CPU and memory, so that the
+// tests can run concurrently
+typedef struct test_context {
+    m6502 cpu;
+    uint8_t memory[MEMORY_SIZE];
+    m6502_decoded* decode_cache;
+
+    unsigned long max_cycles;
+    unsigned long max_instructions;
+    double timeout;
+
+    char output[1024]; // report of the test, printed once it is done
+    size_t output_size;
+} test_context;
+
+// appends to the report of a test
+static void test_printf(test_context* t, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    const int n = vsnprintf(t->output + t->output_size,
+        sizeof(t->output) - t->output_size, format, args);
+    va_end(args);
+
+    if (n > 0) {
+        t->output_size += n;
+        if (t->output_size >= sizeof(t->output)) {
+            t->output_size = sizeof(t->output) - 1;
+        }
+    }
+}
+
+// memory callbacks
 static uint8_t rb(void* userdata, uint16_t addr) {
-    return memory[addr];
+    test_context* t = userdata;
+    return t->memory[addr];
 }
 
 static void wb(void* userdata, uint16_t addr, uint8_t val) {
-    memory[addr] = val;
+    test_context* t = userdata;
+    t->memory[addr] = val;
 }
 
-static int load_file_into_memory(const char* filename, uint16_t addr) {
+// clears the memory and initialises the CPU with the memory callbacks
+static void reset_context(test_context* t) {
+    memset(t->memory, 0, MEMORY_SIZE);
+    m6502_init(&t->cpu);
+    t->cpu.read_byte = &rb;
+    t->cpu.write_byte = &wb;
+    t->cpu.userdata = t;
+}
+
+static int load_file_into_memory(test_context* t, const char* filename,
+        uint16_t addr) {
     FILE* f = fopen(filename, "rb");
     if (f == NULL) {
-        fprintf(stderr, "error: can't open file '%s'.\n", filename);
+        test_printf(t, "error: can't open file '%s'.\n", filename);
         return 1;
     }
 
@@ -30,15 +87,15 @@ static int load_file_into_memory(const char* filename, uint16_t addr) {
     rewind(f);
 
     if (file_size + addr > MEMORY_SIZE) {
-        fprintf(stderr, "error: file %s can't fit in memory.\n", filename);
+        test_printf(t, "error: file %s can't fit in memory.\n", filename);
         fclose(f);
         return 1;
     }
 
     // copying the bytes in the memory:
-    size_t result = fread(&memory[addr], sizeof(uint8_t), file_size, f);
+    size_t result = fread(&t->memory[addr], sizeof(uint8_t), file_size, f);
     if (result != file_size) {
-        fprintf(stderr, "error: while reading file '%s'\n", filename);
+        test_printf(t, "error: while reading file '%s'\n", filename);
         fclose(f);
         return 1;
     }
@@ -47,316 +104,1489 @@ static int load_file_into_memory(const char* filename, uint16_t addr) {
     return 0;
 }
 
-static int test_allsuitea(unsigned long expected_cyc) {
-    printf("AllSuiteA: ");
-
-    memset(memory, 0, MEMORY_SIZE);
-    load_file_into_memory("programs/AllSuiteA.bin", 0x4000);
-    m6502_init(&cpu);
-    cpu.read_byte = &rb;
-    cpu.write_byte = &wb;
-    m6502_gen_res(&cpu);
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    int nb_instructions_executed = 0;
-    while (true) {
-        m6502_step(&cpu);
+// runs the CPU until an exit condition is met, and returns true if it was.
+// Otherwise, the test exceeded its limits, which is reported with the state
+// of the CPU.
+static bool run_test(test_context* t, int exit_flags,
+        m6502_run_result* result) {
+    const double start = seconds();
+    *result = (m6502_run_result) {0, 0, 0};
+
+    for (;;) {
+        const m6502_run_result r = m6502_run(&t->cpu, RUN_SLICE, exit_flags);
+        result->cyc += r.cyc;
+        result->instructions += r.instructions;
+        result->exit = r.exit;
+        if (r.exit != 0) {
+            return true;
+        }
 
-        nb_instructions_executed += 1;
+        const char* limit = NULL;
+        if (result->cyc >= t->max_cycles) {
+            limit = "cycle limit reached";
+        }
+        else if (result->instructions >= t->max_instructions) {
+            limit = "instruction limit reached";
+        }
+        else if (seconds() - start >= t->timeout) {
+            limit = "timeout";
+        }
 
-        if (cpu.pc == 0x45C0) {
-            if (rb(&cpu, 0x0210) == 0xFF) {
-                printf("PASS");
-            }
-            else {
-                printf("FAIL");
-            }
-            break;
+        if (limit != NULL) {
+            const m6502* const c = &t->cpu;
+            test_printf(t, "FAIL (%s at PC:%04X, A:%02X X:%02X Y:%02X "
+                "SP:%02X P:%02X)", limit, c->pc, c->a, c->x, c->y, c->sp,
+                m6502_get_flags(c));
+            return false;
         }
     }
+}
 
-    long long diff = expected_cyc - cpu.cyc;
-    printf(" (%d instructions executed on %lu cycles, "
+// prints the instructions and cycles executed by a test
+static void print_cycles(test_context* t, m6502_run_result r,
+        unsigned long expected_cyc) {
+    long long diff = expected_cyc - t->cpu.cyc;
+    test_printf(t, " (%lu instructions executed on %" PRIu64 " cycles, "
         " expected=%lu, diff=%lld)\n",
-        nb_instructions_executed, cpu.cyc,
+        r.instructions, t->cpu.cyc,
         expected_cyc, diff);
+}
+
+static int test_allsuitea(test_context* t, unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/AllSuiteA.bin", 0x4000) != 0) {
+        return 1;
+    }
+    m6502_gen_res(&t->cpu);
+    t->cpu.exit_pc = 0x45C0;
+
+    m6502_run_result r;
+    if (run_test(t, M6502_EXIT_PC, &r)) {
+        test_printf(t, "%s", t->memory[0x0210] == 0xFF ? "PASS" : "FAIL");
+    }
+    print_cycles(t, r, expected_cyc);
+
+    return t->cpu.cyc != expected_cyc;
+}
+
+static int test_6502_functional_test(test_context* t,
+        unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/6502_65C02_functional_tests/bin_files/6502_functional_test.bin", 0) != 0) {
+        return 1;
+    }
+    m6502_map(&t->cpu, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+    m6502_set_decode_cache(&t->cpu, t->decode_cache);
+    t->cpu.pc = 0x400;
+
+    // run until the program is trapped somewhere
+    m6502_run_result r;
+    if (run_test(t, M6502_EXIT_TRAP, &r)) {
+        if (t->cpu.pc == 0x3469) {
+            test_printf(t, "PASS");
+        }
+        else {
+            test_printf(t, "FAIL (trapped at 0x%04X)", t->cpu.pc);
+        }
+    }
+    print_cycles(t, r, expected_cyc);
 
-    return cpu.cyc != expected_cyc;
+    return t->cpu.cyc != expected_cyc;
 }
 
-static int test_6502_functional_test(unsigned long expected_cyc) {
-    printf("6502_functional_test: ");
+static int test_6502_decimal_test(test_context* t,
+        unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/6502_decimal_test.bin", 0x200) != 0) {
+        return 1;
+    }
+    m6502_map(&t->cpu, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+    t->cpu.pc = 0x200;
+
+    t->cpu.exit_pc = 0x024b;
+
+    m6502_run_result r;
+    if (run_test(t, M6502_EXIT_PC, &r)) {
+        test_printf(t, "%s", t->cpu.a == 0 ? "PASS" : "FAIL");
+    }
+    print_cycles(t, r, expected_cyc);
 
-    memset(memory, 0, MEMORY_SIZE);
-    if (load_file_into_memory("programs/6502_65C02_functional_tests/bin_files/6502_functional_test.bin", 0) != 0) {
+    return t->cpu.cyc != expected_cyc;
+}
+
+static int test_timingtest(test_context* t, unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/timingtest/timingtest-1.bin", 0x1000) != 0) {
         return 1;
     }
-    m6502_init(&cpu);
-    cpu.read_byte = &rb;
-    cpu.write_byte = &wb;
-    cpu.pc = 0x400;
+    t->cpu.pc = 0x1000;
 
-    int nb_instructions_executed = 0;
-    uint16_t previous_pc = 0;
-    while (true) {
-        m6502_step(&cpu);
+    t->cpu.exit_pc = 0x1269;
 
-        nb_instructions_executed += 1;
+    m6502_run_result r;
+    if (run_test(t, M6502_EXIT_PC, &r)) {
+        test_printf(t, "%s", t->cpu.cyc == 1141 ? "PASS" : "FAIL");
+    }
+    print_cycles(t, r, expected_cyc);
 
-        // if the program is trapped somewhere, print and exit
-        if (previous_pc == cpu.pc) {
-            if (cpu.pc == 0x3469) {
-                printf("PASS");
-                break;
-            }
-            printf("FAIL (trapped at 0x%04X)", cpu.pc);
-            break;
+    return t->cpu.cyc != expected_cyc;
+}
+
+static int test_65C02_extended_opcodes_test(test_context* t,
+        unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/6502_65C02_functional_tests/bin_files/65C02_extended_opcodes_test.bin", 0) != 0) {
+        return 1;
+    }
+    m6502_map(&t->cpu, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+    m6502_set_decode_cache(&t->cpu, t->decode_cache);
+    t->cpu.pc = 0x400;
+    t->cpu.m65c02_mode = 1;
+
+    // run until the program is trapped somewhere
+    m6502_run_result r;
+    if (run_test(t, M6502_EXIT_TRAP, &r)) {
+        if (t->cpu.pc == 0x24F1) {
+            test_printf(t, "PASS");
+        }
+        else {
+            test_printf(t, "FAIL (trapped at 0x%04X)", t->cpu.pc);
         }
-        previous_pc = cpu.pc;
     }
+    print_cycles(t, r, expected_cyc);
 
-    long long diff = expected_cyc - cpu.cyc;
-    printf(" (%d instructions executed on %lu cycles, "
-        " expected=%lu, diff=%lld)\n",
-        nb_instructions_executed, cpu.cyc,
-        expected_cyc, diff);
+    return t->cpu.cyc != expected_cyc;
+}
+
+// feedback register of the interrupt test, whose bits drive the interrupt
+// lines (open collector: a bit set asserts its line)
+#define I_PORT 0xBFFC
+#define I_PORT_IRQ (1 << 0)
+#define I_PORT_NMI (1 << 1)
+
+static void wb_feedback(void* userdata, uint16_t addr, uint8_t val) {
+    test_context* t = userdata;
+    t->memory[addr] = val;
+    if (addr == I_PORT) {
+        m6502_set_irq(&t->cpu, 1, val & I_PORT_IRQ);
+        m6502_set_nmi(&t->cpu, val & I_PORT_NMI);
+    }
+}
+
+// runs one of the manual WAI tests of the 65C02 at pc: the IRQ line is
+// asserted once the CPU waits, and released after it resumes if the test
+// doesn't release it itself
+static bool run_wai_test(test_context* t, uint16_t pc, uint16_t success_pc) {
+    m6502* const c = &t->cpu;
+    c->pc = pc;
+    if (m6502_run(c, 1000, M6502_EXIT_TRAP).exit != M6502_EXIT_STOP ||
+            !c->wait) {
+        return false;
+    }
+    m6502_set_irq(c, 1, true);
+    m6502_step(c);
+    m6502_set_irq(c, 1, false);
+    return m6502_run(c, 1000, M6502_EXIT_TRAP).exit == M6502_EXIT_TRAP &&
+        c->pc == success_pc;
+}
+
+static int test_6502_interrupt_test(test_context* t,
+        unsigned long expected_cyc) {
+    reset_context(t);
+    // the image starts at the zero page variables of the test
+    if (load_file_into_memory(t, "programs/6502_interrupt_test.bin", 0x0A) != 0) {
+        return 1;
+    }
+    t->memory[I_PORT] = 0; // no interrupt asserted
+    t->cpu.write_byte = &wb_feedback;
+    t->cpu.pc = 0x400;
+
+    // run until the program is trapped somewhere
+    m6502_run_result r;
+    bool ok = false;
+    if (run_test(t, M6502_EXIT_TRAP, &r)) {
+        ok = t->cpu.pc == 0x06f5;
+        if (!ok) {
+            test_printf(t, "FAIL (trapped at 0x%04X)", t->cpu.pc);
+        }
+    }
+    const uint64_t cyc = t->cpu.cyc;
+
+    // then the WAI tests, with interrupts disabled and enabled
+    if (ok) {
+        t->cpu.m65c02_mode = 1;
+        ok = run_wai_test(t, 0x06fb, 0x070f) && run_wai_test(t, 0x0712, 0x072c);
+        test_printf(t, "%s", ok ? "PASS" : "FAIL (WAI)");
+    }
+    t->cpu.cyc = cyc;
+    print_cycles(t, r, expected_cyc);
+
+    return !ok || t->cpu.cyc != expected_cyc;
+}
+
+// The following test has been assembled with this configuration:
+// cputype = 1         ; 0 = 6502, 1 = 65C02, 2 = 65C816
+// vld_bcd = 0         ; 0 = allow invalid bcd, 1 = valid bcd only
+// chk_a   = 1         ; check accumulator
+// chk_n   = 1         ; check sign (negative) flag
+// chk_v   = 0         ; check overflow flag
+// chk_z   = 1         ; check zero flag
+// chk_c   = 1         ; check carry flag
+static int test_65C02_decimal_test(test_context* t,
+        unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/65C02_decimal_test.bin", 0x200) != 0) {
+        return 1;
+    }
+    m6502_map(&t->cpu, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+    t->cpu.pc = 0x200;
+    t->cpu.m65c02_mode = 1;
+
+    t->cpu.exit_pc = 0x024b;
+
+    m6502_run_result r;
+    if (run_test(t, M6502_EXIT_PC, &r)) {
+        test_printf(t, "%s", t->cpu.a == 0 ? "PASS" : "FAIL");
+    }
+    print_cycles(t, r, expected_cyc);
 
-    return cpu.cyc != expected_cyc;
+    return t->cpu.cyc != expected_cyc;
 }
 
-static int test_6502_decimal_test(unsigned long expected_cyc) {
-    printf("6502_decimal_test: ");
+static int test_65c02_timingtest(test_context* t,
+        unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/65c02timing/65c02timing.bin", 0x6000) != 0) {
+        return 1;
+    }
+    t->cpu.pc = 0x6000;
+    t->cpu.m65c02_mode = 1;
+
+    // run until the program is trapped somewhere
+    m6502_run_result r;
+    if (run_test(t, M6502_EXIT_TRAP, &r)) {
+        test_printf(t, "%s", t->cpu.y == 1 ? "PASS" : "FAIL");
+    }
+    print_cycles(t, r, expected_cyc);
 
-    memset(memory, 0, MEMORY_SIZE);
-    if (load_file_into_memory("programs/6502_decimal_test.bin", 0x200) != 0) {
+    return t->cpu.cyc != expected_cyc;
+}
+
+// runs AllSuiteA on every CPU of a pool, in small slices so that the CPUs
+// move between threads
+#define POOL_SIZE 16
+
+static int test_pool(test_context* t, unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/AllSuiteA.bin", 0x4000) != 0) {
         return 1;
     }
-    m6502_init(&cpu);
-    cpu.read_byte = &rb;
-    cpu.write_byte = &wb;
-    cpu.pc = 0x200;
 
-    int nb_instructions_executed = 0;
-    while (true) {
-        m6502_step(&cpu);
+    m6502_pool* pool = m6502_pool_create(POOL_SIZE, MEMORY_SIZE);
+    if (pool == NULL) {
+        test_printf(t, "FAIL (out of memory)\n");
+        return 1;
+    }
+    for (size_t i = 0; i < POOL_SIZE; i++) {
+        memcpy(m6502_pool_memory(pool, i), t->memory, MEMORY_SIZE);
+        m6502* const c = m6502_pool_cpu(pool, i);
+        m6502_gen_res(c);
+        c->exit_pc = 0x45C0;
+        m6502_pool_set_exit(pool, i, M6502_EXIT_PC, t->max_cycles);
+    }
 
-        nb_instructions_executed += 1;
+    if (!m6502_pool_run(pool, 4, 100)) {
+        test_printf(t, "FAIL (out of memory)\n");
+        m6502_pool_destroy(pool);
+        return 1;
+    }
 
-        if (cpu.pc == 0x024b) {
-            printf("%s", cpu.a == 0 ? "PASS" : "FAIL");
-            break;
+    unsigned nb_passed = 0;
+    int r = 0;
+    for (size_t i = 0; i < POOL_SIZE; i++) {
+        const m6502_run_result result = m6502_pool_result(pool, i);
+        if (result.exit == M6502_EXIT_PC &&
+                m6502_pool_memory(pool, i)[0x0210] == 0xFF) {
+            nb_passed += 1;
         }
+        r += m6502_pool_cpu(pool, i)->cyc != expected_cyc;
     }
+    m6502_pool_destroy(pool);
 
-    long long diff = expected_cyc - cpu.cyc;
-    printf(" (%d instructions executed on %lu cycles, "
-        " expected=%lu, diff=%lld)\n",
-        nb_instructions_executed, cpu.cyc,
-        expected_cyc, diff);
+    test_printf(t, "%s (%u/%d CPUs passed", nb_passed == POOL_SIZE
+        ? "PASS" : "FAIL", nb_passed, POOL_SIZE);
+    test_printf(t, ", %d with a cycle count different from %lu)\n", r,
+        expected_cyc);
 
-    return cpu.cyc != expected_cyc;
+    return r != 0 || nb_passed != POOL_SIZE;
 }
 
-static int test_timingtest(unsigned long expected_cyc) {
-    printf("timingtest: ");
+// runs AllSuiteA on lanes that start a different number of cycles into the
+// program, so that they diverge and meet again
+#define NB_LANES 8
 
-    memset(memory, 0, MEMORY_SIZE);
-    if (load_file_into_memory("programs/timingtest/timingtest-1.bin", 0x1000) != 0) {
+static int test_lockstep(test_context* t, unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/AllSuiteA.bin", 0x4000) != 0) {
         return 1;
     }
-    m6502_init(&cpu);
-    cpu.read_byte = &rb;
-    cpu.write_byte = &wb;
-    cpu.pc = 0x1000;
 
-    int nb_instructions_executed = 0;
-    while (true) {
-        m6502_step(&cpu);
-        nb_instructions_executed += 1;
+    m6502_lockstep* ls = m6502_lockstep_create(NB_LANES,
+        t->cpu.m65c02_mode, t->cpu.enable_bcd);
+    uint8_t* const program = malloc(MEMORY_SIZE);
+    if (ls == NULL || program == NULL) {
+        test_printf(t, "FAIL (out of memory)\n");
+        m6502_lockstep_destroy(ls);
+        free(program);
+        return 1;
+    }
+    memcpy(program, t->memory, MEMORY_SIZE);
+    for (size_t lane = 0; lane < NB_LANES; lane++) {
+        memcpy(t->memory, program, MEMORY_SIZE);
+        m6502 c = t->cpu;
+        m6502_gen_res(&c);
+        c.exit_pc = 0x45C0;
+        m6502_run(&c, lane * 61, M6502_EXIT_PC);
+
+        m6502_lockstep_set_cpu(ls, lane, &c);
+        for (unsigned addr = 0; addr < MEMORY_SIZE; addr++) {
+            m6502_lockstep_write(ls, lane, addr, t->memory[addr]);
+        }
+    }
+    free(program);
 
-        if (cpu.pc == 0x1269) {
-            printf("%s", cpu.cyc == 1141 ? "PASS" : "FAIL");
-            break;
+    m6502_lockstep_run(ls, t->max_cycles, M6502_EXIT_PC);
+
+    unsigned nb_passed = 0;
+    int r = 0;
+    for (size_t lane = 0; lane < NB_LANES; lane++) {
+        m6502 c;
+        m6502_lockstep_get_cpu(ls, lane, &c);
+        if (m6502_lockstep_result(ls, lane).exit == M6502_EXIT_PC &&
+                m6502_lockstep_read(ls, lane, 0x0210) == 0xFF) {
+            nb_passed += 1;
         }
+        r += c.cyc != expected_cyc;
     }
+    m6502_lockstep_destroy(ls);
 
-    long long diff = expected_cyc - cpu.cyc;
-    printf(" (%d instructions executed on %lu cycles, "
-        " expected=%lu, diff=%lld)\n",
-        nb_instructions_executed, cpu.cyc,
-        expected_cyc, diff);
+    test_printf(t, "%s (%u/%d lanes passed", nb_passed == NB_LANES
+        ? "PASS" : "FAIL", nb_passed, NB_LANES);
+    test_printf(t, ", %d with a cycle count different from %lu)\n", r,
+        expected_cyc);
+
+    return r != 0 || nb_passed != NB_LANES;
+}
+
+// runs AllSuiteA with a periodic timer, an event rescheduled before it is
+// due, and a cancelled one: the events must fire at the first instruction
+// boundary at or after their time, without changing the execution
+#define TIMER_PERIOD 97
 
-    return cpu.cyc != expected_cyc;
+typedef struct event_counts {
+    unsigned fired;
+    unsigned late; // events fired 8 cycles or more after their time
+} event_counts;
+
+static void count_event(m6502* c, m6502_event* event) {
+    event_counts* const counts = event->userdata;
+    counts->fired += 1;
+    counts->late += c->cyc < event->time || c->cyc - event->time >= 8;
 }
 
-static int test_65C02_extended_opcodes_test(unsigned long expected_cyc) {
-    printf("65C02_extended_opcodes_test: ");
+static void timer_event(m6502* c, m6502_event* event) {
+    count_event(c, event);
+    m6502_schedule(c, event, event->time + TIMER_PERIOD);
+}
 
-    memset(memory, 0, MEMORY_SIZE);
-    if (load_file_into_memory("programs/6502_65C02_functional_tests/bin_files/65C02_extended_opcodes_test.bin", 0) != 0) {
+static int test_events(test_context* t, unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/AllSuiteA.bin", 0x4000) != 0) {
         return 1;
     }
-    m6502_init(&cpu);
-    cpu.read_byte = &rb;
-    cpu.write_byte = &wb;
-    cpu.pc = 0x400;
-    cpu.m65c02_mode = 1;
+    m6502_gen_res(&t->cpu);
+    t->cpu.exit_pc = 0x45C0;
+
+    event_counts timer_counts = {0, 0}, counts = {0, 0};
+    m6502_event timer = {timer_event, &timer_counts, 0, 0};
+    m6502_event moved = {count_event, &counts, 0, 0};
+    m6502_event cancelled = {count_event, &counts, 0, 0};
+    m6502_schedule(&t->cpu, &timer, TIMER_PERIOD);
+    m6502_schedule(&t->cpu, &moved, 500);
+    m6502_schedule(&t->cpu, &cancelled, 300);
+    m6502_schedule(&t->cpu, &moved, 1000);
+    m6502_unschedule(&t->cpu, &cancelled);
+
+    m6502_run_result r;
+    bool ok = run_test(t, M6502_EXIT_PC, &r);
+    // fires the events due at the end of the program
+    m6502_run(&t->cpu, 0, 0);
+    ok = ok && t->memory[0x0210] == 0xFF &&
+        timer_counts.fired == expected_cyc / TIMER_PERIOD &&
+        m6502_next_event(&t->cpu) == timer.time &&
+        timer.time > t->cpu.cyc && counts.fired == 1 &&
+        timer_counts.late == 0 && counts.late == 0;
+    test_printf(t, "%s (%u timer events, %u other events, %u late)",
+        ok ? "PASS" : "FAIL", timer_counts.fired, counts.fired,
+        timer_counts.late + counts.late);
+    print_cycles(t, r, expected_cyc);
+
+    return !ok || t->cpu.cyc != expected_cyc;
+}
 
-    int nb_instructions_executed = 0;
-    uint16_t previous_pc = 0;
-    while (true) {
-        m6502_step(&cpu);
+// a thread sends SIGNALED_IRQS IRQs to a CPU, each one acknowledged by the
+// handler of the program through SIGNAL_PORT, then stops the run
+#define SIGNALED_IRQS 8
+#define SIGNAL_PORT 0xBF00
+#define SIGNAL_IRQ_SOURCE (1 << 5)
+
+typedef struct signals_context {
+    test_context* t;
+    unsigned acks; // IRQs acknowledged by the program (atomic)
+    bool done; // the run is over (atomic)
+} signals_context;
+
+static uint8_t rb_signals(void* userdata, uint16_t addr) {
+    signals_context* s = userdata;
+    return s->t->memory[addr];
+}
 
-        nb_instructions_executed += 1;
+static void wb_signals(void* userdata, uint16_t addr, uint8_t val) {
+    signals_context* s = userdata;
+    s->t->memory[addr] = val;
+    if (addr == SIGNAL_PORT) {
+        m6502_set_irq(&s->t->cpu, SIGNAL_IRQ_SOURCE, false);
+        __atomic_fetch_add(&s->acks, 1, __ATOMIC_RELEASE);
+    }
+}
 
-        // if the program is trapped somewhere, print and exit
-        if (previous_pc == cpu.pc) {
-            if (cpu.pc == 0x24F1) {
-                printf("PASS");
-                break;
+static void* send_signals(void* arg) {
+    signals_context* const s = arg;
+    const struct timespec delay = {0, 100000};
+    for (unsigned i = 1; i <= SIGNALED_IRQS; i++) {
+        m6502_set_irq(&s->t->cpu, SIGNAL_IRQ_SOURCE, true);
+        while (__atomic_load_n(&s->acks, __ATOMIC_ACQUIRE) < i) {
+            if (__atomic_load_n(&s->done, __ATOMIC_ACQUIRE)) {
+                return NULL;
             }
-            printf("FAIL (trapped at 0x%04X)", cpu.pc);
-            break;
+            nanosleep(&delay, NULL);
         }
-        previous_pc = cpu.pc;
     }
+    m6502_signal(&s->t->cpu, M6502_SIGNAL_STOP);
+    return NULL;
+}
 
-    long long diff = expected_cyc - cpu.cyc;
-    printf(" (%d instructions executed on %lu cycles, "
-        " expected=%lu, diff=%lld)\n",
-        nb_instructions_executed, cpu.cyc,
-        expected_cyc, diff);
+static int test_signals(test_context* t, unsigned long expected_cyc) {
+    (void) expected_cyc;
+    reset_context(t);
+    static const uint8_t program[] = {
+        0x58, // CLI
+        0xA5, 0x10, // loop: LDA $10
+        0xC9, SIGNALED_IRQS, // CMP #SIGNALED_IRQS
+        0xD0, 0xFA, // BNE loop
+        0x4C, 0x07, 0x02, // trap: JMP trap
+    };
+    static const uint8_t handler[] = {
+        0xE6, 0x10, // INC $10
+        0x8D, SIGNAL_PORT & 0xFF, SIGNAL_PORT >> 8, // STA SIGNAL_PORT
+        0x40, // RTI
+    };
+    memcpy(&t->memory[0x0200], program, sizeof(program));
+    memcpy(&t->memory[0x0300], handler, sizeof(handler));
+    t->memory[0xFFFC] = 0x07; // RESET: trap
+    t->memory[0xFFFD] = 0x02;
+    t->memory[0xFFFE] = 0x00; // IRQ: handler
+    t->memory[0xFFFF] = 0x03;
+
+    signals_context s = {t, 0, false};
+    m6502* const c = &t->cpu;
+    c->read_byte = rb_signals;
+    c->write_byte = wb_signals;
+    c->userdata = &s;
+    c->pc = 0x0200;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, send_signals, &s) != 0) {
+        test_printf(t, "error: can't create thread\n");
+        return 1;
+    }
+    m6502_run_result r;
+    bool ok = run_test(t, 0, &r) && r.exit == M6502_EXIT_SIGNAL;
+    __atomic_store_n(&s.done, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    ok = ok && s.acks == SIGNALED_IRQS && t->memory[0x10] == SIGNALED_IRQS;
+    // STOP was consumed, PAUSE holds the runs until it's cleared, and RESET
+    // is taken before the next instruction
+    ok = ok && m6502_run(c, 100, 0).exit == 0;
+    m6502_signal(c, M6502_SIGNAL_PAUSE);
+    r = m6502_run(c, 100, 0);
+    ok = ok && r.exit == M6502_EXIT_SIGNAL && r.instructions == 0;
+    m6502_clear_signals(c, M6502_SIGNAL_PAUSE);
+    m6502_signal(c, M6502_SIGNAL_RESET);
+    r = m6502_run(c, 100, M6502_EXIT_TRAP);
+    ok = ok && r.exit == M6502_EXIT_TRAP && c->pc == 0x0207 &&
+        r.instructions == 1;
+
+    test_printf(t, "%s (%u IRQs acknowledged)\n", ok ? "PASS" : "FAIL",
+        s.acks);
+    return !ok;
+}
 
-    return cpu.cyc != expected_cyc;
+// a timer event raises an IRQ every IDLE_TICK cycles, counted by the
+// handler of a program which waits for them in an idle loop, then with WAI
+#define IDLE_TICK 10000
+#define IDLE_PORT 0xBF00
+
+static void wb_idle(void* userdata, uint16_t addr, uint8_t val) {
+    test_context* t = userdata;
+    t->memory[addr] = val;
+    if (addr == IDLE_PORT) {
+        m6502_set_irq(&t->cpu, 1, false);
+    }
 }
 
-static int test_6502_interrupt_test(unsigned long expected_cyc) {
-    printf("6502_interrupt_test: ");
+static void tick_event(m6502* c, m6502_event* event) {
+    m6502_set_irq(c, 1, true);
+    m6502_schedule(c, event, event->time + IDLE_TICK);
+}
 
-    memset(memory, 0, MEMORY_SIZE);
-    load_file_into_memory("programs/6502_interrupt_test.bin", 0);
-    m6502_init(&cpu);
-    cpu.read_byte = &rb;
-    cpu.write_byte = &wb;
-    cpu.pc = 0x400; // actually start at 0x3f5?
+static bool run_idle(test_context* t, bool skip_idle, bool decode,
+        m6502_run_result* r) {
+    reset_context(t);
+    static const uint8_t program[] = {
+        0x58, // CLI
+        0xA5, 0x10, // loop: LDA $10
+        0xC9, 0x04, // CMP #4
+        0x90, 0xFA, // BCC loop
+        0xCB, // wait: WAI
+        0xA5, 0x10, // LDA $10
+        0xC9, 0x08, // CMP #8
+        0x90, 0xF9, // BCC wait
+        0x4C, 0x0E, 0x02, // trap: JMP trap
+    };
+    static const uint8_t handler[] = {
+        0xE6, 0x10, // INC $10
+        0x8D, IDLE_PORT & 0xFF, IDLE_PORT >> 8, // STA IDLE_PORT
+        0x40, // RTI
+    };
+    memcpy(&t->memory[0x0200], program, sizeof(program));
+    memcpy(&t->memory[0x0300], handler, sizeof(handler));
+    t->memory[0xFFFE] = 0x00;
+    t->memory[0xFFFF] = 0x03;
+
+    m6502* const c = &t->cpu;
+    c->write_byte = wb_idle;
+    c->m65c02_mode = 1;
+    c->skip_idle = skip_idle;
+    c->pc = 0x0200;
+    m6502_map(c, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+    m6502_unmap(c, IDLE_PORT, 0x100);
+    if (decode) {
+        m6502_set_decode_cache(c, t->decode_cache);
+    }
+    m6502_event tick = {tick_event, NULL, 0, 0};
+    m6502_schedule(c, &tick, IDLE_TICK);
 
-    int nb_instructions_executed = 0;
-    uint16_t previous_pc = 0;
-    while (true) {
-        // m6502_debug_output(&cpu);
-        m6502_step(&cpu);
+    const bool ok = run_test(t, M6502_EXIT_TRAP, r) && c->pc == 0x020E &&
+        t->memory[0x10] == 8;
+    m6502_unschedule(c, &tick);
+    return ok;
+}
 
-        nb_instructions_executed += 1;
+static int test_idle(test_context* t, unsigned long expected_cyc) {
+    // the idle loops must take the same cycles when they are skipped (WAI
+    // is always skipped)
+    m6502_run_result expected, r;
+    bool ok = run_idle(t, false, false, &expected);
+    const unsigned long wai_skips = t->cpu.idle_skips;
+    for (int decode = 0; ok && decode <= 1; decode++) {
+        ok = run_idle(t, true, decode, &r) &&
+            r.cyc == expected.cyc && r.instructions == expected.instructions &&
+            t->cpu.idle_skips > wai_skips;
+    }
+    test_printf(t, "%s (%lu idle loops and WAI skipped, %" PRIu64
+        " cycles of %" PRIu64 ")", ok ? "PASS" : "FAIL", t->cpu.idle_skips,
+        t->cpu.idle_cycles, t->cpu.cyc);
+    print_cycles(t, r, expected_cyc);
 
-        // if the program is trapped somewhere, print and exit
-        if (previous_pc == cpu.pc) {
-            if (cpu.pc == 0x06f5) {
-                printf("PASS");
-                break;
-            }
-            printf("FAIL (trapped at 0x%04X)", cpu.pc);
-            break;
+    return !ok || t->cpu.cyc != expected_cyc;
+}
+
+// runs AllSuiteA with a breakpoint in a loop and watchpoints on the result
+// byte, stopping on each hit or not
+#define BREAK_PC 0x4561 // executed twice
+#define WATCH_ADDR 0x0210 // read twice, written three times
+
+typedef struct break_counts {
+    unsigned exec, read, write;
+    int last_kind;
+    bool stop; // the hits end the run
+} break_counts;
+
+static bool count_break(m6502* c, uint16_t addr, int kind) {
+    break_counts* const counts = c->breakpoints->userdata;
+    counts->exec += kind == M6502_BREAK_EXEC && addr == BREAK_PC;
+    counts->read += kind == M6502_BREAK_READ && addr == WATCH_ADDR;
+    counts->write += kind == M6502_BREAK_WRITE && addr == WATCH_ADDR;
+    counts->last_kind = kind;
+    return counts->stop;
+}
+
+static bool run_breakpoints(test_context* t, bool stop, bool decode,
+        m6502_run_result* result, unsigned* stops) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/AllSuiteA.bin", 0x4000) != 0) {
+        return false;
+    }
+    if (decode) {
+        m6502_map(&t->cpu, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+        m6502_set_decode_cache(&t->cpu, t->decode_cache);
+    }
+    m6502_gen_res(&t->cpu);
+    t->cpu.exit_pc = 0x45C0;
+
+    m6502_breakpoints breakpoints = {{0}, {0}, {0}, count_break, NULL};
+    break_counts counts = {0, 0, 0, 0, stop};
+    breakpoints.userdata = &counts;
+    m6502_set_breakpoints(&t->cpu, &breakpoints);
+    m6502_break(&t->cpu, BREAK_PC, 1, M6502_BREAK_EXEC);
+    m6502_break(&t->cpu, WATCH_ADDR, 1, M6502_BREAK_READ | M6502_BREAK_WRITE);
+
+    // the run stops before the instruction at a breakpoint, and after the
+    // one accessing a watched address
+    *result = (m6502_run_result) {0, 0, 0};
+    *stops = 0;
+    bool ok;
+    m6502_run_result r;
+    do {
+        ok = run_test(t, M6502_EXIT_PC, &r);
+        result->cyc += r.cyc;
+        result->instructions += r.instructions;
+        if (r.exit == M6502_EXIT_BREAK) {
+            *stops += 1;
+            ok = ok && (counts.last_kind == M6502_BREAK_EXEC) ==
+                (t->cpu.pc == BREAK_PC);
         }
-        previous_pc = cpu.pc;
+    } while (ok && r.exit == M6502_EXIT_BREAK);
+    m6502_set_breakpoints(&t->cpu, NULL);
+
+    return ok && t->memory[WATCH_ADDR] == 0xFF && counts.exec == 2 &&
+        counts.read == 2 && counts.write == 3;
+}
+
+// runs LDA #$42 / LDA $0300 with read watchpoints on their operand bytes,
+// which are fetched like the opcodes, and on $0300: only the last one hits
+static bool count_operand_watch(m6502* c, uint16_t addr, int kind) {
+    unsigned* const hits = c->breakpoints->userdata;
+    hits[addr == 0x0300] += kind == M6502_BREAK_READ;
+    return false;
+}
+
+static bool run_operand_watch(test_context* t, bool decode) {
+    static const uint8_t PROGRAM[] = {0xA9, 0x42, 0xAD, 0x00, 0x03};
+    reset_context(t);
+    memcpy(&t->memory[0x0200], PROGRAM, sizeof(PROGRAM));
+    if (decode) {
+        m6502_map(&t->cpu, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+        m6502_set_decode_cache(&t->cpu, t->decode_cache);
     }
+    t->cpu.pc = 0x0200;
+    t->cpu.exit_pc = 0x0200 + sizeof(PROGRAM);
+
+    m6502_breakpoints breakpoints = {{0}, {0}, {0}, count_operand_watch,
+        NULL};
+    unsigned hits[2] = {0, 0}; // operand bytes, $0300
+    breakpoints.userdata = hits;
+    m6502_set_breakpoints(&t->cpu, &breakpoints);
+    m6502_break(&t->cpu, 0x0201, 1, M6502_BREAK_READ);
+    m6502_break(&t->cpu, 0x0203, 2, M6502_BREAK_READ);
+    m6502_break(&t->cpu, 0x0300, 1, M6502_BREAK_READ);
+    m6502_run_result r;
+    const bool ok = run_test(t, M6502_EXIT_PC, &r);
+    m6502_set_breakpoints(&t->cpu, NULL);
+
+    return ok && hits[0] == 0 && hits[1] == 1 && r.instructions == 2;
+}
 
-    long long diff = expected_cyc - cpu.cyc;
-    printf(" (%d instructions executed on %lu cycles, "
-        " expected=%lu, diff=%lld)\n",
-        nb_instructions_executed, cpu.cyc,
-        expected_cyc, diff);
+static int test_breakpoints(test_context* t, unsigned long expected_cyc) {
+    bool ok = run_operand_watch(t, false) && run_operand_watch(t, true);
+    m6502_run_result r;
+    unsigned stops = 0, no_stops = 0;
+    ok = ok && run_breakpoints(t, false, false, &r, &no_stops) &&
+        no_stops == 0 && t->cpu.cyc == expected_cyc &&
+        run_breakpoints(t, true, true, &r, &stops) && stops == 5;
+    // (INC hits two watchpoints, and the last one is met with exit_pc)
+    test_printf(t, "%s (%u stops on 2 breakpoint and 5 watchpoint hits)",
+        ok ? "PASS" : "FAIL", stops);
+    print_cycles(t, r, expected_cyc);
+
+    return !ok || t->cpu.cyc != expected_cyc;
+}
 
-    return cpu.cyc != expected_cyc;
+// disassembles an instruction of each addressing mode, and the 65C02 bit
+// instructions
+static int test_disasm(test_context* t, unsigned long expected_cyc) {
+    (void) expected_cyc;
+    static const struct {
+        bool m65c02_mode;
+        uint16_t pc;
+        uint8_t bytes[3];
+        const char* text;
+    } CASES[] = {
+        {false, 0x0200, {0xEA, 0, 0}, "NOP"},
+        {false, 0x0200, {0x0A, 0, 0}, "ASL A"},
+        {false, 0x0200, {0xA9, 0x42, 0}, "LDA #$42"},
+        {false, 0x0200, {0xB6, 0x10, 0}, "LDX $10,Y"},
+        {false, 0x0200, {0x9D, 0x34, 0x12}, "STA $1234,X"},
+        {false, 0x0200, {0x6C, 0xFF, 0x02}, "JMP ($02FF)"},
+        {false, 0x0200, {0xA1, 0x20, 0}, "LDA ($20,X)"},
+        {false, 0x0200, {0x91, 0x20, 0}, "STA ($20),Y"},
+        {false, 0x0200, {0xD0, 0xFE, 0}, "BNE $0200"},
+        {false, 0x0200, {0xB2, 0x20, 0}, "???"},
+        {true, 0x0200, {0xB2, 0x20, 0}, "LDA ($20)"},
+        {true, 0x0200, {0x7C, 0x00, 0x30}, "JMP ($3000,X)"},
+        {true, 0xFFF0, {0x80, 0x7F, 0}, "BRA $0071"},
+        {true, 0x0200, {0x37, 0x12, 0}, "RMB3 $12"},
+        {true, 0x0200, {0xFF, 0x12, 0x80}, "BBS7 $12,$0183"},
+    };
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++) {
+        char text[M6502_DISASM_SIZE];
+        const unsigned length = m6502_disasm(text, sizeof(text),
+            CASES[i].bytes, CASES[i].pc, CASES[i].m65c02_mode);
+        const m6502_opcode* const op =
+            &m6502_opcodes(CASES[i].m65c02_mode)[CASES[i].bytes[0]];
+        if (strcmp(text, CASES[i].text) != 0 || length != op->length) {
+            test_printf(t, "FAIL (\"%s\" instead of \"%s\")\n", text,
+                CASES[i].text);
+            ok = false;
+        }
+    }
+    if (ok) {
+        test_printf(t, "PASS\n");
+    }
+    return !ok;
 }
 
-// The following test has been assembled with this configuration:
-// cputype = 1         ; 0 = 6502, 1 = 65C02, 2 = 65C816
-// vld_bcd = 0         ; 0 = allow invalid bcd, 1 = valid bcd only
-// chk_a   = 1         ; check accumulator
-// chk_n   = 1         ; check sign (negative) flag
-// chk_v   = 0         ; check overflow flag
-// chk_z   = 1         ; check zero flag
-// chk_c   = 1         ; check carry flag
-static int test_65C02_decimal_test(unsigned long expected_cyc) {
-    printf("65C02_decimal_test: ");
+// records a program reading a device that also raises IRQs at irregular
+// times, then replays the log in small slices without the device: the run
+// must end in the same state
+#define REPLAY_IO 0xD000 // value port at REPLAY_IO, IRQ acknowledge port next
+#define REPLAY_IRQS 32
+#define REPLAY_SEED 0x6502C0DEu // of the device
+
+typedef struct replay_device {
+    test_context* t;
+    uint32_t state; // xorshift generator
+    unsigned reads; // reads from the I/O page
+    m6502_event timer;
+    m6502_io_log* log; // log being recorded (with a small buffer)
+    uint8_t stream[0x10000]; // where the log is flushed
+    size_t stream_size;
+} replay_device;
+
+static uint8_t rb_replay(void* userdata, uint16_t addr) {
+    replay_device* d = userdata;
+    d->reads += 1;
+    if (addr == REPLAY_IO + 1) {
+        m6502_set_irq(&d->t->cpu, 1, false);
+        return 0;
+    }
+    d->state ^= d->state << 13;
+    d->state ^= d->state >> 17;
+    d->state ^= d->state << 5;
+    return d->state;
+}
+
+static void replay_timer(m6502* c, m6502_event* event) {
+    replay_device* d = event->userdata;
+    m6502_set_irq(c, 1, true);
+    m6502_schedule(c, event, event->time + 500 + d->state % 700);
+}
+
+static void flush_replay(m6502_io_log* log) {
+    replay_device* d = log->userdata;
+    if (d->stream_size + log->size <= sizeof(d->stream)) {
+        memcpy(&d->stream[d->stream_size], log->data, log->size);
+        d->stream_size += log->size;
+        log->size = 0;
+    }
+}
+
+static void setup_replay(test_context* t, replay_device* d) {
+    static const uint8_t program[] = {
+        0x58, // CLI
+        0xAD, 0x00, 0xD0, // loop: LDA REPLAY_IO
+        0x18, // CLC
+        0x65, 0x10, // ADC $10
+        0x85, 0x10, // STA $10
+        0xA5, 0x12, // LDA $12
+        0xC9, REPLAY_IRQS, // CMP #REPLAY_IRQS
+        0xD0, 0xF2, // BNE loop
+        0x4C, 0x0F, 0x02, // JMP * (trap)
+    };
+    static const uint8_t handler[] = {
+        0xE6, 0x12, // INC $12
+        0xAD, 0x01, 0xD0, // LDA REPLAY_IO + 1
+        0x40, // RTI
+    };
+
+    reset_context(t);
+    memcpy(&t->memory[0x0200], program, sizeof(program));
+    memcpy(&t->memory[0x0300], handler, sizeof(handler));
+    t->memory[0xFFFE] = 0x00;
+    t->memory[0xFFFF] = 0x03;
+    t->cpu.userdata = d;
+    t->cpu.read_byte = &rb_replay;
+    t->cpu.pc = 0x0200;
+    m6502_map(&t->cpu, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+    m6502_unmap(&t->cpu, REPLAY_IO, 0x100);
+    m6502_set_io(&t->cpu, REPLAY_IO, 0x100, true);
+}
+
+static int test_replay(test_context* t, unsigned long expected_cyc) {
+    static replay_device d;
+    uint8_t buffer[64]; // flushed often
+    m6502_io_log log = {.data = buffer, .size = 0,
+        .capacity = sizeof(buffer), .flush = flush_replay, .userdata = &d};
+
+    // recording
+    d = (replay_device) {t, REPLAY_SEED, 0, {replay_timer, &d, 0, 0}, &log,
+        {0}, 0};
+    setup_replay(t, &d);
+    m6502_schedule(&t->cpu, &d.timer, 700);
+    m6502_io_record(&t->cpu, &log);
+    m6502_run_result r;
+    bool ok = run_test(t, M6502_EXIT_TRAP, &r);
+    flush_replay(&log);
+    m6502_io_stop(&t->cpu);
+    const uint64_t cyc = t->cpu.cyc;
+    const uint16_t sum = t->memory[0x10];
+    const unsigned device_reads = d.reads;
+    ok = ok && !log.overflow && log.size == 0 && t->memory[0x12] == REPLAY_IRQS;
+
+    // replay, without the device
+    setup_replay(t, &d);
+    d.reads = 0;
+    log.data = d.stream;
+    log.size = d.stream_size;
+    ok = ok && m6502_io_replay(&t->cpu, &log);
+    m6502_run_result slice;
+    r = (m6502_run_result) {0, 0, 0};
+    do {
+        slice = m6502_run(&t->cpu, 333, M6502_EXIT_TRAP);
+        r.cyc += slice.cyc;
+        r.instructions += slice.instructions;
+    } while (ok && slice.exit == 0 && t->cpu.cyc < 10 * cyc);
+    m6502_io_stop(&t->cpu);
+    ok = ok && slice.exit == M6502_EXIT_TRAP && t->cpu.cyc == cyc &&
+        t->memory[0x10] == sum && t->memory[0x12] == REPLAY_IRQS &&
+        d.reads == 0 && log.mismatches == 0;
+
+    test_printf(t, "%s (%u I/O reads and %d IRQs in a log of %zu bytes)",
+        ok ? "PASS" : "FAIL", device_reads, REPLAY_IRQS, d.stream_size);
+    print_cycles(t, r, expected_cyc);
+
+    return !ok || t->cpu.cyc != expected_cyc;
+}
+
+// runs AllSuiteA from a snapshot taken halfway several times: restoring it
+// only copies back the pages written since, while restoring another
+// snapshot copies back all of them (with the changes made by the host)
+#define SNAPSHOT_RESTORES 100
+#define SNAPSHOT_HOST_ADDR 0x0300 // changed by the host after the runs
+
+static bool run_snapshot(test_context* t, m6502_snapshot* snapshot,
+        unsigned* nb_pages, unsigned long expected_cyc) {
+    *nb_pages = m6502_snapshot_restore(&t->cpu, snapshot);
+    m6502_run_result r;
+    return t->cpu.cyc == snapshot->state.cyc && run_test(t, M6502_EXIT_PC, &r) &&
+        t->memory[0x0210] == 0xFF && t->cpu.cyc == expected_cyc;
+}
+
+static int test_snapshot(test_context* t, unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/AllSuiteA.bin", 0x4000) != 0) {
+        return 1;
+    }
+    m6502_snapshot* const start = malloc(sizeof(m6502_snapshot));
+    m6502_snapshot* const middle = malloc(sizeof(m6502_snapshot));
+    if (start == NULL || middle == NULL) {
+        test_printf(t, "FAIL (out of memory)\n");
+        free(start);
+        free(middle);
+        return 1;
+    }
+    m6502_map(&t->cpu, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+    m6502_set_decode_cache(&t->cpu, t->decode_cache);
+    m6502_gen_res(&t->cpu);
+    t->cpu.exit_pc = 0x45C0;
+
+    m6502_snapshot_save(&t->cpu, start);
+    m6502_run(&t->cpu, expected_cyc / 2, M6502_EXIT_PC);
+    m6502_snapshot_save(&t->cpu, middle);
+    m6502_run_result r;
+    bool ok = run_test(t, M6502_EXIT_PC, &r) && t->cpu.cyc == expected_cyc;
+
+    unsigned max_pages = 0, nb_pages;
+    for (unsigned i = 0; ok && i < SNAPSHOT_RESTORES; i++) {
+        ok = run_snapshot(t, middle, &nb_pages, expected_cyc);
+        max_pages = nb_pages > max_pages ? nb_pages : max_pages;
+    }
+
+    t->memory[SNAPSHOT_HOST_ADDR] = 0x42;
+    m6502_invalidate(&t->cpu, SNAPSHOT_HOST_ADDR, 1);
+    unsigned all_pages = 0;
+    ok = ok && max_pages > 0 && max_pages < 256 &&
+        run_snapshot(t, start, &all_pages, expected_cyc) &&
+        all_pages == 256 && t->memory[SNAPSHOT_HOST_ADDR] == 0;
+    free(start);
+    free(middle);
+
+    test_printf(t, "%s (%d restores copying up to %u pages, %u for another "
+        "snapshot)", ok ? "PASS" : "FAIL", SNAPSHOT_RESTORES, max_pages,
+        all_pages);
+    print_cycles(t, r, expected_cyc);
+
+    return !ok;
+}
+
+// runs AllSuiteA twice: the first time to save the state of the CPU at
+// REWIND_CYC, and the second time with a history too small to hold all its
+// checkpoints, seeking back to REWIND_CYC at the end
+#define REWIND_CYC 1500
+#define REWIND_INTERVAL 64 // cycles
+#define REWIND_CAPACITY 2048 // bytes
+
+typedef struct rewind_state {
+    uint64_t cyc;
+    uint16_t pc;
+    uint8_t a, x, y, sp, p;
+    uint8_t memory[MEMORY_SIZE];
+} rewind_state;
+
+static void save_rewind_state(test_context* t, rewind_state* state) {
+    const m6502* const c = &t->cpu;
+    memset(state, 0, sizeof(*state)); // (compared with memcmp)
+    state->cyc = c->cyc;
+    state->pc = c->pc;
+    state->a = c->a;
+    state->x = c->x;
+    state->y = c->y;
+    state->sp = c->sp;
+    state->p = m6502_get_flags(c);
+    memcpy(state->memory, t->memory, MEMORY_SIZE);
+}
 
-    memset(memory, 0, MEMORY_SIZE);
-    if (load_file_into_memory("programs/65C02_decimal_test.bin", 0x200) != 0) {
+static bool start_rewind_run(test_context* t) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/AllSuiteA.bin", 0x4000) != 0) {
+        return false;
+    }
+    m6502_map(&t->cpu, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+    m6502_set_decode_cache(&t->cpu, t->decode_cache);
+    m6502_gen_res(&t->cpu);
+    t->cpu.exit_pc = 0x45C0;
+    return true;
+}
+
+static int test_rewind(test_context* t, unsigned long expected_cyc) {
+    rewind_state* const expected = malloc(sizeof(rewind_state));
+    rewind_state* const state = malloc(sizeof(rewind_state));
+    m6502_rewind* const rewind = malloc(sizeof(m6502_rewind));
+    uint8_t* const data = malloc(REWIND_CAPACITY);
+    if (expected == NULL || state == NULL || rewind == NULL ||
+            data == NULL) {
+        test_printf(t, "FAIL (out of memory)\n");
+        free(expected);
+        free(state);
+        free(rewind);
+        free(data);
         return 1;
     }
-    m6502_init(&cpu);
-    cpu.read_byte = &rb;
-    cpu.write_byte = &wb;
-    cpu.pc = 0x200;
-    cpu.m65c02_mode = 1;
 
-    int nb_instructions_executed = 0;
-    while (true) {
-        m6502_step(&cpu);
+    bool ok = start_rewind_run(t);
+    m6502_run_result r;
+    if (ok) {
+        m6502_run(&t->cpu, REWIND_CYC, M6502_EXIT_PC);
+        save_rewind_state(t, expected);
+        ok = run_test(t, M6502_EXIT_PC, &r) && start_rewind_run(t);
+    }
 
-        nb_instructions_executed += 1;
+    unsigned long checkpoints = 0;
+    uint64_t oldest = 0;
+    if (ok) {
+        rewind->data = data;
+        rewind->capacity = REWIND_CAPACITY;
+        rewind->interval = REWIND_INTERVAL;
+        ok = m6502_rewind_start(&t->cpu, rewind) &&
+            run_test(t, M6502_EXIT_PC, &r) &&
+            t->cpu.cyc == expected_cyc;
+        checkpoints = rewind->checkpoints;
+        oldest = rewind->oldest;
+
+        // the state at REWIND_CYC is the same, and the program runs the
+        // same from there
+        ok = ok && oldest > 0 && !m6502_rewind_seek(&t->cpu, rewind, 0) &&
+            m6502_rewind_seek(&t->cpu, rewind, REWIND_CYC);
+        save_rewind_state(t, state);
+        ok = ok && memcmp(state, expected, sizeof(rewind_state)) == 0 &&
+            run_test(t, M6502_EXIT_PC, &r) &&
+            t->memory[0x0210] == 0xFF && t->cpu.cyc == expected_cyc;
+        m6502_rewind_stop(&t->cpu, rewind);
+    }
+    free(expected);
+    free(state);
+    free(rewind);
+    free(data);
+
+    test_printf(t, "%s (%lu checkpoints kept in %d bytes, from cycle %" PRIu64
+        ")", ok ? "PASS" : "FAIL", checkpoints, REWIND_CAPACITY, oldest);
+    print_cycles(t, r, expected_cyc);
 
-        if (cpu.pc == 0x024b) {
-            printf("%s", cpu.a == 0 ? "PASS" : "FAIL");
-            break;
+    return !ok;
+}
+
+// runs AllSuiteA halfway and saves it in an image, then finishes the run
+// from the image loaded in a cleared context, whose map of the page left
+// unmapped in the image is dropped
+#define IMAGE_CYC 1000
+#define IMAGE_UNMAPPED 0xC000 // (unused by AllSuiteA)
+#define IMAGE_PROTECTED 0xD000 // write-protected (unused by AllSuiteA)
+#define IMAGE_STORE 0x0300 // where a write to the protected page is stored
+
+static int test_image(test_context* t, unsigned long expected_cyc) {
+    reset_context(t);
+    if (load_file_into_memory(t, "programs/AllSuiteA.bin", 0x4000) != 0) {
+        return 1;
+    }
+    m6502_map(&t->cpu, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+    m6502_unmap(&t->cpu, IMAGE_UNMAPPED, 256);
+    m6502_map(&t->cpu, IMAGE_PROTECTED, 256, &t->memory[IMAGE_PROTECTED],
+        M6502_MAP_READ | M6502_MAP_PROTECT);
+    m6502_gen_res(&t->cpu);
+    m6502_run(&t->cpu, IMAGE_CYC, M6502_EXIT_PC);
+    const uint64_t cyc = t->cpu.cyc;
+    const uint16_t pc = t->cpu.pc;
+
+    char filename[64];
+    snprintf(filename, sizeof(filename), "/tmp/m6502_tests_%ld.image",
+        (long) getpid());
+    if (!m6502_image_save(&t->cpu, filename)) {
+        test_printf(t, "FAIL (can't write '%s')\n", filename);
+        return 1;
+    }
+
+    reset_context(t);
+    m6502_set_decode_cache(&t->cpu, t->decode_cache);
+    m6502_map(&t->cpu, IMAGE_UNMAPPED, 256, &t->memory[IMAGE_UNMAPPED],
+        M6502_MAP_READWRITE);
+    m6502_image* const image = m6502_image_load(&t->cpu, filename);
+    remove(filename);
+    if (image == NULL) {
+        test_printf(t, "FAIL (can't load '%s')\n", filename);
+        return 1;
+    }
+    t->cpu.exit_pc = 0x45C0;
+
+    m6502_run_result r;
+    bool ok = t->cpu.cyc == cyc && t->cpu.pc == pc &&
+        t->cpu.read_map[IMAGE_UNMAPPED >> 8] == NULL &&
+        run_test(t, M6502_EXIT_PC, &r) &&
+        m6502_image_memory(image)[0x0210] == 0xFF && t->memory[0x0210] == 0;
+
+    // the page is still write-protected (STA ignored, not a callback)
+    uint8_t* const memory = m6502_image_memory(image);
+    static const uint8_t STORE[] = {
+        0x8D, IMAGE_PROTECTED & 0xFF, IMAGE_PROTECTED >> 8 // STA protected
+    };
+    memcpy(&memory[IMAGE_STORE], STORE, sizeof(STORE));
+    m6502_invalidate(&t->cpu, IMAGE_STORE, sizeof(STORE));
+    const uint64_t end_cyc = t->cpu.cyc;
+    t->cpu.pc = IMAGE_STORE;
+    t->cpu.a = 0x55;
+    m6502_step(&t->cpu);
+    ok = ok && memory[IMAGE_PROTECTED] != 0x55 &&
+        t->memory[IMAGE_PROTECTED] != 0x55;
+    t->cpu.cyc = end_cyc;
+    m6502_unmap(&t->cpu, 0, MEMORY_SIZE);
+    m6502_image_close(image);
+
+    // a page read from and written to different memory can't be saved
+    m6502_map(&t->cpu, 0, 256, &t->memory[0], M6502_MAP_READ);
+    m6502_map(&t->cpu, 0, 256, &t->memory[256], M6502_MAP_WRITE);
+    ok = ok && !m6502_image_save(&t->cpu, filename);
+    remove(filename);
+
+    test_printf(t, "%s (started at PC:%04X after %" PRIu64 " cycles)",
+        ok ? "PASS" : "FAIL", pc, cyc);
+    print_cycles(t, r, expected_cyc);
+
+    return !ok || t->cpu.cyc != expected_cyc;
+}
+
+// runs a program from the second window of a protected ROM bank, which
+// selects the windows of a data bank through a register handled by the
+// write callback
+#define MAPPER_REGISTER 0xD000
+#define MAPPER_WINDOWS 4
+#define MAPPER_WINDOW_SIZE 0x1000
+
+static const uint8_t MAPPER_PROGRAM[] = {
+    0xA2, 0x00, // LDX #0
+    0x8E, 0x00, 0xE0, // STX $E000 (ignored)
+    0x8E, 0x00, 0xD0, // STX $D000 (selects window X of the data at $C000)
+    0xBD, 0x00, 0xC0, // LDA $C000,X
+    0x95, 0x10, // STA $10,X
+    0xE8, // INX
+    0xE0, MAPPER_WINDOWS, // CPX #MAPPER_WINDOWS
+    0xD0, 0xF3, // BNE $E005
+    0x4C, 0x12, 0xE0, // JMP $E012
+};
+
+static void wb_mapper(void* userdata, uint16_t addr, uint8_t val) {
+    m6502_mapper* const mapper = userdata;
+    if (addr == MAPPER_REGISTER) {
+        m6502_mapper_switch(mapper, 0xC000, MAPPER_WINDOW_SIZE,
+            m6502_mapper_find(mapper, "data"), val);
+    }
+}
+
+static int test_mapper(test_context* t, unsigned long expected_cyc) {
+    static uint8_t rom[0x4000], data[MAPPER_WINDOWS * MAPPER_WINDOW_SIZE];
+    memcpy(&rom[0x2000], MAPPER_PROGRAM, sizeof(MAPPER_PROGRAM));
+    for (unsigned i = 0; i < MAPPER_WINDOWS; i++) {
+        data[i * MAPPER_WINDOW_SIZE + i] = 0xA0 + i;
+    }
+
+    reset_context(t);
+    m6502_mapper mapper;
+    m6502_mapper_init(&mapper, &t->cpu);
+    t->cpu.write_byte = &wb_mapper;
+    t->cpu.userdata = &mapper;
+    const int ram = m6502_mapper_add(&mapper, "ram", t->memory, 0x8000,
+        M6502_MAP_READWRITE);
+    const int program = m6502_mapper_add(&mapper, "rom", rom, sizeof(rom),
+        M6502_MAP_READ | M6502_MAP_PROTECT);
+    m6502_mapper_add(&mapper, "data", data, sizeof(data),
+        M6502_MAP_READ | M6502_MAP_PROTECT);
+    m6502_mapper_switch(&mapper, 0x0000, 0x8000, ram, 0);
+    m6502_mapper_switch(&mapper, 0xE000, 0x2000, program, 1);
+    m6502_set_decode_cache(&t->cpu, t->decode_cache);
+    t->cpu.pc = 0xE000;
+
+    m6502_run_result r;
+    bool ok = run_test(t, M6502_EXIT_TRAP, &r) && rom[0x2000] == 0xA2;
+    for (unsigned i = 0; i < MAPPER_WINDOWS; i++) {
+        ok = ok && t->memory[0x10 + i] == 0xA0 + i;
+    }
+    size_t offset = 0;
+    ok = ok && m6502_mapper_bank_at(&mapper, 0xC123, &offset) ==
+        m6502_mapper_find(&mapper, "data") &&
+        offset == (MAPPER_WINDOWS - 1) * MAPPER_WINDOW_SIZE + 0x123 &&
+        m6502_mapper_bank_at(&mapper, 0xD000, NULL) < 0 &&
+        !m6502_mapper_switch(&mapper, 0xD000, 0x80, ram, 0) &&
+        !m6502_mapper_switch(&mapper, 0xD080, 0x100, ram, 0) &&
+        m6502_mapper_bank_at(&mapper, 0xD000, NULL) < 0;
+
+    test_printf(t, "%s (%d windows switched)", ok ? "PASS" : "FAIL",
+        MAPPER_WINDOWS);
+    print_cycles(t, r, expected_cyc);
+
+    return !ok || t->cpu.cyc != expected_cyc;
+}
+
+// the recompiler must run the programs with the same cycles as the cores,
+// leaving them the I/O, the interrupts (raised by the timer of test_idle)
+// and the self-modifying code of JIT_PROGRAM
+#define JIT_PORT 0xBF01 // a counter, incremented by each read
+
+static const uint8_t JIT_PROGRAM[] = {
+    0x58, // CLI
+    0xA2, 0x40, // LDX #$40
+    0xA0, 0x00, // outer: LDY #0
+    0xA9, 0x00, // inner: LDA #0 (incremented by the outer loop)
+    0x18, // CLC
+    0x79, 0xF0, 0x30, // ADC $30F0,Y
+    0x99, 0x00, 0x31, // STA $3100,Y
+    0x45, 0x11, // EOR $11
+    0x85, 0x11, // STA $11
+    0x88, // DEY
+    0xD0, 0xF0, // BNE inner
+    0xEE, 0x06, 0x02, // INC inner + 1
+    0xAD, JIT_PORT & 0xFF, JIT_PORT >> 8, // LDA JIT_PORT
+    0xF8, // SED
+    0x65, 0x12, // ADC $12
+    0xD8, // CLD
+    0x85, 0x12, // STA $12
+    0xCA, // DEX
+    0xD0, 0xDF, // BNE outer
+    0x4C, 0x24, 0x02, // trap: JMP trap
+};
+
+typedef struct jit_program {
+    const char* filename; // NULL for JIT_PROGRAM
+    uint16_t addr; // where it's loaded and started
+    uint16_t exit_pc;
+    bool m65c02;
+} jit_program;
+
+static const jit_program JIT_PROGRAMS[] = {
+    {"programs/AllSuiteA.bin", 0x4000, 0x45C0, false},
+    {"programs/6502_decimal_test.bin", 0x0200, 0x024B, false},
+    {"programs/timingtest/timingtest-1.bin", 0x1000, 0x1269, false},
+    {NULL, 0x0200, 0x0224, false},
+    {NULL, 0x0200, 0x0224, true},
+};
+
+#define NB_JIT_PROGRAMS (sizeof(JIT_PROGRAMS) / sizeof(JIT_PROGRAMS[0]))
+
+// the state compared between the runs
+typedef struct jit_state {
+    m6502_run_result r;
+    uint64_t cyc;
+    uint16_t pc;
+    uint8_t a, x, y, sp, p;
+    uint32_t memory_hash;
+} jit_state;
+
+static uint8_t rb_jit(void* userdata, uint16_t addr) {
+    test_context* t = userdata;
+    return addr == JIT_PORT ? t->memory[addr]++ : t->memory[addr];
+}
+
+// runs a program from mapped memory with the decode cache and the
+// recompiler jit (NULL for none)
+static bool run_jit_program(test_context* t, const jit_program* program,
+        m6502_jit* jit, jit_state* s) {
+    static const uint8_t handler[] = {
+        0xE6, 0x10, // INC $10
+        0x8D, IDLE_PORT & 0xFF, IDLE_PORT >> 8, // STA IDLE_PORT
+        0x40, // RTI
+    };
+
+    reset_context(t);
+    m6502* const c = &t->cpu;
+    m6502_event tick = {tick_event, NULL, 0, 0};
+    if (program->filename != NULL) {
+        if (load_file_into_memory(t, program->filename, program->addr) != 0) {
+            return false;
+        }
+    }
+    else {
+        memcpy(&t->memory[program->addr], JIT_PROGRAM, sizeof(JIT_PROGRAM));
+        memcpy(&t->memory[0x0300], handler, sizeof(handler));
+        t->memory[0xFFFE] = 0x00;
+        t->memory[0xFFFF] = 0x03;
+        for (unsigned i = 0; i < 0x200; i++) {
+            t->memory[0x3000 + i] = i * 7;
         }
+        m6502_schedule(c, &tick, IDLE_TICK);
+    }
+    c->read_byte = rb_jit;
+    c->write_byte = wb_idle;
+    m6502_map(c, 0, MEMORY_SIZE, t->memory, M6502_MAP_READWRITE);
+    m6502_unmap(c, IDLE_PORT, 0x100);
+    m6502_set_decode_cache(c, t->decode_cache);
+    m6502_set_jit(c, jit);
+    c->m65c02_mode = program->m65c02;
+    c->pc = program->addr;
+    c->exit_pc = program->exit_pc;
+
+    memset(s, 0, sizeof(*s));
+    const bool ok = run_test(t, M6502_EXIT_PC, &s->r);
+    m6502_unschedule(c, &tick);
+    s->cyc = c->cyc;
+    s->pc = c->pc;
+    s->a = c->a;
+    s->x = c->x;
+    s->y = c->y;
+    s->sp = c->sp;
+    s->p = m6502_get_flags(c);
+    for (size_t i = 0; i < MEMORY_SIZE; i++) {
+        s->memory_hash = s->memory_hash * 31 + t->memory[i];
     }
+    return ok;
+}
 
-    long long diff = expected_cyc - cpu.cyc;
-    printf(" (%d instructions executed on %lu cycles, "
-        " expected=%lu, diff=%lld)\n",
-        nb_instructions_executed, cpu.cyc,
-        expected_cyc, diff);
+static int test_jit(test_context* t, unsigned long expected_cyc) {
+    (void) expected_cyc;
+    m6502_jit* const jit = m6502_jit_create(0);
+    jit_state expected, s;
+    unsigned long blocks = 0;
+    uint64_t instructions = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < NB_JIT_PROGRAMS; i++) {
+        ok = run_jit_program(t, &JIT_PROGRAMS[i], NULL, &expected) &&
+            run_jit_program(t, &JIT_PROGRAMS[i], jit, &s) &&
+            memcmp(&expected, &s, sizeof(s)) == 0;
+        blocks += t->cpu.jit_blocks;
+        instructions += t->cpu.jit_instructions;
+    }
+    // (the emulator may be built without the recompiler)
+    ok = ok && (jit != NULL) == (instructions != 0);
+    m6502_jit_destroy(jit);
 
-    return cpu.cyc != expected_cyc;
-}
-
-// static int test_65c02_timingtest(unsigned long expected_cyc) {
-//     printf("timingtest: ");
-
-//     memset(memory, 0, MEMORY_SIZE);
-//     load_file_into_memory("programs/65c02timing/65c02timing.bin", 0x6000);
-//     m6502_init(&cpu);
-//     cpu.read_byte = &rb;
-//     cpu.write_byte = &wb;
-//     cpu.pc = 0x6000;
-//     cpu.m65c02_mode = 1;
-
-//     int nb_instructions_executed = 0;
-//     uint16_t previous_pc = 0;
-//     while (true) {
-//         // m6502_debug_output(&cpu);
-//         m6502_step(&cpu);
-//         nb_instructions_executed += 1;
-
-//         // if the program is trapped somewhere, print and exit
-//         if (previous_pc == cpu.pc) {
-//             printf("%s", cpu.y == 1 ? "PASS" : "FAIL");
-//             break;
-//         }
-//         previous_pc = cpu.pc;
-//     }
-
-//     long long diff = expected_cyc - cpu.cyc;
-//     printf(" (%d instructions executed on %lu cycles,"
-//         " expected=%lu, diff=%lld)\n",
-//         nb_instructions_executed, cpu.cyc,
-//         expected_cyc, diff);
-// }
-
-int main(void) {
-    memory = malloc(MEMORY_SIZE);
+    test_printf(t, "%s (%lu blocks compiled, %" PRIu64 " instructions "
+        "executed by them)\n", ok ? "PASS" : "FAIL", blocks, instructions);
+    return !ok;
+}
+
+typedef struct test {
+    const char* name;
+    int (*run)(test_context*, unsigned long);
+    unsigned long expected_cyc;
+    bool enabled; // disabled tests only run with -a
+} test;
+
+static const test TESTS[] = {
+    {"AllSuiteA", test_allsuitea, 1946LU, true},
+    // same cycle count on fake6502
+    {"6502_functional_test", test_6502_functional_test, 96241367LU, true},
+    {"6502_decimal_test", test_6502_decimal_test, 46089505LU, true},
+    {"timingtest", test_timingtest, 1141LU, true},
+    {"65C02_extended_opcodes_test", test_65C02_extended_opcodes_test,
+        66886142LU, true},
+    {"pool", test_pool, 1946LU, true},
+    {"lockstep", test_lockstep, 1946LU, true},
+    {"events", test_events, 1946LU, true},
+    {"6502_interrupt_test", test_6502_interrupt_test, 3016LU, true},
+    // the cycle count depends on the timing of the thread sending the IRQs
+    {"signals", test_signals, 0LU, true},
+    {"idle", test_idle, 80032LU, true},
+    {"breakpoints", test_breakpoints, 1946LU, true},
+    {"disasm", test_disasm, 0LU, true},
+    // the cycle count depends on the values read from the device
+    {"replay", test_replay, 26148LU, true},
+    {"snapshot", test_snapshot, 1946LU, true},
+    {"rewind", test_rewind, 1946LU, true},
+    {"image", test_image, 1946LU, true},
+    {"mapper", test_mapper, 84LU, true},
+    {"jit", test_jit, 0LU, true},
+    {"65C02_decimal_test", test_65C02_decimal_test, 0LU, false},
+    {"65c02_timingtest", test_65c02_timingtest, 0LU, false},
+};
+
+#define NB_TESTS (sizeof(TESTS) / sizeof(TESTS[0]))
+
+// the tests are distributed to the worker threads in order
+static test_context* contexts[NB_TESTS];
+static int results[NB_TESTS];
+static bool selected[NB_TESTS];
+static size_t next_test = 0;
+static pthread_mutex_t next_test_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void* worker(void* arg) {
+    (void) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&next_test_mutex);
+        while (next_test < NB_TESTS && !selected[next_test]) {
+            next_test += 1;
+        }
+        const size_t i = next_test++;
+        pthread_mutex_unlock(&next_test_mutex);
+
+        if (i >= NB_TESTS) {
+            return NULL;
+        }
+
+        test_context* const t = contexts[i];
+        test_printf(t, "%s: ", TESTS[i].name);
+        results[i] = TESTS[i].run(t, TESTS[i].expected_cyc);
+    }
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-j threads] [-t timeout] [-a]\n"
+        "  -j  number of tests run concurrently (default: one per CPU)\n"
+        "  -t  time limit of each test in seconds (default: %.0f)\n"
+        "  -a  also run the disabled tests\n", name, DEFAULT_TIMEOUT);
+}
+
+int main(int argc, char** argv) {
+    long nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    double timeout = DEFAULT_TIMEOUT;
+    bool all = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-j") == 0) {
+            nb_threads = atol(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-t") == 0) {
+            timeout = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-a") == 0) {
+            all = true;
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (nb_threads < 1) {
+        nb_threads = 1;
+    }
+    if (nb_threads > (long) NB_TESTS) {
+        nb_threads = NB_TESTS;
+    }
+
+    bool allocated = true;
+    for (size_t i = 0; i < NB_TESTS; i++) {
+        selected[i] = all || TESTS[i].enabled;
+        contexts[i] = calloc(1, sizeof(test_context));
+        if (contexts[i] == NULL) {
+            allocated = false;
+            continue;
+        }
+        contexts[i]->decode_cache =
+            malloc(M6502_DECODE_CACHE_SIZE * sizeof(m6502_decoded));
+        allocated = allocated && contexts[i]->decode_cache != NULL;
+        contexts[i]->max_cycles = TESTS[i].expected_cyc != 0
+            ? 2 * TESTS[i].expected_cyc : DEFAULT_MAX_CYCLES;
+        contexts[i]->max_instructions = contexts[i]->max_cycles;
+        contexts[i]->timeout = timeout;
+    }
+    if (!allocated) {
+        fprintf(stderr, "error: out of memory\n");
+        for (size_t i = 0; i < NB_TESTS; i++) {
+            if (contexts[i] != NULL) {
+                free(contexts[i]->decode_cache);
+                free(contexts[i]);
+            }
+        }
+        return 1;
+    }
+
+    // the calling thread is the first worker (and runs all the tests if
+    // the other threads can't be created)
+    pthread_t threads[NB_TESTS];
+    bool started[NB_TESTS];
+    for (long i = 1; i < nb_threads; i++) {
+        started[i] = pthread_create(&threads[i], NULL, worker, NULL) == 0;
+    }
+    worker(NULL);
+    for (long i = 1; i < nb_threads; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
 
     int r = 0;
-    r += test_allsuitea(1946LU);
-    r += test_6502_functional_test(96241367LU); // same cycle count on fake6502
-    r += test_6502_decimal_test(46089505LU);
-    r += test_timingtest(1141LU);
-    r += test_65C02_extended_opcodes_test(66886142LU);
-    // r += test_6502_interrupt_test(0LU);
-    // r += test_65C02_decimal_test(0LU);
-    // r += test_65c02_timingtest(0LU);
-
-    free(memory);
+    for (size_t i = 0; i < NB_TESTS; i++) {
+        if (selected[i]) {
+            fputs(contexts[i]->output, stdout);
+            r += results[i];
+        }
+        free(contexts[i]->decode_cache);
+        free(contexts[i]);
+    }
 
     return r != 0;
 }
@@ -0,0 +1,78 @@
+// trace decoder: prints the instructions recorded in a trace file (see
+// m6502_set_trace and the -t option of m6502_prof)
+//
+// usage: m6502_trace [-n last] [-f] trace_file
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m6502.h"
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-n last] [-f] trace_file\n"
+        "  -n  number of instructions printed (default: all those kept)\n"
+        "  -f  prints the cycle counter and the disassembly of each\n"
+        "      instruction instead of the m6502_debug_output format\n",
+        name);
+}
+
+int main(int argc, char** argv) {
+    unsigned long long last = 0;
+    int format = M6502_TRACE_NINTENDULATOR;
+    const char* filename = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+            last = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-f") == 0) {
+            format = M6502_TRACE_FULL;
+        }
+        else if (argv[i][0] != '-' && filename == NULL) {
+            filename = argv[i];
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (filename == NULL) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "error: can't open file '%s'.\n", filename);
+        return 1;
+    }
+    m6502_trace header;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+            memcmp(header.magic, M6502_TRACE_MAGIC,
+            sizeof(header.magic)) != 0 || header.capacity == 0 ||
+            header.next >= header.capacity) {
+        fprintf(stderr, "error: '%s' isn't a trace file\n", filename);
+        fclose(f);
+        return 1;
+    }
+
+    m6502_trace* const trace = malloc(m6502_trace_size(header.capacity));
+    if (trace == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        fclose(f);
+        return 1;
+    }
+    *trace = header;
+    const size_t nb_records = fread(trace->records,
+        sizeof(m6502_trace_record), header.capacity, f);
+    fclose(f);
+    if (nb_records != header.capacity) {
+        fprintf(stderr, "error: while reading file '%s'\n", filename);
+        free(trace);
+        return 1;
+    }
+
+    m6502_trace_print(stdout, trace, format, last);
+    free(trace);
+    return 0;
+}